@@ -10,7 +10,8 @@ let package = Package(
     ],
     targets: [
         .target(
-            name: "IcedHTTP"
+            name: "IcedHTTP",
+            linkerSettings: [.linkedLibrary("z")]
         )
     ]
 )
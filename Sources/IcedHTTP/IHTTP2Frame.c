@@ -0,0 +1,69 @@
+#include "IHTTP2Frame.h"
+
+#include <string.h>
+
+/*! @brief the connection preface, RFC 9113 section 3.4, which an HTTP/1.1 parser takes for a request with the method PRI */
+static const char IHTTP2Preface[IHTTP2PrefaceLength + 1] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+IHTTPParseResult IHTTP2ParsePreface(const uint8_t* bytes, size_t length) {
+    size_t compared = (length < IHTTP2PrefaceLength ? length : IHTTP2PrefaceLength);
+    if (memcmp(bytes, IHTTP2Preface, compared) != 0) {
+        return IHTTPParseInvalid;
+    }
+    return (compared == IHTTP2PrefaceLength ? IHTTPParseComplete : IHTTPParseIncomplete);
+}
+
+void IHTTP2ParseFrameHeader(const uint8_t* bytes, IHTTP2FrameHeader* header) {
+    header->length = (((uint32_t)bytes[0] << 16) | ((uint32_t)bytes[1] << 8) | (uint32_t)bytes[2]);
+    header->type = bytes[3];
+    header->flags = bytes[4];
+    header->streamID = (IHTTP2ReadUInt32(bytes + 5) & 0x7FFFFFFF);
+}
+
+void IHTTP2WriteFrameHeader(uint8_t* buffer, uint32_t length, IHTTP2FrameType type, uint8_t flags, uint32_t streamID) {
+    buffer[0] = (uint8_t)(length >> 16);
+    buffer[1] = (uint8_t)(length >> 8);
+    buffer[2] = (uint8_t)length;
+    buffer[3] = (uint8_t)type;
+    buffer[4] = flags;
+    IHTTP2WriteUInt32((buffer + 5), (streamID & 0x7FFFFFFF));
+}
+
+bool IHTTP2FrameContent(const IHTTP2FrameHeader* header, const uint8_t* payload, const uint8_t** content, size_t* contentLength) {
+    size_t start = 0;
+    size_t padding = 0;
+    if (header->flags & IHTTP2FlagPadded) {
+        if (header->length < 1) {
+            return false;
+        }
+        padding = payload[0];
+        start = 1;
+    }
+    if (header->type == IHTTP2FrameHeaders && (header->flags & IHTTP2FlagPriority)) { // the stream dependency and weight, which are ignored
+        start += 5;
+    }
+    if ((start + padding) > header->length) {
+        return false;
+    }
+
+    *content = (payload + start);
+    *contentLength = (header->length - start - padding);
+    return true;
+}
+
+void IHTTP2WriteSetting(uint8_t* buffer, IHTTP2Setting setting, uint32_t value) {
+    buffer[0] = (uint8_t)(setting >> 8);
+    buffer[1] = (uint8_t)setting;
+    IHTTP2WriteUInt32((buffer + 2), value);
+}
+
+uint32_t IHTTP2ReadUInt32(const uint8_t* bytes) {
+    return (((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3]);
+}
+
+void IHTTP2WriteUInt32(uint8_t* buffer, uint32_t value) {
+    buffer[0] = (uint8_t)(value >> 24);
+    buffer[1] = (uint8_t)(value >> 16);
+    buffer[2] = (uint8_t)(value >> 8);
+    buffer[3] = (uint8_t)value;
+}
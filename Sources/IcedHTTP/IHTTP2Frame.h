@@ -0,0 +1,118 @@
+#ifndef IHTTP2Frame_h
+#define IHTTP2Frame_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "IHTTPParser.h"
+
+/*! @header IHTTP2Frame.h
+    @abstract RFC 9113 HTTP/2 frame headers, settings and the connection preface, not part of the public API */
+
+/*! @brief the length of a frame header */
+#define IHTTP2FrameHeaderLength 9
+
+/*! @brief the length of the connection preface a client starts with */
+#define IHTTP2PrefaceLength 24
+
+/*! @brief the largest frame payload either end accepts until the other raises it, the server never does */
+#define IHTTP2DefaultMaxFrameSize 16384
+
+/*! @brief the largest frame payload an endpoint may allow */
+#define IHTTP2MaxFrameSizeLimit 16777215
+
+/*! @brief the flow control window of the connection and of each new stream until SETTINGS change it */
+#define IHTTP2DefaultWindowSize 65535
+
+/*! @brief the largest a flow control window may grow */
+#define IHTTP2MaxWindowSize 0x7FFFFFFF
+
+/*! @brief the length of a setting in a SETTINGS payload, a 16 bit identifier and a 32 bit value */
+#define IHTTP2SettingLength 6
+
+/*! @enum IHTTP2FrameType */
+typedef enum {
+    IHTTP2FrameData = 0x0,
+    IHTTP2FrameHeaders = 0x1,
+    IHTTP2FramePriority = 0x2,
+    IHTTP2FrameResetStream = 0x3,
+    IHTTP2FrameSettings = 0x4,
+    IHTTP2FramePushPromise = 0x5,
+    IHTTP2FramePing = 0x6,
+    IHTTP2FrameGoAway = 0x7,
+    IHTTP2FrameWindowUpdate = 0x8,
+    IHTTP2FrameContinuation = 0x9
+} IHTTP2FrameType;
+
+/*! @enum IHTTP2FrameFlags */
+typedef enum {
+    IHTTP2FlagEndStream = 0x01,     /* DATA and HEADERS */
+    IHTTP2FlagAck = 0x01,           /* SETTINGS and PING */
+    IHTTP2FlagEndHeaders = 0x04,    /* HEADERS and CONTINUATION */
+    IHTTP2FlagPadded = 0x08,        /* DATA and HEADERS */
+    IHTTP2FlagPriority = 0x20       /* HEADERS */
+} IHTTP2FrameFlags;
+
+/*! @enum IHTTP2ErrorCode
+    @brief the codes sent in RST_STREAM and GOAWAY frames */
+typedef enum {
+    IHTTP2ErrorNone = 0x0,
+    IHTTP2ErrorProtocol = 0x1,
+    IHTTP2ErrorInternal = 0x2,
+    IHTTP2ErrorFlowControl = 0x3,
+    IHTTP2ErrorSettingsTimeout = 0x4,
+    IHTTP2ErrorStreamClosed = 0x5,
+    IHTTP2ErrorFrameSize = 0x6,
+    IHTTP2ErrorRefusedStream = 0x7,
+    IHTTP2ErrorCancel = 0x8,
+    IHTTP2ErrorCompression = 0x9,
+    IHTTP2ErrorConnect = 0xA,
+    IHTTP2ErrorEnhanceYourCalm = 0xB,
+    IHTTP2ErrorInadequateSecurity = 0xC,
+    IHTTP2ErrorHTTP11Required = 0xD
+} IHTTP2ErrorCode;
+
+/*! @enum IHTTP2Setting
+    @brief the identifiers of the settings in a SETTINGS frame */
+typedef enum {
+    IHTTP2SettingHeaderTableSize = 0x1,
+    IHTTP2SettingEnablePush = 0x2,
+    IHTTP2SettingMaxConcurrentStreams = 0x3,
+    IHTTP2SettingInitialWindowSize = 0x4,
+    IHTTP2SettingMaxFrameSize = 0x5,
+    IHTTP2SettingMaxHeaderListSize = 0x6
+} IHTTP2Setting;
+
+/*! @brief a parsed frame header */
+typedef struct {
+    uint32_t length;            /* of the payload which follows the header */
+    uint8_t type;
+    uint8_t flags;
+    uint32_t streamID;          /* without the reserved bit */
+} IHTTP2FrameHeader;
+
+/*! @brief IHTTPParseComplete if the bytes start with the connection preface, IHTTPParseIncomplete if they're the start of it,
+    otherwise IHTTPParseInvalid */
+IHTTPParseResult IHTTP2ParsePreface(const uint8_t* bytes, size_t length);
+
+/*! @brief parse the frame header at the start of the bytes, which hold at least IHTTP2FrameHeaderLength of them */
+void IHTTP2ParseFrameHeader(const uint8_t* bytes, IHTTP2FrameHeader* header);
+
+/*! @brief write a frame header into the buffer, which holds IHTTP2FrameHeaderLength bytes */
+void IHTTP2WriteFrameHeader(uint8_t* buffer, uint32_t length, IHTTP2FrameType type, uint8_t flags, uint32_t streamID);
+
+/*! @brief the payload of a DATA or HEADERS frame without its padding, or the priority fields of HEADERS,
+    returns false if the padding is longer than the payload */
+bool IHTTP2FrameContent(const IHTTP2FrameHeader* header, const uint8_t* payload, const uint8_t** content, size_t* contentLength);
+
+/*! @brief write a setting into the buffer, which holds IHTTP2SettingLength bytes */
+void IHTTP2WriteSetting(uint8_t* buffer, IHTTP2Setting setting, uint32_t value);
+
+/*! @brief read a 32 bit big endian value */
+uint32_t IHTTP2ReadUInt32(const uint8_t* bytes);
+
+/*! @brief write a 32 bit big endian value */
+void IHTTP2WriteUInt32(uint8_t* buffer, uint32_t value);
+
+#endif /* IHTTP2Frame_h */
@@ -0,0 +1,95 @@
+#import <Foundation/Foundation.h>
+
+#import "IHTTPConnection.h"
+#import "IHTTPEventLoop.h"
+
+#include "IHTTP2Frame.h"
+
+@class IHTTPRequest;
+@class IHTTP2Session;
+
+/*! @header IHTTP2Session.h
+    @abstract IHTTP2Session serves HTTP/2 over cleartext TCP on a connection, not part of the public API */
+
+/*! @class IHTTP2Stream
+    @brief a request read from an HTTP/2 stream and the frames of its response
+    @discussion the request is passed to its handler as an HTTP/1.1 request head and a complete body, so handlers don't change,
+    the response sends its headers and body to the stream instead of the socket. Only used on the loop thread of the connection's worker,
+    the response's output reaches it there in the order it was sent */
+@interface IHTTP2Stream : NSObject
+
+/*! @brief the session the stream belongs to */
+@property(nonatomic, weak, readonly) IHTTP2Session* session;
+
+/*! @brief the stream identifier the client chose */
+@property(nonatomic, readonly) uint32_t streamID;
+
+/*! @brief the request read from the stream, held until the response is done with it */
+@property(nonatomic, readonly) IHTTPRequest* request;
+
+/*! @brief YES once the stream has been reset by either end or the connection has closed, output sent afterwards fails */
+@property(nonatomic, readonly) BOOL isReset;
+
+// MARK: -
+
+/*! @brief a response has started answering the stream, it counts against the session's concurrent streams until it finishes,
+    even if the stream is reset before then */
+- (void) startResponse;
+
+/*! @brief send the status and header fields in a HEADERS frame, connection specific fields are dropped,
+    returns NO if the stream has been reset */
+- (BOOL) sendStatus:(NSUInteger) status headers:(NSDictionary<NSString*, NSString*>*) headers endStream:(BOOL) endStream;
+
+/*! @brief queue the bytes to be sent in DATA frames as the flow control windows allow, returns NO if the stream has been reset */
+- (BOOL) sendData:(NSData*) data;
+
+/*! @brief queue part of the file to be sent in DATA frames, it's read as the flow control windows allow, returns NO if the stream has been reset */
+- (BOOL) sendFile:(NSFileHandle*) file offset:(unsigned long long) offset length:(unsigned long long) length;
+
+/*! @brief end the stream once the queued output has been sent, or reset it if the response failed */
+- (void) finishResponseWithError:(BOOL) didFail;
+
+/*! @brief answer a request which can't be read with the status, and reset the stream if the client is still sending its body */
+- (void) rejectWithStatus:(NSUInteger) status;
+
+@end
+
+// MARK: -
+
+/*! @class IHTTP2Session
+    @brief reads the frames of an HTTP/2 connection, runs a request for each stream and multiplexes their responses
+    @discussion started by a client's connection preface on a new connection, or by an HTTP/1.1 request with Upgrade: h2c.
+    Request bodies are collected in the stream until the client ends it, under the server's maxRequestBodyLength,
+    responses are sent round robin across the streams within the client's flow control windows, and no faster than the client reads them.
+    Frames are queued and written to the connection together at the end of each read and each pass of the loop.
+    Only used on the loop thread of the connection's worker */
+@interface IHTTP2Session : NSObject <IHTTPEventLoopSource>
+
+/*! @brief the connection the session reads and writes */
+@property(nonatomic, weak, readonly) IHTTPConnection* connection;
+
+/*! @brief the requests of the streams which are open */
+@property(nonatomic, readonly) NSArray<IHTTPRequest*>* requests;
+
+// MARK: -
+
+/*! @brief a session for the connection, which isn't read until it's opened */
++ (IHTTP2Session*) sessionWithConnection:(IHTTPConnection*) connection;
+
+// MARK: -
+
+/*! @brief take the settings of an HTTP/1.1 request with Upgrade: h2c, which is answered on stream 1 once the session opens,
+    returns NO if its HTTP2-Settings header is malformed, and the request should be answered as it is */
+- (BOOL) upgradeRequest:(IHTTPRequest*) request;
+
+/*! @brief send the server's settings and start reading frames, the data is what the client sent after the request it upgraded
+    or after its connection preface */
+- (void) openWithData:(NSData*) data;
+
+/*! @brief answer streams whose bodies have stalled with 408 Request Timeout, or close an idle connection */
+- (void) connectionDidTimeOut:(IHTTPTimeoutKind) kind;
+
+/*! @brief send GOAWAY with the error code and close the connection, resetting the open streams */
+- (void) closeWithError:(IHTTP2ErrorCode) errorCode;
+
+@end
@@ -0,0 +1,1365 @@
+#import "IHTTP2Session.h"
+
+#import "IHTTPConnection.h"
+#import "IHTTPConstants.h"
+#import "IHTTPPrivate.h"
+#import "IHTTPServer.h"
+#import "IHTTPWorker.h"
+
+#include "IHTTPHPACK.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/*! @brief the flow control window the server allows the connection and each stream for request bodies */
+static uint32_t const IHTTP2SessionWindowSize = (1024 * 1024);
+
+/*! @brief the longest header block accepted across a HEADERS frame and its CONTINUATION frames */
+static NSUInteger const IHTTP2SessionMaxHeaderBlockLength = (64 * 1024);
+
+/*! @brief queued frames are written to the connection once there's this much of them, otherwise when the session has nothing more to do,
+    and no more DATA frames are made while this much written to the connection is waiting for the client to read it */
+static NSUInteger const IHTTP2SessionOutputBufferSize = (64 * 1024);
+
+/*! @brief the most capacity reserved up front for a request body, larger bodies grow as they arrive */
+static NSUInteger const IHTTP2SessionBodyCapacity = (1024 * 1024);
+
+/*! @brief the client may reset as many streams as it may have open in each of these intervals, more is a rapid reset attack
+    and the connection is closed, CVE-2023-44487 */
+static NSTimeInterval const IHTTP2SessionResetInterval = 1;
+
+/*! @brief YES if the bytes are a token, RFC 9110 section 5.6.2, field names in HTTP/2 must also be lower case */
+static BOOL IHTTP2IsToken(const uint8_t* bytes, size_t length, BOOL allowsUpperCase) {
+    static const char symbols[] = "!#$%&'*+-.^_`|~";
+    if (length == 0) {
+        return NO;
+    }
+
+    for (size_t index = 0; index < length; index++) {
+        uint8_t character = bytes[index];
+        if (!((character >= 'a' && character <= 'z') || (character >= '0' && character <= '9')
+           || (allowsUpperCase && character >= 'A' && character <= 'Z')
+           || (character != 0 && strchr(symbols, character)))) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+/*! @brief YES if the bytes can be a field value, which can't carry NUL, CR or LF, RFC 9113 section 8.2.1 */
+static BOOL IHTTP2IsFieldValue(const uint8_t* bytes, size_t length) {
+    for (size_t index = 0; index < length; index++) {
+        if (bytes[index] == 0 || bytes[index] == '\r' || bytes[index] == '\n') {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+/*! @brief YES if the bytes can be the target of a request line, visible characters without spaces */
+static BOOL IHTTP2IsRequestTarget(const uint8_t* bytes, size_t length) {
+    for (size_t index = 0; index < length; index++) {
+        if (bytes[index] <= ' ' || bytes[index] == 0x7F) {
+            return NO;
+        }
+    }
+    return (length > 0);
+}
+
+/*! @brief YES if the field name in the decoded output is the lower case name */
+static BOOL IHTTP2FieldIs(const uint8_t* output, IHTTPSlice name, const char* string) {
+    size_t length = strlen(string);
+    return (name.length == length && memcmp((output + name.offset), string, length) == 0);
+}
+
+/*! @brief append the lower case field name as HTTP/1.1 clients usually send it, with the first letter of each word in upper case,
+    so handlers which look fields up in the requestHeaders dictionary find them */
+static void IHTTP2AppendFieldName(NSMutableData* head, const uint8_t* name, size_t length) {
+    size_t start = head.length;
+    [head appendBytes:name length:length];
+    uint8_t* bytes = ((uint8_t*)head.mutableBytes + start);
+    BOOL isStart = YES;
+    for (size_t index = 0; index < length; index++) {
+        if (isStart && bytes[index] >= 'a' && bytes[index] <= 'z') {
+            bytes[index] -= ('a' - 'A');
+        }
+        isStart = (bytes[index] == '-');
+    }
+}
+
+/*! @brief the base64url HTTP2-Settings header of an upgrade request, RFC 7540 section 3.2.1, or nil if it's malformed or repeated */
+static NSData* IHTTP2DecodeSettingsHeader(NSString* value) {
+    if (!value || [value rangeOfString:@","].location != NSNotFound) { // repeated fields are combined with a comma
+        return nil;
+    }
+
+    NSMutableString* base64 = [[value stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet] mutableCopy];
+    [base64 replaceOccurrencesOfString:@"-" withString:@"+" options:0 range:NSMakeRange(0, base64.length)];
+    [base64 replaceOccurrencesOfString:@"_" withString:@"/" options:0 range:NSMakeRange(0, base64.length)];
+    while ((base64.length % 4) != 0) {
+        [base64 appendString:@"="];
+    }
+    return [NSData.alloc initWithBase64EncodedString:base64 options:0];
+}
+
+/*! @brief how a response header field is encoded, values which change with every response aren't worth a place in the client's table,
+    and cookies are never indexed so they can't be probed by compression, RFC 7541 section 7.1.3 */
+static IHTTPHPACKIndexing IHTTP2IndexingForField(NSString* name) {
+    static NSSet<NSString*>* unindexed = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        unindexed = [NSSet setWithObjects:@"date", @"content-length", @"etag", @"last-modified", @"age", @"expires", @"content-range", nil];
+    });
+
+    if ([name isEqualToString:@"set-cookie"]) {
+        return IHTTPHPACKIndexingNever;
+    }
+    return ([unindexed containsObject:name] ? IHTTPHPACKIndexingNone : IHTTPHPACKIndexingIncremental);
+}
+
+// MARK: -
+
+/*! @class IHTTP2FileOutput
+    @brief part of a file queued on a stream, read into DATA frames as the flow control windows allow */
+@interface IHTTP2FileOutput : NSObject
+@property(nonatomic, retain) NSFileHandle* file;
+@property(nonatomic, assign) unsigned long long offset;
+@property(nonatomic, assign) unsigned long long remaining;
+
+@end
+
+// MARK: -
+
+@implementation IHTTP2FileOutput
+
+@end
+
+// MARK: -
+
+@interface IHTTP2Stream ()
+@property(nonatomic, weak) IHTTP2Session* sessionStorage;
+@property(nonatomic, assign) uint32_t streamIDStorage;
+@property(nonatomic, retain) IHTTPRequest* requestStorage;
+@property(nonatomic, retain) NSMutableData* head;
+@property(nonatomic, retain) NSMutableData* body;
+@property(nonatomic, assign) long long declaredLength;
+@property(nonatomic, retain) NSMutableArray* pendingOutput;
+@property(nonatomic, assign) NSUInteger pendingOffset;
+@property(nonatomic, assign) int64_t sendWindow;
+@property(nonatomic, assign) int64_t receiveWindow;
+@property(nonatomic, assign) BOOL isResetStorage;
+@property(nonatomic, assign) BOOL isSending;
+@property(nonatomic, assign) BOOL didEndInput;
+@property(nonatomic, assign) BOOL didSendHeaders;
+@property(nonatomic, assign) BOOL isEndQueued;
+@property(nonatomic, assign) BOOL didEndOutput;
+@property(nonatomic, assign) BOOL isResponding;
+@property(nonatomic, assign) BOOL isActive;
+
+@end
+
+// MARK: -
+
+@interface IHTTP2Session ()
+@property(nonatomic, weak) IHTTPConnection* connectionStorage;
+@property(nonatomic, weak) IHTTPEventLoop* eventLoop;
+@property(nonatomic, assign) int fileDescriptor;
+@property(nonatomic, retain) NSMutableDictionary<NSNumber*, IHTTP2Stream*>* streams;
+@property(nonatomic, retain) NSMutableArray<IHTTP2Stream*>* sendingStreams;
+@property(nonatomic, retain) NSMutableData* inputBuffer;
+@property(nonatomic, retain) NSMutableData* output;
+@property(nonatomic, retain) NSMutableData* headerBlock;
+@property(nonatomic, retain) NSData* upgradeHead;
+@property(nonatomic, assign) uint32_t headerStreamID;
+@property(nonatomic, assign) uint8_t headerFlags;
+@property(nonatomic, assign) uint32_t lastStreamID;
+@property(nonatomic, assign) NSUInteger maxConcurrentStreams;
+@property(nonatomic, assign) NSUInteger maxBodyLength;
+@property(nonatomic, assign) NSUInteger receivingCount;
+@property(nonatomic, assign) NSUInteger activeCount;
+@property(nonatomic, assign) NSUInteger resetCount;
+@property(nonatomic, assign) NSTimeInterval resetIntervalStart;
+@property(nonatomic, assign) int64_t sendWindow;
+@property(nonatomic, assign) int64_t receiveWindow;
+@property(nonatomic, assign) uint32_t peerInitialWindow;
+@property(nonatomic, assign) uint32_t peerMaxFrameSize;
+@property(nonatomic, assign) BOOL expectsPreface;
+@property(nonatomic, assign) BOOL didReceiveSettings;
+@property(nonatomic, assign) BOOL isGoingAway;
+@property(nonatomic, assign) BOOL isReadingInput;
+@property(nonatomic, assign) BOOL isReadingFrames;
+@property(nonatomic, assign) BOOL isFlushScheduled;
+@property(nonatomic, assign) BOOL isWaitingForOutput;
+@property(nonatomic, assign) BOOL isClosed;
+
+- (BOOL) sendHeadersForStream:(IHTTP2Stream*) stream status:(NSUInteger) status headers:(NSDictionary*) headers endStream:(BOOL) endStream;
+- (BOOL) queueOutput:(id) output forStream:(IHTTP2Stream*) stream;
+- (void) finishStream:(IHTTP2Stream*) stream didFail:(BOOL) didFail;
+- (void) rejectStream:(IHTTP2Stream*) stream status:(NSUInteger) status;
+
+@end
+
+// MARK: -
+
+@implementation IHTTP2Stream
+
+// MARK: - Properties
+
+- (IHTTP2Session*) session {
+    return self.sessionStorage;
+}
+
+- (uint32_t) streamID {
+    return self.streamIDStorage;
+}
+
+- (IHTTPRequest*) request {
+    return self.requestStorage;
+}
+
+- (BOOL) isReset {
+    return self.isResetStorage;
+}
+
+// MARK: -
+
+- (void) startResponse {
+    self.isResponding = YES;
+}
+
+- (BOOL) sendStatus:(NSUInteger) status headers:(NSDictionary<NSString*, NSString*>*) headers endStream:(BOOL) endStream {
+    return [self.session sendHeadersForStream:self status:status headers:headers endStream:endStream];
+}
+
+- (BOOL) sendData:(NSData*) data {
+    return (data.length > 0 ? [self.session queueOutput:data forStream:self] : !self.isReset);
+}
+
+- (BOOL) sendFile:(NSFileHandle*) file offset:(unsigned long long) offset length:(unsigned long long) length {
+    if (length == 0) {
+        return !self.isReset;
+    }
+
+    IHTTP2FileOutput* output = IHTTP2FileOutput.new;
+    output.file = file;
+    output.offset = offset;
+    output.remaining = length;
+    return [self.session queueOutput:output forStream:self];
+}
+
+- (void) finishResponseWithError:(BOOL) didFail {
+    [self.session finishStream:self didFail:didFail];
+}
+
+- (void) rejectWithStatus:(NSUInteger) status {
+    [self.session rejectStream:self status:status];
+}
+
+// MARK: - NSObject
+
+- (NSString*)description {
+    return [NSString stringWithFormat:@"<%@:%p stream: %u reset: %@ request: %@>",
+        NSStringFromClass(self.class), self, self.streamID, (self.isReset ? @"YES" : @"NO"), self.request.requestURL];
+}
+
+@end
+
+// MARK: -
+
+@implementation IHTTP2Session {
+    IHTTPHPACKTable _decoder;
+    IHTTPHPACKTable _encoder;
+    IHTTPHeaderField _fields[IHTTPHPACKMaxFields];
+    uint8_t _headerOutput[IHTTPParserMaxHeaderSize]; // the names and values decoded from a header block
+}
+
+// MARK: - Initializers
+
+- (id)init {
+    if ((self = super.init)) {
+        IHTTPHPACKInitTable(&_decoder, IHTTPHPACKDefaultTableSize);
+        IHTTPHPACKInitTable(&_encoder, IHTTPHPACKDefaultTableSize);
+        self.streams = NSMutableDictionary.new;
+        self.sendingStreams = NSMutableArray.new;
+        self.output = [NSMutableData dataWithCapacity:IHTTP2SessionOutputBufferSize];
+        self.sendWindow = IHTTP2DefaultWindowSize;
+        self.receiveWindow = IHTTP2SessionWindowSize;
+        self.peerInitialWindow = IHTTP2DefaultWindowSize;
+        self.peerMaxFrameSize = IHTTP2DefaultMaxFrameSize;
+    }
+    return self;
+}
+
++ (IHTTP2Session*) sessionWithConnection:(IHTTPConnection*) connection {
+    IHTTPWorker* worker = connection.worker;
+    IHTTP2Session* session = IHTTP2Session.new;
+    session.connectionStorage = connection;
+    session.eventLoop = worker.eventLoop;
+    session.fileDescriptor = connection.fileDescriptor;
+    session.maxConcurrentStreams = worker.http2MaxConcurrentStreams;
+    session.maxBodyLength = worker.server.maxRequestBodyLength;
+    return session;
+}
+
+- (void)dealloc {
+    IHTTPHPACKFreeTable(&_decoder);
+    IHTTPHPACKFreeTable(&_encoder);
+}
+
+// MARK: - Properties
+
+- (IHTTPConnection*) connection {
+    return self.connectionStorage;
+}
+
+- (NSArray<IHTTPRequest*>*) requests {
+    NSMutableArray<IHTTPRequest*>* requests = [NSMutableArray arrayWithCapacity:self.streams.count];
+    for (IHTTP2Stream* stream in self.streams.objectEnumerator) {
+        if (stream.request) {
+            [requests addObject:stream.request];
+        }
+    }
+    return requests;
+}
+
+// MARK: - Connection
+
+- (BOOL) upgradeRequest:(IHTTPRequest*) request {
+    NSData* settings = IHTTP2DecodeSettingsHeader([request headerFieldValue:IHTTPHTTP2SettingsHeader]);
+    if (!settings || (settings.length % IHTTP2SettingLength) != 0
+     || [self applySettings:settings.bytes length:settings.length] != IHTTP2ErrorNone) {
+        return NO;
+    }
+
+    self.upgradeHead = request.requestHead;
+    self.expectsPreface = YES; // the client sends it after the 101 Switching Protocols response
+    return YES;
+}
+
+- (void) openWithData:(NSData*) data {
+    if (self.upgradeHead) {
+        static const char switchingLines[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+        [self.output appendBytes:switchingLines length:(sizeof(switchingLines) - 1)];
+    }
+
+    // the server's connection preface, RFC 9113 section 3.4, then a larger window for the connection than the default
+    uint8_t settings[3 * IHTTP2SettingLength];
+    IHTTP2WriteSetting(settings, IHTTP2SettingMaxConcurrentStreams, (uint32_t)MIN(self.maxConcurrentStreams, (NSUInteger)UINT32_MAX));
+    IHTTP2WriteSetting((settings + IHTTP2SettingLength), IHTTP2SettingInitialWindowSize, IHTTP2SessionWindowSize);
+    IHTTP2WriteSetting((settings + (2 * IHTTP2SettingLength)), IHTTP2SettingMaxHeaderListSize, IHTTPParserMaxHeaderSize);
+    [self writeFrameType:IHTTP2FrameSettings flags:0 streamID:0 payload:settings length:sizeof(settings)];
+    [self writeWindowUpdate:0 increment:(IHTTP2SessionWindowSize - IHTTP2DefaultWindowSize)];
+
+    self.isReadingInput = [self.eventLoop addSource:self forFileDescriptor:self.fileDescriptor];
+    self.isReadingFrames = YES;
+    if (self.upgradeHead) { // the request which asked for the upgrade is answered on stream 1, which the client has half closed
+        NSData* head = self.upgradeHead;
+        self.upgradeHead = nil;
+        self.lastStreamID = 1; // counted when it was read as HTTP/1.1
+        IHTTP2Stream* stream = [self openStream:1];
+        stream.didEndInput = YES;
+        [stream.request readStreamHead:head body:nil];
+    }
+
+    if (data.length > 0 && !self.isClosed) { // frames which arrived with the request or the preface
+        [self appendBytes:data.bytes length:data.length];
+    }
+    self.isReadingFrames = NO;
+
+    [self sendPendingData];
+    [self flushOutput];
+    [self updateTimeout];
+}
+
+- (void) connectionDidTimeOut:(IHTTPTimeoutKind) kind {
+    __attribute__((objc_precise_lifetime)) IHTTP2Session* session = self; // closing the connection releases its last reference
+    if (kind == IHTTPTimeoutBody) { // like a request head which is too slow on HTTP/1.1, the rest of the connection carries on
+        for (IHTTP2Stream* stream in self.streams.allValues) {
+            if (!stream.didEndInput) {
+                [stream.request rejectRequest:IHTTPStatus408RequestTimeout];
+            }
+        }
+        [self flushOutput];
+        [self updateTimeout];
+    }
+    else { // idle for the keep-alive timeout
+        [self closeWithError:IHTTP2ErrorNone];
+    }
+}
+
+- (void) closeWithError:(IHTTP2ErrorCode) errorCode {
+    __attribute__((objc_precise_lifetime)) IHTTP2Session* session = self;
+    if (self.isClosed) {
+        return;
+    }
+
+    if (errorCode != IHTTP2ErrorNone && self.connection.worker.server.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ closing connection: %@ error: %u", NSStringFromClass([self class]), self.connection, (unsigned)errorCode);
+    }
+
+    uint8_t payload[8];
+    IHTTP2WriteUInt32(payload, self.lastStreamID);
+    IHTTP2WriteUInt32((payload + 4), errorCode);
+    [self writeFrameType:IHTTP2FrameGoAway flags:0 streamID:0 payload:payload length:sizeof(payload)];
+    if ([self flushOutput]) {
+        [self finish];
+    }
+}
+
+/*! @brief stop reading, reset the open streams and close the connection, once */
+- (void) finish {
+    if (self.isClosed) {
+        return;
+    }
+    self.isClosed = YES;
+
+    IHTTPConnection* connection = self.connection;
+    if (self.isReadingInput) {
+        [self.eventLoop removeSource:self forFileDescriptor:self.fileDescriptor];
+        self.isReadingInput = NO;
+    }
+
+    for (IHTTP2Stream* stream in self.streams.objectEnumerator) { // their responses' output fails from now on
+        stream.isResetStorage = YES;
+        [stream.pendingOutput removeAllObjects];
+    }
+    [self.streams removeAllObjects];
+    [self.sendingStreams removeAllObjects];
+    self.receivingCount = 0;
+    self.activeCount = 0;
+    self.inputBuffer = nil;
+    self.output = nil;
+
+    [connection closeSocket]; // after the frames already written, the GOAWAY among them
+}
+
+/*! @brief wait for the bodies still arriving under the body timeout, or for the next stream under the keep-alive timeout */
+- (void) updateTimeout {
+    IHTTPConnection* connection = self.connection;
+    if (self.isClosed) {
+        return;
+    }
+
+    if (self.receivingCount > 0) { // pushes the deadline back without moving the timer
+        [connection startTimeout:IHTTPTimeoutBody];
+    }
+    else if (self.streams.count == 0) {
+        if (connection.timeoutKind != IHTTPTimeoutIdle) {
+            [connection startTimeout:IHTTPTimeoutIdle];
+        }
+    }
+    else { // the handlers are answering
+        [connection cancelTimeout];
+    }
+}
+
+// MARK: - Settings
+
+/*! @brief apply the client's settings, RFC 9113 section 6.5.2, returns the error code of a connection error, or IHTTP2ErrorNone */
+- (IHTTP2ErrorCode) applySettings:(const uint8_t*) bytes length:(NSUInteger) length {
+    for (NSUInteger offset = 0; (offset + IHTTP2SettingLength) <= length; offset += IHTTP2SettingLength) {
+        uint16_t setting = (uint16_t)((bytes[offset] << 8) | bytes[offset + 1]);
+        uint32_t value = IHTTP2ReadUInt32(bytes + offset + 2);
+        switch (setting) {
+            case IHTTP2SettingHeaderTableSize: // the server's table is never larger than the default
+                IHTTPHPACKSetTableLimit(&_encoder, MIN((size_t)value, (size_t)IHTTPHPACKDefaultTableSize));
+                break;
+            case IHTTP2SettingEnablePush: // the server doesn't push
+                if (value > 1) {
+                    return IHTTP2ErrorProtocol;
+                }
+                break;
+            case IHTTP2SettingInitialWindowSize: { // applies to the streams already open as well
+                if (value > IHTTP2MaxWindowSize) {
+                    return IHTTP2ErrorFlowControl;
+                }
+                int64_t delta = ((int64_t)value - (int64_t)self.peerInitialWindow);
+                for (IHTTP2Stream* stream in self.streams.objectEnumerator) {
+                    stream.sendWindow += delta;
+                    if (stream.sendWindow > IHTTP2MaxWindowSize) {
+                        return IHTTP2ErrorFlowControl;
+                    }
+                }
+                self.peerInitialWindow = value;
+                break;
+            }
+            case IHTTP2SettingMaxFrameSize:
+                if (value < IHTTP2DefaultMaxFrameSize || value > IHTTP2MaxFrameSizeLimit) {
+                    return IHTTP2ErrorProtocol;
+                }
+                self.peerMaxFrameSize = value;
+                break;
+            default: // the concurrent stream limit is for pushes, the header list size is advisory, unknown settings are ignored
+                break;
+        }
+    }
+    return IHTTP2ErrorNone;
+}
+
+// MARK: - Input
+
+/*! @brief read the frames in the bytes, keeping a frame split between reads until the rest of it arrives */
+- (void) appendBytes:(const uint8_t*) bytes length:(NSUInteger) length {
+    if (self.inputBuffer.length > 0) {
+        [self.inputBuffer appendBytes:bytes length:length];
+        bytes = self.inputBuffer.bytes;
+        length = self.inputBuffer.length;
+    }
+
+    NSUInteger consumed = 0;
+    if (self.expectsPreface) { // the client's connection preface, after the 101 Switching Protocols response
+        IHTTPParseResult preface = IHTTP2ParsePreface(bytes, length);
+        if (preface == IHTTPParseInvalid) {
+            [self closeWithError:IHTTP2ErrorProtocol];
+            return;
+        }
+        else if (preface == IHTTPParseComplete) {
+            consumed = IHTTP2PrefaceLength;
+            self.expectsPreface = NO;
+        }
+    }
+
+    while (!self.expectsPreface && !self.isClosed && (length - consumed) >= IHTTP2FrameHeaderLength) {
+        IHTTP2FrameHeader header;
+        IHTTP2ParseFrameHeader((bytes + consumed), &header);
+        if (header.length > IHTTP2DefaultMaxFrameSize) { // the server never allows larger frames
+            [self closeWithError:IHTTP2ErrorFrameSize];
+            return;
+        }
+        else if ((length - consumed - IHTTP2FrameHeaderLength) < header.length) {
+            break;
+        }
+
+        [self receiveFrame:&header payload:(bytes + consumed + IHTTP2FrameHeaderLength)];
+        consumed += (IHTTP2FrameHeaderLength + header.length);
+    }
+
+    if (self.isClosed) {
+        return;
+    }
+    else if (consumed == length) {
+        self.inputBuffer = nil;
+    }
+    else if (self.inputBuffer.length > 0) {
+        [self.inputBuffer replaceBytesInRange:NSMakeRange(0, consumed) withBytes:NULL length:0];
+    }
+    else {
+        self.inputBuffer = [NSMutableData dataWithBytes:(bytes + consumed) length:(length - consumed)];
+    }
+}
+
+/*! @brief act on a complete frame, RFC 9113 section 6 */
+- (void) receiveFrame:(const IHTTP2FrameHeader*) header payload:(const uint8_t*) payload {
+    if (self.headerStreamID && (header->type != IHTTP2FrameContinuation || header->streamID != self.headerStreamID)) {
+        [self closeWithError:IHTTP2ErrorProtocol]; // a header block can't be interleaved with other frames
+        return;
+    }
+    else if (!self.didReceiveSettings && (header->type != IHTTP2FrameSettings || (header->flags & IHTTP2FlagAck))) {
+        [self closeWithError:IHTTP2ErrorProtocol]; // the client's preface ends with its SETTINGS
+        return;
+    }
+
+    switch (header->type) {
+        case IHTTP2FrameData:
+            [self receiveData:header payload:payload];
+            break;
+        case IHTTP2FrameHeaders:
+            [self receiveHeaders:header payload:payload];
+            break;
+        case IHTTP2FrameContinuation:
+            [self receiveContinuation:header payload:payload];
+            break;
+        case IHTTP2FrameSettings:
+            [self receiveSettings:header payload:payload];
+            break;
+        case IHTTP2FrameWindowUpdate:
+            [self receiveWindowUpdate:header payload:payload];
+            break;
+        case IHTTP2FrameResetStream:
+            [self receiveResetStream:header payload:payload];
+            break;
+        case IHTTP2FramePing:
+            if (header->streamID != 0) {
+                [self closeWithError:IHTTP2ErrorProtocol];
+            }
+            else if (header->length != 8) {
+                [self closeWithError:IHTTP2ErrorFrameSize];
+            }
+            else if (!(header->flags & IHTTP2FlagAck)) {
+                [self writeFrameType:IHTTP2FramePing flags:IHTTP2FlagAck streamID:0 payload:payload length:8];
+            }
+            break;
+        case IHTTP2FrameGoAway: // the client is leaving, the streams it opened are still answered
+            if (header->streamID != 0) {
+                [self closeWithError:IHTTP2ErrorProtocol];
+            }
+            else if (header->length < 8) {
+                [self closeWithError:IHTTP2ErrorFrameSize];
+            }
+            else {
+                self.isGoingAway = YES;
+                if (self.streams.count == 0) {
+                    [self finish];
+                }
+            }
+            break;
+        case IHTTP2FramePriority: // the streams are served round robin
+            if (header->streamID == 0) {
+                [self closeWithError:IHTTP2ErrorProtocol];
+            }
+            else if (header->length != 5) {
+                [self writeResetStreamID:header->streamID error:IHTTP2ErrorFrameSize];
+            }
+            break;
+        case IHTTP2FramePushPromise: // only servers push
+            [self closeWithError:IHTTP2ErrorProtocol];
+            break;
+        default: // unknown frame types are ignored
+            break;
+    }
+}
+
+- (void) receiveSettings:(const IHTTP2FrameHeader*) header payload:(const uint8_t*) payload {
+    if (header->streamID != 0) {
+        [self closeWithError:IHTTP2ErrorProtocol];
+        return;
+    }
+    else if (header->flags & IHTTP2FlagAck) { // the client applied the server's settings
+        if (header->length != 0) {
+            [self closeWithError:IHTTP2ErrorFrameSize];
+        }
+        return;
+    }
+    else if ((header->length % IHTTP2SettingLength) != 0) {
+        [self closeWithError:IHTTP2ErrorFrameSize];
+        return;
+    }
+
+    IHTTP2ErrorCode errorCode = [self applySettings:payload length:header->length];
+    if (errorCode != IHTTP2ErrorNone) {
+        [self closeWithError:errorCode];
+        return;
+    }
+    self.didReceiveSettings = YES;
+    [self writeFrameType:IHTTP2FrameSettings flags:IHTTP2FlagAck streamID:0 payload:NULL length:0];
+}
+
+- (void) receiveWindowUpdate:(const IHTTP2FrameHeader*) header payload:(const uint8_t*) payload {
+    if (header->length != 4) {
+        [self closeWithError:IHTTP2ErrorFrameSize];
+        return;
+    }
+
+    uint32_t increment = (IHTTP2ReadUInt32(payload) & 0x7FFFFFFF);
+    if (header->streamID == 0) {
+        self.sendWindow += increment;
+        if (increment == 0) {
+            [self closeWithError:IHTTP2ErrorProtocol];
+        }
+        else if (self.sendWindow > IHTTP2MaxWindowSize) {
+            [self closeWithError:IHTTP2ErrorFlowControl];
+        }
+        return;
+    }
+
+    IHTTP2Stream* stream = self.streams[@(header->streamID)];
+    if (!stream) { // a stream which has closed may still get updates, one which hasn't opened can't
+        if (header->streamID > self.lastStreamID) {
+            [self closeWithError:IHTTP2ErrorProtocol];
+        }
+        return;
+    }
+
+    stream.sendWindow += increment;
+    if (increment == 0) {
+        [self resetStream:stream error:IHTTP2ErrorProtocol];
+    }
+    else if (stream.sendWindow > IHTTP2MaxWindowSize) {
+        [self resetStream:stream error:IHTTP2ErrorFlowControl];
+    }
+}
+
+- (void) receiveResetStream:(const IHTTP2FrameHeader*) header payload:(const uint8_t*) payload {
+    if (header->streamID == 0 || header->streamID > self.lastStreamID) {
+        [self closeWithError:IHTTP2ErrorProtocol];
+        return;
+    }
+    else if (header->length != 4) {
+        [self closeWithError:IHTTP2ErrorFrameSize];
+        return;
+    }
+
+    // opening and resetting streams costs the client nothing, each one costs the server a handler
+    NSTimeInterval now = self.eventLoop.currentTime;
+    if ((now - self.resetIntervalStart) >= IHTTP2SessionResetInterval) {
+        self.resetIntervalStart = now;
+        self.resetCount = 0;
+    }
+    self.resetCount += 1;
+    if (self.resetCount > self.maxConcurrentStreams) {
+        [self closeWithError:IHTTP2ErrorEnhanceYourCalm];
+        return;
+    }
+
+    IHTTP2Stream* stream = self.streams[@(header->streamID)];
+    if (stream) { // the client has given up on it, the handler's output is dropped but it still counts until it's done
+        [self closeStream:stream];
+    }
+}
+
+- (void) receiveData:(const IHTTP2FrameHeader*) header payload:(const uint8_t*) payload {
+    const uint8_t* content = NULL;
+    size_t contentLength = 0;
+    if (header->streamID == 0 || header->streamID > self.lastStreamID
+     || !IHTTP2FrameContent(header, payload, &content, &contentLength)) {
+        [self closeWithError:IHTTP2ErrorProtocol];
+        return;
+    }
+
+    // the whole frame counts against the connection's window, whatever becomes of it
+    self.receiveWindow -= header->length;
+    if (self.receiveWindow < 0) {
+        [self closeWithError:IHTTP2ErrorFlowControl];
+        return;
+    }
+    else if (self.receiveWindow <= (IHTTP2SessionWindowSize / 2)) {
+        [self writeWindowUpdate:0 increment:(uint32_t)(IHTTP2SessionWindowSize - self.receiveWindow)];
+        self.receiveWindow = IHTTP2SessionWindowSize;
+    }
+
+    IHTTP2Stream* stream = self.streams[@(header->streamID)];
+    if (!stream) { // reset or answered already
+        return;
+    }
+    else if (stream.didEndInput) {
+        [self resetStream:stream error:IHTTP2ErrorStreamClosed];
+        return;
+    }
+
+    stream.receiveWindow -= header->length;
+    if (stream.receiveWindow < 0) {
+        [self resetStream:stream error:IHTTP2ErrorFlowControl];
+        return;
+    }
+
+    if (contentLength > 0) {
+        if (!stream.body) {
+            NSUInteger capacity = (stream.declaredLength > 0 ? (NSUInteger)stream.declaredLength : contentLength);
+            stream.body = [NSMutableData dataWithCapacity:MIN(capacity, IHTTP2SessionBodyCapacity)];
+        }
+        [stream.body appendBytes:content length:contentLength];
+    }
+
+    if (self.maxBodyLength > 0 && stream.body.length > self.maxBodyLength) {
+        [stream.request rejectRequest:IHTTPStatus413PayloadTooLarge];
+    }
+    else if (header->flags & IHTTP2FlagEndStream) {
+        [self dispatchStream:stream];
+    }
+    else if (stream.receiveWindow <= (IHTTP2SessionWindowSize / 2)) {
+        [self writeWindowUpdate:stream.streamID increment:(uint32_t)(IHTTP2SessionWindowSize - stream.receiveWindow)];
+        stream.receiveWindow = IHTTP2SessionWindowSize;
+    }
+}
+
+- (void) receiveHeaders:(const IHTTP2FrameHeader*) header payload:(const uint8_t*) payload {
+    const uint8_t* content = NULL;
+    size_t contentLength = 0;
+    if (header->streamID == 0 || (header->streamID % 2) == 0 || !IHTTP2FrameContent(header, payload, &content, &contentLength)) {
+        [self closeWithError:IHTTP2ErrorProtocol];
+        return;
+    }
+
+    if (header->flags & IHTTP2FlagEndHeaders) { // decoded straight from the input
+        [self receiveHeaderBlock:content length:contentLength streamID:header->streamID flags:header->flags];
+    }
+    else { // the rest follows in CONTINUATION frames
+        self.headerBlock = [NSMutableData dataWithBytes:content length:contentLength];
+        self.headerStreamID = header->streamID;
+        self.headerFlags = header->flags;
+    }
+}
+
+- (void) receiveContinuation:(const IHTTP2FrameHeader*) header payload:(const uint8_t*) payload {
+    if (!self.headerStreamID) { // nothing to continue
+        [self closeWithError:IHTTP2ErrorProtocol];
+        return;
+    }
+
+    [self.headerBlock appendBytes:payload length:header->length];
+    if (self.headerBlock.length > IHTTP2SessionMaxHeaderBlockLength) {
+        [self closeWithError:IHTTP2ErrorEnhanceYourCalm];
+    }
+    else if (header->flags & IHTTP2FlagEndHeaders) {
+        NSData* block = self.headerBlock;
+        uint32_t streamID = self.headerStreamID;
+        self.headerBlock = nil;
+        self.headerStreamID = 0;
+        [self receiveHeaderBlock:block.bytes length:block.length streamID:streamID flags:self.headerFlags];
+    }
+}
+
+/*! @brief decode a complete header block, which keeps the dynamic table in step even when the stream is refused,
+    and open a stream for it, or end the body of the stream it's the trailer fields of */
+- (void) receiveHeaderBlock:(const uint8_t*) block length:(NSUInteger) length streamID:(uint32_t) streamID flags:(uint8_t) flags {
+    unsigned fieldCount = 0;
+    IHTTPParseResult result = IHTTPHPACKDecode(&_decoder, block, length, _headerOutput, sizeof(_headerOutput), _fields, &fieldCount);
+    if (result == IHTTPParseInvalid) {
+        [self closeWithError:IHTTP2ErrorCompression];
+        return;
+    }
+
+    IHTTP2Stream* stream = self.streams[@(streamID)];
+    if (stream || streamID <= self.lastStreamID) { // trailer fields, which are dropped, or a stream which has closed
+        if (stream.didEndInput) {
+            [self resetStream:stream error:IHTTP2ErrorStreamClosed];
+        }
+        else if (stream && !(flags & IHTTP2FlagEndStream)) {
+            [self resetStream:stream error:IHTTP2ErrorProtocol];
+        }
+        else if (stream) {
+            [self dispatchStream:stream];
+        }
+        return;
+    }
+
+    self.lastStreamID = streamID;
+    if (self.activeCount >= self.maxConcurrentStreams) { // reset streams count while their handlers are still answering them
+        [self writeResetStreamID:streamID error:IHTTP2ErrorRefusedStream];
+        return;
+    }
+
+    stream = [self openStream:streamID];
+    self.connection.requestCount += 1;
+    if (flags & IHTTP2FlagEndStream) {
+        stream.didEndInput = YES;
+    }
+    else {
+        self.receivingCount += 1;
+    }
+
+    if (result == IHTTPParseTooLarge) {
+        [stream.request rejectRequest:IHTTPStatus431RequestHeaderFieldsTooLarge];
+    }
+    else if (![self readHeaderFields:fieldCount stream:stream]) {
+        [self resetStream:stream error:IHTTP2ErrorProtocol];
+    }
+    else if (self.maxBodyLength > 0 && stream.declaredLength > (long long)self.maxBodyLength) { // refuse before the body is sent
+        [stream.request rejectRequest:IHTTPStatus413PayloadTooLarge];
+    }
+    else if (stream.didEndInput) {
+        [self dispatchStream:stream];
+    }
+}
+
+/*! @brief check the decoded fields, RFC 9113 section 8.3.1, and write them into the stream's head as an HTTP/1.1 request,
+    with the :authority as the Host and the cookie fields joined, returns NO if the request is malformed */
+- (BOOL) readHeaderFields:(unsigned) fieldCount stream:(IHTTP2Stream*) stream {
+    static const char* const pseudoNames[4] = { ":method", ":scheme", ":path", ":authority" };
+    static const char* const connectionNames[5] = { "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade" };
+    const uint8_t* output = _headerOutput;
+    IHTTPSlice pseudo[4] = { { 0, 0 } };
+    BOOL hasPseudo[4] = { NO, NO, NO, NO };
+
+    unsigned index = 0;
+    for (; index < fieldCount && _fields[index].name.length > 0 && output[_fields[index].name.offset] == ':'; index++) {
+        IHTTPHeaderField field = _fields[index];
+        int found = -1;
+        for (int name = 0; name < 4; name++) {
+            if (IHTTP2FieldIs(output, field.name, pseudoNames[name])) {
+                found = name;
+            }
+        }
+        if (found < 0 || hasPseudo[found] || !IHTTP2IsFieldValue((output + field.value.offset), field.value.length)) {
+            return NO; // unknown, repeated or malformed
+        }
+        hasPseudo[found] = YES;
+        pseudo[found] = field.value;
+    }
+
+    // CONNECT isn't supported, it has no :scheme or :path
+    if (!hasPseudo[0] || !hasPseudo[1] || !hasPseudo[2]
+     || !IHTTP2IsToken((output + pseudo[0].offset), pseudo[0].length, YES)
+     || !IHTTP2IsRequestTarget((output + pseudo[2].offset), pseudo[2].length)) {
+        return NO;
+    }
+
+    NSMutableData* head = [NSMutableData dataWithCapacity:(IHTTPParserMaxHeaderSize / 4)];
+    [head appendBytes:(output + pseudo[0].offset) length:pseudo[0].length];
+    [head appendBytes:" " length:1];
+    [head appendBytes:(output + pseudo[2].offset) length:pseudo[2].length];
+    [head appendBytes:" HTTP/1.1\r\n" length:11];
+    if (hasPseudo[3]) {
+        [head appendBytes:"Host: " length:6];
+        [head appendBytes:(output + pseudo[3].offset) length:pseudo[3].length];
+        [head appendBytes:"\r\n" length:2];
+    }
+
+    NSMutableData* cookies = nil;
+    for (; index < fieldCount; index++) {
+        IHTTPHeaderField field = _fields[index];
+        const uint8_t* name = (output + field.name.offset);
+        const uint8_t* value = (output + field.value.offset);
+        if (!IHTTP2IsToken(name, field.name.length, NO) || !IHTTP2IsFieldValue(value, field.value.length)) {
+            return NO; // upper case, or a pseudo-header field after the regular ones
+        }
+
+        for (int connection = 0; connection < 5; connection++) {
+            if (IHTTP2FieldIs(output, field.name, connectionNames[connection])) {
+                return NO;
+            }
+        }
+
+        if (IHTTP2FieldIs(output, field.name, "te")) {
+            if (field.value.length != 8 || memcmp(value, "trailers", 8) != 0) {
+                return NO;
+            }
+        }
+        else if (IHTTP2FieldIs(output, field.name, "content-length")) { // replaced by the length of the body
+            long long declared = 0;
+            for (uint32_t offset = 0; offset < field.value.length; offset++) {
+                if (value[offset] < '0' || value[offset] > '9' || declared > ((LLONG_MAX - 9) / 10)) {
+                    return NO;
+                }
+                declared = ((declared * 10) + (value[offset] - '0'));
+            }
+            if (field.value.length == 0 || (stream.declaredLength >= 0 && stream.declaredLength != declared)) {
+                return NO;
+            }
+            stream.declaredLength = declared;
+            continue;
+        }
+        else if (IHTTP2FieldIs(output, field.name, "cookie")) { // may be split into a field for each cookie, RFC 9113 section 8.2.3
+            if (!cookies) {
+                cookies = [NSMutableData dataWithCapacity:field.value.length];
+            }
+            else {
+                [cookies appendBytes:"; " length:2];
+            }
+            [cookies appendBytes:value length:field.value.length];
+            continue;
+        }
+        else if ((hasPseudo[3] && IHTTP2FieldIs(output, field.name, "host")) || IHTTP2FieldIs(output, field.name, "expect")) {
+            continue; // the :authority is the Host, and the whole body arrives before the handler runs
+        }
+
+        IHTTP2AppendFieldName(head, name, field.name.length);
+        [head appendBytes:": " length:2];
+        [head appendBytes:value length:field.value.length];
+        [head appendBytes:"\r\n" length:2];
+    }
+
+    if (cookies) {
+        [head appendBytes:"Cookie: " length:8];
+        [head appendData:cookies];
+        [head appendBytes:"\r\n" length:2];
+    }
+
+    stream.head = head;
+    return YES;
+}
+
+/*! @brief the client has ended the stream, end the head with the length of the body and pass the request to its handler */
+- (void) dispatchStream:(IHTTP2Stream*) stream {
+    [self endInputForStream:stream];
+
+    NSData* body = stream.body;
+    if (stream.declaredLength >= 0 && (unsigned long long)stream.declaredLength != body.length) { // RFC 9113 section 8.1.1
+        [self resetStream:stream error:IHTTP2ErrorProtocol];
+        return;
+    }
+
+    NSMutableData* head = stream.head;
+    if (body.length > 0 || stream.declaredLength >= 0) {
+        char contentLength[48];
+        [head appendBytes:contentLength length:(NSUInteger)snprintf(contentLength, sizeof(contentLength), "Content-Length: %lu\r\n", (unsigned long)body.length)];
+    }
+    [head appendBytes:"\r\n" length:2];
+    stream.head = nil;
+    stream.body = nil;
+
+    [stream.request readStreamHead:head body:body];
+}
+
+// MARK: - Streams
+
+/*! @brief a stream with a request for the worker to run */
+- (IHTTP2Stream*) openStream:(uint32_t) streamID {
+    IHTTPConnection* connection = self.connection;
+    IHTTP2Stream* stream = IHTTP2Stream.new;
+    stream.sessionStorage = self;
+    stream.streamIDStorage = streamID;
+    stream.declaredLength = -1;
+    stream.sendWindow = self.peerInitialWindow;
+    stream.receiveWindow = IHTTP2SessionWindowSize;
+    stream.pendingOutput = NSMutableArray.new;
+
+    IHTTPRequest* request = [IHTTPRequest requestWithInput:nil]; // the stream reads it
+    request.delegate = connection.worker;
+    request.eventLoop = self.eventLoop;
+    request.connection = connection;
+    request.startTime = self.eventLoop.currentTime;
+    request.stream = stream;
+    stream.requestStorage = request;
+
+    self.streams[@(streamID)] = stream;
+    stream.isActive = YES;
+    self.activeCount += 1;
+    return stream;
+}
+
+/*! @brief the stream no longer counts against maxConcurrentStreams once it's been forgotten and its response, if any, is done */
+- (void) releaseStream:(IHTTP2Stream*) stream {
+    if (stream.isActive && !stream.isResponding && self.streams[@(stream.streamID)] != stream && !self.isClosed) {
+        stream.isActive = NO;
+        self.activeCount -= 1;
+    }
+}
+
+/*! @brief the client won't send any more of the stream */
+- (void) endInputForStream:(IHTTP2Stream*) stream {
+    if (!stream.didEndInput) {
+        stream.didEndInput = YES;
+        self.receivingCount -= 1;
+    }
+}
+
+/*! @brief the server has ended its side of the stream, forget it once the client has ended theirs */
+- (void) endOutputForStream:(IHTTP2Stream*) stream {
+    stream.didEndOutput = YES;
+    if (stream.didEndInput) {
+        [self removeStream:stream];
+    }
+}
+
+/*! @brief send RST_STREAM with the error code and forget the stream */
+- (void) resetStream:(IHTTP2Stream*) stream error:(IHTTP2ErrorCode) errorCode {
+    if (!stream.isReset) {
+        [self writeResetStreamID:stream.streamID error:errorCode];
+    }
+    [self closeStream:stream];
+}
+
+/*! @brief drop the stream's queued output and forget it, its response's output fails from now on */
+- (void) closeStream:(IHTTP2Stream*) stream {
+    stream.isResetStorage = YES;
+    [self endInputForStream:stream];
+    [stream.pendingOutput removeAllObjects];
+    stream.pendingOffset = 0;
+    if (stream.isSending) {
+        stream.isSending = NO;
+        [self.sendingStreams removeObject:stream];
+    }
+    [self removeStream:stream];
+}
+
+/*! @brief drop the stream from the open streams, its response holds it until it's done, close the connection if the client has gone away */
+- (void) removeStream:(IHTTP2Stream*) stream {
+    NSNumber* streamID = @(stream.streamID);
+    if (self.streams[streamID] == stream) {
+        [self.streams removeObjectForKey:streamID];
+    }
+    [self releaseStream:stream];
+
+    if (self.streams.count == 0 && self.isGoingAway) {
+        [self finish];
+    }
+    else if (!self.isReadingFrames) { // otherwise when the read is done
+        [self updateTimeout];
+    }
+}
+
+// MARK: - Output
+
+- (BOOL) sendHeadersForStream:(IHTTP2Stream*) stream status:(NSUInteger) status headers:(NSDictionary*) headers endStream:(BOOL) endStream {
+    static NSSet<NSString*>* connectionHeaders = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{ // lower case, RFC 9113 section 8.2.2
+        connectionHeaders = [NSSet setWithObjects:@"connection", @"keep-alive", @"proxy-connection", @"transfer-encoding", @"upgrade", nil];
+    });
+
+    if (stream.isReset || stream.didSendHeaders || self.isClosed) {
+        return NO;
+    }
+
+    char statusValue[8];
+    size_t statusLength = (size_t)snprintf(statusValue, sizeof(statusValue), "%lu", (unsigned long)(status % 1000));
+    NSMutableData* block = [NSMutableData dataWithLength:(8 + IHTTPHPACKMaxEncodedLength(7, statusLength))];
+    size_t length = IHTTPHPACKEncodeSizeUpdate(&_encoder, block.mutableBytes);
+    length += IHTTPHPACKEncodeField(&_encoder, ((uint8_t*)block.mutableBytes + length), ":status", 7, statusValue, statusLength,
+        IHTTPHPACKIndexingIncremental);
+
+    for (NSString* headerField in headers) {
+        NSString* name = headerField.lowercaseString;
+        if ([connectionHeaders containsObject:name]) {
+            continue;
+        }
+
+        NSData* nameBytes = [name dataUsingEncoding:NSISOLatin1StringEncoding allowLossyConversion:YES];
+        NSData* valueBytes = [headers[headerField] dataUsingEncoding:NSISOLatin1StringEncoding allowLossyConversion:YES];
+        block.length = (length + IHTTPHPACKMaxEncodedLength(nameBytes.length, valueBytes.length));
+        length += IHTTPHPACKEncodeField(&_encoder, ((uint8_t*)block.mutableBytes + length), nameBytes.bytes, nameBytes.length,
+            valueBytes.bytes, valueBytes.length, IHTTP2IndexingForField(name));
+    }
+
+    // the block is split into CONTINUATION frames if it's larger than the client's frames
+    const uint8_t* bytes = block.bytes;
+    size_t written = 0;
+    do {
+        size_t piece = MIN((length - written), (size_t)self.peerMaxFrameSize);
+        BOOL isLast = ((written + piece) == length);
+        uint8_t flags = ((isLast ? IHTTP2FlagEndHeaders : 0) | ((written == 0 && endStream) ? IHTTP2FlagEndStream : 0));
+        [self writeFrameType:(written == 0 ? IHTTP2FrameHeaders : IHTTP2FrameContinuation) flags:flags streamID:stream.streamID
+            payload:(bytes + written) length:piece];
+        written += piece;
+    } while (written < length);
+
+    stream.didSendHeaders = YES;
+    if (endStream) {
+        [self endOutputForStream:stream];
+    }
+    [self scheduleFlush];
+    return YES;
+}
+
+- (BOOL) queueOutput:(id) output forStream:(IHTTP2Stream*) stream {
+    if (stream.isReset || stream.didEndOutput || stream.isEndQueued || self.isClosed) {
+        return NO;
+    }
+
+    [stream.pendingOutput addObject:output];
+    if (!stream.isSending) {
+        stream.isSending = YES;
+        [self.sendingStreams addObject:stream];
+    }
+    [self sendPendingData];
+    [self scheduleFlush];
+    return !stream.isReset;
+}
+
+- (void) finishStream:(IHTTP2Stream*) stream didFail:(BOOL) didFail {
+    if (stream.isResponding) {
+        stream.isResponding = NO;
+        [self releaseStream:stream]; // if it was reset while the handler ran
+    }
+
+    if (stream.isReset || stream.didEndOutput || stream.isEndQueued || self.isClosed) {
+        return;
+    }
+    else if (didFail || !stream.didSendHeaders) { // the client can't tell the response is short any other way
+        [self resetStream:stream error:IHTTP2ErrorInternal];
+        [self scheduleFlush];
+        return;
+    }
+
+    stream.isEndQueued = YES; // sent with the last of the queued output
+    if (!stream.isSending) {
+        stream.isSending = YES;
+        [self.sendingStreams addObject:stream];
+    }
+    [self sendPendingData];
+    [self scheduleFlush];
+}
+
+- (void) rejectStream:(IHTTP2Stream*) stream status:(NSUInteger) status {
+    if ([self sendHeadersForStream:stream status:status headers:@{} endStream:YES] && !stream.didEndInput) {
+        [self resetStream:stream error:IHTTP2ErrorNone]; // the client can stop sending the body, RFC 9113 section 8.1
+    }
+}
+
+/*! @brief carry on with the DATA frames once the connection has sent what's been written, the session closes if the output fails */
+- (void) resumeWhenOutputSent {
+    IHTTP2Session* session = self;
+    self.isWaitingForOutput = YES;
+    [self.connection performWhenOutputSent:^(BOOL didSend) {
+        session.isWaitingForOutput = NO;
+        if (didSend) {
+            [session sendPendingData];
+            [session flushOutput];
+        }
+    }];
+}
+
+/*! @brief write DATA frames from the streams with queued output, a frame from each in turn, until the flow control windows are used up
+    or the connection has as much output waiting as the client has yet to read */
+- (void) sendPendingData {
+    BOOL didSend = YES;
+    while (didSend && self.sendingStreams.count > 0 && !self.isClosed && !self.isWaitingForOutput) {
+        if (self.connection.pendingOutputLength >= IHTTP2SessionOutputBufferSize) {
+            [self resumeWhenOutputSent];
+            break;
+        }
+
+        didSend = NO;
+        for (IHTTP2Stream* stream in [self.sendingStreams copy]) {
+            if ([self sendDataFrameForStream:stream]) {
+                didSend = YES;
+            }
+            if (stream.isSending && (stream.isReset || stream.didEndOutput)) {
+                stream.isSending = NO;
+                [self.sendingStreams removeObject:stream];
+            }
+        }
+
+        if (self.output.length >= IHTTP2SessionOutputBufferSize) {
+            [self flushOutput];
+        }
+    }
+}
+
+/*! @brief write the next DATA frame of the stream's output, as large as the windows and the client's frame size allow,
+    or the empty frame which ends it, returns YES if a frame was written */
+- (BOOL) sendDataFrameForStream:(IHTTP2Stream*) stream {
+    id next = stream.pendingOutput.firstObject;
+    if (stream.isReset || stream.didEndOutput) {
+        return NO;
+    }
+    else if (!next) {
+        if (stream.isEndQueued) { // an empty frame takes no window
+            [self writeFrameType:IHTTP2FrameData flags:IHTTP2FlagEndStream streamID:stream.streamID payload:NULL length:0];
+            [self endOutputForStream:stream];
+            return YES;
+        }
+        return NO;
+    }
+
+    int64_t window = MIN(MIN(self.sendWindow, stream.sendWindow), (int64_t)self.peerMaxFrameSize);
+    if (window <= 0) {
+        return NO;
+    }
+
+    NSMutableData* output = self.output;
+    NSUInteger frameStart = output.length;
+    NSUInteger length = 0;
+    BOOL isLastPiece = NO;
+    if ([next isKindOfClass:NSData.class]) {
+        NSData* data = next;
+        length = MIN((NSUInteger)window, (data.length - stream.pendingOffset));
+        [output increaseLengthBy:IHTTP2FrameHeaderLength];
+        [output appendBytes:((const uint8_t*)data.bytes + stream.pendingOffset) length:length];
+        stream.pendingOffset += length;
+        isLastPiece = (stream.pendingOffset == data.length);
+    }
+    else { // read straight into the output
+        IHTTP2FileOutput* file = next;
+        size_t wanted = (size_t)MIN((unsigned long long)window, file.remaining);
+        [output increaseLengthBy:(IHTTP2FrameHeaderLength + wanted)];
+        uint8_t* payload = ((uint8_t*)output.mutableBytes + frameStart + IHTTP2FrameHeaderLength);
+        ssize_t count = 0;
+        do {
+            count = pread(file.file.fileDescriptor, payload, wanted, (off_t)file.offset);
+        } while (count < 0 && errno == EINTR);
+
+        if (count <= 0) { // the file was truncated or can't be read, the body can't be finished
+            output.length = frameStart;
+            [self resetStream:stream error:IHTTP2ErrorInternal];
+            return NO;
+        }
+        length = (NSUInteger)count;
+        output.length = (frameStart + IHTTP2FrameHeaderLength + length);
+        file.offset += length;
+        file.remaining -= length;
+        isLastPiece = (file.remaining == 0);
+    }
+
+    if (isLastPiece) {
+        [stream.pendingOutput removeObjectAtIndex:0];
+        stream.pendingOffset = 0;
+    }
+
+    BOOL endStream = (stream.pendingOutput.count == 0 && stream.isEndQueued);
+    IHTTP2WriteFrameHeader(((uint8_t*)output.mutableBytes + frameStart), (uint32_t)length, IHTTP2FrameData,
+        (endStream ? IHTTP2FlagEndStream : 0), stream.streamID);
+    self.sendWindow -= length;
+    stream.sendWindow -= length;
+    if (endStream) {
+        [self endOutputForStream:stream];
+    }
+    return YES;
+}
+
+/*! @brief queue a frame for the next write */
+- (void) writeFrameType:(IHTTP2FrameType) type flags:(uint8_t) flags streamID:(uint32_t) streamID payload:(const void*) payload length:(NSUInteger) length {
+    uint8_t header[IHTTP2FrameHeaderLength];
+    IHTTP2WriteFrameHeader(header, (uint32_t)length, type, flags, streamID);
+    [self.output appendBytes:header length:sizeof(header)];
+    if (length > 0) {
+        [self.output appendBytes:payload length:length];
+    }
+}
+
+- (void) writeResetStreamID:(uint32_t) streamID error:(IHTTP2ErrorCode) errorCode {
+    uint8_t payload[4];
+    IHTTP2WriteUInt32(payload, errorCode);
+    [self writeFrameType:IHTTP2FrameResetStream flags:0 streamID:streamID payload:payload length:sizeof(payload)];
+}
+
+- (void) writeWindowUpdate:(uint32_t) streamID increment:(uint32_t) increment {
+    uint8_t payload[4];
+    IHTTP2WriteUInt32(payload, increment);
+    [self writeFrameType:IHTTP2FrameWindowUpdate flags:0 streamID:streamID payload:payload length:sizeof(payload)];
+}
+
+/*! @brief write the queued frames to the connection, which sends them as the client reads, returns NO and closes the connection
+    if its output has failed */
+- (BOOL) flushOutput {
+    NSMutableData* output = self.output;
+    if (self.isClosed) {
+        return NO;
+    }
+    else if (output.length == 0) {
+        return YES;
+    }
+
+    BOOL didWrite = [self.connection writeBytes:output.bytes length:output.length];
+    output.length = 0;
+    if (!didWrite) {
+        [self finish];
+    }
+    return didWrite;
+}
+
+/*! @brief write the queued frames on the next pass of the loop, so the output of several streams goes out together,
+    the frames queued while reading are written when the read is done */
+- (void) scheduleFlush {
+    if (!self.isFlushScheduled && !self.isReadingFrames && !self.isClosed) {
+        self.isFlushScheduled = YES;
+        IHTTP2Session* session = self;
+        [self.eventLoop performBlock:^{
+            session.isFlushScheduled = NO;
+            [session sendPendingData];
+            [session flushOutput];
+        }];
+    }
+}
+
+// MARK: - IHTTPEventLoopSource
+
+- (void) eventLoopSourceIsReadable:(IHTTPEventLoop*) loop {
+    __attribute__((objc_precise_lifetime)) IHTTP2Session* session = self; // closing the connection releases its last reference
+    ssize_t received = recv(self.fileDescriptor, loop.readBuffer, loop.readBufferSize, MSG_DONTWAIT);
+    if (received > 0) {
+        session.isReadingFrames = YES;
+        [self appendBytes:loop.readBuffer length:(NSUInteger)received];
+        session.isReadingFrames = NO;
+
+        [self sendPendingData];
+        [self flushOutput];
+        [self updateTimeout];
+    }
+    else if (received == 0 || (errno != EAGAIN && errno != EINTR)) { // EoF or the connection was reset
+        [self finish];
+    }
+}
+
+// MARK: - NSObject
+
+- (NSString*)description {
+    return [NSString stringWithFormat:@"<%@:%p fd: %i streams: %lu last: %u>",
+        NSStringFromClass(self.class), self, self.fileDescriptor, (unsigned long)self.streams.count, self.lastStreamID];
+}
+
+@end
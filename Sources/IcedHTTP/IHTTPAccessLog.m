@@ -0,0 +1,416 @@
+#import "IHTTPAccessLog.h"
+
+#import "IHTTPConstants.h"
+#import "IHTTPPrivate.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*! @brief the longest line in bytes, including its newline, longer lines are cut short */
+#define IHTTPAccessLogLineSize 1024
+
+/*! @brief default number of lines in the ring */
+static NSUInteger const IHTTPAccessLogDefaultCapacity = 4096;
+
+/*! @brief the most bytes gathered from the ring for one write */
+static size_t const IHTTPAccessLogBatchSize = (64 * 1024);
+
+/*! @brief milliseconds the log's thread sleeps when the ring is empty, the workers only wake it as the ring fills */
+static int64_t const IHTTPAccessLogPollInterval = 50;
+
+/*! @brief bumped by the SIGHUP handler, each log reopens its file when it sees a new value */
+static atomic_uint IHTTPAccessLogHangups;
+
+/*! @brief a line in the ring, the sequence says whether it's free for a worker or ready for the log's thread */
+typedef struct {
+    atomic_size_t sequence;
+    size_t length;
+    char line[IHTTPAccessLogLineSize];
+} IHTTPAccessLogSlot;
+
+/*! @brief a line being formatted into a slot */
+typedef struct {
+    char* bytes;
+    size_t length;
+    size_t size;
+} IHTTPAccessLogLine;
+
+static void IHTTPAccessLogHangup(int signalNumber) {
+    atomic_fetch_add_explicit(&IHTTPAccessLogHangups, 1, memory_order_relaxed);
+}
+
+static void IHTTPAccessLogAppend(IHTTPAccessLogLine* line, const char* bytes, size_t length) {
+    size_t room = (line->size - line->length);
+    size_t copied = MIN(length, room);
+    memcpy((line->bytes + line->length), bytes, copied);
+    line->length += copied;
+}
+
+static void IHTTPAccessLogAppendString(IHTTPAccessLogLine* line, const char* string) {
+    IHTTPAccessLogAppend(line, string, strlen(string));
+}
+
+static void IHTTPAccessLogAppendFormat(IHTTPAccessLogLine* line, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void IHTTPAccessLogAppendFormat(IHTTPAccessLogLine* line, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf((line->bytes + line->length), (line->size - line->length), format, arguments);
+    va_end(arguments);
+    if (length > 0) {
+        line->length = MIN((line->length + (size_t)length), (line->size - 1)); // the NUL vsnprintf needs room for
+    }
+}
+
+/*! @brief append the bytes for a quoted field, escaping quotes, backslashes and control characters as JSON or Apache's log does,
+    bytes outside ASCII are escaped in JSON, which must be valid UTF-8, so the field says exactly what the client sent */
+static void IHTTPAccessLogAppendEscaped(IHTTPAccessLogLine* line, const uint8_t* bytes, size_t length, BOOL json) {
+    if (!bytes || length == 0) {
+        IHTTPAccessLogAppendString(line, "-");
+        return;
+    }
+
+    for (size_t index = 0; index < length && line->length < line->size; index++) {
+        uint8_t byte = bytes[index];
+        if (byte == '"' || byte == '\\') {
+            char escaped[2] = { '\\', (char)byte };
+            IHTTPAccessLogAppend(line, escaped, 2);
+        }
+        else if (byte < 0x20 || byte == 0x7f || (json && byte >= 0x80)) {
+            IHTTPAccessLogAppendFormat(line, (json ? "\\u%04x" : "\\x%02x"), byte);
+        }
+        else {
+            IHTTPAccessLogAppend(line, (const char*)&byte, 1);
+        }
+    }
+}
+
+static void IHTTPAccessLogAppendEscapedString(IHTTPAccessLogLine* line, NSString* string, BOOL json) {
+    const char* bytes = string.UTF8String;
+    IHTTPAccessLogAppendEscaped(line, (const uint8_t*)bytes, (bytes ? strlen(bytes) : 0), json);
+}
+
+/*! @brief append the time as Common Log Format's [10/Oct/2000:13:55:36 +0000] or JSON's 2000-10-10T13:55:36Z, in UTC without the locale */
+static void IHTTPAccessLogAppendTime(IHTTPAccessLogLine* line, time_t time, BOOL json) {
+    static const char* const months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    struct tm utc;
+    gmtime_r(&time, &utc);
+    if (json) {
+        IHTTPAccessLogAppendFormat(line, "%04d-%02d-%02dT%02d:%02d:%02dZ",
+            (utc.tm_year + 1900), (utc.tm_mon + 1), utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec);
+    }
+    else {
+        IHTTPAccessLogAppendFormat(line, "[%02d/%s/%04d:%02d:%02d:%02d +0000]",
+            utc.tm_mday, months[utc.tm_mon], (utc.tm_year + 1900), utc.tm_hour, utc.tm_min, utc.tm_sec);
+    }
+}
+
+// MARK: -
+
+@interface IHTTPAccessLog ()
+@property(nonatomic, retain) NSString* filePathStorage;
+@property(nonatomic, assign) IHTTPAccessLogFormat formatStorage;
+@property(nonatomic, assign) NSUInteger capacityStorage;
+@property(nonatomic, retain) NSThread* writerThread;
+@property(nonatomic, retain) dispatch_semaphore_t writerWake;
+@property(nonatomic, retain) dispatch_semaphore_t writerStopped;
+@property(nonatomic, assign) int fileDescriptor;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPAccessLog {
+    IHTTPAccessLogSlot* _slots;
+    atomic_size_t _enqueuePosition;     // claimed by the workers
+    size_t _dequeuePosition;            // only touched by the log's thread
+    atomic_ulong _writtenCount;
+    atomic_ulong _droppedCount;
+    atomic_bool _isWriterWaiting;
+    atomic_bool _isReopenRequested;
+    atomic_bool _isClosing;
+    unsigned _hangups;
+}
+
++ (IHTTPAccessLog*) accessLogWithPath:(NSString*) filePath format:(IHTTPAccessLogFormat) format {
+    return [self accessLogWithPath:filePath format:format capacity:IHTTPAccessLogDefaultCapacity];
+}
+
++ (IHTTPAccessLog*) accessLogWithPath:(NSString*) filePath format:(IHTTPAccessLogFormat) format capacity:(NSUInteger) capacity {
+    IHTTPAccessLog* log = IHTTPAccessLog.new;
+    log.filePathStorage = filePath;
+    log.formatStorage = format;
+    log.fileDescriptor = [log openFile];
+    if (log.fileDescriptor < 0) {
+        return nil;
+    }
+
+    NSUInteger slotCount = 4; // a power of two, so positions map to slots with a mask
+    while (slotCount < capacity) {
+        slotCount <<= 1;
+    }
+    log.capacityStorage = slotCount;
+    log->_slots = calloc(slotCount, sizeof(IHTTPAccessLogSlot));
+    for (NSUInteger index = 0; index < slotCount; index++) {
+        atomic_init(&log->_slots[index].sequence, index); // free for the worker which claims position index
+    }
+    log->_hangups = atomic_load(&IHTTPAccessLogHangups);
+
+    [log startWriter];
+    return log;
+}
+
++ (void) reopenLogsOnHangup {
+    struct sigaction hangup;
+    memset(&hangup, 0, sizeof(hangup));
+    hangup.sa_handler = IHTTPAccessLogHangup;
+    hangup.sa_flags = SA_RESTART;
+    sigemptyset(&hangup.sa_mask);
+    sigaction(SIGHUP, &hangup, NULL);
+}
+
+- (void) dealloc {
+    free(_slots);
+}
+
+// MARK: - Properties
+
+- (NSString*) filePath {
+    return self.filePathStorage;
+}
+
+- (IHTTPAccessLogFormat) format {
+    return self.formatStorage;
+}
+
+- (NSUInteger) capacity {
+    return self.capacityStorage;
+}
+
+- (NSUInteger) writtenEntryCount {
+    return (NSUInteger)atomic_load_explicit(&_writtenCount, memory_order_relaxed);
+}
+
+- (NSUInteger) droppedEntryCount {
+    return (NSUInteger)atomic_load_explicit(&_droppedCount, memory_order_relaxed);
+}
+
+// MARK: - Logging
+
+- (void) logRequest:(IHTTPRequest*) request remoteAddress:(NSString*) remoteAddress status:(NSUInteger) status
+    bytesSent:(unsigned long long) bytesSent duration:(NSTimeInterval) duration {
+    if (atomic_load_explicit(&_isClosing, memory_order_relaxed)) {
+        return;
+    }
+
+    // claim a free slot, a worker which finds it still waiting to be written drops the line instead of waiting
+    size_t mask = (self.capacity - 1);
+    size_t position = atomic_load_explicit(&_enqueuePosition, memory_order_relaxed);
+    IHTTPAccessLogSlot* slot = NULL;
+    while (YES) {
+        slot = &_slots[position & mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = ((intptr_t)sequence - (intptr_t)position);
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&_enqueuePosition, &position, (position + 1), memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (difference < 0) {
+            atomic_fetch_add_explicit(&_droppedCount, 1, memory_order_relaxed);
+            return;
+        }
+        else {
+            position = atomic_load_explicit(&_enqueuePosition, memory_order_relaxed);
+        }
+    }
+
+    IHTTPAccessLogLine line = { slot->line, 0, (IHTTPAccessLogLineSize - 1) }; // room for the newline
+    [self formatLine:&line request:request remoteAddress:remoteAddress status:status bytesSent:bytesSent duration:duration];
+    line.bytes[line.length++] = '\n';
+    slot->length = line.length;
+    atomic_store_explicit(&slot->sequence, (position + 1), memory_order_release);
+
+    // the writer polls, but is woken each time a quarter of the ring fills so a burst doesn't overflow it
+    if ((position & ((self.capacity / 4) - 1)) == 0 && atomic_exchange(&_isWriterWaiting, false)) {
+        dispatch_semaphore_signal(self.writerWake);
+    }
+}
+
+- (void) formatLine:(IHTTPAccessLogLine*) line request:(IHTTPRequest*) request remoteAddress:(NSString*) remoteAddress
+    status:(NSUInteger) status bytesSent:(unsigned long long) bytesSent duration:(NSTimeInterval) duration {
+    BOOL json = (self.format == IHTTPAccessLogJSON);
+    NSString* version = request.requestVersion; // nil until the head has been parsed
+    size_t targetLength = 0;
+    const uint8_t* target = (version ? [request requestTargetBytes:&targetLength] : NULL);
+    NSString* method = (version ? request.requestMethod : nil);
+    NSString* referer = (version && self.format != IHTTPAccessLogCommon ? [request headerFieldValue:IHTTPRefererHeader] : nil);
+    NSString* userAgent = (version && self.format != IHTTPAccessLogCommon ? [request headerFieldValue:IHTTPUserAgentHeader] : nil);
+    const char* address = (remoteAddress.UTF8String ?: "-");
+
+    if (json) {
+        IHTTPAccessLogAppendString(line, "{\"time\":\"");
+        IHTTPAccessLogAppendTime(line, time(NULL), YES);
+        IHTTPAccessLogAppendFormat(line, "\",\"remote\":\"%s\",\"method\":\"", address);
+        IHTTPAccessLogAppendEscapedString(line, method, YES);
+        IHTTPAccessLogAppendString(line, "\",\"target\":\"");
+        IHTTPAccessLogAppendEscaped(line, target, targetLength, YES);
+        IHTTPAccessLogAppendString(line, "\",\"version\":\"");
+        IHTTPAccessLogAppendEscapedString(line, version, YES);
+        IHTTPAccessLogAppendFormat(line, "\",\"status\":%lu,\"bytes\":%llu,\"duration\":%.6f,\"referer\":\"",
+            (unsigned long)status, bytesSent, MAX(duration, 0));
+        IHTTPAccessLogAppendEscapedString(line, referer, YES);
+        IHTTPAccessLogAppendString(line, "\",\"user_agent\":\"");
+        IHTTPAccessLogAppendEscapedString(line, userAgent, YES);
+        IHTTPAccessLogAppendString(line, "\"}");
+    }
+    else {
+        IHTTPAccessLogAppendFormat(line, "%s - - ", address);
+        IHTTPAccessLogAppendTime(line, time(NULL), NO);
+        IHTTPAccessLogAppendString(line, " \"");
+        if (method) {
+            IHTTPAccessLogAppendEscapedString(line, method, NO);
+            IHTTPAccessLogAppendString(line, " ");
+            IHTTPAccessLogAppendEscaped(line, target, targetLength, NO);
+            IHTTPAccessLogAppendString(line, " ");
+            IHTTPAccessLogAppendEscapedString(line, version, NO);
+        }
+        else {
+            IHTTPAccessLogAppendString(line, "-");
+        }
+        IHTTPAccessLogAppendFormat(line, "\" %lu %llu", (unsigned long)status, bytesSent);
+        if (self.format == IHTTPAccessLogCombined) {
+            IHTTPAccessLogAppendString(line, " \"");
+            IHTTPAccessLogAppendEscapedString(line, referer, NO);
+            IHTTPAccessLogAppendString(line, "\" \"");
+            IHTTPAccessLogAppendEscapedString(line, userAgent, NO);
+            IHTTPAccessLogAppendString(line, "\"");
+        }
+    }
+}
+
+// MARK: - Writer
+
+/*! @brief open the log file for appending, or duplicate the standard error so closing it leaves the process's alone */
+- (int) openFile {
+    if (!self.filePath) {
+        return fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    }
+    return open(self.filePath.fileSystemRepresentation, (O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC), 0644);
+}
+
+- (void) startWriter {
+    IHTTPAccessLog* log = self; // retained by the thread until closeLog
+    dispatch_semaphore_t stopped = dispatch_semaphore_create(0);
+    self.writerWake = dispatch_semaphore_create(0);
+    self.writerStopped = stopped;
+    self.writerThread = [NSThread.alloc initWithBlock:^{
+        [log runWriter];
+        dispatch_semaphore_signal(stopped);
+    }];
+    self.writerThread.name = NSStringFromClass(self.class);
+    self.writerThread.qualityOfService = NSQualityOfServiceUtility;
+    [self.writerThread start];
+}
+
+/*! @brief move the lines which are ready from the ring into the batch, returns the number moved */
+- (NSUInteger) takeLines:(char*) batch length:(size_t*) batchLength {
+    size_t mask = (self.capacity - 1);
+    NSUInteger taken = 0;
+    while (YES) {
+        IHTTPAccessLogSlot* slot = &_slots[_dequeuePosition & mask];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != (_dequeuePosition + 1)
+         || (*batchLength + slot->length) > IHTTPAccessLogBatchSize) {
+            break;
+        }
+        memcpy((batch + *batchLength), slot->line, slot->length);
+        *batchLength += slot->length;
+        atomic_store_explicit(&slot->sequence, (_dequeuePosition + self.capacity), memory_order_release); // free for the next lap
+        _dequeuePosition += 1;
+        taken += 1;
+    }
+    return taken;
+}
+
+/*! @brief write the whole batch, counting its lines as written or dropped */
+- (void) writeBatch:(const char*) batch length:(size_t) length lines:(NSUInteger) lines {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t count = write(self.fileDescriptor, (batch + written), (length - written));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            atomic_fetch_add_explicit(&_droppedCount, lines, memory_order_relaxed);
+            return;
+        }
+        written += (size_t)count;
+    }
+    atomic_fetch_add_explicit(&_writtenCount, lines, memory_order_relaxed);
+}
+
+/*! @brief drain the ring into the file in batches until the log is closed */
+- (void) runWriter {
+    char* batch = malloc(IHTTPAccessLogBatchSize);
+
+    while (YES) {
+        unsigned hangups = atomic_load_explicit(&IHTTPAccessLogHangups, memory_order_relaxed);
+        if (hangups != _hangups || atomic_exchange(&_isReopenRequested, false)) { // logrotate has moved the file
+            _hangups = hangups;
+            int reopened = [self openFile];
+            if (reopened >= 0) {
+                close(self.fileDescriptor);
+                self.fileDescriptor = reopened;
+            }
+        }
+
+        size_t length = 0;
+        NSUInteger lines = [self takeLines:batch length:&length];
+        if (lines > 0) {
+            [self writeBatch:batch length:length lines:lines];
+            continue;
+        }
+
+        if (atomic_load(&_isClosing)) {
+            break;
+        }
+
+        atomic_store(&_isWriterWaiting, true);
+        lines = [self takeLines:batch length:&length];
+        if (lines > 0) { // a line arrived before the workers could see the writer waiting
+            atomic_store(&_isWriterWaiting, false);
+            [self writeBatch:batch length:length lines:lines];
+            continue;
+        }
+        dispatch_semaphore_wait(self.writerWake, dispatch_time(DISPATCH_TIME_NOW, (IHTTPAccessLogPollInterval * NSEC_PER_MSEC)));
+        atomic_store(&_isWriterWaiting, false);
+    }
+
+    free(batch);
+    close(self.fileDescriptor);
+    self.fileDescriptor = -1;
+}
+
+// MARK: -
+
+- (void) reopenLog {
+    atomic_store(&_isReopenRequested, true);
+    dispatch_semaphore_signal(self.writerWake);
+}
+
+- (void) closeLog {
+    if (!atomic_exchange(&_isClosing, true)) {
+        dispatch_semaphore_signal(self.writerWake);
+        dispatch_semaphore_wait(self.writerStopped, DISPATCH_TIME_FOREVER);
+        self.writerThread = nil;
+    }
+}
+
+@end
@@ -0,0 +1,14 @@
+#import <Foundation/Foundation.h>
+
+/*! @header IHTTPCompression.h
+    @abstract content coding negotiation and gzip compression with zlib, not part of the public API */
+
+/*! @brief the content codings in the supported list which the Accept-Encoding header value accepts, the client's preferred first,
+    ties in the order of the supported list, empty if the header is missing or accepts none of them */
+NSArray<NSString*>* IHTTPAcceptedEncodings(NSString* acceptEncoding, NSArray<NSString*>* supported);
+
+/*! @brief YES if a body with the Content-Type is text which compresses well, rather than media which is already compressed */
+BOOL IHTTPIsCompressibleType(NSString* contentType);
+
+/*! @brief the data compressed in the gzip format at the zlib level, nil if it would not be any smaller */
+NSData* IHTTPGzipData(NSData* data, int level);
@@ -0,0 +1,74 @@
+#import "IHTTPCompression.h"
+
+#import "IHTTPConstants.h"
+
+#include <zlib.h>
+
+/*! @brief the window bits which select the gzip wrapper in deflateInit2 */
+static int const IHTTPGzipWindowBits = (MAX_WBITS + 16);
+
+// MARK: -
+
+NSArray<NSString*>* IHTTPAcceptedEncodings(NSString* acceptEncoding, NSArray<NSString*>* supported) {
+    NSMutableDictionary<NSString*, NSNumber*>* qualities = NSMutableDictionary.new;
+    for (NSString* listed in [acceptEncoding componentsSeparatedByString:@","]) {
+        NSArray<NSString*>* parameters = [listed componentsSeparatedByString:@";"];
+        NSString* coding = [parameters.firstObject stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet].lowercaseString;
+        double quality = 1.0;
+        for (NSString* parameter in [parameters subarrayWithRange:NSMakeRange(1, (parameters.count - 1))]) {
+            NSString* trimmed = [parameter stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+            if ([trimmed.lowercaseString hasPrefix:@"q="]) {
+                quality = [trimmed substringFromIndex:2].doubleValue;
+            }
+        }
+
+        if (coding.length > 0) {
+            qualities[([coding isEqualToString:@"x-gzip"] ? IHTTPGzipEncoding : coding)] = @(quality);
+        }
+    }
+
+    NSMutableArray<NSString*>* accepted = NSMutableArray.new;
+    for (NSString* coding in supported) {
+        if ((qualities[coding] ?: qualities[@"*"]).doubleValue > 0) { // unlisted codings are only acceptable under *
+            [accepted addObject:coding];
+        }
+    }
+
+    [accepted sortWithOptions:NSSortStable usingComparator:^NSComparisonResult(NSString* first, NSString* second) {
+        double firstQuality = (qualities[first] ?: qualities[@"*"]).doubleValue;
+        double secondQuality = (qualities[second] ?: qualities[@"*"]).doubleValue;
+        return (firstQuality > secondQuality ? NSOrderedAscending : firstQuality < secondQuality ? NSOrderedDescending : NSOrderedSame);
+    }];
+
+    return accepted;
+}
+
+BOOL IHTTPIsCompressibleType(NSString* contentType) {
+    NSString* mediaType = [contentType componentsSeparatedByString:@";"].firstObject.lowercaseString;
+    return ([mediaType hasPrefix:@"text/"]
+         || [mediaType hasSuffix:@"+xml"]
+         || [mediaType hasSuffix:@"+json"]
+         || [mediaType isEqualToString:@"application/json"]
+         || [mediaType isEqualToString:@"application/javascript"]
+         || [mediaType isEqualToString:@"application/xml"]
+         || [mediaType isEqualToString:@"application/wasm"]
+         || [mediaType isEqualToString:@"image/x-icon"]);
+}
+
+NSData* IHTTPGzipData(NSData* data, int level) {
+    z_stream deflater = {0};
+    if (data.length > UINT_MAX || deflateInit2(&deflater, level, Z_DEFLATED, IHTTPGzipWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nil;
+    }
+
+    NSMutableData* compressed = [NSMutableData dataWithLength:deflateBound(&deflater, (uLong)data.length)];
+    deflater.next_in = (Bytef*)data.bytes;
+    deflater.avail_in = (uInt)data.length;
+    deflater.next_out = compressed.mutableBytes;
+    deflater.avail_out = (uInt)compressed.length;
+    int status = deflate(&deflater, Z_FINISH); // the bound leaves room for all of it in one call
+    compressed.length = (NSUInteger)deflater.total_out;
+    deflateEnd(&deflater);
+
+    return ((status == Z_STREAM_END && compressed.length < data.length) ? compressed : nil);
+}
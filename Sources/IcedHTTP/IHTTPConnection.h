@@ -0,0 +1,183 @@
+#import <Foundation/Foundation.h>
+
+#import "IHTTPEventLoop.h"
+#import "IHTTPTimerWheel.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*! @brief a send to a connection the client has closed fails with EPIPE instead of raising SIGPIPE,
+    Darwin sets SO_NOSIGPIPE on each accepted socket instead */
+#ifdef MSG_NOSIGNAL
+#define IHTTPSendFlags MSG_NOSIGNAL
+#else
+#define IHTTPSendFlags 0
+#endif
+
+/*! @brief send as much of length bytes of the file from the offset as the socket takes, without copying them through user space,
+    returns the number of bytes sent, which is short with errno EAGAIN when the socket is full or 0 when the file was truncated,
+    or -1 with errno set */
+long long IHTTPSendFile(int socket, int file, off_t offset, unsigned long long length);
+
+@class IHTTP2Session;
+@class IHTTPRequest;
+@class IHTTPWebSocket;
+@class IHTTPWorker;
+
+/*! @enum IHTTPTimeoutKind
+    @brief what a connection's timer is waiting for */
+typedef NS_ENUM(NSUInteger, IHTTPTimeoutKind) {
+    IHTTPTimeoutNone,
+    IHTTPTimeoutHeader,     /* the rest of the request head, after the connection opened or the first bytes of a kept-alive request */
+    IHTTPTimeoutBody,       /* more of the request body while the handler is reading it */
+    IHTTPTimeoutIdle,       /* the first bytes of the next request on a kept-alive connection */
+    IHTTPTimeoutWrite,      /* the client to accept more of the output pending on the connection, run by its outputTimer */
+    IHTTPTimeoutPing,       /* any frame from a WebSocket client, which is pinged when it expires, or the answer to the ping or a close frame */
+    IHTTPTimeoutLinger      /* the client to close its end of a connection the server has finished sending on, while its input is discarded */
+};
+
+/*! @header IHTTPConnection.h
+    @abstract IHTTPConnection tracks an accepted socket for its worker, not part of the public API */
+
+@class IHTTPConnection;
+
+/*! @class IHTTPOutputTimer
+    @brief the second timer of a connection, which limits how long its output waits for the client to read it,
+    while the connection's own timer may be waiting for the next request at the same time */
+@interface IHTTPOutputTimer : NSObject <IHTTPTimer>
+
+/*! @brief the connection whose output is waiting */
+@property(nonatomic, weak) IHTTPConnection* connection;
+
+@end
+
+// MARK: -
+
+/*! @class IHTTPConnection
+    @brief an accepted socket and the request currently being read or handled on it
+    @discussion the request and its response point at their connection, so the worker finds it without searching.
+    The socket never blocks, output is sent as far as the socket takes it and the rest queued on the connection,
+    which waits for the socket to be writable under the write timeout. Only used on the thread of the worker which accepted the socket */
+@interface IHTTPConnection : NSObject <IHTTPTimer, IHTTPEventLoopSource>
+
+/*! @brief the worker which accepted the connection and runs its timers */
+@property(nonatomic, weak) IHTTPWorker* worker;
+
+/*! @brief the file handle of the socket, which closes it when the last request using it is released */
+@property(nonatomic, readonly) NSFileHandle* socket;
+
+/*! @brief the file descriptor of the socket, which keys the connection in its worker's table */
+@property(nonatomic, readonly) int fileDescriptor;
+
+/*! @brief the request being read or handled on the connection, replaced by the next one on a kept-alive connection */
+@property(nonatomic, retain) IHTTPRequest* request;
+
+/*! @brief the WebSocket the connection was upgraded to, which reads the connection from then on, or nil */
+@property(nonatomic, retain) IHTTPWebSocket* webSocket;
+
+/*! @brief the HTTP/2 session the connection switched to, which reads the connection from then on, or nil */
+@property(nonatomic, retain) IHTTP2Session* http2Session;
+
+/*! @brief the address of the client, set when the server has an access log */
+@property(nonatomic, retain) NSString* remoteAddress;
+
+/*! @brief the number of requests read on the connection, including the current one */
+@property(nonatomic, assign) NSUInteger requestCount;
+
+/*! @brief what the connection's timer is running for, IHTTPTimeoutNone when it isn't */
+@property(nonatomic, readonly) IHTTPTimeoutKind timeoutKind;
+
+/*! @brief the timer running while output is pending */
+@property(nonatomic, readonly) IHTTPOutputTimer* outputTimer;
+
+/*! @brief the number of bytes written to the connection which the socket hasn't taken yet */
+@property(nonatomic, readonly) unsigned long long pendingOutputLength;
+
+/*! @brief YES once a write has failed or the write timeout expired, the rest of the output is dropped */
+@property(nonatomic, readonly) BOOL didFailOutput;
+
+/*! @brief the errno of the write which failed, ETIMEDOUT for the write timeout or 0 if a file was shorter than its length */
+@property(nonatomic, readonly) int outputError;
+
+/*! @brief YES once the socket is closing, it closes when the pending output has been sent */
+@property(nonatomic, readonly) BOOL isClosing;
+
+/*! @brief YES once the socket has been closed */
+@property(nonatomic, readonly) BOOL isClosed;
+
+/*! @brief YES to shut down the sending side of the socket once the output has been sent, then read and discard the client's input
+    until it closes or the linger timeout expires before closing it, so a client still sending a request body reads the response
+    rather than a reset, set before closeSocket */
+@property(nonatomic, assign) BOOL lingersOnClose;
+
+// MARK: -
+
+/*! @brief a connection for the socket, with no request yet */
++ (IHTTPConnection*) connectionWithSocket:(NSFileHandle*) socket;
+
+// MARK: -
+
+/*! @brief start or restart the timer for the worker's timeout of the kind, replacing any other, on the worker's thread */
+- (void) startTimeout:(IHTTPTimeoutKind) kind;
+
+/*! @brief stop the timer, on the worker's thread */
+- (void) cancelTimeout;
+
+// MARK: - Output
+
+/*! @brief send the bytes, queueing what the socket doesn't take behind the output already pending,
+    returns NO if the output has failed, on the worker's thread */
+- (BOOL) writeBytes:(const void*) bytes length:(NSUInteger) length;
+
+/*! @brief send the vectors in one call, queueing what the socket doesn't take, returns NO if the output has failed, on the worker's thread */
+- (BOOL) writeVectors:(struct iovec*) vectors count:(int) count;
+
+/*! @brief send length bytes of the file from the offset, queueing the part of the file the socket doesn't take without reading it,
+    returns NO if the output has failed, on the worker's thread */
+- (BOOL) writeFile:(NSFileHandle*) file offset:(unsigned long long) offset length:(unsigned long long) length;
+
+/*! @brief run the block once the output written so far has been sent, right away if there's none pending,
+    didSend is NO if the output failed first, on the worker's thread */
+- (void) performWhenOutputSent:(void (^)(BOOL didSend)) block;
+
+/*! @brief close the socket once the pending output has been sent or has failed, the worker drops the connection when it closes,
+    the connection's readers must have stopped, on the worker's thread */
+- (void) closeSocket;
+
+/*! @brief try to send the pending output once more, then drop what's left and close the socket, when the worker stops */
+- (void) abortSocket;
+
+/*! @brief the write timeout expired with output still pending, fail it */
+- (void) outputTimerDidExpire;
+
+/*! @brief the client didn't close its end within the linger timeout, close the socket */
+- (void) lingerTimerDidExpire;
+
+@end
+
+// MARK: -
+
+/*! @class IHTTPConnectionTable
+    @brief a worker's open connections, indexed by their file descriptors
+    @discussion the kernel hands out the lowest free descriptor, so the table stays about as long as the most connections open at once */
+@interface IHTTPConnectionTable : NSObject
+
+/*! @brief the number of connections in the table */
+@property(nonatomic, readonly) NSUInteger count;
+
+/*! @brief the connections in the table, in order of their file descriptors */
+@property(nonatomic, readonly) NSArray<IHTTPConnection*>* allConnections;
+
+// MARK: -
+
+/*! @brief the connection for the file descriptor, or nil */
+- (IHTTPConnection*) connectionForFileDescriptor:(int) fileDescriptor;
+
+/*! @brief add the connection at its file descriptor */
+- (void) addConnection:(IHTTPConnection*) connection;
+
+/*! @brief remove the connection, if it's still the one at its file descriptor */
+- (void) removeConnection:(IHTTPConnection*) connection;
+
+@end
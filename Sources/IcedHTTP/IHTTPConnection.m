@@ -0,0 +1,638 @@
+#import "IHTTPConnection.h"
+
+#import "IHTTPWorker.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if __linux__
+#include <sys/sendfile.h>
+#endif
+
+/*! @brief largest slice of a file sent with one sendfile or send call */
+static size_t const IHTTPConnectionFileSliceSize = (8 * 1024 * 1024);
+
+/*! @brief most queued buffers gathered into one sendmsg */
+static int const IHTTPConnectionOutputVectors = 16;
+
+/*! @brief send as much of length bytes of the file from the offset as the socket takes, from a memory map of each slice,
+    returns the number of bytes sent, short with errno EAGAIN when the socket is full, or -1 with errno set */
+static long long IHTTPSendMappedFile(int socket, int file, off_t offset, unsigned long long length) {
+    off_t pageSize = (off_t)sysconf(_SC_PAGESIZE);
+    unsigned long long sent = 0;
+
+    while (sent < length) {
+        off_t position = (offset + (off_t)sent);
+        size_t lead = (size_t)(position % pageSize); // mmap offsets must be page aligned
+        size_t slice = (size_t)MIN((length - sent), IHTTPConnectionFileSliceSize);
+        uint8_t* map = mmap(NULL, (lead + slice), PROT_READ, MAP_SHARED, file, (position - (off_t)lead));
+        if (map == MAP_FAILED) {
+            return -1;
+        }
+        madvise(map, (lead + slice), MADV_SEQUENTIAL);
+
+        size_t written = 0;
+        int sendError = 0;
+        while (written < slice) {
+            ssize_t count = send(socket, (map + lead + written), (slice - written), IHTTPSendFlags);
+            if (count < 0 && errno != EINTR) {
+                sendError = errno;
+                break;
+            }
+            written += (size_t)MAX(count, 0);
+        }
+
+        munmap(map, (lead + slice));
+        sent += written;
+        if (sendError != 0) {
+            errno = sendError;
+            return ((sendError == EAGAIN || sendError == EWOULDBLOCK) ? (long long)sent : -1);
+        }
+    }
+
+    return (long long)sent;
+}
+
+long long IHTTPSendFile(int socket, int file, off_t offset, unsigned long long length) {
+    unsigned long long sent = 0;
+
+    while (sent < length) {
+#if __linux__
+        off_t position = (offset + (off_t)sent);
+        ssize_t count = sendfile(socket, file, &position, (size_t)MIN((length - sent), IHTTPConnectionFileSliceSize));
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            else if (sent == 0 && (errno == EINVAL || errno == ENOSYS)) { // the file system can't sendfile
+                return IHTTPSendMappedFile(socket, file, offset, length);
+            }
+            return ((errno == EAGAIN || errno == EWOULDBLOCK) ? (long long)sent : -1);
+        }
+#elif __APPLE__
+        off_t count = (off_t)MIN((length - sent), IHTTPConnectionFileSliceSize);
+        if (sendfile(file, socket, (offset + (off_t)sent), &count, NULL, 0) != 0) {
+            if (errno == EINTR || errno == EAGAIN) { // count has the bytes sent before the interruption or the socket filled
+                int sendError = errno;
+                sent += (unsigned long long)count;
+                if (sendError == EAGAIN) {
+                    errno = sendError;
+                    return (long long)sent;
+                }
+                continue;
+            }
+            else if (sent == 0 && (errno == ENOTSUP || errno == EOPNOTSUPP)) {
+                return IHTTPSendMappedFile(socket, file, offset, length);
+            }
+            return -1;
+        }
+#elif defined(__FreeBSD__)
+        off_t count = 0;
+        if (sendfile(file, socket, (offset + (off_t)sent), (size_t)MIN((length - sent), IHTTPConnectionFileSliceSize), NULL, &count, 0) != 0) {
+            if (errno == EINTR || errno == EBUSY || errno == EAGAIN) {
+                int sendError = errno;
+                sent += (unsigned long long)count;
+                if (sendError == EAGAIN) {
+                    errno = sendError;
+                    return (long long)sent;
+                }
+                continue;
+            }
+            else if (sent == 0 && errno == EOPNOTSUPP) {
+                return IHTTPSendMappedFile(socket, file, offset, length);
+            }
+            return -1;
+        }
+#else
+        return IHTTPSendMappedFile(socket, file, offset, length);
+#endif
+        if (count == 0) { // the file is shorter than expected
+            errno = 0;
+            break;
+        }
+        sent += (unsigned long long)count;
+    }
+
+    return (long long)sent;
+}
+
+/*! @brief send as much of the vectors as the socket takes in one call, returns the number of bytes sent or -1 with errno set,
+    sendmsg rather than writev so a closed connection can't raise SIGPIPE */
+static ssize_t IHTTPSendVectors(int socket, struct iovec* vectors, int count) {
+    struct msghdr message = { .msg_iov = vectors, .msg_iovlen = count };
+    ssize_t written = 0;
+    do {
+        written = sendmsg(socket, &message, (MSG_DONTWAIT | IHTTPSendFlags));
+    } while (written < 0 && errno == EINTR);
+    return written;
+}
+
+// MARK: -
+
+/*! @class IHTTPConnectionFileOutput
+    @brief part of a file queued on a connection, sent as the socket takes it */
+@interface IHTTPConnectionFileOutput : NSObject
+@property(nonatomic, retain) NSFileHandle* file;
+@property(nonatomic, assign) unsigned long long offset;
+@property(nonatomic, assign) unsigned long long remaining;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPConnectionFileOutput
+
+@end
+
+// MARK: -
+
+@implementation IHTTPOutputTimer
+@synthesize timerDeadline;
+@synthesize timerSlot;
+
+@end
+
+// MARK: -
+
+@interface IHTTPConnection ()
+@property(nonatomic, retain) NSFileHandle* socketStorage;
+@property(nonatomic, assign) int fileDescriptorStorage;
+@property(nonatomic, assign) IHTTPTimeoutKind timeoutKindStorage;
+@property(nonatomic, retain) IHTTPOutputTimer* outputTimerStorage;
+@property(nonatomic, retain) NSMutableArray* pendingOutput; // NSData, IHTTPConnectionFileOutput and the blocks waiting for what's ahead of them
+@property(nonatomic, assign) NSUInteger pendingOffset;      // into the first NSData
+@property(nonatomic, assign) unsigned long long pendingOutputLengthStorage;
+@property(nonatomic, assign) int outputErrorStorage;
+@property(nonatomic, assign) BOOL didFailOutputStorage;
+@property(nonatomic, assign) BOOL isWaitingToWrite;
+@property(nonatomic, assign) BOOL isSendingOutput;
+@property(nonatomic, assign) BOOL isClosingStorage;
+@property(nonatomic, assign) BOOL isLingering;
+@property(nonatomic, assign) BOOL isClosedStorage;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPConnection
+@synthesize timerDeadline;
+@synthesize timerSlot;
+
++ (IHTTPConnection*) connectionWithSocket:(NSFileHandle*) socket {
+    IHTTPConnection* connection = IHTTPConnection.new;
+    connection.socketStorage = socket;
+    connection.fileDescriptorStorage = socket.fileDescriptor; // still the key after the socket is closed
+    connection.outputTimerStorage = IHTTPOutputTimer.new;
+    connection.outputTimerStorage.connection = connection;
+    connection.pendingOutput = NSMutableArray.new;
+    return connection;
+}
+
+// MARK: - Properties
+
+- (NSFileHandle*) socket {
+    return self.socketStorage;
+}
+
+- (int) fileDescriptor {
+    return self.fileDescriptorStorage;
+}
+
+- (IHTTPTimeoutKind) timeoutKind {
+    return self.timeoutKindStorage;
+}
+
+- (IHTTPOutputTimer*) outputTimer {
+    return self.outputTimerStorage;
+}
+
+- (unsigned long long) pendingOutputLength {
+    return self.pendingOutputLengthStorage;
+}
+
+- (BOOL) didFailOutput {
+    return self.didFailOutputStorage;
+}
+
+- (int) outputError {
+    return self.outputErrorStorage;
+}
+
+- (BOOL) isClosing {
+    return self.isClosingStorage;
+}
+
+- (BOOL) isClosed {
+    return self.isClosedStorage;
+}
+
+// MARK: - Timeouts
+
+- (void) startTimeout:(IHTTPTimeoutKind) kind {
+    self.timeoutKindStorage = kind;
+    [self.worker startTimeoutForConnection:self];
+}
+
+- (void) cancelTimeout {
+    if (self.timeoutKindStorage != IHTTPTimeoutNone) {
+        self.timeoutKindStorage = IHTTPTimeoutNone;
+        [self.worker startTimeoutForConnection:self];
+    }
+}
+
+// MARK: - Output
+
+- (BOOL) writeBytes:(const void*) bytes length:(NSUInteger) length {
+    struct iovec vector = { (void*)bytes, length };
+    return [self writeVectors:&vector count:1];
+}
+
+- (BOOL) writeVectors:(struct iovec*) vectors count:(int) count {
+    if (self.didFailOutput || self.isClosed) {
+        return NO;
+    }
+
+    size_t written = 0;
+    if (self.pendingOutput.count == 0) { // straight to the socket, only what it doesn't take is copied
+        ssize_t sent = IHTTPSendVectors(self.fileDescriptor, vectors, count);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            [self failOutputWithError:errno];
+            return NO;
+        }
+        written = (size_t)MAX(sent, 0);
+    }
+
+    NSMutableData* rest = nil;
+    for (int index = 0; index < count; index++) {
+        size_t skip = MIN(written, vectors[index].iov_len);
+        written -= skip;
+        if (skip < vectors[index].iov_len) {
+            if (!rest) {
+                rest = NSMutableData.new;
+            }
+            [rest appendBytes:((const uint8_t*)vectors[index].iov_base + skip) length:(vectors[index].iov_len - skip)];
+        }
+    }
+
+    if (rest) {
+        [self.pendingOutput addObject:rest];
+        self.pendingOutputLengthStorage += rest.length;
+        [self waitToWrite:NO];
+    }
+    return YES;
+}
+
+- (BOOL) writeFile:(NSFileHandle*) file offset:(unsigned long long) offset length:(unsigned long long) length {
+    if (self.didFailOutput || self.isClosed) {
+        return NO;
+    }
+
+    unsigned long long sent = 0;
+    if (self.pendingOutput.count == 0) {
+        long long count = IHTTPSendFile(self.fileDescriptor, file.fileDescriptor, (off_t)offset, length);
+        if (count < 0 || ((unsigned long long)count < length && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            // the client closed the connection, or the file was truncated and the body is short of its Content-Length
+            [self failOutputWithError:(count < 0 ? errno : 0)];
+            return NO;
+        }
+        sent = (unsigned long long)count;
+    }
+
+    if (sent < length) {
+        IHTTPConnectionFileOutput* output = IHTTPConnectionFileOutput.new;
+        output.file = file;
+        output.offset = (offset + sent);
+        output.remaining = (length - sent);
+        [self.pendingOutput addObject:output];
+        self.pendingOutputLengthStorage += output.remaining;
+        [self waitToWrite:NO];
+    }
+    return YES;
+}
+
+- (void) performWhenOutputSent:(void (^)(BOOL didSend)) block {
+    if (self.pendingOutput.count == 0) {
+        block(!self.didFailOutput);
+    }
+    else {
+        [self.pendingOutput addObject:[block copy]];
+    }
+}
+
+/*! @brief send as much of the pending output as the socket takes, running the blocks it reaches, then wait for the rest */
+- (void) sendPendingOutput {
+    if (self.isSendingOutput) { // a block wrote more, which this pass sends
+        return;
+    }
+
+    __attribute__((objc_precise_lifetime)) IHTTPConnection* connection = self; // a block may close the connection and release it
+    BOOL didProgress = NO;
+    self.isSendingOutput = YES;
+    while (self.pendingOutput.count > 0 && !self.didFailOutput) {
+        id next = self.pendingOutput.firstObject;
+        if ([next isKindOfClass:NSData.class]) { // gather the buffers queued together into one call
+            struct iovec vectors[IHTTPConnectionOutputVectors];
+            int count = 0;
+            size_t total = 0;
+            for (id item in self.pendingOutput) {
+                if (count == IHTTPConnectionOutputVectors || ![item isKindOfClass:NSData.class]) {
+                    break;
+                }
+                NSData* data = item;
+                size_t skip = (count == 0 ? self.pendingOffset : 0);
+                vectors[count] = (struct iovec){ ((uint8_t*)data.bytes + skip), (data.length - skip) };
+                total += vectors[count].iov_len;
+                count++;
+            }
+
+            ssize_t sent = IHTTPSendVectors(self.fileDescriptor, vectors, count);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    [self failOutputWithError:errno];
+                }
+                break;
+            }
+
+            didProgress = (didProgress || sent > 0);
+            self.pendingOutputLengthStorage -= (unsigned long long)sent;
+            size_t written = (size_t)sent;
+            while (written > 0) {
+                NSData* data = self.pendingOutput.firstObject;
+                size_t left = (data.length - self.pendingOffset);
+                if (written < left) {
+                    self.pendingOffset += written;
+                    break;
+                }
+                written -= left;
+                self.pendingOffset = 0;
+                [self.pendingOutput removeObjectAtIndex:0];
+            }
+
+            if ((size_t)sent < total) { // the socket is full
+                break;
+            }
+        }
+        else if ([next isKindOfClass:IHTTPConnectionFileOutput.class]) {
+            IHTTPConnectionFileOutput* file = next;
+            long long sent = IHTTPSendFile(self.fileDescriptor, file.file.fileDescriptor, (off_t)file.offset, file.remaining);
+            if (sent < 0) {
+                [self failOutputWithError:errno];
+                break;
+            }
+
+            BOOL isFull = (errno == EAGAIN || errno == EWOULDBLOCK);
+            didProgress = (didProgress || sent > 0);
+            file.offset += (unsigned long long)sent;
+            file.remaining -= (unsigned long long)sent;
+            self.pendingOutputLengthStorage -= (unsigned long long)sent;
+            if (file.remaining == 0) {
+                [self.pendingOutput removeObjectAtIndex:0];
+            }
+            else if (isFull) {
+                break;
+            }
+            else { // the file was truncated
+                [self failOutputWithError:0];
+                break;
+            }
+        }
+        else { // everything written before the block has been sent
+            void (^block)(BOOL didSend) = next;
+            [self.pendingOutput removeObjectAtIndex:0];
+            block(YES);
+        }
+    }
+    self.isSendingOutput = NO;
+
+    if (!self.didFailOutput) {
+        [self waitToWrite:didProgress];
+    }
+}
+
+/*! @brief watch for the socket to be writable while output is pending, under the write timeout, which is pushed back whenever some is sent,
+    and close the socket once it's sent if it's closing */
+- (void) waitToWrite:(BOOL) didProgress {
+    IHTTPWorker* worker = self.worker;
+    if (self.isSendingOutput) { // the pass sending the output decides once it's done
+        return;
+    }
+    else if (self.pendingOutput.count > 0) {
+        if (!self.isWaitingToWrite) {
+            self.isWaitingToWrite = [worker.eventLoop addWriteSource:self forFileDescriptor:self.fileDescriptor];
+        }
+        if (didProgress || self.outputTimer.timerDeadline == 0) {
+            [worker startTimeoutForOutput:self];
+        }
+    }
+    else {
+        [self stopWaitingToWrite];
+        if (self.isClosing) {
+            [self outputDidDrain];
+        }
+    }
+}
+
+/*! @brief stop watching for the socket to be writable, and the write timeout */
+- (void) stopWaitingToWrite {
+    IHTTPWorker* worker = self.worker;
+    if (self.isWaitingToWrite) {
+        [worker.eventLoop removeWriteSource:self forFileDescriptor:self.fileDescriptor];
+        self.isWaitingToWrite = NO;
+    }
+    if (self.outputTimer.timerDeadline != 0) {
+        [worker startTimeoutForOutput:self]; // cancels it, with no output pending
+    }
+}
+
+/*! @brief drop the pending output, telling the blocks waiting for it, and shut the socket down so its readers see it end */
+- (void) failOutputWithError:(int) outputError {
+    if (self.didFailOutput) {
+        return;
+    }
+
+    __attribute__((objc_precise_lifetime)) IHTTPConnection* connection = self; // a block may close the connection and release it
+    NSArray* pending = self.pendingOutput;
+    self.didFailOutputStorage = YES;
+    self.outputErrorStorage = outputError;
+    self.pendingOutput = NSMutableArray.new;
+    self.pendingOffset = 0;
+    self.pendingOutputLengthStorage = 0;
+    [self stopWaitingToWrite];
+    if (!self.isClosed) {
+        shutdown(self.fileDescriptor, SHUT_RDWR);
+    }
+
+    for (id item in pending) {
+        if (![item isKindOfClass:NSData.class] && ![item isKindOfClass:IHTTPConnectionFileOutput.class]) {
+            void (^block)(BOOL didSend) = item;
+            block(NO);
+        }
+    }
+
+    if (self.isClosing) {
+        [self finishClosing];
+    }
+}
+
+- (void) outputTimerDidExpire {
+    [self failOutputWithError:ETIMEDOUT];
+}
+
+// MARK: - Closing
+
+- (void) closeSocket {
+    if (self.isClosing || self.isClosed) {
+        return;
+    }
+
+    self.isClosingStorage = YES;
+    [self cancelTimeout];
+    if (self.didFailOutput) {
+        [self finishClosing];
+    }
+    else if (self.pendingOutput.count == 0) {
+        [self outputDidDrain];
+    }
+}
+
+- (void) abortSocket {
+    self.lingersOnClose = NO;
+    if (self.pendingOutput.count > 0) {
+        [self sendPendingOutput];
+    }
+    if (self.pendingOutput.count > 0) {
+        [self failOutputWithError:ECONNABORTED];
+    }
+
+    if (self.isClosing) { // including while it lingers
+        [self finishClosing];
+    }
+    else {
+        [self closeSocket];
+    }
+}
+
+- (void) lingerTimerDidExpire {
+    [self finishClosing];
+}
+
+/*! @brief the output of the closing connection has all been sent, linger if it's asked to, otherwise close the socket */
+- (void) outputDidDrain {
+    if (!self.lingersOnClose) {
+        [self finishClosing];
+    }
+    else if (!self.isLingering) { // the client's input is read from now on, its request has stopped reading it
+        if (shutdown(self.fileDescriptor, SHUT_WR) != 0
+         || ![self.worker.eventLoop addSource:self forFileDescriptor:self.fileDescriptor]) {
+            [self finishClosing];
+            return;
+        }
+        self.isLingering = YES;
+        [self startTimeout:IHTTPTimeoutLinger];
+    }
+}
+
+/*! @brief close the socket and tell the worker, once */
+- (void) finishClosing {
+    if (self.isClosed) {
+        return;
+    }
+
+    __attribute__((objc_precise_lifetime)) IHTTPConnection* connection = self; // the worker releases it
+    self.isClosedStorage = YES;
+    if (self.isLingering) {
+        [self.worker.eventLoop removeSource:self forFileDescriptor:self.fileDescriptor];
+        self.isLingering = NO;
+    }
+    [self stopWaitingToWrite];
+    [self cancelTimeout];
+    [self.socket closeFile];
+    [self.worker removeConnection:self];
+}
+
+// MARK: - IHTTPEventLoopSource
+
+- (void) eventLoopSourceIsReadable:(IHTTPEventLoop*) loop { // only while lingering, otherwise the request, WebSocket or session reads
+    ssize_t received = recv(self.fileDescriptor, loop.readBuffer, loop.readBufferSize, MSG_DONTWAIT);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) { // the client closed its end
+        [self finishClosing];
+    }
+}
+
+- (void) eventLoopSourceIsWritable:(IHTTPEventLoop*) loop {
+    [self sendPendingOutput];
+}
+
+// MARK: - NSObject
+
+- (NSString*)description {
+    return [NSString stringWithFormat:@"<%@:%p fd: %i requests: %lu pending: %llu>",
+        NSStringFromClass(self.class), self, self.fileDescriptor, (unsigned long)self.requestCount, self.pendingOutputLength];
+}
+
+@end
+
+// MARK: -
+
+@interface IHTTPConnectionTable ()
+@property(nonatomic, retain) NSPointerArray* connections;
+@property(nonatomic, assign) NSUInteger countStorage;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPConnectionTable
+
+- (id)init {
+    if ((self = super.init)) {
+        self.connections = NSPointerArray.strongObjectsPointerArray;
+    }
+    return self;
+}
+
+// MARK: - Properties
+
+- (NSUInteger) count {
+    return self.countStorage;
+}
+
+- (NSArray<IHTTPConnection*>*) allConnections {
+    NSMutableArray<IHTTPConnection*>* all = [NSMutableArray arrayWithCapacity:self.count];
+    for (IHTTPConnection* connection in self.connections) { // skips the empty slots
+        if (connection) {
+            [all addObject:connection];
+        }
+    }
+    return all;
+}
+
+// MARK: -
+
+- (IHTTPConnection*) connectionForFileDescriptor:(int) fileDescriptor {
+    if (fileDescriptor < 0 || (NSUInteger)fileDescriptor >= self.connections.count) {
+        return nil;
+    }
+    return (__bridge IHTTPConnection*)[self.connections pointerAtIndex:(NSUInteger)fileDescriptor];
+}
+
+- (void) addConnection:(IHTTPConnection*) connection {
+    NSUInteger index = (NSUInteger)connection.fileDescriptor;
+    if (index >= self.connections.count) { // new slots are NULL
+        self.connections.count = (index + 1);
+    }
+
+    if ([self.connections pointerAtIndex:index] == NULL) {
+        self.countStorage += 1;
+    }
+    [self.connections replacePointerAtIndex:index withPointer:(__bridge void*)connection];
+}
+
+- (void) removeConnection:(IHTTPConnection*) connection {
+    if (connection && [self connectionForFileDescriptor:connection.fileDescriptor] == connection) {
+        [self.connections replacePointerAtIndex:(NSUInteger)connection.fileDescriptor withPointer:NULL];
+        self.countStorage -= 1;
+    }
+}
+
+@end
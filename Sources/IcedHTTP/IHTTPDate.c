@@ -0,0 +1,82 @@
+#include "IHTTPDate.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char* const IHTTPDayNames[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char* const IHTTPMonthNames[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+size_t IHTTPFormatDate(time_t time, char* buffer, size_t bufferSize) {
+    struct tm date;
+    if (bufferSize <= IHTTPDateLength || !gmtime_r(&time, &date)) {
+        return 0;
+    }
+
+    int length = snprintf(buffer, bufferSize, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+        IHTTPDayNames[date.tm_wday], date.tm_mday, IHTTPMonthNames[date.tm_mon], (date.tm_year + 1900),
+        date.tm_hour, date.tm_min, date.tm_sec);
+
+    return (length == IHTTPDateLength ? (size_t)length : 0);
+}
+
+const char* IHTTPCurrentDate(void) {
+    static _Thread_local time_t formattedTime = -1; // per thread, so the string never changes under another thread's write
+    static _Thread_local char formatted[IHTTPDateLength + 1];
+    time_t now = time(NULL);
+
+    if (now != formattedTime && IHTTPFormatDate(now, formatted, sizeof(formatted)) == IHTTPDateLength) {
+        formattedTime = now;
+    }
+    return formatted;
+}
+
+static int IHTTPMonthIndex(const char* month) {
+    for (int index = 0; index < 12; index++) {
+        if (strncmp(month, IHTTPMonthNames[index], 3) == 0) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+time_t IHTTPParseDate(const char* string) {
+    struct tm date;
+    char month[4] = {0};
+    int day = 0, year = 0, hour = 0, minute = 0, second = 0;
+
+    if (!string) {
+        return -1;
+    }
+
+    const char* comma = strchr(string, ',');
+    if (comma && (comma - string) == 3) { // IMF-fixdate: Sun, 06 Nov 1994 08:49:37 GMT
+        if (sscanf(comma + 1, " %2d %3s %4d %2d:%2d:%2d GMT", &day, month, &year, &hour, &minute, &second) != 6) {
+            return -1;
+        }
+    }
+    else if (comma) { // RFC 850: Sunday, 06-Nov-94 08:49:37 GMT
+        if (sscanf(comma + 1, " %2d-%3s-%2d %2d:%2d:%2d GMT", &day, month, &year, &hour, &minute, &second) != 6) {
+            return -1;
+        }
+        year += (year < 70 ? 2000 : 1900);
+    }
+    else { // asctime: Sun Nov  6 08:49:37 1994
+        if (sscanf(string, "%*3s %3s %2d %2d:%2d:%2d %4d", month, &day, &hour, &minute, &second, &year) != 6) {
+            return -1;
+        }
+    }
+
+    memset(&date, 0, sizeof(date));
+    date.tm_mon = IHTTPMonthIndex(month);
+    date.tm_mday = day;
+    date.tm_year = (year - 1900);
+    date.tm_hour = hour;
+    date.tm_min = minute;
+    date.tm_sec = second;
+
+    if (date.tm_mon < 0 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return -1;
+    }
+
+    return timegm(&date);
+}
@@ -0,0 +1,24 @@
+#ifndef IHTTPDate_h
+#define IHTTPDate_h
+
+#include <stddef.h>
+#include <time.h>
+
+/*! @header IHTTPDate.h
+    @abstract HTTP-date formatting and parsing which doesn't depend on the locale, not part of the public API */
+
+/*! @brief length of an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT", without the terminating NUL */
+#define IHTTPDateLength 29
+
+/*! @brief write the IMF-fixdate for the time into the buffer, which must have room for IHTTPDateLength + 1 bytes,
+    returns the length written or 0 if the buffer is too short */
+size_t IHTTPFormatDate(time_t time, char* buffer, size_t bufferSize);
+
+/*! @brief parse an IMF-fixdate, or the obsolete RFC 850 and asctime formats, returns -1 if the string isn't an HTTP-date */
+time_t IHTTPParseDate(const char* string);
+
+/*! @brief the current time as an IMF-fixdate for the Date header, formatted at most once a second on each thread
+    and shared by every response the thread sends, the string is the calling thread's and changes on its next call */
+const char* IHTTPCurrentDate(void);
+
+#endif /* IHTTPDate_h */
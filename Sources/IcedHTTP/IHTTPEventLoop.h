@@ -0,0 +1,78 @@
+#import <Foundation/Foundation.h>
+
+@class IHTTPEventLoop;
+
+/*! @header IHTTPEventLoop.h
+    @abstract IHTTPEventLoop waits for socket events with epoll on Linux or kqueue on BSD and macOS */
+
+/*! @brief monotonic time in seconds, read from the clock on every call */
+extern NSTimeInterval IHTTPMonotonicTime(void);
+
+/*! @protocol IHTTPEventLoopSource
+    @brief objects which own a file descriptor registered with an IHTTPEventLoop */
+@protocol IHTTPEventLoopSource <NSObject>
+
+/*! @brief called on the loop thread when the source's file descriptor can be read without blocking, or has reached EoF */
+- (void) eventLoopSourceIsReadable:(IHTTPEventLoop*) loop;
+
+@optional
+
+/*! @brief called on the loop thread when the source's file descriptor has room to write without blocking, or has failed */
+- (void) eventLoopSourceIsWritable:(IHTTPEventLoop*) loop;
+
+@end
+
+// MARK: -
+
+/*! @class IHTTPEventLoop
+    @brief dispatches readiness events from the kernel straight to the sources registered for them
+    @discussion sources are not retained, and must be removed from the loop before they are released.
+    A file descriptor has at most one source for reading and one for writing, which may be the same object.
+    All methods other than performBlock: and stop must be called on the loop thread once run has been called */
+@interface IHTTPEventLoop : NSObject
+
+/*! @brief a buffer shared by every source on the loop for reading, its contents are only valid until the source returns */
+@property(nonatomic, readonly) void* readBuffer;
+
+/*! @brief the size of the readBuffer in bytes */
+@property(nonatomic, readonly) size_t readBufferSize;
+
+/*! @brief monotonic time in seconds, updated each time the loop wakes up */
+@property(nonatomic, readonly) NSTimeInterval currentTime;
+
+/*! @brief YES when called on the thread which is running the loop */
+@property(nonatomic, readonly) BOOL isLoopThread;
+
+/*! @brief called on the loop thread about once a second while the loop is running */
+@property(nonatomic, copy) dispatch_block_t tickBlock;
+
+// MARK: -
+
+/*! @brief a new event loop, or nil if the kernel event queue could not be created */
++ (IHTTPEventLoop*) eventLoop;
+
+// MARK: -
+
+/*! @brief start delivering read events for the file descriptor to the source, replacing any other source reading it */
+- (BOOL) addSource:(id<IHTTPEventLoopSource>) source forFileDescriptor:(int) fileDescriptor;
+
+/*! @brief stop delivering read events for the file descriptor, including any already collected for the source but not yet delivered */
+- (void) removeSource:(id<IHTTPEventLoopSource>) source forFileDescriptor:(int) fileDescriptor;
+
+/*! @brief start delivering write events for the file descriptor to the source, which implements eventLoopSourceIsWritable:,
+    until it's removed, so only add it while there's output waiting for room in the socket */
+- (BOOL) addWriteSource:(id<IHTTPEventLoopSource>) source forFileDescriptor:(int) fileDescriptor;
+
+/*! @brief stop delivering write events for the file descriptor, including any already collected but not yet delivered */
+- (void) removeWriteSource:(id<IHTTPEventLoopSource>) source forFileDescriptor:(int) fileDescriptor;
+
+/*! @brief run the block on the loop thread the next time it wakes up, may be called from any thread */
+- (void) performBlock:(dispatch_block_t) block;
+
+/*! @brief run the loop on the current thread until stop is called */
+- (void) run;
+
+/*! @brief ask the loop to return from run, may be called from any thread */
+- (void) stop;
+
+@end
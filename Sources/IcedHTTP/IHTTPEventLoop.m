@@ -0,0 +1,384 @@
+#import "IHTTPEventLoop.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+typedef struct epoll_event IHTTPEvent;
+#else
+#include <sys/event.h>
+typedef struct kevent IHTTPEvent;
+#endif
+
+/*! @brief number of events collected from the kernel on each pass of the loop */
+#define IHTTPEventLoopBatchSize 256
+
+/*! @brief size of the read buffer shared by the sources on a loop */
+#define IHTTPEventLoopReadBufferSize (64 * 1024)
+
+#if __linux__
+/*! @brief the sources reading and writing a file descriptor, which epoll watches with one registration */
+typedef struct {
+    void* reader;
+    void* writer;
+} IHTTPEventRegistration;
+
+/*! @brief event data marking the wakeup event, which runs the pending blocks, the data of other events is their file descriptor */
+#define IHTTPEventLoopWakeupData UINT64_MAX
+
+/*! @brief event data marking an event collected for a file descriptor which has since lost its sources */
+#define IHTTPEventLoopDroppedData (UINT64_MAX - 1)
+#else
+/*! @brief event data marking the wakeup event, which runs the pending blocks */
+static char IHTTPEventLoopWakeup;
+#endif
+
+NSTimeInterval IHTTPMonotonicTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec + (now.tv_nsec / 1e9));
+}
+
+// MARK: -
+
+@interface IHTTPEventLoop ()
+@property(nonatomic, assign) int queueDescriptor;
+@property(nonatomic, assign) int wakeupDescriptor;
+@property(nonatomic, assign) NSTimeInterval currentTimeStorage;
+@property(nonatomic, weak) NSThread* loopThread;
+@property(nonatomic, retain) NSMutableArray* pendingBlocks;
+@property(nonatomic, retain) NSLock* pendingLock;
+@property(atomic, assign) BOOL stopRequested;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPEventLoop {
+    IHTTPEvent* _events;
+    int _eventCount;
+    int _eventIndex;
+    void* _readBuffer;
+#if __linux__
+    IHTTPEventRegistration* _registrations; // indexed by file descriptor
+    int _registrationCount;
+#endif
+}
+
++ (IHTTPEventLoop*) eventLoop {
+    IHTTPEventLoop* loop = IHTTPEventLoop.new;
+    return (loop.queueDescriptor >= 0 ? loop : nil);
+}
+
+// MARK: - Initializers
+
+- (id) init {
+    if ((self = super.init)) {
+        self.pendingBlocks = NSMutableArray.new;
+        self.pendingLock = NSLock.new;
+        self.currentTimeStorage = IHTTPMonotonicTime();
+        self.wakeupDescriptor = -1;
+        _events = calloc(IHTTPEventLoopBatchSize, sizeof(IHTTPEvent));
+        _readBuffer = malloc(IHTTPEventLoopReadBufferSize);
+#if __linux__
+        self.queueDescriptor = epoll_create1(EPOLL_CLOEXEC);
+        self.wakeupDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (self.queueDescriptor >= 0 && self.wakeupDescriptor >= 0) {
+            struct epoll_event wakeup = { .events = EPOLLIN, .data.u64 = IHTTPEventLoopWakeupData };
+            epoll_ctl(self.queueDescriptor, EPOLL_CTL_ADD, self.wakeupDescriptor, &wakeup);
+        }
+#else
+        self.queueDescriptor = kqueue();
+        if (self.queueDescriptor >= 0) {
+            struct kevent wakeup;
+            EV_SET(&wakeup, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, &IHTTPEventLoopWakeup);
+            kevent(self.queueDescriptor, &wakeup, 1, NULL, 0, NULL);
+        }
+#endif
+    }
+    return self;
+}
+
+- (void) dealloc {
+    if (self.wakeupDescriptor >= 0) {
+        close(self.wakeupDescriptor);
+    }
+
+    if (self.queueDescriptor >= 0) {
+        close(self.queueDescriptor);
+    }
+
+    free(_events);
+    free(_readBuffer);
+#if __linux__
+    free(_registrations);
+#endif
+}
+
+// MARK: - Properties
+
+- (void*) readBuffer {
+    return _readBuffer;
+}
+
+- (size_t) readBufferSize {
+    return IHTTPEventLoopReadBufferSize;
+}
+
+- (NSTimeInterval) currentTime {
+    return self.currentTimeStorage;
+}
+
+- (BOOL) isLoopThread {
+    return (NSThread.currentThread == self.loopThread);
+}
+
+// MARK: - Sources
+
+- (BOOL) addSource:(id<IHTTPEventLoopSource>) source forFileDescriptor:(int) fileDescriptor {
+#if __linux__
+    return [self registerReader:(__bridge void*)source writer:NULL forFileDescriptor:fileDescriptor];
+#else
+    return [self changeFilter:EVFILT_READ flags:EV_ADD source:source forFileDescriptor:fileDescriptor];
+#endif
+}
+
+- (void) removeSource:(id<IHTTPEventLoopSource>) source forFileDescriptor:(int) fileDescriptor {
+#if __linux__
+    [self unregisterReader:YES writer:NO forFileDescriptor:fileDescriptor];
+#else
+    [self changeFilter:EVFILT_READ flags:EV_DELETE source:nil forFileDescriptor:fileDescriptor];
+#endif
+}
+
+- (BOOL) addWriteSource:(id<IHTTPEventLoopSource>) source forFileDescriptor:(int) fileDescriptor {
+#if __linux__
+    return [self registerReader:NULL writer:(__bridge void*)source forFileDescriptor:fileDescriptor];
+#else
+    return [self changeFilter:EVFILT_WRITE flags:EV_ADD source:source forFileDescriptor:fileDescriptor];
+#endif
+}
+
+- (void) removeWriteSource:(id<IHTTPEventLoopSource>) source forFileDescriptor:(int) fileDescriptor {
+#if __linux__
+    [self unregisterReader:NO writer:YES forFileDescriptor:fileDescriptor];
+#else
+    [self changeFilter:EVFILT_WRITE flags:EV_DELETE source:nil forFileDescriptor:fileDescriptor];
+#endif
+}
+
+#if __linux__
+/*! @brief set the reader or writer of the file descriptor, whichever isn't NULL, and register the events they want */
+- (BOOL) registerReader:(void*) reader writer:(void*) writer forFileDescriptor:(int) fileDescriptor {
+    if (fileDescriptor < 0) {
+        return NO;
+    }
+    else if (fileDescriptor >= _registrationCount) { // grows with the highest descriptor, like the worker's connection table
+        int count = MAX(MAX((fileDescriptor + 1), (_registrationCount * 2)), 64);
+        IHTTPEventRegistration* registrations = realloc(_registrations, ((size_t)count * sizeof(IHTTPEventRegistration)));
+        if (!registrations) {
+            return NO;
+        }
+        memset((registrations + _registrationCount), 0, ((size_t)(count - _registrationCount) * sizeof(IHTTPEventRegistration)));
+        _registrations = registrations;
+        _registrationCount = count;
+    }
+
+    IHTTPEventRegistration previous = _registrations[fileDescriptor];
+    _registrations[fileDescriptor].reader = (reader ?: previous.reader);
+    _registrations[fileDescriptor].writer = (writer ?: previous.writer);
+    if (![self updateFileDescriptor:fileDescriptor previous:previous]) {
+        _registrations[fileDescriptor] = previous;
+        return NO;
+    }
+    return YES;
+}
+
+/*! @brief clear the reader or writer of the file descriptor, and drop anything already collected for it once it has neither,
+    since the source may be released and the descriptor reused by another before the rest of the events are delivered */
+- (void) unregisterReader:(BOOL) reader writer:(BOOL) writer forFileDescriptor:(int) fileDescriptor {
+    if (fileDescriptor < 0 || fileDescriptor >= _registrationCount) {
+        return;
+    }
+
+    IHTTPEventRegistration previous = _registrations[fileDescriptor];
+    if (reader) {
+        _registrations[fileDescriptor].reader = NULL;
+    }
+    if (writer) {
+        _registrations[fileDescriptor].writer = NULL;
+    }
+    [self updateFileDescriptor:fileDescriptor previous:previous];
+
+    if (!_registrations[fileDescriptor].reader && !_registrations[fileDescriptor].writer) {
+        for (int index = _eventIndex; index < _eventCount; index++) { // including the event being delivered, so its writer isn't called
+            if (_events[index].data.u64 == (uint64_t)fileDescriptor) {
+                _events[index].data.u64 = IHTTPEventLoopDroppedData;
+            }
+        }
+    }
+}
+
+/*! @brief add, change or delete the epoll registration of the file descriptor to match its sources */
+- (BOOL) updateFileDescriptor:(int) fileDescriptor previous:(IHTTPEventRegistration) previous {
+    IHTTPEventRegistration current = _registrations[fileDescriptor];
+    uint32_t events = ((current.reader ? (EPOLLIN | EPOLLRDHUP) : 0) | (current.writer ? EPOLLOUT : 0));
+    uint32_t previousEvents = ((previous.reader ? (EPOLLIN | EPOLLRDHUP) : 0) | (previous.writer ? EPOLLOUT : 0));
+    if (events == previousEvents) {
+        return YES;
+    }
+
+    struct epoll_event event = { .events = events, .data.u64 = (uint64_t)fileDescriptor };
+    int operation = (events == 0 ? EPOLL_CTL_DEL : (previousEvents == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD));
+    int result = epoll_ctl(self.queueDescriptor, operation, fileDescriptor, &event);
+    if (result != 0 && operation == EPOLL_CTL_MOD && errno == ENOENT) { // closing the descriptor dropped the registration
+        result = epoll_ctl(self.queueDescriptor, EPOLL_CTL_ADD, fileDescriptor, &event);
+    }
+    else if (result != 0 && operation == EPOLL_CTL_ADD && errno == EEXIST) {
+        result = epoll_ctl(self.queueDescriptor, EPOLL_CTL_MOD, fileDescriptor, &event);
+    }
+    return (result == 0 || operation == EPOLL_CTL_DEL);
+}
+#else
+/*! @brief add or delete the kqueue filter for the file descriptor, deleting drops anything already collected for the filter,
+    since the source may be released and the descriptor reused by another before the rest of the events are delivered */
+- (BOOL) changeFilter:(int16_t) filter flags:(uint16_t) flags source:(id<IHTTPEventLoopSource>) source forFileDescriptor:(int) fileDescriptor {
+    struct kevent event;
+    EV_SET(&event, fileDescriptor, filter, flags, 0, 0, (__bridge void*)source);
+    BOOL didChange = (kevent(self.queueDescriptor, &event, 1, NULL, 0, NULL) == 0);
+
+    if (flags & EV_DELETE) {
+        for (int index = (_eventIndex + 1); index < _eventCount; index++) {
+            if (_events[index].ident == (uintptr_t)fileDescriptor && _events[index].filter == filter) {
+                _events[index].udata = NULL;
+            }
+        }
+    }
+    return didChange;
+}
+#endif
+
+// MARK: - Blocks
+
+- (void) performBlock:(dispatch_block_t) block {
+    [self.pendingLock lock];
+    BOOL wasEmpty = (self.pendingBlocks.count == 0);
+    [self.pendingBlocks addObject:[block copy]];
+    [self.pendingLock unlock];
+
+    if (wasEmpty) {
+        [self wakeup];
+    }
+}
+
+- (void) wakeup {
+#if __linux__
+    uint64_t count = 1;
+    (void)write(self.wakeupDescriptor, &count, sizeof(count));
+#else
+    struct kevent wakeup;
+    EV_SET(&wakeup, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, &IHTTPEventLoopWakeup);
+    kevent(self.queueDescriptor, &wakeup, 1, NULL, 0, NULL);
+#endif
+}
+
+- (void) performPendingBlocks {
+#if __linux__
+    uint64_t count = 0;
+    (void)read(self.wakeupDescriptor, &count, sizeof(count));
+#endif
+    [self.pendingLock lock];
+    NSArray* blocks = self.pendingBlocks;
+    self.pendingBlocks = NSMutableArray.new;
+    [self.pendingLock unlock];
+
+    for (dispatch_block_t block in blocks) {
+        block();
+    }
+}
+
+// MARK: - Running
+
+- (void) run {
+    NSTimeInterval nextTick = (IHTTPMonotonicTime() + 1);
+    self.loopThread = NSThread.currentThread;
+
+    while (!self.stopRequested) {
+        @autoreleasepool {
+            NSTimeInterval untilTick = MAX((nextTick - IHTTPMonotonicTime()), 0);
+#if __linux__
+            int count = epoll_wait(self.queueDescriptor, _events, IHTTPEventLoopBatchSize, (int)(untilTick * 1000) + 1);
+#else
+            struct timespec timeout = { (time_t)untilTick, (long)((untilTick - (time_t)untilTick) * 1e9) };
+            int count = kevent(self.queueDescriptor, NULL, 0, _events, IHTTPEventLoopBatchSize, &timeout);
+#endif
+            if (count < 0 && errno != EINTR) {
+                NSLog(@"%@ error waiting for events: %s", NSStringFromClass(self.class), strerror(errno));
+                break;
+            }
+
+            self.currentTimeStorage = IHTTPMonotonicTime();
+            _eventCount = MAX(count, 0);
+            for (_eventIndex = 0; _eventIndex < _eventCount; _eventIndex++) {
+#if __linux__
+                uint64_t data = _events[_eventIndex].data.u64;
+                uint32_t events = _events[_eventIndex].events;
+                if (data == IHTTPEventLoopWakeupData) {
+                    [self performPendingBlocks];
+                    continue;
+                }
+                else if (data == IHTTPEventLoopDroppedData) {
+                    continue;
+                }
+
+                int fileDescriptor = (int)data;
+                void* reader = _registrations[fileDescriptor].reader;
+                if (reader && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                    [(__bridge id<IHTTPEventLoopSource>)reader eventLoopSourceIsReadable:self];
+                }
+
+                // looked up again, the reader may have finished the output or closed the descriptor
+                void* writer = (_events[_eventIndex].data.u64 == data ? _registrations[fileDescriptor].writer : NULL);
+                if (writer && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+                    [(__bridge id<IHTTPEventLoopSource>)writer eventLoopSourceIsWritable:self];
+                }
+#else
+                void* data = _events[_eventIndex].udata;
+                if (data == &IHTTPEventLoopWakeup) {
+                    [self performPendingBlocks];
+                }
+                else if (data && _events[_eventIndex].filter == EVFILT_WRITE) {
+                    [(__bridge id<IHTTPEventLoopSource>)data eventLoopSourceIsWritable:self];
+                }
+                else if (data) {
+                    [(__bridge id<IHTTPEventLoopSource>)data eventLoopSourceIsReadable:self];
+                }
+#endif
+            }
+            _eventCount = 0;
+            _eventIndex = 0;
+
+            if (self.currentTime >= nextTick) {
+                nextTick = (self.currentTime + 1);
+                if (self.tickBlock) {
+                    self.tickBlock();
+                }
+            }
+        }
+    }
+
+    [self performPendingBlocks]; // anything queued while stopping
+    self.loopThread = nil;
+}
+
+- (void) stop {
+    self.stopRequested = YES;
+    [self wakeup];
+}
+
+@end
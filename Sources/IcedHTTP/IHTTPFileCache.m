@@ -0,0 +1,491 @@
+#import "IHTTPFileCache.h"
+
+#import "IHTTPConstants.h"
+#import "IHTTPEventLoop.h"
+#import "IHTTPPrivate.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if __linux__
+#include <sys/inotify.h>
+#else
+#include <sys/event.h>
+#endif
+
+#if __APPLE__
+#define IHTTPStatModified(fileStat) ((fileStat).st_mtimespec)
+#define IHTTPWatchOpenFlags (O_EVTONLY | O_CLOEXEC)
+#else
+#define IHTTPStatModified(fileStat) ((fileStat).st_mtim)
+#define IHTTPWatchOpenFlags (O_RDONLY | O_CLOEXEC)
+#endif
+
+/*! @brief default size of the largest file kept in the cache */
+static NSUInteger const IHTTPFileCacheDefaultMaxEntrySize = (256 * 1024);
+
+// MARK: -
+
+@interface IHTTPFileCacheEntry ()
+@property(nonatomic, retain) NSString* keyStorage;
+@property(nonatomic, retain) NSString* filePathStorage;
+@property(nonatomic, retain) NSData* headerDataStorage;
+@property(nonatomic, retain) NSData* bodyStorage;
+@property(nonatomic, retain) NSString* entityTagStorage;
+@property(nonatomic, retain) NSString* varyStorage;
+@property(nonatomic, assign) time_t modifiedStorage;
+@property(nonatomic, assign) int watch;
+@property(nonatomic, retain) IHTTPFileCacheEntry* newer;
+@property(nonatomic, weak) IHTTPFileCacheEntry* older;
+
++ (IHTTPFileCacheEntry*) entryWithKey:(NSString*) key body:(NSData*) body headers:(NSDictionary*) headers modified:(time_t) modified;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPFileCacheEntry
+
+- (NSString*) key {
+    return self.keyStorage;
+}
+
+- (NSString*) filePath {
+    return self.filePathStorage;
+}
+
+- (NSData*) headerData {
+    return self.headerDataStorage;
+}
+
+- (NSData*) body {
+    return self.bodyStorage;
+}
+
+- (NSString*) entityTag {
+    return self.entityTagStorage;
+}
+
+- (NSString*) vary {
+    return self.varyStorage;
+}
+
+- (time_t) modified {
+    return self.modifiedStorage;
+}
+
+// MARK: -
+
+/*! @brief an entry for the body with its 200 OK status line and headers serialized ahead of time */
++ (IHTTPFileCacheEntry*) entryWithKey:(NSString*) key body:(NSData*) body headers:(NSDictionary*) headers modified:(time_t) modified {
+    NSMutableString* serialized = [NSMutableString stringWithString:@"HTTP/1.1 200 OK\r\n"];
+    for (NSString* header in [headers.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        [serialized appendFormat:@"%@: %@\r\n", header, headers[header]];
+    }
+
+    IHTTPFileCacheEntry* entry = IHTTPFileCacheEntry.new;
+    entry.keyStorage = key;
+    entry.headerDataStorage = [serialized dataUsingEncoding:NSISOLatin1StringEncoding allowLossyConversion:YES]; // as IHTTPResponse sends headers
+    entry.bodyStorage = body;
+    entry.entityTagStorage = headers[IHTTPETagHeader];
+    entry.varyStorage = headers[IHTTPVaryHeader];
+    entry.modifiedStorage = modified;
+    return entry;
+}
+
+@end
+
+// MARK: -
+
+/*! @brief reports changes to the watched files from the cache's event loop thread,
+    a separate object from the cache so the loop never calls into a cache which is being released */
+@interface IHTTPFileWatcher : NSObject <IHTTPEventLoopSource>
+@property(nonatomic, weak) IHTTPFileCache* cache;
+@property(nonatomic, assign) int descriptor;
+
+/*! @brief start watching the file, returns the watch identifier or -1 */
+- (int) watchPath:(NSString*) filePath;
+
+/*! @brief stop watching the file */
+- (void) unwatch:(int) watch;
+
+@end
+
+// MARK: -
+
+@interface IHTTPFileCache ()
+@property(nonatomic, assign) NSUInteger capacityStorage;
+@property(nonatomic, retain) NSLock* lock;
+@property(nonatomic, retain) NSMutableDictionary<NSString*, IHTTPFileCacheEntry*>* entries;
+@property(nonatomic, retain) NSMutableDictionary<NSNumber*, IHTTPFileCacheEntry*>* watchedEntries;
+@property(nonatomic, retain) IHTTPFileCacheEntry* oldest;
+@property(nonatomic, weak) IHTTPFileCacheEntry* newest;
+@property(nonatomic, retain) IHTTPFileWatcher* watcher;
+@property(nonatomic, retain) IHTTPEventLoop* watcherLoop;
+@property(nonatomic, assign) NSUInteger sizeStorage;
+@property(nonatomic, assign) NSUInteger hitsStorage;
+@property(nonatomic, assign) NSUInteger missesStorage;
+@property(nonatomic, assign) NSUInteger evictionsStorage;
+@property(nonatomic, assign) NSUInteger invalidationsStorage;
+
+- (void) invalidateWatch:(int) watch;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPFileWatcher
+
+- (void) dealloc {
+    if (self.descriptor >= 0) {
+        close(self.descriptor);
+    }
+}
+
+- (int) watchPath:(NSString*) filePath {
+#if __linux__
+    return inotify_add_watch(self.descriptor, filePath.fileSystemRepresentation, (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF));
+#else
+    int fileDescriptor = open(filePath.fileSystemRepresentation, IHTTPWatchOpenFlags);
+    if (fileDescriptor >= 0) {
+        struct kevent event;
+        EV_SET(&event, fileDescriptor, EVFILT_VNODE, (EV_ADD | EV_CLEAR),
+            (NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE), 0, NULL);
+        if (kevent(self.descriptor, &event, 1, NULL, 0, NULL) != 0) {
+            close(fileDescriptor);
+            fileDescriptor = -1;
+        }
+    }
+    return fileDescriptor;
+#endif
+}
+
+- (void) unwatch:(int) watch {
+#if __linux__
+    inotify_rm_watch(self.descriptor, watch);
+#else
+    close(watch); // removes the event from the queue
+#endif
+}
+
+// MARK: - IHTTPEventLoopSource
+
+- (void) eventLoopSourceIsReadable:(IHTTPEventLoop*) loop {
+    IHTTPFileCache* cache = self.cache;
+#if __linux__
+    ssize_t length = read(self.descriptor, loop.readBuffer, loop.readBufferSize);
+    for (ssize_t offset = 0; offset < length;) {
+        struct inotify_event* event = (struct inotify_event*)((uint8_t*)loop.readBuffer + offset);
+        [cache invalidateWatch:event->wd];
+        offset += (sizeof(struct inotify_event) + event->len);
+    }
+#else
+    struct kevent events[64];
+    struct timespec immediately = { 0, 0 };
+    int count = kevent(self.descriptor, NULL, 0, events, 64, &immediately);
+    for (int index = 0; index < count; index++) {
+        [cache invalidateWatch:(int)events[index].ident];
+    }
+#endif
+}
+
+@end
+
+// MARK: -
+
+@implementation IHTTPFileCache
+
++ (IHTTPFileCache*) cacheWithCapacity:(NSUInteger) capacity {
+    IHTTPFileCache* cache = IHTTPFileCache.new;
+    cache.capacityStorage = capacity;
+    return ([cache startWatching] ? cache : nil);
+}
+
+// MARK: - Initializers
+
+- (id) init {
+    if ((self = super.init)) {
+        self.maxEntrySize = IHTTPFileCacheDefaultMaxEntrySize;
+        self.lock = NSLock.new;
+        self.entries = NSMutableDictionary.new;
+        self.watchedEntries = NSMutableDictionary.new;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [self.watcherLoop stop];
+}
+
+// MARK: - Properties
+
+- (NSUInteger) capacity {
+    return self.capacityStorage;
+}
+
+- (NSUInteger) size {
+    [self.lock lock];
+    NSUInteger size = self.sizeStorage;
+    [self.lock unlock];
+    return size;
+}
+
+- (NSUInteger) count {
+    [self.lock lock];
+    NSUInteger count = self.entries.count;
+    [self.lock unlock];
+    return count;
+}
+
+- (NSUInteger) hits {
+    [self.lock lock];
+    NSUInteger hits = self.hitsStorage;
+    [self.lock unlock];
+    return hits;
+}
+
+- (NSUInteger) misses {
+    [self.lock lock];
+    NSUInteger misses = self.missesStorage;
+    [self.lock unlock];
+    return misses;
+}
+
+- (NSUInteger) evictions {
+    [self.lock lock];
+    NSUInteger evictions = self.evictionsStorage;
+    [self.lock unlock];
+    return evictions;
+}
+
+- (NSUInteger) invalidations {
+    [self.lock lock];
+    NSUInteger invalidations = self.invalidationsStorage;
+    [self.lock unlock];
+    return invalidations;
+}
+
+// MARK: -
+
+/*! @brief create the file watcher and run its event loop on a thread of its own */
+- (BOOL) startWatching {
+    IHTTPFileWatcher* watcher = IHTTPFileWatcher.new;
+    IHTTPEventLoop* loop = [IHTTPEventLoop eventLoop];
+#if __linux__
+    watcher.descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+    watcher.descriptor = kqueue();
+#endif
+    watcher.cache = self;
+
+    if (!loop || watcher.descriptor < 0 || ![loop addSource:watcher forFileDescriptor:watcher.descriptor]) {
+        return NO;
+    }
+
+    self.watcher = watcher;
+    self.watcherLoop = loop;
+    NSThread* watcherThread = [NSThread.alloc initWithBlock:^{
+        [loop run];
+        [loop removeSource:watcher forFileDescriptor:watcher.descriptor];
+    }];
+    watcherThread.name = NSStringFromClass(self.class);
+    [watcherThread start];
+
+    return YES;
+}
+
+- (void) removeAllEntries {
+    [self.lock lock];
+    while (self.oldest) {
+        [self removeEntry:self.oldest];
+    }
+    [self.lock unlock];
+}
+
+// MARK: - Entries, called with the lock held
+
+- (void) removeEntry:(IHTTPFileCacheEntry*) entry {
+    if (entry.watch >= 0) {
+        [self.watcher unwatch:entry.watch];
+        [self.watchedEntries removeObjectForKey:@(entry.watch)];
+    }
+    [self.entries removeObjectForKey:entry.key];
+    self.sizeStorage -= entry.body.length;
+
+    if (entry.older) {
+        entry.older.newer = entry.newer;
+    }
+    else {
+        self.oldest = entry.newer;
+    }
+
+    if (entry.newer) {
+        entry.newer.older = entry.older;
+    }
+    else {
+        self.newest = entry.older;
+    }
+
+    entry.newer = nil;
+    entry.older = nil;
+}
+
+- (void) appendEntry:(IHTTPFileCacheEntry*) entry {
+    entry.older = self.newest;
+    if (self.newest) {
+        self.newest.newer = entry;
+    }
+    else {
+        self.oldest = entry;
+    }
+    self.newest = entry;
+}
+
+/*! @brief add the entry as the most recently used, evicting the least recently used entries to make room */
+- (void) insertEntry:(IHTTPFileCacheEntry*) entry {
+    while (self.oldest && (self.sizeStorage + entry.body.length) > self.capacity) {
+        [self removeEntry:self.oldest];
+        self.evictionsStorage++;
+    }
+
+    self.entries[entry.key] = entry;
+    if (entry.watch >= 0) {
+        self.watchedEntries[@(entry.watch)] = entry;
+    }
+    self.sizeStorage += entry.body.length;
+    [self appendEntry:entry];
+}
+
+- (void) touchEntry:(IHTTPFileCacheEntry*) entry {
+    if (entry != self.newest) {
+        IHTTPFileCacheEntry* retained = entry; // the list holds the only other reference
+        if (retained.older) {
+            retained.older.newer = retained.newer;
+        }
+        else {
+            self.oldest = retained.newer;
+        }
+        retained.newer.older = retained.older;
+        retained.newer = nil;
+        [self appendEntry:retained];
+    }
+}
+
+// MARK: - Private
+
+- (BOOL) containsPath:(NSString*) filePath {
+    [self.lock lock];
+    BOOL contains = (self.entries[filePath] != nil);
+    [self.lock unlock];
+    return contains;
+}
+
+- (IHTTPFileCacheEntry*) entryForKey:(NSString*) key {
+    [self.lock lock];
+    IHTTPFileCacheEntry* entry = self.entries[key];
+    if (entry) {
+        self.hitsStorage++;
+        [self touchEntry:entry];
+    }
+    [self.lock unlock];
+    return entry;
+}
+
+- (IHTTPFileCacheEntry*) entryForPath:(NSString*) filePath {
+    [self.lock lock];
+    IHTTPFileCacheEntry* entry = self.entries[filePath];
+    if (entry) {
+        self.hitsStorage++;
+        [self touchEntry:entry];
+    }
+    else {
+        self.missesStorage++;
+    }
+    [self.lock unlock];
+    return entry;
+}
+
+- (IHTTPFileCacheEntry*) addEntryForKey:(NSString*) key filePath:(NSString*) filePath file:(NSFileHandle*) file headers:(NSDictionary*) headers {
+    struct stat before;
+    struct stat after;
+    if (fstat(file.fileDescriptor, &before) != 0 || (NSUInteger)before.st_size > MIN(self.maxEntrySize, self.capacity)) {
+        return nil;
+    }
+
+    int watch = [self.watcher watchPath:filePath]; // before reading, so a change while reading invalidates the entry
+    if (watch < 0) {
+        return nil;
+    }
+
+    NSMutableData* body = [NSMutableData dataWithLength:(NSUInteger)before.st_size];
+    size_t offset = 0;
+    while (offset < body.length) {
+        ssize_t count = pread(file.fileDescriptor, ((uint8_t*)body.mutableBytes + offset), (body.length - offset), (off_t)offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (count <= 0) {
+            break;
+        }
+        offset += (size_t)count;
+    }
+
+    struct timespec modified = IHTTPStatModified(before);
+    struct timespec modifiedAfter = (fstat(file.fileDescriptor, &after) == 0 ? IHTTPStatModified(after) : (struct timespec){ 0, 0 });
+    if (offset != body.length || after.st_size != before.st_size
+     || modifiedAfter.tv_sec != modified.tv_sec || modifiedAfter.tv_nsec != modified.tv_nsec) { // changed while reading
+        [self.watcher unwatch:watch];
+        return nil;
+    }
+
+    IHTTPFileCacheEntry* entry = [IHTTPFileCacheEntry entryWithKey:key body:body headers:headers modified:modified.tv_sec];
+    entry.filePathStorage = filePath;
+    entry.watch = watch;
+
+    [self.lock lock];
+    IHTTPFileCacheEntry* existing = self.entries[key];
+    IHTTPFileCacheEntry* watching = self.watchedEntries[@(watch)];
+    if (existing || watching) { // another worker cached it first, or another path links to the same file
+        [self.lock unlock];
+        if (!watching) {
+            [self.watcher unwatch:watch];
+        }
+        return (existing ?: entry);
+    }
+
+    [self insertEntry:entry];
+    [self.lock unlock];
+
+    return entry;
+}
+
+- (IHTTPFileCacheEntry*) addEntryForKey:(NSString*) key body:(NSData*) body headers:(NSDictionary*) headers modified:(time_t) modified {
+    if (body.length > MIN(self.maxEntrySize, self.capacity)) {
+        return nil;
+    }
+
+    IHTTPFileCacheEntry* entry = [IHTTPFileCacheEntry entryWithKey:key body:body headers:headers modified:modified];
+    entry.watch = -1;
+
+    [self.lock lock];
+    IHTTPFileCacheEntry* existing = self.entries[key];
+    if (!existing) {
+        [self insertEntry:entry];
+    }
+    [self.lock unlock];
+
+    return (existing ?: entry);
+}
+
+- (void) invalidateWatch:(int) watch {
+    [self.lock lock];
+    IHTTPFileCacheEntry* entry = self.watchedEntries[@(watch)];
+    if (entry) {
+        [self removeEntry:entry];
+        self.invalidationsStorage++;
+    }
+    [self.lock unlock];
+}
+
+@end
@@ -0,0 +1,597 @@
+#include "IHTTPHPACK.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*! @brief the longest Huffman code in bits */
+#define IHTTPHuffmanMaxLength 30
+
+/*! @brief the Huffman symbol which ends a string, which must never appear in one */
+#define IHTTPHuffmanEndOfString 256
+
+/*! @brief the static table, RFC 7541 Appendix A */
+static const struct { const char* name; const char* value; } IHTTPHPACKStaticTable[IHTTPHPACKStaticTableLength + 1] = {
+    { NULL, NULL }, // indices start at 1
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" }
+};
+
+/*! @brief the Huffman code of each symbol, RFC 7541 Appendix B, right aligned in its length, symbol 256 is EOS */
+static const uint32_t IHTTPHuffmanCodes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff
+};
+
+/*! @brief the length in bits of each symbol's code */
+static const uint8_t IHTTPHuffmanLengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+/*! @brief the symbols in order of their codes, the code is canonical so the codes of each length are consecutive */
+static const uint16_t IHTTPHuffmanSymbols[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+    52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+    110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+    119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+    43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+    163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+    158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+    144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+    256
+};
+
+/*! @brief the first code, the number of codes and the index of the first symbol of each code length, by length */
+static const struct { uint32_t first; uint16_t count; uint16_t offset; } IHTTPHuffmanLengthCodes[IHTTPHuffmanMaxLength + 1] = {
+    [5] = { 0x0, 10, 0 },
+    [6] = { 0x14, 26, 10 },
+    [7] = { 0x5c, 32, 36 },
+    [8] = { 0xf8, 6, 68 },
+    [10] = { 0x3f8, 5, 74 },
+    [11] = { 0x7fa, 3, 79 },
+    [12] = { 0xffa, 2, 82 },
+    [13] = { 0x1ff8, 6, 84 },
+    [14] = { 0x3ffc, 2, 90 },
+    [15] = { 0x7ffc, 3, 92 },
+    [19] = { 0x7fff0, 3, 95 },
+    [20] = { 0xfffe6, 8, 98 },
+    [21] = { 0x1fffdc, 13, 106 },
+    [22] = { 0x3fffd2, 26, 119 },
+    [23] = { 0x7fffd8, 29, 145 },
+    [24] = { 0xffffea, 12, 174 },
+    [25] = { 0x1ffffec, 4, 186 },
+    [26] = { 0x3ffffe0, 15, 190 },
+    [27] = { 0x7ffffde, 19, 205 },
+    [28] = { 0xfffffe2, 29, 224 },
+    [30] = { 0x3ffffffc, 4, 253 }
+};
+
+// MARK: - Huffman Code
+
+/*! @brief decode the Huffman coded bytes into the output, which holds (length * 8 / 5) bytes, the most the shortest codes make,
+    returns false if the string contains EOS or is padded with anything other than up to 7 bits of it */
+static bool IHTTPHuffmanDecode(const uint8_t* bytes, size_t length, uint8_t* output, size_t* outputLength) {
+    uint64_t window = 0; // the unread bits are the low bits of the window
+    unsigned bits = 0;
+    size_t index = 0;
+    size_t written = 0;
+
+    while (true) {
+        while (bits < IHTTPHuffmanMaxLength && index < length) {
+            window = ((window << 8) | bytes[index++]);
+            bits += 8;
+        }
+        if (bits == 0) {
+            break;
+        }
+
+        // the codes of each length are consecutive and sort after every shorter code, so the first length
+        // whose range the leading bits fall below is the length of the next code
+        unsigned codeLength = 5;
+        uint32_t code = 0;
+        for (; codeLength <= IHTTPHuffmanMaxLength && codeLength <= bits; codeLength++) {
+            code = (uint32_t)((window >> (bits - codeLength)) & ((1ull << codeLength) - 1));
+            if (code < (IHTTPHuffmanLengthCodes[codeLength].first + IHTTPHuffmanLengthCodes[codeLength].count)) {
+                break;
+            }
+        }
+
+        if (codeLength > IHTTPHuffmanMaxLength || codeLength > bits) { // what's left is padding, the leading bits of EOS
+            if (index < length || bits > 7 || (window & ((1ull << bits) - 1)) != ((1ull << bits) - 1)) {
+                return false;
+            }
+            break;
+        }
+
+        uint16_t symbol = IHTTPHuffmanSymbols[IHTTPHuffmanLengthCodes[codeLength].offset + (code - IHTTPHuffmanLengthCodes[codeLength].first)];
+        if (symbol == IHTTPHuffmanEndOfString) {
+            return false;
+        }
+        output[written++] = (uint8_t)symbol;
+        bits -= codeLength;
+    }
+
+    *outputLength = written;
+    return true;
+}
+
+/*! @brief the length of the bytes once Huffman coded */
+static size_t IHTTPHuffmanEncodedLength(const uint8_t* bytes, size_t length) {
+    size_t bits = 0;
+    for (size_t index = 0; index < length; index++) {
+        bits += IHTTPHuffmanLengths[bytes[index]];
+    }
+    return ((bits + 7) / 8);
+}
+
+/*! @brief Huffman code the bytes into the output, padded with the leading bits of EOS, returns the length written */
+static size_t IHTTPHuffmanEncode(const uint8_t* bytes, size_t length, uint8_t* output) {
+    uint64_t window = 0;
+    unsigned bits = 0;
+    size_t written = 0;
+
+    for (size_t index = 0; index < length; index++) {
+        window = ((window << IHTTPHuffmanLengths[bytes[index]]) | IHTTPHuffmanCodes[bytes[index]]);
+        bits += IHTTPHuffmanLengths[bytes[index]];
+        while (bits >= 8) {
+            bits -= 8;
+            output[written++] = (uint8_t)(window >> bits);
+        }
+    }
+
+    if (bits > 0) {
+        output[written++] = (uint8_t)((window << (8 - bits)) | (0xFF >> bits));
+    }
+    return written;
+}
+
+// MARK: - Integers and Strings
+
+/*! @brief decode an integer with a prefix of the bits in the first byte, returns false if the block ends first
+    or it's larger than any length or index the server accepts */
+static bool IHTTPHPACKDecodeInteger(const uint8_t** cursor, const uint8_t* end, unsigned prefixBits, size_t* value) {
+    const uint8_t* bytes = *cursor;
+    if (bytes >= end) {
+        return false;
+    }
+
+    size_t mask = ((1u << prefixBits) - 1);
+    size_t result = (*bytes++ & mask);
+    if (result == mask) {
+        unsigned shift = 0;
+        uint8_t byte = 0;
+        do {
+            if (bytes >= end || shift > 21) { // 28 bits is more than a header block can hold
+                return false;
+            }
+            byte = *bytes++;
+            result += ((size_t)(byte & 0x7F) << shift);
+            shift += 7;
+        } while (byte & 0x80);
+    }
+
+    *cursor = bytes;
+    *value = result;
+    return true;
+}
+
+/*! @brief encode the integer after the flags in the first byte, with a prefix of the bits, returns the length written */
+static size_t IHTTPHPACKEncodeInteger(uint8_t* buffer, uint8_t flags, unsigned prefixBits, size_t value) {
+    size_t mask = ((1u << prefixBits) - 1);
+    if (value < mask) {
+        buffer[0] = (uint8_t)(flags | value);
+        return 1;
+    }
+
+    buffer[0] = (uint8_t)(flags | mask);
+    value -= mask;
+    size_t written = 1;
+    while (value >= 0x80) {
+        buffer[written++] = (uint8_t)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    buffer[written++] = (uint8_t)value;
+    return written;
+}
+
+/*! @brief encode the string, Huffman coded if that's shorter, returns the length written */
+static size_t IHTTPHPACKEncodeString(uint8_t* buffer, const char* string, size_t length) {
+    size_t huffmanLength = IHTTPHuffmanEncodedLength((const uint8_t*)string, length);
+    if (huffmanLength < length) {
+        size_t written = IHTTPHPACKEncodeInteger(buffer, 0x80, 7, huffmanLength);
+        return (written + IHTTPHuffmanEncode((const uint8_t*)string, length, (buffer + written)));
+    }
+
+    size_t written = IHTTPHPACKEncodeInteger(buffer, 0x00, 7, length);
+    memcpy((buffer + written), string, length);
+    return (written + length);
+}
+
+/*! @brief a decoded name or value, in the output or in an allocation of its own when it doesn't fit */
+typedef struct {
+    const uint8_t* bytes;
+    size_t length;
+    uint8_t* allocated;
+} IHTTPHPACKString;
+
+/*! @brief space for length bytes at the end of the output, or allocated if they don't fit, returns NULL if the allocation fails */
+static uint8_t* IHTTPHPACKReserve(size_t length, uint8_t* output, size_t capacity, size_t* used, IHTTPHPACKString* string) {
+    uint8_t* destination = NULL;
+    if (length <= (capacity - *used)) {
+        destination = (output + *used);
+        *used += length;
+    }
+    else {
+        destination = malloc(length ? length : 1);
+        string->allocated = destination;
+    }
+    string->bytes = destination;
+    string->length = length;
+    return destination;
+}
+
+/*! @brief copy the bytes of a table entry out of the table, which may evict it before the field is used */
+static bool IHTTPHPACKKeepBytes(const uint8_t* bytes, size_t length, uint8_t* output, size_t capacity, size_t* used, IHTTPHPACKString* string) {
+    uint8_t* destination = IHTTPHPACKReserve(length, output, capacity, used, string);
+    if (!destination) {
+        return false;
+    }
+    memcpy(destination, bytes, length);
+    return true;
+}
+
+/*! @brief decode a string literal, Huffman coded or not */
+static bool IHTTPHPACKDecodeString(const uint8_t** cursor, const uint8_t* end, uint8_t* output, size_t capacity, size_t* used,
+                                   IHTTPHPACKString* string) {
+    if (*cursor >= end) {
+        return false;
+    }
+
+    bool isHuffman = ((**cursor & 0x80) != 0);
+    size_t length = 0;
+    if (!IHTTPHPACKDecodeInteger(cursor, end, 7, &length) || length > (size_t)(end - *cursor)) {
+        return false;
+    }
+
+    const uint8_t* bytes = *cursor;
+    *cursor += length;
+    if (!isHuffman) {
+        return IHTTPHPACKKeepBytes(bytes, length, output, capacity, used, string);
+    }
+
+    size_t reserved = (((length * 8) / 5) + 1);
+    size_t start = *used;
+    uint8_t* destination = IHTTPHPACKReserve(reserved, output, capacity, used, string);
+    size_t decoded = 0;
+    if (!destination || !IHTTPHuffmanDecode(bytes, length, destination, &decoded)) {
+        return false;
+    }
+    if (!string->allocated) { // give back what the decoded string didn't need
+        *used = (start + decoded);
+    }
+    string->length = decoded;
+    return true;
+}
+
+// MARK: - Tables
+
+/*! @brief the entry at the index from the newest, 0 based */
+static IHTTPHPACKEntry* IHTTPHPACKEntryAt(IHTTPHPACKTable* table, size_t index) {
+    return &table->entries[(table->first + index) % IHTTPHPACKMaxEntries];
+}
+
+/*! @brief evict the oldest entries until there's room for an entry of the size */
+static void IHTTPHPACKEvict(IHTTPHPACKTable* table, size_t needed) {
+    while (table->count > 0 && (table->size + needed) > table->maxSize) {
+        IHTTPHPACKEntry* oldest = IHTTPHPACKEntryAt(table, (table->count - 1));
+        table->size -= (oldest->nameLength + oldest->valueLength + IHTTPHPACKEntryOverhead);
+        free(oldest->bytes);
+        oldest->bytes = NULL;
+        table->count--;
+    }
+}
+
+/*! @brief add the field as the newest entry, evicting what it displaces, an entry larger than the table empties it,
+    returns false if the allocation fails */
+static bool IHTTPHPACKAddEntry(IHTTPHPACKTable* table, const uint8_t* name, size_t nameLength, const uint8_t* value, size_t valueLength) {
+    size_t size = (nameLength + valueLength + IHTTPHPACKEntryOverhead);
+    if (size > table->maxSize) {
+        IHTTPHPACKEvict(table, (table->maxSize + 1));
+        return true;
+    }
+
+    uint8_t* bytes = malloc(nameLength + valueLength + 1); // copied first, the name may be an entry which is about to be evicted
+    if (!bytes) {
+        return false;
+    }
+    memcpy(bytes, name, nameLength);
+    memcpy((bytes + nameLength), value, valueLength);
+    IHTTPHPACKEvict(table, size);
+
+    table->first = ((table->first + IHTTPHPACKMaxEntries - 1) % IHTTPHPACKMaxEntries);
+    table->count++;
+    table->size += size;
+    *IHTTPHPACKEntryAt(table, 0) = (IHTTPHPACKEntry){ bytes, nameLength, valueLength };
+    return true;
+}
+
+/*! @brief the name and value at the index into the static table followed by the dynamic table, returns false if there's no such entry */
+static bool IHTTPHPACKLookup(IHTTPHPACKTable* table, size_t index, const uint8_t** name, size_t* nameLength,
+                             const uint8_t** value, size_t* valueLength) {
+    if (index == 0) {
+        return false;
+    }
+    else if (index <= IHTTPHPACKStaticTableLength) {
+        *name = (const uint8_t*)IHTTPHPACKStaticTable[index].name;
+        *nameLength = strlen(IHTTPHPACKStaticTable[index].name);
+        *value = (const uint8_t*)IHTTPHPACKStaticTable[index].value;
+        *valueLength = strlen(IHTTPHPACKStaticTable[index].value);
+        return true;
+    }
+    else if ((index - IHTTPHPACKStaticTableLength) <= table->count) {
+        IHTTPHPACKEntry* entry = IHTTPHPACKEntryAt(table, (index - IHTTPHPACKStaticTableLength - 1));
+        *name = entry->bytes;
+        *nameLength = entry->nameLength;
+        *value = (entry->bytes + entry->nameLength);
+        *valueLength = entry->valueLength;
+        return true;
+    }
+    return false;
+}
+
+void IHTTPHPACKInitTable(IHTTPHPACKTable* table, size_t maxSize) {
+    memset(table, 0, sizeof(*table));
+    table->maxSize = maxSize;
+    table->limit = maxSize;
+}
+
+void IHTTPHPACKFreeTable(IHTTPHPACKTable* table) {
+    table->maxSize = 0;
+    IHTTPHPACKEvict(table, 1);
+}
+
+void IHTTPHPACKSetTableLimit(IHTTPHPACKTable* table, size_t limit) {
+    size_t maxSize = (limit < IHTTPHPACKDefaultTableSize ? limit : IHTTPHPACKDefaultTableSize);
+    table->limit = limit;
+    if (maxSize != table->maxSize) {
+        table->maxSize = maxSize;
+        table->needsSizeUpdate = true;
+        IHTTPHPACKEvict(table, 0);
+    }
+}
+
+// MARK: - Decoding
+
+IHTTPParseResult IHTTPHPACKDecode(IHTTPHPACKTable* table, const uint8_t* block, size_t length,
+                                  uint8_t* output, size_t outputCapacity, IHTTPHeaderField* fields, unsigned* fieldCount) {
+    const uint8_t* cursor = block;
+    const uint8_t* end = (block + length);
+    size_t used = 0;
+    unsigned count = 0;
+    bool isTooLarge = false;
+    bool canUpdateSize = true;
+
+    while (cursor < end) {
+        uint8_t first = *cursor;
+        if ((first & 0xE0) == 0x20) { // a dynamic table size update, only at the start of a block
+            size_t maxSize = 0;
+            if (!canUpdateSize || !IHTTPHPACKDecodeInteger(&cursor, end, 5, &maxSize) || maxSize > table->limit) {
+                return IHTTPParseInvalid;
+            }
+            table->maxSize = maxSize;
+            IHTTPHPACKEvict(table, 0);
+            continue;
+        }
+        canUpdateSize = false;
+
+        IHTTPHPACKString name = { NULL, 0, NULL };
+        IHTTPHPACKString value = { NULL, 0, NULL };
+        bool isValid = true;
+        if (first & 0x80) { // an indexed field
+            size_t index = 0;
+            const uint8_t* nameBytes = NULL;
+            const uint8_t* valueBytes = NULL;
+            isValid = (IHTTPHPACKDecodeInteger(&cursor, end, 7, &index)
+                    && IHTTPHPACKLookup(table, index, &nameBytes, &name.length, &valueBytes, &value.length)
+                    && IHTTPHPACKKeepBytes(nameBytes, name.length, output, outputCapacity, &used, &name)
+                    && IHTTPHPACKKeepBytes(valueBytes, value.length, output, outputCapacity, &used, &value));
+        }
+        else { // a literal field, with incremental indexing, without indexing or never indexed
+            bool isIndexing = ((first & 0x40) != 0);
+            size_t index = 0;
+            isValid = IHTTPHPACKDecodeInteger(&cursor, end, (isIndexing ? 6 : 4), &index);
+            if (isValid && index > 0) {
+                const uint8_t* nameBytes = NULL;
+                const uint8_t* valueBytes = NULL;
+                size_t valueLength = 0;
+                isValid = (IHTTPHPACKLookup(table, index, &nameBytes, &name.length, &valueBytes, &valueLength)
+                        && IHTTPHPACKKeepBytes(nameBytes, name.length, output, outputCapacity, &used, &name));
+            }
+            else if (isValid) {
+                isValid = IHTTPHPACKDecodeString(&cursor, end, output, outputCapacity, &used, &name);
+            }
+            isValid = (isValid
+                    && IHTTPHPACKDecodeString(&cursor, end, output, outputCapacity, &used, &value)
+                    && (!isIndexing || IHTTPHPACKAddEntry(table, name.bytes, name.length, value.bytes, value.length)));
+        }
+
+        if (isValid && !name.allocated && !value.allocated && count < IHTTPHPACKMaxFields) {
+            fields[count++] = (IHTTPHeaderField){
+                { (uint32_t)(name.bytes - output), (uint32_t)name.length },
+                { (uint32_t)(value.bytes - output), (uint32_t)value.length }
+            };
+        }
+        else {
+            isTooLarge = true;
+        }
+        free(name.allocated);
+        free(value.allocated);
+
+        if (!isValid) {
+            return IHTTPParseInvalid;
+        }
+    }
+
+    *fieldCount = count;
+    return (isTooLarge ? IHTTPParseTooLarge : IHTTPParseComplete);
+}
+
+// MARK: - Encoding
+
+size_t IHTTPHPACKEncodeSizeUpdate(IHTTPHPACKTable* table, uint8_t* buffer) {
+    if (!table->needsSizeUpdate) {
+        return 0;
+    }
+    table->needsSizeUpdate = false;
+    return IHTTPHPACKEncodeInteger(buffer, 0x20, 5, table->maxSize);
+}
+
+size_t IHTTPHPACKEncodeField(IHTTPHPACKTable* table, uint8_t* buffer, const char* name, size_t nameLength,
+                             const char* value, size_t valueLength, IHTTPHPACKIndexing indexing) {
+    size_t nameIndex = 0;
+    for (size_t index = 1; index <= (IHTTPHPACKStaticTableLength + table->count); index++) {
+        const uint8_t* entryName = NULL;
+        const uint8_t* entryValue = NULL;
+        size_t entryNameLength = 0;
+        size_t entryValueLength = 0;
+        IHTTPHPACKLookup(table, index, &entryName, &entryNameLength, &entryValue, &entryValueLength);
+        if (entryNameLength == nameLength && memcmp(entryName, name, nameLength) == 0) {
+            if (indexing != IHTTPHPACKIndexingNever && entryValueLength == valueLength && memcmp(entryValue, value, valueLength) == 0) {
+                return IHTTPHPACKEncodeInteger(buffer, 0x80, 7, index);
+            }
+            nameIndex = (nameIndex ?: index);
+        }
+    }
+
+    if (indexing == IHTTPHPACKIndexingIncremental // added as the decoder will add it, unless there's no memory for it
+     && !IHTTPHPACKAddEntry(table, (const uint8_t*)name, nameLength, (const uint8_t*)value, valueLength)) {
+        indexing = IHTTPHPACKIndexingNone;
+    }
+
+    size_t written = 0;
+    if (indexing == IHTTPHPACKIndexingIncremental) {
+        written = IHTTPHPACKEncodeInteger(buffer, 0x40, 6, nameIndex);
+    }
+    else {
+        written = IHTTPHPACKEncodeInteger(buffer, (indexing == IHTTPHPACKIndexingNever ? 0x10 : 0x00), 4, nameIndex);
+    }
+
+    if (nameIndex == 0) {
+        written += IHTTPHPACKEncodeString((buffer + written), name, nameLength);
+    }
+    written += IHTTPHPACKEncodeString((buffer + written), value, valueLength);
+    return written;
+}
@@ -0,0 +1,90 @@
+#ifndef IHTTPHPACK_h
+#define IHTTPHPACK_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "IHTTPParser.h"
+
+/*! @header IHTTPHPACK.h
+    @abstract RFC 7541 HPACK header compression for HTTP/2, not part of the public API
+    @discussion each direction of a connection has its own dynamic table, which the decoder and encoder keep in step with the
+    client's by seeing every header block in order, so a block which can't be used must still be decoded */
+
+/*! @brief the number of entries in the static table */
+#define IHTTPHPACKStaticTableLength 61
+
+/*! @brief the dynamic table size both ends start with, and the largest the server uses */
+#define IHTTPHPACKDefaultTableSize 4096
+
+/*! @brief the overhead counted for each entry in the dynamic table, on top of its name and value */
+#define IHTTPHPACKEntryOverhead 32
+
+/*! @brief the most entries the largest dynamic table can hold */
+#define IHTTPHPACKMaxEntries (IHTTPHPACKDefaultTableSize / IHTTPHPACKEntryOverhead)
+
+/*! @brief the most header fields decoded from a block, the parser's limit with room for the pseudo-header fields */
+#define IHTTPHPACKMaxFields (IHTTPParserMaxHeaders + 4)
+
+/*! @brief the most bytes IHTTPHPACKEncodeField writes for a name and value of the lengths */
+#define IHTTPHPACKMaxEncodedLength(nameLength, valueLength) ((nameLength) + (valueLength) + 16)
+
+/*! @brief an entry in a dynamic table, the name followed by the value in one allocation */
+typedef struct {
+    uint8_t* bytes;
+    size_t nameLength;
+    size_t valueLength;
+} IHTTPHPACKEntry;
+
+/*! @brief a dynamic table, set up with IHTTPHPACKInitTable and released with IHTTPHPACKFreeTable */
+typedef struct {
+    IHTTPHPACKEntry entries[IHTTPHPACKMaxEntries];
+    size_t first;               /* the index in entries of the newest entry */
+    size_t count;
+    size_t size;                /* the sum of the entries' sizes */
+    size_t maxSize;             /* the size the table is held to, at most limit */
+    size_t limit;               /* the largest size the other end allows, which a size update may not exceed */
+    bool needsSizeUpdate;       /* the encoder's maxSize changed, which must be signalled at the start of the next block */
+} IHTTPHPACKTable;
+
+/*! @enum IHTTPHPACKIndexing
+    @brief how the encoder represents a field it doesn't find in either table */
+typedef enum {
+    IHTTPHPACKIndexingIncremental,  /* added to the dynamic table, for fields likely to repeat on the connection */
+    IHTTPHPACKIndexingNone,         /* not added, for values which change with each response */
+    IHTTPHPACKIndexingNever         /* not added by the encoder or any intermediary, for sensitive values */
+} IHTTPHPACKIndexing;
+
+/*! @brief an empty table held to the size, which is also the largest the other end allows until it says otherwise */
+void IHTTPHPACKInitTable(IHTTPHPACKTable* table, size_t maxSize);
+
+/*! @brief free the entries of the table */
+void IHTTPHPACKFreeTable(IHTTPHPACKTable* table);
+
+/*! @brief change the largest size the other end allows an encoder's table, it shrinks to fit and the change is signalled
+    at the start of the next block */
+void IHTTPHPACKSetTableLimit(IHTTPHPACKTable* table, size_t limit);
+
+// MARK: - Decoding
+
+/*! @brief decode a complete header block, updating the dynamic table
+    @param output holds the decoded names and values, which the fields are slices of
+    @param fields filled in with up to IHTTPHPACKMaxFields fields in the order they were sent
+    @return IHTTPParseComplete, IHTTPParseTooLarge if the fields don't fit the output or the field limit, which leaves the table
+    in step so the connection can carry on, or IHTTPParseInvalid if the block is malformed, which is a connection error */
+IHTTPParseResult IHTTPHPACKDecode(IHTTPHPACKTable* table, const uint8_t* block, size_t length,
+    uint8_t* output, size_t outputCapacity, IHTTPHeaderField* fields, unsigned* fieldCount);
+
+// MARK: - Encoding
+
+/*! @brief write the dynamic table size update the encoder owes the decoder into the buffer, which holds at least 8 bytes,
+    returns its length, 0 if none is due */
+size_t IHTTPHPACKEncodeSizeUpdate(IHTTPHPACKTable* table, uint8_t* buffer);
+
+/*! @brief encode the field, which has a lower case name, into the buffer, which holds IHTTPHPACKMaxEncodedLength bytes,
+    indexing it as requested when it isn't in either table, returns the number of bytes written */
+size_t IHTTPHPACKEncodeField(IHTTPHPACKTable* table, uint8_t* buffer, const char* name, size_t nameLength,
+    const char* value, size_t valueLength, IHTTPHPACKIndexing indexing);
+
+#endif /* IHTTPHPACK_h */
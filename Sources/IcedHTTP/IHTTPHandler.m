@@ -4,11 +4,29 @@
 #import "IHTTPRequest.h"
 #import "IHTTPResponse.h"
 #import "IHTTPServer.h"
+#import "IHTTPPrivate.h"
+
+#include "IHTTPDate.h"
+#include "IHTTPCompression.h"
+#include "IHTTPWebSocketFrame.h"
+#include <limits.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#if __APPLE__
+#define IHTTPStatModified(fileStat) ((fileStat).st_mtimespec)
+#else
+#define IHTTPStatModified(fileStat) ((fileStat).st_mtim)
+#endif
+
+/*! @brief most ranges served from one Range header, more than this and the whole file is sent instead */
+static NSUInteger const IHTTPFileHandlerMaxRanges = 16;
 
 // MARK: -
 
 @interface IHTTPFileHandler : IHTTPHandler
 @property(nonatomic,retain) NSString* filePath;
+@property(nonatomic,retain) IHTTPFileCache* fileCache;
 @end
 
 // MARK: -
@@ -16,6 +34,29 @@
 @interface IHTTPBlockHandler : IHTTPHandler
 @property(nonatomic,copy) IHTTPRequestBlock requestBlock;
 @property(nonatomic,copy) IHTTPResponseBlock  responseBlock;
+@property(nonatomic,copy) IHTTPAsyncResponseBlock asyncResponseBlock;
+@end
+
+// MARK: -
+
+@interface IHTTPStaticHandler : IHTTPHandler
+@property(nonatomic,assign) NSUInteger status;
+@property(nonatomic,retain) NSData* headerData;
+@property(nonatomic,retain) NSData* body;
+@end
+
+// MARK: -
+
+@interface IHTTPCachingHandler : IHTTPHandler
+@property(nonatomic,retain) IHTTPHandler* handler;
+@property(nonatomic,retain) IHTTPResponseCache* responseCache;
+@property(nonatomic,copy) NSArray<NSString*>* varyHeaders;
+@end
+
+// MARK: -
+
+@interface IHTTPWebSocketHandler : IHTTPHandler
+@property(nonatomic,copy) IHTTPWebSocketBlock webSocketBlock;
 @end
 
 // MARK: -
@@ -28,6 +69,31 @@
     return handler;
 }
 
++ (IHTTPHandler*) handlerWithFilePath:(NSString*) filePath cache:(IHTTPFileCache*) fileCache {
+    IHTTPFileHandler *handler = [IHTTPFileHandler new];
+    handler.filePath = filePath;
+    handler.fileCache = fileCache;
+    return handler;
+}
+
++ (IHTTPHandler*) handlerWithStatus:(NSUInteger) status headers:(NSDictionary<NSString*, NSString*>*) headers body:(NSData*) body {
+    NSMutableDictionary* allHeaders = NSMutableDictionary.new;
+    for (NSString* name in headers) { // the body's length replaces any Content-Length given
+        if ([name caseInsensitiveCompare:IHTTPContentLengthHeader] != NSOrderedSame) {
+            allHeaders[name] = headers[name];
+        }
+    }
+    if (!((status >= 100 && status < 200) || status == IHTTPStatus204NoContent || status == IHTTPStatus304NotModified)) {
+        allHeaders[IHTTPContentLengthHeader] = [NSString stringWithFormat:@"%lu", (unsigned long)body.length];
+    }
+
+    IHTTPStaticHandler* handler = [IHTTPStaticHandler new];
+    handler.status = status;
+    handler.headerData = [IHTTPResponse preparedHeaderDataWithStatus:status headers:allHeaders];
+    handler.body = body;
+    return handler;
+}
+
 + (IHTTPHandler*) handlerWithRequestBlock:(IHTTPRequestBlock) requestBlock responseBlock:(IHTTPResponseBlock) responseBlock {
     IHTTPBlockHandler* handler = [IHTTPBlockHandler new];
     handler.requestBlock = requestBlock;
@@ -41,6 +107,52 @@
     return handler;
 }
 
++ (IHTTPHandler*) handlerWithRequestBlock:(IHTTPRequestBlock) requestBlock asyncResponseBlock:(IHTTPAsyncResponseBlock) responseBlock {
+    IHTTPBlockHandler* handler = [IHTTPBlockHandler new];
+    handler.requestBlock = requestBlock;
+    handler.asyncResponseBlock = responseBlock;
+    return handler;
+}
+
++ (IHTTPHandler*) handlerWithAsyncResponseBlock:(IHTTPAsyncResponseBlock) responseBlock {
+    IHTTPBlockHandler* handler = [IHTTPBlockHandler new];
+    handler.asyncResponseBlock = responseBlock;
+    return handler;
+}
+
++ (IHTTPHandler*) handlerWithHandler:(IHTTPHandler*) handler responseCache:(IHTTPResponseCache*) responseCache varyHeaders:(NSArray<NSString*>*) varyHeaders {
+    IHTTPCachingHandler* cachingHandler = [IHTTPCachingHandler new];
+    cachingHandler.name = handler.name;
+    cachingHandler.handler = handler;
+    cachingHandler.responseCache = responseCache;
+    cachingHandler.varyHeaders = (varyHeaders ?: @[]);
+    return cachingHandler;
+}
+
++ (IHTTPHandler*) handlerWithWebSocketBlock:(IHTTPWebSocketBlock) webSocketBlock {
+    IHTTPWebSocketHandler* handler = [IHTTPWebSocketHandler new];
+    handler.webSocketBlock = webSocketBlock;
+    return handler;
+}
+
++ (IHTTPHandler*) handlerWithMetricsOfServer:(IHTTPServer*) server {
+    __weak IHTTPServer* weakServer = server; // the server retains its prototypes
+    IHTTPBlockHandler* handler = [IHTTPBlockHandler new];
+    handler.name = @"metrics";
+    handler.responseBlock = ^NSUInteger(IHTTPRequest* request, IHTTPResponse* response) {
+        NSData* metrics = ([weakServer.prometheusMetrics dataUsingEncoding:NSUTF8StringEncoding] ?: NSData.data);
+        [response sendStatus:IHTTPStatus200OK];
+        [response sendHeaders:@{
+            IHTTPContentTypeHeader: @"text/plain; version=0.0.4; charset=utf-8",
+            IHTTPContentLengthHeader: [NSString stringWithFormat:@"%lu", (unsigned long)metrics.length]
+        }];
+        [response sendBody:metrics];
+        [response completeResponse];
+        return IHTTPStatus200OK;
+    };
+    return handler;
+}
+
 // MARK: -
 
 - (BOOL)canHandleRequest:(IHTTPRequest*) request {
@@ -48,11 +160,22 @@
     return NO;
 }
 
+- (BOOL) isStateless {
+    return NO;
+}
+
 - (IHTTPHandler*) handlerForRequest:(IHTTPRequest*) request {
+    if (self.isStateless) {
+        return self;
+    }
+
     IHTTPHandler* clone = [self copy];
     return clone;
 }
 
+- (void) prepareForReuse {
+}
+
 - (NSUInteger)handleRequest:(IHTTPRequest*) request withResponse:(IHTTPResponse*) response {
     [response sendStatus:IHTTPStatus501NotImplemented];
     [response completeResponse];
@@ -73,21 +196,385 @@
 
 @implementation IHTTPFileHandler
 
-+ (NSUInteger) copyFile:(NSString*)filePath toStream:(NSFileHandle*)outStream {
-    NSUInteger chunk = 4096;
-    NSUInteger bytes = 0;
-    NSMutableData *buffer = [NSMutableData dataWithLength:chunk];
-    NSInputStream* inputStream = [NSInputStream inputStreamWithFileAtPath:filePath];
-    while ([inputStream hasBytesAvailable]) {
-        NSUInteger read = [inputStream read:buffer.mutableBytes maxLength:chunk];
-        [outStream writeData:((read < chunk) ? [buffer subdataWithRange:NSMakeRange(0, read)] : buffer)];
-        bytes += read;
+/*! @brief the Content-Type for the file's extension, application/octet-stream if it's not known */
++ (NSString*) contentTypeForPath:(NSString*) filePath {
+    static NSDictionary<NSString*, NSString*>* contentTypes = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        contentTypes = @{
+            @"html": @"text/html; charset=utf-8",
+            @"htm": @"text/html; charset=utf-8",
+            @"css": @"text/css; charset=utf-8",
+            @"js": @"text/javascript; charset=utf-8",
+            @"mjs": @"text/javascript; charset=utf-8",
+            @"json": @"application/json",
+            @"xml": @"application/xml",
+            @"txt": @"text/plain; charset=utf-8",
+            @"md": @"text/markdown; charset=utf-8",
+            @"csv": @"text/csv; charset=utf-8",
+            @"svg": @"image/svg+xml",
+            @"png": @"image/png",
+            @"jpg": @"image/jpeg",
+            @"jpeg": @"image/jpeg",
+            @"gif": @"image/gif",
+            @"webp": @"image/webp",
+            @"ico": @"image/x-icon",
+            @"woff": @"font/woff",
+            @"woff2": @"font/woff2",
+            @"ttf": @"font/ttf",
+            @"otf": @"font/otf",
+            @"wasm": @"application/wasm",
+            @"pdf": @"application/pdf",
+            @"zip": @"application/zip",
+            @"gz": @"application/gzip",
+            @"mp3": @"audio/mpeg",
+            @"mp4": @"video/mp4",
+            @"webm": @"video/webm"
+        };
+    });
+
+    return (contentTypes[filePath.pathExtension.lowercaseString] ?: @"application/octet-stream");
+}
+
+/*! @brief parse the unsigned decimal number, returns NO if the string has anything but digits or overflows */
++ (BOOL) scanByteOffset:(NSString*) string into:(unsigned long long*) offset {
+    const char* digits = string.UTF8String;
+    unsigned long long value = 0;
+    if (!digits || !*digits) {
+        return NO;
     }
 
-    return bytes;
+    for (; *digits; digits++) {
+        if (*digits < '0' || *digits > '9' || value > ((ULLONG_MAX - 9) / 10)) {
+            return NO;
+        }
+        value = ((value * 10) + (unsigned long long)(*digits - '0'));
+    }
+
+    *offset = value;
+    return YES;
+}
+
+/*! @brief the byte ranges of the file requested by the Range header value,
+    nil if the header should be ignored and the whole file sent, empty if none of the ranges can be satisfied */
++ (NSArray<NSValue*>*) byteRanges:(NSString*) rangeHeader fileSize:(unsigned long long) fileSize {
+    if (![rangeHeader.lowercaseString hasPrefix:@"bytes="]) {
+        return nil;
+    }
+
+    NSArray<NSString*>* rangeSpecs = [[rangeHeader substringFromIndex:6] componentsSeparatedByString:@","];
+    if (rangeSpecs.count > IHTTPFileHandlerMaxRanges) {
+        return nil;
+    }
+
+    NSMutableArray<NSValue*>* ranges = NSMutableArray.new;
+    for (NSString* rangeSpec in rangeSpecs) {
+        NSString* spec = [rangeSpec stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+        NSRange dash = [spec rangeOfString:@"-"];
+        if (dash.location == NSNotFound) {
+            return nil;
+        }
+
+        NSString* firstString = [spec substringToIndex:dash.location];
+        NSString* lastString = [spec substringFromIndex:(dash.location + 1)];
+        unsigned long long first = 0;
+        unsigned long long last = 0;
+
+        if (firstString.length == 0) { // suffix range, the last bytes of the file
+            if (![IHTTPFileHandler scanByteOffset:lastString into:&last]) {
+                return nil;
+            }
+            else if (last == 0 || fileSize == 0) {
+                continue;
+            }
+            first = (fileSize - MIN(last, fileSize));
+            last = (fileSize - 1);
+        }
+        else if (![IHTTPFileHandler scanByteOffset:firstString into:&first]
+              || (lastString.length > 0 && (![IHTTPFileHandler scanByteOffset:lastString into:&last] || last < first))) {
+            return nil;
+        }
+        else if (first >= fileSize) {
+            continue;
+        }
+        else {
+            last = (lastString.length > 0 ? MIN(last, (fileSize - 1)) : (fileSize - 1));
+        }
+
+        [ranges addObject:[NSValue valueWithRange:NSMakeRange((NSUInteger)first, (NSUInteger)(last - first + 1))]];
+    }
+
+    return ranges;
+}
+
+/*! @brief YES if the request's If-None-Match or If-Modified-Since header shows the client has the current file */
++ (BOOL) isNotModifiedRequest:(IHTTPRequest*) request entityTag:(NSString*) entityTag modified:(time_t) modified {
+    NSString* ifNoneMatch = [request headerFieldValue:IHTTPIfNoneMatchHeader];
+    if (ifNoneMatch) { // takes precedence over If-Modified-Since, compared weakly
+        for (NSString* listed in [ifNoneMatch componentsSeparatedByString:@","]) {
+            NSString* tag = [listed stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+            if ([tag hasPrefix:@"W/"]) {
+                tag = [tag substringFromIndex:2];
+            }
+
+            if ([tag isEqualToString:@"*"] || [tag isEqualToString:entityTag]) {
+                return YES;
+            }
+        }
+        return NO;
+    }
+
+    NSString* ifModifiedSince = [request headerFieldValue:IHTTPIfModifiedSinceHeader];
+    if (ifModifiedSince) {
+        time_t since = IHTTPParseDate(ifModifiedSince.UTF8String);
+        return (since >= 0 && modified <= since);
+    }
+
+    return NO;
+}
+
+/*! @brief send the ranges of the file as a multipart/byteranges body, each with its own Content-Range */
++ (void) sendRanges:(NSArray<NSValue*>*) ranges ofFile:(NSFileHandle*) file fileSize:(unsigned long long) fileSize contentType:(NSString*) contentType
+    headers:(NSMutableDictionary*) headers forRequest:(IHTTPRequest*) request withResponse:(IHTTPResponse*) response {
+    NSString* boundary = [NSUUID.UUID.UUIDString stringByReplacingOccurrencesOfString:@"-" withString:@""];
+    NSData* closing = [[NSString stringWithFormat:@"\r\n--%@--\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableArray<NSData*>* partHeaders = NSMutableArray.new;
+    unsigned long long contentLength = closing.length;
+
+    for (NSValue* rangeValue in ranges) {
+        NSRange range = rangeValue.rangeValue;
+        NSData* partHeader = [[NSString stringWithFormat:@"\r\n--%@\r\n%@: %@\r\n%@: bytes %lu-%lu/%llu\r\n\r\n",
+            boundary, IHTTPContentTypeHeader, contentType, IHTTPContentRangeHeader,
+            (unsigned long)range.location, (unsigned long)NSMaxRange(range) - 1, fileSize] dataUsingEncoding:NSUTF8StringEncoding];
+        [partHeaders addObject:partHeader];
+        contentLength += (partHeader.length + range.length);
+    }
+
+    headers[IHTTPContentTypeHeader] = [NSString stringWithFormat:@"multipart/byteranges; boundary=%@", boundary];
+    headers[IHTTPContentLengthHeader] = [NSString stringWithFormat:@"%llu", contentLength];
+    [response sendStatus:IHTTPStatus206PartialContent];
+    [response sendHeaders:headers];
+
+    if (![request.requestMethod isEqualToString:IHTTPHeadMethod]) {
+        [ranges enumerateObjectsUsingBlock:^(NSValue* rangeValue, NSUInteger index, BOOL* stop) {
+            NSRange range = rangeValue.rangeValue;
+            [response sendBody:partHeaders[index]];
+            [response sendFile:file offset:range.location length:range.length];
+            *stop = response.didCompleteResponse; // the connection closed
+        }];
+        [response sendBody:closing];
+    }
+}
+
+/*! @brief send the cached file, or 304 if the client has it, returns the status sent */
++ (NSUInteger) sendCacheEntry:(IHTTPFileCacheEntry*) entry forRequest:(IHTTPRequest*) request withResponse:(IHTTPResponse*) response {
+    BOOL isHead = [request.requestMethod isEqualToString:IHTTPHeadMethod];
+    if ((isHead || [request.requestMethod isEqualToString:IHTTPGetMethod])
+     && [IHTTPFileHandler isNotModifiedRequest:request entityTag:entry.entityTag modified:entry.modified]) {
+        char lastModified[IHTTPDateLength + 1] = {0};
+        IHTTPFormatDate(entry.modified, lastModified, sizeof(lastModified));
+        NSMutableDictionary* headers = [NSMutableDictionary dictionaryWithDictionary:@{
+            IHTTPETagHeader: entry.entityTag,
+            IHTTPLastModifiedHeader: @(lastModified)
+        }];
+        headers[IHTTPVaryHeader] = entry.vary;
+        [response sendStatus:IHTTPStatus304NotModified];
+        [response sendHeaders:headers];
+        return IHTTPStatus304NotModified;
+    }
+
+    [response sendPreparedHeaders:entry.headerData status:IHTTPStatus200OK body:(isHead ? nil : entry.body)];
+    return IHTTPStatus200OK;
+}
+
+/*! @brief the content codings of the precompressed files the request accepts, the client's preferred first,
+    none for a Range request, whose ranges are of the file as it is */
++ (NSArray<NSString*>*) acceptedEncodingsForRequest:(IHTTPRequest*) request {
+    NSString* acceptEncoding = [request headerFieldValue:IHTTPAcceptEncodingHeader];
+    if (!acceptEncoding || [request headerFieldValue:IHTTPRangeHeader]
+     || !([request.requestMethod isEqualToString:IHTTPGetMethod] || [request.requestMethod isEqualToString:IHTTPHeadMethod])) {
+        return nil;
+    }
+
+    return IHTTPAcceptedEncodings(acceptEncoding, @[IHTTPBrotliEncoding, IHTTPGzipEncoding]);
+}
+
+/*! @brief the path of the file's sibling precompressed in the content coding */
++ (NSString*) precompressedPath:(NSString*) filePath encoding:(NSString*) encoding {
+    return [filePath stringByAppendingPathExtension:([encoding isEqualToString:IHTTPBrotliEncoding] ? @"br" : @"gz")];
+}
+
+/*! @brief the cache key of the file's precompressed sibling in the content coding */
++ (NSString*) cacheKeyForPath:(NSString*) filePath encoding:(NSString*) encoding {
+    return [NSString stringWithFormat:@"%@ %@", encoding, filePath];
+}
+
+/*! @brief the cache key of the entry's contents compressed with gzip, which changes with its ETag */
++ (NSString*) gzipCacheKeyForEntry:(IHTTPFileCacheEntry*) entry {
+    return [NSString stringWithFormat:@"%@ %@ %@", IHTTPGzipEncoding, entry.key, entry.entityTag];
+}
+
+/*! @brief the cache entry with the entry's contents compressed with gzip, compressed and added if it's not there,
+    nil if the contents don't get any smaller */
++ (IHTTPFileCacheEntry*) gzipEntryForEntry:(IHTTPFileCacheEntry*) entry contentType:(NSString*) contentType cache:(IHTTPFileCache*) cache {
+    NSString* cacheKey = [IHTTPFileHandler gzipCacheKeyForEntry:entry];
+    IHTTPFileCacheEntry* compressed = [cache entryForKey:cacheKey];
+    if (compressed) {
+        return compressed;
+    }
+
+    NSData* body = IHTTPGzipData(entry.body, Z_BEST_COMPRESSION); // once for every request the cache serves it to
+    if (!body) {
+        return nil;
+    }
+
+    char lastModified[IHTTPDateLength + 1] = {0};
+    IHTTPFormatDate(entry.modified, lastModified, sizeof(lastModified));
+    NSString* entityTag = [NSString stringWithFormat:@"%@-%@\"", [entry.entityTag substringToIndex:(entry.entityTag.length - 1)], IHTTPGzipEncoding];
+    return [cache addEntryForKey:cacheKey body:body headers:@{
+        IHTTPContentTypeHeader: contentType,
+        IHTTPContentEncodingHeader: IHTTPGzipEncoding,
+        IHTTPContentLengthHeader: [NSString stringWithFormat:@"%lu", (unsigned long)body.length],
+        IHTTPETagHeader: entityTag,
+        IHTTPLastModifiedHeader: @(lastModified),
+        IHTTPVaryHeader: IHTTPAcceptEncodingHeader
+    } modified:entry.modified];
+}
+
+/*! @brief send the regular file at the path with its Content-Type, Content-Length and validators,
+    in place of it a precompressed sibling with a .br or .gz extension in a content coding the client accepts,
+    or its contents compressed with gzip if it's text, in the cache and the client accepts gzip,
+    answering conditional and Range requests, from the cache when it's there and adding it when it's not,
+    returns the status sent or 0 if it could not be opened */
++ (NSUInteger) sendFile:(NSString*) filePath cache:(IHTTPFileCache*) cache forRequest:(IHTTPRequest*) request withResponse:(IHTTPResponse*) response {
+    NSArray<NSString*>* encodings = [IHTTPFileHandler acceptedEncodingsForRequest:request];
+    NSString* contentType = [IHTTPFileHandler contentTypeForPath:filePath];
+    BOOL compresses = (cache && IHTTPIsCompressibleType(contentType) && [encodings containsObject:IHTTPGzipEncoding]);
+
+    IHTTPFileCacheEntry* entry = nil;
+    for (NSString* encoding in encodings) { // the precompressed files already in the cache, without touching the file system
+        if ((entry = [cache entryForKey:[IHTTPFileHandler cacheKeyForPath:filePath encoding:encoding]])) {
+            return [IHTTPFileHandler sendCacheEntry:entry forRequest:request withResponse:response];
+        }
+    }
+
+    entry = ((cache && ![request headerFieldValue:IHTTPRangeHeader]) ? [cache entryForPath:filePath] : nil);
+    IHTTPFileCacheEntry* compressed = ((entry && compresses) ? [cache entryForKey:[IHTTPFileHandler gzipCacheKeyForEntry:entry]] : nil);
+    if (compressed) {
+        return [IHTTPFileHandler sendCacheEntry:compressed forRequest:request withResponse:response];
+    }
+
+    for (NSString* encoding in encodings) {
+        NSUInteger status = [IHTTPFileHandler sendFile:[IHTTPFileHandler precompressedPath:filePath encoding:encoding] contentType:contentType
+            encoding:encoding cacheKey:[IHTTPFileHandler cacheKeyForPath:filePath encoding:encoding] cache:cache compresses:NO forRequest:request withResponse:response];
+        if (status) {
+            return status;
+        }
+    }
+
+    if (entry) {
+        compressed = (compresses ? [IHTTPFileHandler gzipEntryForEntry:entry contentType:contentType cache:cache] : nil);
+        return [IHTTPFileHandler sendCacheEntry:(compressed ?: entry) forRequest:request withResponse:response];
+    }
+
+    return [IHTTPFileHandler sendFile:filePath contentType:contentType
+        encoding:nil cacheKey:filePath cache:cache compresses:compresses forRequest:request withResponse:response];
+}
+
+/*! @brief send the regular file at the path, which is precompressed in the content coding unless it's nil, adding it to the cache under the key,
+    and sending its contents compressed with gzip in place of it if it compresses and is cached, returns the status sent or 0 if it could not be opened */
++ (NSUInteger) sendFile:(NSString*) filePath contentType:(NSString*) contentType encoding:(NSString*) encoding cacheKey:(NSString*) cacheKey
+    cache:(IHTTPFileCache*) cache compresses:(BOOL) compresses forRequest:(IHTTPRequest*) request withResponse:(IHTTPResponse*) response {
+    NSString* rangeHeader = [request headerFieldValue:IHTTPRangeHeader];
+    IHTTPFileCacheEntry* entry = nil;
+    NSFileHandle* file = [NSFileHandle fileHandleForReadingAtPath:filePath];
+    struct stat fileStat;
+    if (!file || fstat(file.fileDescriptor, &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+        return 0;
+    }
+
+    unsigned long long fileSize = (unsigned long long)fileStat.st_size;
+    struct timespec modified = IHTTPStatModified(fileStat);
+    char lastModified[IHTTPDateLength + 1] = {0};
+    IHTTPFormatDate(modified.tv_sec, lastModified, sizeof(lastModified));
+
+    NSString* entityTag = [NSString stringWithFormat:@"\"%llx-%lx-%llx\"",
+        (unsigned long long)modified.tv_sec, (unsigned long)modified.tv_nsec, fileSize];
+    NSString* lastModifiedString = @(lastModified);
+    NSMutableDictionary* headers = [NSMutableDictionary dictionaryWithDictionary:@{
+        IHTTPETagHeader: entityTag,
+        IHTTPLastModifiedHeader: lastModifiedString,
+        IHTTPAcceptRangesHeader: @"bytes"
+    }];
+    if (encoding || IHTTPIsCompressibleType(contentType)) { // the same URL is sent in other content codings
+        headers[IHTTPVaryHeader] = IHTTPAcceptEncodingHeader;
+    }
+
+    BOOL isGet = [request.requestMethod isEqualToString:IHTTPGetMethod];
+    BOOL isHead = [request.requestMethod isEqualToString:IHTTPHeadMethod];
+    if ((isGet || isHead) && [IHTTPFileHandler isNotModifiedRequest:request entityTag:entityTag modified:modified.tv_sec]) {
+        [response sendStatus:IHTTPStatus304NotModified];
+        [response sendHeaders:headers];
+        return IHTTPStatus304NotModified;
+    }
+
+    NSString* ifRange = [request headerFieldValue:IHTTPIfRangeHeader];
+    NSArray<NSValue*>* ranges = nil;
+    if (isGet && rangeHeader && (!ifRange || [ifRange isEqualToString:entityTag] || [ifRange isEqualToString:lastModifiedString])) {
+        ranges = [IHTTPFileHandler byteRanges:rangeHeader fileSize:fileSize];
+    }
+
+    if (ranges && ranges.count == 0) {
+        headers[IHTTPContentRangeHeader] = [NSString stringWithFormat:@"bytes */%llu", fileSize];
+        headers[IHTTPContentLengthHeader] = @"0";
+        [response sendStatus:IHTTPStatus416RangeNotSatisfiable];
+        [response sendHeaders:headers];
+        return IHTTPStatus416RangeNotSatisfiable;
+    }
+    else if (ranges.count > 1) {
+        [IHTTPFileHandler sendRanges:ranges ofFile:file fileSize:fileSize contentType:contentType headers:headers forRequest:request withResponse:response];
+        return IHTTPStatus206PartialContent;
+    }
+
+    NSUInteger status = IHTTPStatus200OK;
+    NSRange range = NSMakeRange(0, (NSUInteger)fileSize);
+    if (ranges.count == 1) {
+        status = IHTTPStatus206PartialContent;
+        range = ranges.firstObject.rangeValue;
+        headers[IHTTPContentRangeHeader] = [NSString stringWithFormat:@"bytes %lu-%lu/%llu",
+            (unsigned long)range.location, (unsigned long)NSMaxRange(range) - 1, fileSize];
+    }
+
+    headers[IHTTPContentTypeHeader] = contentType;
+    headers[IHTTPContentLengthHeader] = [NSString stringWithFormat:@"%lu", (unsigned long)range.length];
+    if (encoding) {
+        headers[IHTTPContentEncodingHeader] = encoding;
+    }
+
+    if (cache && status == IHTTPStatus200OK && (entry = [cache addEntryForKey:cacheKey filePath:filePath file:file headers:headers])) {
+        IHTTPFileCacheEntry* compressed = (compresses ? [IHTTPFileHandler gzipEntryForEntry:entry contentType:contentType cache:cache] : nil);
+        return [IHTTPFileHandler sendCacheEntry:(compressed ?: entry) forRequest:request withResponse:response];
+    }
+
+    [response sendStatus:status];
+    [response sendHeaders:headers];
+
+    if (!isHead) {
+        [response sendFile:file offset:range.location length:range.length];
+    }
+
+    return status;
+}
+
+- (BOOL)isStateless {
+    return YES; // the path and cache never change once the handler is registered
 }
 
 - (BOOL)canHandleRequest:(IHTTPRequest*)aRequest {
+    if ([self.fileCache containsPath:self.filePath]) { // the cache would have dropped it if it changed
+        return YES;
+    }
+
     NSFileManager* fm = [NSFileManager defaultManager];
     BOOL isDirectory = NO;
 	if ([fm fileExistsAtPath:self.filePath isDirectory:&isDirectory]) {
@@ -98,19 +585,15 @@
 }
 
 - (NSUInteger)handleRequest:(IHTTPRequest*) request withResponse:(IHTTPResponse*) response {
-    NSUInteger responseCode = IHTTPStatus500InternalServerError;
+    NSUInteger responseCode = [IHTTPFileHandler sendFile:self.filePath cache:self.fileCache forRequest:request withResponse:response];
     BOOL isDirectory = NO;
-	if ([NSFileManager.defaultManager fileExistsAtPath:self.filePath isDirectory:&isDirectory] && !isDirectory) {
-        [response sendStatus:IHTTPStatus200OK];
-        [IHTTPFileHandler copyFile:self.filePath toStream:response.output];
+	if (responseCode) {
         goto complete;
 	}
-    else if (isDirectory) {
+    else if ([NSFileManager.defaultManager fileExistsAtPath:self.filePath isDirectory:&isDirectory] && isDirectory) {
         for (NSString* defaultPage in @[@"index.html", @"default.html"]) {
-            if ([NSFileManager.defaultManager fileExistsAtPath:[self.filePath stringByAppendingPathComponent:defaultPage] isDirectory:&isDirectory]
-             && !isDirectory) {
-                [response sendStatus:IHTTPStatus200OK];
-                [IHTTPFileHandler copyFile:[self.filePath stringByAppendingPathComponent:defaultPage] toStream:response.output];
+            responseCode = [IHTTPFileHandler sendFile:[self.filePath stringByAppendingPathComponent:defaultPage] cache:self.fileCache forRequest:request withResponse:response];
+            if (responseCode) {
                 goto complete;
             }
         }
@@ -118,11 +601,13 @@
         // - get a list of the files
         // - decide on an output format
         // - render to the response.output
-        [response sendStatus:IHTTPStatus501NotImplemented]; // not implemented
+        responseCode = IHTTPStatus501NotImplemented;
+        [response sendStatus:responseCode]; // not implemented
         goto complete;
     }
     else {
-        [response sendStatus:IHTTPStatus404NotFound]; // not found
+        responseCode = IHTTPStatus404NotFound;
+        [response sendStatus:responseCode]; // not found
         goto complete;
     }
     
@@ -137,6 +622,7 @@ complete:
 - (id)copyWithZone:(nullable NSZone *)zone {
     IHTTPFileHandler* clone = [IHTTPFileHandler new];
     clone.filePath = self.filePath;
+    clone.fileCache = self.fileCache;
     return clone;
 }
 
@@ -146,6 +632,10 @@ complete:
 
 @implementation IHTTPBlockHandler
 
+- (BOOL)isStateless {
+    return YES; // any state belongs to the blocks
+}
+
 - (BOOL)canHandleRequest:(IHTTPRequest*)aRequest {
     BOOL canHandle = YES;
     if (self.requestBlock) {
@@ -155,6 +645,10 @@ complete:
 }
 
 - (NSUInteger)handleRequest:(IHTTPRequest*) request withResponse:(IHTTPResponse*) response {
+    if (self.asyncResponseBlock) { // the status isn't known until the block completes the response
+        self.asyncResponseBlock(request, response);
+        return IHTTPStatusCodeUnknown;
+    }
     return self.responseBlock(request, response);
 }
 
@@ -164,6 +658,170 @@ complete:
     IHTTPBlockHandler* clone = [IHTTPBlockHandler new];
     clone.requestBlock = self.requestBlock;
     clone.responseBlock = self.responseBlock;
+    clone.asyncResponseBlock = self.asyncResponseBlock;
+    return clone;
+}
+
+@end
+
+// MARK: -
+
+@implementation IHTTPStaticHandler
+
+- (BOOL)isStateless {
+    return YES; // the response never changes
+}
+
+- (BOOL)canHandleRequest:(IHTTPRequest*)aRequest {
+    return YES;
+}
+
+- (NSUInteger)handleRequest:(IHTTPRequest*) request withResponse:(IHTTPResponse*) response {
+    BOOL isHead = [request.requestMethod isEqualToString:IHTTPHeadMethod];
+    [response sendPreparedHeaders:self.headerData status:self.status body:(isHead ? nil : self.body)];
+    [response completeResponse];
+    return self.status;
+}
+
+// MARK: - NSCopying
+
+- (id)copyWithZone:(nullable NSZone *)zone {
+    IHTTPStaticHandler* clone = [IHTTPStaticHandler new];
+    clone.status = self.status;
+    clone.headerData = self.headerData;
+    clone.body = self.body;
+    return clone;
+}
+
+@end
+
+// MARK: -
+
+@implementation IHTTPCachingHandler
+
+- (BOOL)isStateless {
+    return YES; // the responses and the requests waiting for them are kept by the cache
+}
+
+- (BOOL)canHandleRequest:(IHTTPRequest*)aRequest {
+    return [self.handler canHandleRequest:aRequest];
+}
+
+/*! @brief the Host, the request target and the values of the varyHeaders, which tell the responses for a handler apart */
+- (NSString*)cacheKeyForRequest:(IHTTPRequest*)request {
+    size_t targetLength = 0;
+    const uint8_t* target = [request requestTargetBytes:&targetLength];
+    NSMutableString* key = [NSMutableString stringWithFormat:@"%@ ", ([request headerFieldValue:IHTTPHostHeader] ?: @"")];
+    [key appendString:[NSString.alloc initWithBytes:target length:targetLength encoding:NSISOLatin1StringEncoding]];
+    for (NSString* header in self.varyHeaders) {
+        [key appendFormat:@"\n%@", ([request headerFieldValue:header] ?: @"")];
+    }
+    return key;
+}
+
+- (NSUInteger)handleRequest:(IHTTPRequest*) request withResponse:(IHTTPResponse*) response {
+    BOOL isCacheable = (([request.requestMethod isEqualToString:IHTTPGetMethod] || [request.requestMethod isEqualToString:IHTTPHeadMethod])
+                     && ![request headerFieldValue:IHTTPRangeHeader] && ![request headerFieldValue:IHTTPAuthorizationHeader]);
+    if (!isCacheable) { // ranges and answers for one client go to the handler every time
+        return [[self.handler handlerForRequest:request] handleRequest:request withResponse:response];
+    }
+
+    return [self.responseCache sendResponseForKey:[self cacheKeyForRequest:request] varyHeaders:self.varyHeaders
+        handler:self.handler request:request response:response];
+}
+
+// MARK: - NSCopying
+
+- (id)copyWithZone:(nullable NSZone *)zone {
+    IHTTPCachingHandler* clone = [IHTTPCachingHandler new];
+    clone.handler = self.handler;
+    clone.responseCache = self.responseCache;
+    clone.varyHeaders = self.varyHeaders;
+    return clone;
+}
+
+@end
+
+// MARK: -
+
+@implementation IHTTPWebSocketHandler
+
+- (BOOL)isStateless {
+    return YES; // the connection's state belongs to its WebSocket
+}
+
+- (BOOL)canHandleRequest:(IHTTPRequest*)aRequest {
+    return YES;
+}
+
+/*! @brief YES if the header field's value has the token in its comma separated list, without regard to case */
++ (BOOL) headerValue:(NSString*) value hasToken:(NSString*) token {
+    for (NSString* element in [value componentsSeparatedByString:@","]) {
+        NSString* trimmed = [element stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+        if ([trimmed caseInsensitiveCompare:token] == NSOrderedSame) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+/*! @brief answer a request which can't be upgraded with the status and no body */
++ (NSUInteger) refuseRequest:(IHTTPRequest*) request status:(NSUInteger) status headers:(NSDictionary*) headers withResponse:(IHTTPResponse*) response {
+    NSMutableDictionary* allHeaders = [NSMutableDictionary dictionaryWithDictionary:(headers ?: @{})];
+    allHeaders[IHTTPContentLengthHeader] = @"0";
+    [response sendStatus:status];
+    [response sendHeaders:allHeaders];
+    [response completeResponse];
+    return status;
+}
+
+- (NSUInteger)handleRequest:(IHTTPRequest*) request withResponse:(IHTTPResponse*) response {
+    NSString* key = [request headerFieldValue:IHTTPSecWebSocketKeyHeader];
+    BOOL isHandshake = ([request.requestMethod isEqualToString:IHTTPGetMethod] && [request.requestVersion isEqualToString:@"HTTP/1.1"]
+                     && [IHTTPWebSocketHandler headerValue:[request headerFieldValue:IHTTPUpgradeHeader] hasToken:@"websocket"]
+                     && [IHTTPWebSocketHandler headerValue:[request headerFieldValue:IHTTPConnectionHeader] hasToken:@"upgrade"]);
+    if (!isHandshake || ![[request headerFieldValue:IHTTPSecWebSocketVersionHeader] isEqualToString:@"13"]) { // RFC 6455 section 4.4
+        return [IHTTPWebSocketHandler refuseRequest:request status:IHTTPStatus426UpgradeRequired headers:@{
+            IHTTPUpgradeHeader: @"websocket",
+            IHTTPSecWebSocketVersionHeader: @"13"
+        } withResponse:response];
+    }
+    else if ([NSData.alloc initWithBase64EncodedString:(key ?: @"") options:0].length != 16) { // a random 16 byte nonce
+        return [IHTTPWebSocketHandler refuseRequest:request status:IHTTPStatus400BadRequest headers:nil withResponse:response];
+    }
+
+    IHTTPWebSocket* webSocket = [IHTTPWebSocket webSocketWithRequest:request];
+    self.webSocketBlock(request, webSocket);
+    if (webSocket.isClosed) { // the block turned the client away
+        [webSocket closeConnectionWithCode:IHTTPWebSocketClosePolicyViolation];
+        return [IHTTPWebSocketHandler refuseRequest:request status:IHTTPStatus403Forbidden headers:nil withResponse:response];
+    }
+
+    const char* keyBytes = key.UTF8String;
+    char accept[IHTTPWebSocketAcceptLength + 1];
+    IHTTPWebSocketAcceptKey(keyBytes, strlen(keyBytes), accept);
+    NSMutableDictionary* headers = [NSMutableDictionary dictionaryWithDictionary:@{
+        IHTTPUpgradeHeader: @"websocket",
+        IHTTPConnectionHeader: @"Upgrade",
+        IHTTPSecWebSocketAcceptHeader: @(accept)
+    }];
+    if (webSocket.protocol) {
+        headers[IHTTPSecWebSocketProtocolHeader] = webSocket.protocol;
+    }
+
+    response.webSocket = webSocket; // the worker hands it the connection once the response is written
+    response.keepAlive = YES; // whatever the keep-alive limits, the connection stays open, it isn't read for another request
+    [response sendStatus:IHTTPStatus101SwitchingProtocols];
+    [response sendHeaders:headers];
+    [response completeResponse];
+    return IHTTPStatus101SwitchingProtocols;
+}
+
+// MARK: - NSCopying
+
+- (id)copyWithZone:(nullable NSZone *)zone {
+    IHTTPWebSocketHandler* clone = [IHTTPWebSocketHandler new];
+    clone.webSocketBlock = self.webSocketBlock;
     return clone;
 }
 
@@ -0,0 +1,54 @@
+#import <Foundation/Foundation.h>
+
+/*! @header IHTTPMetrics.h
+    @abstract IHTTPMetrics counts a worker's requests and the time they take, not part of the public API */
+
+/*! @enum IHTTPMetricsStage
+    @brief the stages of a request whose latency is recorded */
+typedef NS_ENUM(NSUInteger, IHTTPMetricsStage) {
+    IHTTPMetricsHeaderRead,     /* accepted, or the first bytes of a kept-alive request, to the head being parsed */
+    IHTTPMetricsHandlerWait,    /* the head being parsed to the handler starting */
+    IHTTPMetricsHandler,        /* the handler starting to the response completing */
+    IHTTPMetricsTotal,          /* accepted, or the first bytes, to the response completing */
+    IHTTPMetricsStageCount
+};
+
+/*! @class IHTTPMetrics
+    @brief counters and latency histograms for one worker, by stage, status code and handler
+    @discussion each worker records into its own metrics with relaxed atomic adds, without locks, and any thread may read them.
+    The handlers are counted by the metricsIndex of their prototypes, up to the number of handlers the metrics were made for,
+    handlers registered later are counted under index 0 */
+@interface IHTTPMetrics : NSObject
+
+/*! @brief the number of handler indexes the metrics count separately */
+@property(nonatomic, readonly) NSUInteger handlerCount;
+
+// MARK: -
+
+/*! @brief empty metrics counting the handlers with indexes below the count separately */
++ (IHTTPMetrics*) metricsWithHandlerCount:(NSUInteger) handlerCount;
+
+// MARK: -
+
+/*! @brief count an accepted connection */
+- (void) countConnection;
+
+/*! @brief count a request whose head has been parsed */
+- (void) countRequest;
+
+/*! @brief count a response by its status without timing it, e.g. one the server sent for a request which couldn't be read */
+- (void) countResponseStatus:(NSUInteger) status;
+
+/*! @brief record a completed response with its status, the index of its handler, and the monotonic times of its stages */
+- (void) recordResponseStatus:(NSUInteger) status handlerIndex:(NSUInteger) handlerIndex started:(NSTimeInterval) started
+    parsed:(NSTimeInterval) parsed handlerStarted:(NSTimeInterval) handlerStarted completed:(NSTimeInterval) completed;
+
+// MARK: -
+
+/*! @brief add the other metrics into these, for a snapshot of several workers */
+- (void) addMetrics:(IHTTPMetrics*) metrics;
+
+/*! @brief append the metrics to the text in the Prometheus text exposition format, naming the handlers with the labels by index */
+- (void) appendPrometheusText:(NSMutableString*) text handlerLabels:(NSArray<NSString*>*) handlerLabels;
+
+@end
@@ -0,0 +1,192 @@
+#import "IHTTPMetrics.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/*! @brief the upper bounds of the latency histogram buckets in seconds, the last bucket is unbounded */
+static const double IHTTPMetricsBucketBounds[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+#define IHTTPMetricsBucketCount ((sizeof(IHTTPMetricsBucketBounds) / sizeof(IHTTPMetricsBucketBounds[0])) + 1)
+
+/*! @brief the status codes counted separately, from 100 to 599 */
+#define IHTTPMetricsStatusBase 100
+#define IHTTPMetricsStatusCount 500
+
+/*! @brief a latency histogram, the sum is kept in microseconds so it can be added atomically */
+typedef struct {
+    atomic_ullong buckets[IHTTPMetricsBucketCount];
+    atomic_ullong count;
+    atomic_ullong sumMicroseconds;
+} IHTTPHistogram;
+
+/*! @brief the requests and response times of one handler */
+typedef struct {
+    atomic_ullong requests;
+    IHTTPHistogram duration;
+} IHTTPHandlerMetrics;
+
+static void IHTTPHistogramRecord(IHTTPHistogram* histogram, NSTimeInterval seconds) {
+    seconds = MAX(seconds, 0);
+    size_t bucket = 0;
+    while (bucket < (IHTTPMetricsBucketCount - 1) && seconds > IHTTPMetricsBucketBounds[bucket]) {
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&histogram->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sumMicroseconds, (unsigned long long)(seconds * 1e6), memory_order_relaxed);
+}
+
+static void IHTTPHistogramAdd(IHTTPHistogram* histogram, IHTTPHistogram* other) {
+    for (size_t bucket = 0; bucket < IHTTPMetricsBucketCount; bucket++) {
+        atomic_fetch_add_explicit(&histogram->buckets[bucket], atomic_load_explicit(&other->buckets[bucket], memory_order_relaxed), memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&histogram->count, atomic_load_explicit(&other->count, memory_order_relaxed), memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sumMicroseconds, atomic_load_explicit(&other->sumMicroseconds, memory_order_relaxed), memory_order_relaxed);
+}
+
+/*! @brief append the histogram's cumulative buckets, sum and count, with the labels, which may be empty, in front of le */
+static void IHTTPHistogramAppend(IHTTPHistogram* histogram, NSMutableString* text, NSString* name, NSString* labels) {
+    NSString* separator = (labels.length > 0 ? @"," : @"");
+    unsigned long long cumulative = 0;
+    for (size_t bucket = 0; bucket < IHTTPMetricsBucketCount; bucket++) {
+        cumulative += atomic_load_explicit(&histogram->buckets[bucket], memory_order_relaxed);
+        NSString* bound = (bucket < (IHTTPMetricsBucketCount - 1) ? [NSString stringWithFormat:@"%g", IHTTPMetricsBucketBounds[bucket]] : @"+Inf");
+        [text appendFormat:@"%@_bucket{%@%@le=\"%@\"} %llu\n", name, labels, separator, bound, cumulative];
+    }
+    NSString* braced = (labels.length > 0 ? [NSString stringWithFormat:@"{%@}", labels] : @"");
+    [text appendFormat:@"%@_sum%@ %.6f\n", name, braced, (atomic_load_explicit(&histogram->sumMicroseconds, memory_order_relaxed) / 1e6)];
+    [text appendFormat:@"%@_count%@ %llu\n", name, braced, atomic_load_explicit(&histogram->count, memory_order_relaxed)];
+}
+
+/*! @brief the label value with its backslashes, quotes and newlines escaped */
+static NSString* IHTTPMetricsLabelValue(NSString* value) {
+    return [[[value stringByReplacingOccurrencesOfString:@"\\" withString:@"\\\\"]
+        stringByReplacingOccurrencesOfString:@"\"" withString:@"\\\""]
+        stringByReplacingOccurrencesOfString:@"\n" withString:@"\\n"];
+}
+
+// MARK: -
+
+@interface IHTTPMetrics ()
+@property(nonatomic, assign) NSUInteger handlerCountStorage;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPMetrics {
+    atomic_ullong _connections;
+    atomic_ullong _requests;
+    atomic_ullong _statuses[IHTTPMetricsStatusCount];
+    IHTTPHistogram _stages[IHTTPMetricsStageCount];
+    IHTTPHandlerMetrics* _handlers;
+}
+
++ (IHTTPMetrics*) metricsWithHandlerCount:(NSUInteger) handlerCount {
+    IHTTPMetrics* metrics = IHTTPMetrics.new; // the ivars start zeroed
+    metrics.handlerCountStorage = MAX(handlerCount, 1);
+    metrics->_handlers = calloc(metrics.handlerCountStorage, sizeof(IHTTPHandlerMetrics));
+    return metrics;
+}
+
+- (void) dealloc {
+    free(_handlers);
+}
+
+// MARK: - Properties
+
+- (NSUInteger) handlerCount {
+    return self.handlerCountStorage;
+}
+
+// MARK: -
+
+- (void) countConnection {
+    atomic_fetch_add_explicit(&_connections, 1, memory_order_relaxed);
+}
+
+- (void) countRequest {
+    atomic_fetch_add_explicit(&_requests, 1, memory_order_relaxed);
+}
+
+- (void) countResponseStatus:(NSUInteger) status {
+    if (status >= IHTTPMetricsStatusBase && status < (IHTTPMetricsStatusBase + IHTTPMetricsStatusCount)) {
+        atomic_fetch_add_explicit(&_statuses[status - IHTTPMetricsStatusBase], 1, memory_order_relaxed);
+    }
+}
+
+- (void) recordResponseStatus:(NSUInteger) status handlerIndex:(NSUInteger) handlerIndex started:(NSTimeInterval) started
+    parsed:(NSTimeInterval) parsed handlerStarted:(NSTimeInterval) handlerStarted completed:(NSTimeInterval) completed {
+    [self countResponseStatus:status];
+
+    if (started > 0) {
+        IHTTPHistogramRecord(&_stages[IHTTPMetricsHeaderRead], (parsed - started));
+        IHTTPHistogramRecord(&_stages[IHTTPMetricsTotal], (completed - started));
+    }
+    IHTTPHistogramRecord(&_stages[IHTTPMetricsHandlerWait], (handlerStarted - parsed));
+    IHTTPHistogramRecord(&_stages[IHTTPMetricsHandler], (completed - handlerStarted));
+
+    IHTTPHandlerMetrics* handler = &_handlers[(handlerIndex < self.handlerCount ? handlerIndex : 0)];
+    atomic_fetch_add_explicit(&handler->requests, 1, memory_order_relaxed);
+    IHTTPHistogramRecord(&handler->duration, (completed - handlerStarted));
+}
+
+// MARK: -
+
+- (void) addMetrics:(IHTTPMetrics*) metrics {
+    atomic_fetch_add_explicit(&_connections, atomic_load_explicit(&metrics->_connections, memory_order_relaxed), memory_order_relaxed);
+    atomic_fetch_add_explicit(&_requests, atomic_load_explicit(&metrics->_requests, memory_order_relaxed), memory_order_relaxed);
+    for (NSUInteger index = 0; index < IHTTPMetricsStatusCount; index++) {
+        atomic_fetch_add_explicit(&_statuses[index], atomic_load_explicit(&metrics->_statuses[index], memory_order_relaxed), memory_order_relaxed);
+    }
+    for (NSUInteger stage = 0; stage < IHTTPMetricsStageCount; stage++) {
+        IHTTPHistogramAdd(&_stages[stage], &metrics->_stages[stage]);
+    }
+    for (NSUInteger index = 0; index < MIN(self.handlerCount, metrics.handlerCount); index++) {
+        atomic_fetch_add_explicit(&_handlers[index].requests, atomic_load_explicit(&metrics->_handlers[index].requests, memory_order_relaxed), memory_order_relaxed);
+        IHTTPHistogramAdd(&_handlers[index].duration, &metrics->_handlers[index].duration);
+    }
+}
+
+- (void) appendPrometheusText:(NSMutableString*) text handlerLabels:(NSArray<NSString*>*) handlerLabels {
+    [text appendString:@"# HELP ihttp_connections_accepted_total Connections accepted.\n# TYPE ihttp_connections_accepted_total counter\n"];
+    [text appendFormat:@"ihttp_connections_accepted_total %llu\n", atomic_load_explicit(&_connections, memory_order_relaxed)];
+
+    [text appendString:@"# HELP ihttp_requests_total Requests whose heads were parsed.\n# TYPE ihttp_requests_total counter\n"];
+    [text appendFormat:@"ihttp_requests_total %llu\n", atomic_load_explicit(&_requests, memory_order_relaxed)];
+
+    [text appendString:@"# HELP ihttp_responses_total Completed responses by status code.\n# TYPE ihttp_responses_total counter\n"];
+    for (NSUInteger index = 0; index < IHTTPMetricsStatusCount; index++) {
+        unsigned long long count = atomic_load_explicit(&_statuses[index], memory_order_relaxed);
+        if (count > 0) {
+            [text appendFormat:@"ihttp_responses_total{code=\"%lu\"} %llu\n", (unsigned long)(index + IHTTPMetricsStatusBase), count];
+        }
+    }
+
+    static NSString* const stageNames[IHTTPMetricsStageCount] = { @"header_read", @"handler_wait", @"handler", @"total" };
+    [text appendString:@"# HELP ihttp_request_duration_seconds Request latency by stage.\n# TYPE ihttp_request_duration_seconds histogram\n"];
+    for (NSUInteger stage = 0; stage < IHTTPMetricsStageCount; stage++) {
+        IHTTPHistogramAppend(&_stages[stage], text, @"ihttp_request_duration_seconds", [NSString stringWithFormat:@"stage=\"%@\"", stageNames[stage]]);
+    }
+
+    [text appendString:@"# HELP ihttp_handler_requests_total Completed responses by handler.\n# TYPE ihttp_handler_requests_total counter\n"];
+    for (NSUInteger index = 0; index < self.handlerCount; index++) {
+        unsigned long long count = atomic_load_explicit(&_handlers[index].requests, memory_order_relaxed);
+        if (count > 0) {
+            NSString* label = IHTTPMetricsLabelValue(index < handlerLabels.count ? handlerLabels[index] : @"other");
+            [text appendFormat:@"ihttp_handler_requests_total{handler=\"%@\"} %llu\n", label, count];
+        }
+    }
+
+    [text appendString:@"# HELP ihttp_handler_duration_seconds Time from the handler starting to the response completing, by handler.\n# TYPE ihttp_handler_duration_seconds histogram\n"];
+    for (NSUInteger index = 0; index < self.handlerCount; index++) {
+        if (atomic_load_explicit(&_handlers[index].requests, memory_order_relaxed) > 0) {
+            NSString* label = IHTTPMetricsLabelValue(index < handlerLabels.count ? handlerLabels[index] : @"other");
+            IHTTPHistogramAppend(&_handlers[index].duration, text, @"ihttp_handler_duration_seconds", [NSString stringWithFormat:@"handler=\"%@\"", label]);
+        }
+    }
+}
+
+@end
@@ -0,0 +1,379 @@
+#include "IHTTPParser.h"
+
+#include <string.h>
+#include <strings.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*! @brief 1 for the characters allowed in a method or header field name, the tchar of RFC 9110 */
+static const uint8_t IHTTPTokenCharacters[256] = {
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1, ['+'] = 1, ['-'] = 1, ['.'] = 1,
+    ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1, ['~'] = 1,
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+    ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1, ['G'] = 1, ['H'] = 1, ['I'] = 1, ['J'] = 1,
+    ['K'] = 1, ['L'] = 1, ['M'] = 1, ['N'] = 1, ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1, ['S'] = 1, ['T'] = 1,
+    ['U'] = 1, ['V'] = 1, ['W'] = 1, ['X'] = 1, ['Y'] = 1, ['Z'] = 1,
+    ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1, ['g'] = 1, ['h'] = 1, ['i'] = 1, ['j'] = 1,
+    ['k'] = 1, ['l'] = 1, ['m'] = 1, ['n'] = 1, ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1, ['s'] = 1, ['t'] = 1,
+    ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1, ['y'] = 1, ['z'] = 1
+};
+
+/*! @brief the offset of the first newline at or after from, or length if there isn't one, 16 bytes at a time where the CPU allows */
+static size_t IHTTPFindNewline(const uint8_t* buffer, size_t from, size_t length) {
+    size_t offset = from;
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; (offset + 16) <= length; offset += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(buffer + offset));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        if (mask) {
+            return (offset + (size_t)__builtin_ctz((unsigned)mask));
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    for (; (offset + 16) <= length; offset += 16) {
+        uint8x16_t matches = vceqq_u8(vld1q_u8(buffer + offset), newline);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0); // 4 bits per byte
+        if (mask) {
+            return (offset + (size_t)(__builtin_ctzll(mask) >> 2));
+        }
+    }
+#endif
+    const uint8_t* found = memchr((buffer + offset), '\n', (length - offset));
+    return (found ? (size_t)(found - buffer) : length);
+}
+
+/*! @brief the end of the line starting at offset, without its CR, and the start of the next line */
+static size_t IHTTPLineEnd(const uint8_t* buffer, size_t offset, size_t headLength, size_t* nextLine) {
+    size_t newline = IHTTPFindNewline(buffer, offset, headLength);
+    *nextLine = (newline + 1);
+    return ((newline > offset && buffer[newline - 1] == '\r') ? (newline - 1) : newline);
+}
+
+static IHTTPParseResult IHTTPParseRequestLine(IHTTPParsedRequest* parsed, const uint8_t* buffer, size_t offset, size_t lineEnd) {
+    size_t index = offset;
+    while (index < lineEnd && IHTTPTokenCharacters[buffer[index]]) {
+        index++;
+    }
+    if (index == offset || index >= lineEnd || buffer[index] != ' ') {
+        return IHTTPParseInvalid;
+    }
+    parsed->method = (IHTTPSlice){ (uint32_t)offset, (uint32_t)(index - offset) };
+
+    size_t targetStart = ++index;
+    while (index < lineEnd && buffer[index] > ' ' && buffer[index] != 0x7F) {
+        index++;
+    }
+    if (index == targetStart || index >= lineEnd || buffer[index] != ' ') {
+        return IHTTPParseInvalid;
+    }
+    parsed->target = (IHTTPSlice){ (uint32_t)targetStart, (uint32_t)(index - targetStart) };
+
+    index++;
+    if ((lineEnd - index) != 8 || memcmp((buffer + index), "HTTP/1.", 7) != 0 || buffer[index + 7] < '0' || buffer[index + 7] > '9') {
+        return IHTTPParseInvalid;
+    }
+    parsed->versionMinor = (buffer[index + 7] == '0' ? 0 : 1);
+
+    return IHTTPParseComplete;
+}
+
+static IHTTPParseResult IHTTPParseHeaderLine(IHTTPParsedRequest* parsed, const uint8_t* buffer, size_t offset, size_t lineEnd) {
+    if (parsed->headerCount >= IHTTPParserMaxHeaders) {
+        return IHTTPParseTooLarge;
+    }
+
+    size_t index = offset;
+    while (index < lineEnd && IHTTPTokenCharacters[buffer[index]]) {
+        index++;
+    }
+    if (index == offset || index >= lineEnd || buffer[index] != ':') { // no whitespace is allowed before the colon, or line folding
+        return IHTTPParseInvalid;
+    }
+    IHTTPSlice name = { (uint32_t)offset, (uint32_t)(index - offset) };
+
+    index++;
+    while (index < lineEnd && (buffer[index] == ' ' || buffer[index] == '\t')) {
+        index++;
+    }
+
+    size_t valueStart = index;
+    size_t valueEnd = valueStart;
+    for (; index < lineEnd; index++) {
+        uint8_t character = buffer[index];
+        if ((character < ' ' && character != '\t') || character == 0x7F) {
+            return IHTTPParseInvalid;
+        }
+        else if (character != ' ' && character != '\t') {
+            valueEnd = (index + 1);
+        }
+    }
+
+    parsed->headers[parsed->headerCount++] = (IHTTPHeaderField){ name, { (uint32_t)valueStart, (uint32_t)(valueEnd - valueStart) } };
+    return IHTTPParseComplete;
+}
+
+IHTTPParseResult IHTTPParseRequest(IHTTPParsedRequest* parsed, const uint8_t* buffer, size_t length) {
+    if (parsed->headLength > 0) {
+        return IHTTPParseComplete;
+    }
+
+    size_t start = 0;
+    while (start < length && (buffer[start] == '\r' || buffer[start] == '\n')) { // empty lines before the request line are ignored
+        start++;
+    }
+
+    // find the empty line which ends the head, resuming where the last call stopped
+    size_t headLength = 0;
+    size_t offset = (parsed->scanned > start ? parsed->scanned : start);
+    while (offset < length) {
+        size_t newline = IHTTPFindNewline(buffer, offset, length);
+        if (newline >= length) {
+            offset = length;
+            break;
+        }
+        else if ((newline + 1) < length && buffer[newline + 1] == '\n') {
+            headLength = (newline + 2);
+            break;
+        }
+        else if ((newline + 2) < length && buffer[newline + 1] == '\r' && buffer[newline + 2] == '\n') {
+            headLength = (newline + 3);
+            break;
+        }
+        else if ((newline + 1) >= length || ((newline + 2) >= length && buffer[newline + 1] == '\r')) {
+            offset = newline; // can't tell if the next line is empty yet
+            break;
+        }
+        offset = (newline + 1);
+    }
+
+    if (headLength == 0) {
+        parsed->scanned = offset;
+        return ((length - start) > IHTTPParserMaxHeaderSize ? IHTTPParseTooLarge : IHTTPParseIncomplete);
+    }
+    else if ((headLength - start) > IHTTPParserMaxHeaderSize || headLength > UINT32_MAX) {
+        return IHTTPParseTooLarge;
+    }
+
+    // parse the request line and each of the header field lines
+    size_t nextLine = 0;
+    size_t lineEnd = IHTTPLineEnd(buffer, start, headLength, &nextLine);
+    IHTTPParseResult result = IHTTPParseRequestLine(parsed, buffer, start, lineEnd);
+
+    parsed->headerCount = 0;
+    for (size_t line = nextLine; result == IHTTPParseComplete;) {
+        lineEnd = IHTTPLineEnd(buffer, line, headLength, &nextLine);
+        if (lineEnd == line) { // the empty line
+            break;
+        }
+        result = IHTTPParseHeaderLine(parsed, buffer, line, lineEnd);
+        line = nextLine;
+    }
+
+    if (result == IHTTPParseComplete) {
+        parsed->headLength = headLength;
+    }
+
+    return result;
+}
+
+int IHTTPFindHeader(const IHTTPParsedRequest* parsed, const uint8_t* buffer, const char* name, size_t nameLength, unsigned start) {
+    for (unsigned index = start; index < parsed->headerCount; index++) {
+        const IHTTPHeaderField* field = &parsed->headers[index];
+        if (field->name.length == nameLength && strncasecmp((const char*)(buffer + field->name.offset), name, nameLength) == 0) {
+            return (int)index;
+        }
+    }
+    return -1;
+}
+
+int IHTTPHasToken(const uint8_t* value, size_t length, const char* token, size_t tokenLength) {
+    for (size_t start = 0; start <= length;) {
+        size_t end = start;
+        while (end < length && value[end] != ',') {
+            end++;
+        }
+
+        size_t first = start;
+        size_t last = end;
+        while (first < last && (value[first] == ' ' || value[first] == '\t')) {
+            first++;
+        }
+        while (last > first && (value[last - 1] == ' ' || value[last - 1] == '\t')) {
+            last--;
+        }
+        if ((last - first) == tokenLength && strncasecmp((const char*)(value + first), token, tokenLength) == 0) {
+            return 1;
+        }
+        start = (end + 1);
+    }
+    return 0;
+}
+
+// MARK: - Chunked Transfer Coding
+
+/*! @enum IHTTPChunkState */
+enum {
+    IHTTPChunkSize = 0,         /* hex digits of the chunk size */
+    IHTTPChunkSizeEnd,          /* whitespace after the digits, then a chunk extension or the CR */
+    IHTTPChunkExtension,        /* a chunk extension, names and values which are tokens */
+    IHTTPChunkExtensionQuoted,  /* a chunk extension value which is a quoted string */
+    IHTTPChunkExtensionEscape,  /* the character after a backslash in a quoted string */
+    IHTTPChunkSizeLineEnd,      /* the LF after the CR which ends the size line */
+    IHTTPChunkData,             /* remaining bytes of chunk data */
+    IHTTPChunkDataEnd,          /* the CR after the chunk data */
+    IHTTPChunkDataLineEnd,      /* the LF after the chunk data */
+    IHTTPChunkTrailer,          /* the start of a trailer field line, or the CR of the empty line which ends the body */
+    IHTTPChunkTrailerLine,      /* the rest of a trailer field line */
+    IHTTPChunkTrailerLineEnd,   /* the LF which ends a trailer field line */
+    IHTTPChunkTrailerEnd,       /* the LF of the empty line which ends the body */
+    IHTTPChunkDone
+};
+
+static int IHTTPHexValue(uint8_t character) {
+    if (character >= '0' && character <= '9') {
+        return (character - '0');
+    }
+    else if ((character | 0x20) >= 'a' && (character | 0x20) <= 'f') {
+        return ((character | 0x20) - 'a' + 10);
+    }
+    return -1;
+}
+
+/*! @brief 1 for the characters allowed in a quoted string, besides the backslash and quote, or after a backslash, RFC 9110 section 5.6.4 */
+static int IHTTPIsQuotedCharacter(uint8_t character) {
+    return (character == '\t' || (character >= ' ' && character != 0x7F));
+}
+
+/*! @brief the state after the character within a chunk size line or trailer field line, or IHTTPChunkDone if it isn't allowed there,
+    only the framing of RFC 9112 section 7.1 is accepted since a proxy in front which reads the same bytes differently
+    would pass the rest of the body on as another request */
+static int IHTTPChunkNextState(IHTTPChunkDecoder* decoder, uint8_t character) {
+    switch (decoder->state) {
+        case IHTTPChunkSizeEnd:
+            return (character == ' ' || character == '\t' ? IHTTPChunkSizeEnd
+                  : character == ';' ? IHTTPChunkExtension
+                  : character == '\r' ? IHTTPChunkSizeLineEnd
+                  : IHTTPChunkDone);
+        case IHTTPChunkExtension:
+            return (IHTTPTokenCharacters[character] || character == ' ' || character == '\t' || character == ';' || character == '='
+                    ? IHTTPChunkExtension
+                  : character == '"' ? IHTTPChunkExtensionQuoted
+                  : character == '\r' ? IHTTPChunkSizeLineEnd
+                  : IHTTPChunkDone);
+        case IHTTPChunkExtensionQuoted:
+            return (character == '"' ? IHTTPChunkExtension
+                  : character == '\\' ? IHTTPChunkExtensionEscape
+                  : IHTTPIsQuotedCharacter(character) ? IHTTPChunkExtensionQuoted
+                  : IHTTPChunkDone);
+        case IHTTPChunkExtensionEscape:
+            return (IHTTPIsQuotedCharacter(character) ? IHTTPChunkExtensionQuoted : IHTTPChunkDone);
+        case IHTTPChunkTrailerLine:
+            return (character == '\r' ? IHTTPChunkTrailerLineEnd
+                  : (character >= ' ' || character == '\t') && character != 0x7F ? IHTTPChunkTrailerLine
+                  : IHTTPChunkDone);
+    }
+    return IHTTPChunkDone;
+}
+
+IHTTPParseResult IHTTPDecodeChunk(IHTTPChunkDecoder* decoder, const uint8_t* bytes, size_t length, size_t* consumed,
+    const uint8_t** data, size_t* dataLength) {
+    size_t offset = 0;
+    *consumed = 0;
+    *data = NULL;
+    *dataLength = 0;
+
+    while (offset < length && decoder->state != IHTTPChunkDone) {
+        uint8_t character = bytes[offset];
+        switch (decoder->state) {
+            case IHTTPChunkSize: {
+                int digit = IHTTPHexValue(character);
+                if (digit >= 0) {
+                    if (decoder->remaining > (UINT64_MAX >> 4)) {
+                        return IHTTPParseTooLarge;
+                    }
+                    decoder->remaining = ((decoder->remaining << 4) | (uint64_t)digit);
+                    decoder->lineLength++;
+                    offset++;
+                    break;
+                }
+                else if (decoder->lineLength == 0) { // at least one digit
+                    return IHTTPParseInvalid;
+                }
+                decoder->state = IHTTPChunkSizeEnd;
+            } /* fall through */
+            case IHTTPChunkSizeEnd:
+            case IHTTPChunkExtension:
+            case IHTTPChunkExtensionQuoted:
+            case IHTTPChunkExtensionEscape:
+            case IHTTPChunkTrailerLine: {
+                int state = IHTTPChunkNextState(decoder, character);
+                if (state == IHTTPChunkDone) {
+                    return IHTTPParseInvalid;
+                }
+                else if (++decoder->lineLength > IHTTPParserMaxHeaderSize) { // extensions and trailer fields are skipped, but not forever
+                    return IHTTPParseTooLarge;
+                }
+                decoder->state = state;
+                offset++;
+                break;
+            }
+            case IHTTPChunkSizeLineEnd:
+                if (character != '\n') {
+                    return IHTTPParseInvalid;
+                }
+                decoder->lineLength = 0;
+                decoder->state = (decoder->remaining > 0 ? IHTTPChunkData : IHTTPChunkTrailer);
+                offset++;
+                break;
+            case IHTTPChunkData: {
+                size_t available = (length - offset);
+                size_t take = (decoder->remaining < available ? (size_t)decoder->remaining : available);
+                decoder->remaining -= take;
+                if (decoder->remaining == 0) {
+                    decoder->state = IHTTPChunkDataEnd;
+                }
+                *data = (bytes + offset);
+                *dataLength = take;
+                *consumed = (offset + take);
+                return IHTTPParseIncomplete; // one piece of data for each call
+            }
+            case IHTTPChunkDataEnd:
+            case IHTTPChunkDataLineEnd:
+                if (character != (decoder->state == IHTTPChunkDataEnd ? '\r' : '\n')) { // exactly CRLF after the data
+                    return IHTTPParseInvalid;
+                }
+                decoder->state = (decoder->state == IHTTPChunkDataEnd ? IHTTPChunkDataLineEnd : IHTTPChunkSize);
+                offset++;
+                break;
+            case IHTTPChunkTrailer:
+                if (character == '\r') {
+                    decoder->state = IHTTPChunkTrailerEnd;
+                }
+                else if (IHTTPTokenCharacters[character]) { // the name of a trailer field, never whitespace or a folded line
+                    decoder->state = IHTTPChunkTrailerLine;
+                }
+                else {
+                    return IHTTPParseInvalid;
+                }
+                offset++;
+                break;
+            case IHTTPChunkTrailerLineEnd:
+            case IHTTPChunkTrailerEnd:
+                if (character != '\n') {
+                    return IHTTPParseInvalid;
+                }
+                decoder->state = (decoder->state == IHTTPChunkTrailerEnd ? IHTTPChunkDone : IHTTPChunkTrailer);
+                offset++;
+                break;
+        }
+    }
+
+    *consumed = offset;
+    return (decoder->state == IHTTPChunkDone ? IHTTPParseComplete : IHTTPParseIncomplete);
+}
@@ -0,0 +1,75 @@
+#ifndef IHTTPParser_h
+#define IHTTPParser_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! @header IHTTPParser.h
+    @abstract incremental HTTP/1.x request head parser, not part of the public API
+    @discussion the parser records the request line and header fields as offsets into the caller's buffer,
+    which must hold every byte passed so far, nothing is copied or allocated */
+
+/*! @brief the most header fields accepted in a request */
+#define IHTTPParserMaxHeaders 64
+
+/*! @brief the most bytes accepted in the request line and header fields, including the blank line which ends them */
+#define IHTTPParserMaxHeaderSize (16 * 1024)
+
+/*! @enum IHTTPParseResult */
+typedef enum {
+    IHTTPParseInvalid = -2,     /* the request is malformed and the connection should be closed with 400 */
+    IHTTPParseTooLarge = -1,    /* the request head is over the limits and the connection should be closed with 431 */
+    IHTTPParseIncomplete = 0,   /* more bytes are needed, call again with the same buffer extended */
+    IHTTPParseComplete = 1      /* the request head has been parsed */
+} IHTTPParseResult;
+
+/*! @brief a slice of the buffer */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} IHTTPSlice;
+
+/*! @brief a header field name and value, without surrounding whitespace */
+typedef struct {
+    IHTTPSlice name;
+    IHTTPSlice value;
+} IHTTPHeaderField;
+
+/*! @brief the state of the parser and the parsed request head, zero it before the first call */
+typedef struct {
+    size_t scanned;             /* bytes already searched for the end of the head */
+    size_t headLength;          /* bytes in the request line, header fields and blank line, once complete */
+    IHTTPSlice method;
+    IHTTPSlice target;
+    int versionMinor;           /* 0 for HTTP/1.0, 1 for HTTP/1.1 */
+    unsigned headerCount;
+    IHTTPHeaderField headers[IHTTPParserMaxHeaders];
+} IHTTPParsedRequest;
+
+/*! @brief continue parsing the request head in the buffer, which starts with the bytes passed on earlier calls */
+IHTTPParseResult IHTTPParseRequest(IHTTPParsedRequest* parsed, const uint8_t* buffer, size_t length);
+
+/*! @brief the state of a chunked transfer coding decoder, zero it before the first call */
+typedef struct {
+    int state;
+    uint64_t remaining;         /* bytes left in the current chunk */
+    size_t lineLength;          /* bytes of chunk extension or trailer fields skipped, which are limited like the head */
+} IHTTPChunkDecoder;
+
+/*! @brief decode the next part of a chunked body from the bytes, which start where the last call stopped
+    @param consumed set to the number of bytes used, the caller passes the bytes after them on the next call
+    @param data set to the next piece of the body within the bytes, or NULL
+    @param dataLength set to the length of the piece, which is 0 if there isn't one
+    @return IHTTPParseIncomplete while the body continues, IHTTPParseComplete once the last chunk and trailer fields are consumed,
+    IHTTPParseInvalid for a malformed chunk, or IHTTPParseTooLarge for a chunk size or trailer section over the limits */
+IHTTPParseResult IHTTPDecodeChunk(IHTTPChunkDecoder* decoder, const uint8_t* bytes, size_t length, size_t* consumed,
+    const uint8_t** data, size_t* dataLength);
+
+/*! @brief the index of the first header field at or after start with the name, compared without regard to case, or -1 */
+int IHTTPFindHeader(const IHTTPParsedRequest* parsed, const uint8_t* buffer, const char* name, size_t nameLength, unsigned start);
+
+/*! @brief 1 if one of the comma separated elements of the field value is the token, compared without regard to case after
+    the whitespace around the element is trimmed, or 0, so 'close' is found in 'keep-alive, Close' but not in 'closed' */
+int IHTTPHasToken(const uint8_t* value, size_t length, const char* token, size_t tokenLength);
+
+#endif /* IHTTPParser_h */
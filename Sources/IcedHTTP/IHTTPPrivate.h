@@ -0,0 +1,276 @@
+#import <Foundation/Foundation.h>
+
+#import "IHTTPHandler.h"
+#import "IHTTPRequest.h"
+#import "IHTTPResponse.h"
+#import "IHTTPServer.h"
+#import "IHTTPFileCache.h"
+#import "IHTTPResponseCache.h"
+#import "IHTTPWebSocket.h"
+#import "IHTTPEventLoop.h"
+#import "IHTTPConnection.h"
+#import "IHTTPAccessLog.h"
+#import "IHTTP2Session.h"
+
+/*! @header IHTTPPrivate.h
+    @abstract interfaces shared between the IcedHTTP classes, not part of the public API */
+
+// MARK: -
+
+@interface IHTTPRequest () <IHTTPEventLoopSource>
+
+/*! @brief the event loop which delivers the input to the request */
+@property(nonatomic, weak) IHTTPEventLoop* eventLoop;
+
+/*! @brief the connection the request arrived on */
+@property(nonatomic, weak) IHTTPConnection* connection;
+
+/*! @brief the monotonic time the connection was accepted, or the first bytes of the request arrived on a kept-alive connection */
+@property(nonatomic, assign) NSTimeInterval startTime;
+
+/*! @brief the parameters captured by the route which matched the request */
+@property(nonatomic, retain) NSDictionary<NSString*, NSString*>* pathParameters;
+
+/*! @brief the HTTP/2 stream the request was read from, which holds it, or nil for a request read from the socket */
+@property(nonatomic, weak) IHTTP2Stream* stream;
+
+/*! @brief the request head as the client sent it, or as it was rebuilt from an HTTP/2 header block */
+@property(nonatomic, readonly) NSData* requestHead;
+
+/*! @brief the request target as the client sent it, without copying, valid while the request is */
+- (const uint8_t*) requestTargetBytes:(size_t*) length;
+
+/*! @brief YES if the request has the header field, and one of its comma separated elements is the whole token without regard to case,
+    or if the token is NULL */
+- (BOOL) headerField:(NSString*) headerField containsToken:(const char*) token;
+
+/*! @brief the number of Content-Length body bytes which are still waiting to be read from the input */
+@property(nonatomic, readonly) NSUInteger unreadBodyLength;
+
+/*! @brief NO if the end of the body can't be found, so the connection can't carry another request,
+    decodes whatever is left of a chunked body which has already arrived */
+@property(nonatomic, readonly) BOOL canReadNextRequest;
+
+/*! @brief create the next request on a kept-alive connection, carrying over any pipelined data
+    and skipping whatever part of this request's body the handler did not read */
+- (IHTTPRequest*) nextRequest;
+
+/*! @brief read the headers of the request, under the connection's header timeout,
+    or its idle timeout until the first bytes of a kept-alive request arrive */
+- (void) readHeadersWithTimeout:(IHTTPTimeoutKind) timeout;
+
+/*! @brief collect the body for a handler which runs on the worker thread, so readBody returns it without waiting for the socket,
+    then call the block on the worker thread, at once if the body has already arrived or is declared longer than the maxBodyLength */
+- (void) collectBodyForHandler:(dispatch_block_t) block;
+
+/*! @brief answer a request which can't be read with the status and close the connection,
+    or reset its stream if it was read from one */
+- (void) rejectRequest:(NSUInteger) status;
+
+/*! @brief parse the head an HTTP/2 stream rebuilt as an HTTP/1.1 request, with the Content-Length of the complete body,
+    and tell the delegate, on the loop thread */
+- (void) readStreamHead:(NSData*) head body:(NSData*) body;
+
+/*! @brief the body can't be read, so the connection can't be reused, tell the chunk block why */
+- (void) failBody:(IHTTPRequestErrorNumber) errorNumber;
+
+/*! @brief close the input and tell the delegate the request did close */
+- (void) closeConnection;
+
+/*! @brief the bytes which arrived after the head of a request the connection was upgraded on, which belong to the new protocol,
+    taken from the request so it won't pass them to a next request */
+- (NSData*) takeUpgradeData;
+
+@end
+
+// MARK: -
+
+@interface IHTTPHandler ()
+
+/*! @brief the prototype a copied handler was made from, which keys the worker's pool of idle copies */
+@property(nonatomic, weak) IHTTPHandler* prototype;
+
+/*! @brief the index the server's metrics count the prototype's requests under, 0 until it's registered */
+@property(nonatomic, assign) NSUInteger metricsIndex;
+
+@end
+
+// MARK: -
+
+@interface IHTTPServer ()
+
+/*! @brief the bounded queue handlers run on while the server is running with a handlerConcurrency, otherwise nil */
+@property(nonatomic, readonly) NSOperationQueue* handlerQueue;
+
+/*! @brief the first registered prototype which can handle the request */
+- (IHTTPHandler*) prototypeForRequest:(IHTTPRequest*) request;
+
+/*! @brief the names of the registered prototypes by their metricsIndex, index 0 counts the handlers registered after the server started */
+@property(atomic, readonly) NSArray<NSString*>* handlerLabels;
+
+/*! @brief tell the delegate a request's headers have been parsed, on the worker's thread */
+- (void) didReceiveRequest:(IHTTPRequest*) request;
+
+/*! @brief tell the delegate a response has completed, on the worker's thread */
+- (void) didCompleteResponse:(IHTTPResponse*) response;
+
+@end
+
+// MARK: -
+
+@interface IHTTPResponse ()
+
+/*! @brief the request the response answers */
+@property(nonatomic, weak) IHTTPRequest* request;
+
+/*! @brief the connection the response is sent on, saves the worker searching for it when the response completes */
+@property(nonatomic, weak) IHTTPConnection* connection;
+
+/*! @brief the handler sending the response, returned to its worker's pool when the response completes */
+@property(nonatomic, retain) IHTTPHandler* handler;
+
+/*! @brief the event loop of the worker which owns the connection, output sent on other threads is written there in order */
+@property(nonatomic, weak) IHTTPEventLoop* eventLoop;
+
+/*! @brief the monotonic times the request started, its headers were parsed and its handler started, for the worker's metrics */
+@property(nonatomic, assign) NSTimeInterval startTime;
+@property(nonatomic, assign) NSTimeInterval parsedTime;
+@property(nonatomic, assign) NSTimeInterval handlerStartTime;
+
+/*! @brief the metricsIndex of the handler's prototype */
+@property(nonatomic, assign) NSUInteger metricsIndex;
+
+/*! @brief the WebSocket the connection switches to once a 101 Switching Protocols response has been written */
+@property(nonatomic, retain) IHTTPWebSocket* webSocket;
+
+/*! @brief the HTTP/2 stream the response is sent on instead of an output, or nil */
+@property(nonatomic, retain) IHTTP2Stream* stream;
+
+/*! @brief the number of bytes written to the output, headers included */
+@property(nonatomic, readonly) unsigned long long bytesSent;
+
+/*! @brief YES once the handler has returned, set by the worker on its loop thread */
+@property(nonatomic, assign) BOOL didHandlerReturn;
+
+/*! @brief YES once the last of the output has been written and the delegate told the response is complete */
+@property(nonatomic, readonly) BOOL didFinishResponse;
+
+/*! @brief send a status line and headers serialized ahead of time, followed by the Date and Connection headers and the body, in one write
+    @param headerData the status line and header lines, each ending in CRLF, without the blank line which ends the headers */
+- (void) sendPreparedHeaders:(NSData*) headerData status:(NSUInteger) status body:(NSData*) body;
+
+/*! @brief the status line and headers serialized for sendPreparedHeaders:status:body:, without the Date, Connection
+    and Transfer-Encoding headers it sends with each response */
++ (NSData*) preparedHeaderDataWithStatus:(NSUInteger) status headers:(NSDictionary*) headers;
+
+/*! @brief a response with no output, which keeps its body in recordedBody instead of writing it, so it can answer other requests,
+    it's written to on the caller's thread and its delegate is told when it completes */
++ (IHTTPResponse*) recordingResponseForRequest:(IHTTPRequest*) request;
+
+/*! @brief a response which sends its headers and body as frames on the HTTP/2 stream, on the stream's loop thread */
++ (IHTTPResponse*) responseForStream:(IHTTP2Stream*) stream;
+
+/*! @brief the body of a recording response, without transfer coding, or nil if the response isn't recording */
+@property(nonatomic, readonly) NSData* recordedBody;
+
+/*! @brief the status line and headers of a recording response, as sendPreparedHeaders: takes them,
+    with the Content-Length of the recorded body */
+- (NSData*) recordedHeaderData;
+
+@end
+
+// MARK: -
+
+@interface IHTTPAccessLog ()
+
+/*! @brief format a line for the request into the ring, or count it as dropped if the ring is full, from any thread without locking */
+- (void) logRequest:(IHTTPRequest*) request remoteAddress:(NSString*) remoteAddress status:(NSUInteger) status
+    bytesSent:(unsigned long long) bytesSent duration:(NSTimeInterval) duration;
+
+@end
+
+// MARK: -
+
+@interface IHTTPResponseCache ()
+
+/*! @brief answer a GET or HEAD request with the response cached for the key, or run a handler from the prototype for it,
+    recording the response of a GET for the cache and for the other GET requests for the key which wait for it meanwhile
+    @returns the status sent, or 0 if it's sent when the handler another request is running completes */
+- (NSUInteger) sendResponseForKey:(NSString*) key varyHeaders:(NSArray<NSString*>*) varyHeaders
+    handler:(IHTTPHandler*) prototype request:(IHTTPRequest*) request response:(IHTTPResponse*) response;
+
+@end
+
+// MARK: -
+
+@interface IHTTPWebSocket () <IHTTPEventLoopSource>
+
+/*! @brief a WebSocket for the upgrade request, which holds the frames sent on it until it opens */
++ (IHTTPWebSocket*) webSocketWithRequest:(IHTTPRequest*) request;
+
+/*! @brief start reading frames and write the frames held for the client, on the loop thread once the 101 Switching Protocols response
+    has been written, the data is what the client sent after the request */
+- (void) openWithData:(NSData*) data;
+
+/*! @brief the connection has been quiet for the ping interval, ping the client, or close the connection if it didn't answer
+    the last ping or the close frame, on the loop thread */
+- (void) pingTimerDidExpire;
+
+/*! @brief send a close frame with the code, unless one has been sent, and close the connection if it's open without waiting for
+    the client's, when the server stops or the upgrade fails, on the loop thread once the WebSocket has opened */
+- (void) closeConnectionWithCode:(NSUInteger) code;
+
+@end
+
+// MARK: -
+
+/*! @class IHTTPFileCacheEntry
+    @brief the contents and prepared response headers of a file in an IHTTPFileCache */
+@interface IHTTPFileCacheEntry : NSObject
+
+/*! @brief the key the entry is found by, the path of the file for its contents as they are */
+@property(nonatomic, readonly) NSString* key;
+
+/*! @brief the path of the file the entry was read from and which is watched for changes, nil for an entry made from another */
+@property(nonatomic, readonly) NSString* filePath;
+
+/*! @brief the serialized 200 OK status line and headers for the file */
+@property(nonatomic, readonly) NSData* headerData;
+
+/*! @brief the contents of the file */
+@property(nonatomic, readonly) NSData* body;
+
+/*! @brief the ETag sent with the file */
+@property(nonatomic, readonly) NSString* entityTag;
+
+/*! @brief the Vary header sent with the file, which a 304 Not Modified repeats, or nil */
+@property(nonatomic, readonly) NSString* vary;
+
+/*! @brief the modification time of the file in seconds */
+@property(nonatomic, readonly) time_t modified;
+
+@end
+
+// MARK: -
+
+@interface IHTTPFileCache ()
+
+/*! @brief YES if the file is in the cache, without counting a hit or a miss */
+- (BOOL) containsPath:(NSString*) filePath;
+
+/*! @brief the entry for the file, marking it most recently used, or nil if it's not in the cache */
+- (IHTTPFileCacheEntry*) entryForPath:(NSString*) filePath;
+
+/*! @brief the entry with the key, marking it most recently used and counting a hit, or nil without counting a miss */
+- (IHTTPFileCacheEntry*) entryForKey:(NSString*) key;
+
+/*! @brief read the open file into a new entry under the key with the headers provided, evicting older entries to make room,
+    the entry is dropped when the file changes, returns nil if the file is too large or changed while it was read */
+- (IHTTPFileCacheEntry*) addEntryForKey:(NSString*) key filePath:(NSString*) filePath file:(NSFileHandle*) file headers:(NSDictionary*) headers;
+
+/*! @brief add an entry for a body made from a file, e.g. its compressed contents, which isn't watched,
+    so the key must change with the file's modification time, it ages out of the cache once it does,
+    returns nil if the body is too large */
+- (IHTTPFileCacheEntry*) addEntryForKey:(NSString*) key body:(NSData*) body headers:(NSDictionary*) headers modified:(time_t) modified;
+
+@end
@@ -0,0 +1,142 @@
+#import "IHTTPRateLimiter.h"
+
+#import "IHTTPEventLoop.h"
+
+#include <math.h>
+#include <stdatomic.h>
+
+/*! @brief the number of independently locked tables the buckets are spread across */
+static NSUInteger const IHTTPRateLimiterShardCount = 16;
+
+/*! @brief the most clients a table holds before the buckets which have refilled are dropped */
+static NSUInteger const IHTTPRateLimiterShardCapacity = 4096;
+
+// MARK: -
+
+/*! @class IHTTPTokenBucket
+    @brief the tokens a client held when it last sent a request */
+@interface IHTTPTokenBucket : NSObject
+@property(nonatomic, assign) double tokens;
+@property(nonatomic, assign) NSTimeInterval updated;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPTokenBucket
+
+@end
+
+// MARK: -
+
+@interface IHTTPRateLimiter ()
+@property(nonatomic, assign) double rateStorage;
+@property(nonatomic, assign) NSUInteger burstStorage;
+@property(nonatomic, retain) NSArray<NSLock*>* locks;
+@property(nonatomic, retain) NSArray<NSMutableDictionary<NSString*, IHTTPTokenBucket*>*>* shards;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPRateLimiter {
+    atomic_ulong _limitedCount; // counted by the workers without taking a lock
+}
+
++ (IHTTPRateLimiter*) rateLimiterWithRate:(double) rate burst:(NSUInteger) burst {
+    if (!(rate > 0)) {
+        return nil;
+    }
+
+    NSMutableArray<NSLock*>* locks = [NSMutableArray arrayWithCapacity:IHTTPRateLimiterShardCount];
+    NSMutableArray<NSMutableDictionary<NSString*, IHTTPTokenBucket*>*>* shards = [NSMutableArray arrayWithCapacity:IHTTPRateLimiterShardCount];
+    for (NSUInteger index = 0; index < IHTTPRateLimiterShardCount; index++) {
+        [locks addObject:NSLock.new];
+        [shards addObject:NSMutableDictionary.new];
+    }
+
+    IHTTPRateLimiter* limiter = IHTTPRateLimiter.new;
+    limiter.rateStorage = rate;
+    limiter.burstStorage = MAX(burst, 1);
+    limiter.locks = locks;
+    limiter.shards = shards;
+    return limiter;
+}
+
+// MARK: - Properties
+
+- (double) rate {
+    return self.rateStorage;
+}
+
+- (NSUInteger) burst {
+    return self.burstStorage;
+}
+
+- (NSUInteger) retryAfter {
+    return (NSUInteger)MAX(ceil(1 / self.rate), 1);
+}
+
+- (NSUInteger) limitedCount {
+    return (NSUInteger)atomic_load(&_limitedCount);
+}
+
+// MARK: -
+
+- (BOOL) admitClient:(NSString*) clientAddress {
+    if (!clientAddress) {
+        return YES;
+    }
+
+    double rate = self.rate;
+    double burst = (double)self.burst;
+    NSUInteger shard = (clientAddress.hash % IHTTPRateLimiterShardCount);
+    NSLock* lock = self.locks[shard];
+    NSMutableDictionary<NSString*, IHTTPTokenBucket*>* buckets = self.shards[shard];
+    NSTimeInterval now = IHTTPMonotonicTime();
+
+    [lock lock];
+    IHTTPTokenBucket* bucket = buckets[clientAddress];
+    if (bucket) { // earned since its last request
+        bucket.tokens = MIN(burst, (bucket.tokens + ((now - bucket.updated) * rate)));
+    }
+    else {
+        if (buckets.count >= IHTTPRateLimiterShardCapacity) {
+            [self dropRefilledBuckets:buckets now:now];
+        }
+        bucket = IHTTPTokenBucket.new;
+        bucket.tokens = burst;
+        buckets[clientAddress] = bucket;
+    }
+    bucket.updated = now;
+
+    BOOL admitted = (bucket.tokens >= 1);
+    if (admitted) {
+        bucket.tokens -= 1;
+    }
+    [lock unlock];
+
+    if (!admitted) {
+        atomic_fetch_add(&_limitedCount, 1);
+    }
+    return admitted;
+}
+
+/*! @brief forget the clients whose buckets are full again, with the table's lock held, clients still being limited are kept */
+- (void) dropRefilledBuckets:(NSMutableDictionary<NSString*, IHTTPTokenBucket*>*) buckets now:(NSTimeInterval) now {
+    double rate = self.rate;
+    double burst = (double)self.burst;
+    NSArray<NSString*>* refilled = [buckets keysOfEntriesPassingTest:^BOOL(NSString* clientAddress, IHTTPTokenBucket* bucket, BOOL* stop) {
+        return ((bucket.tokens + ((now - bucket.updated) * rate)) >= burst);
+    }].allObjects;
+    [buckets removeObjectsForKeys:refilled];
+}
+
+// MARK: - NSObject
+
+- (NSString*)description {
+    return [NSString stringWithFormat:@"<%@:%p rate: %g burst: %lu limited: %lu>",
+        NSStringFromClass(self.class), self, self.rate, (unsigned long)self.burst, (unsigned long)self.limitedCount];
+}
+
+@end
@@ -1,18 +1,64 @@
 #import "include/IHTTPRequest.h"
+#import "include/IHTTPServer.h"
+
+#import "IHTTPConstants.h"
+#import "IHTTPPrivate.h"
+#import "IHTTPWorker.h"
+
+#include "IHTTP2Frame.h"
+#include "IHTTPParser.h"
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+
+NSString* const IHTTPRequestErrorDomain = @"IHTTPRequestError";
+
+/*! @brief the most capacity reserved up front for a collected body, larger bodies grow as they arrive */
+static NSUInteger const IHTTPRequestBodyCapacity = (1024 * 1024);
+
+/*! @enum IHTTPBodyFraming
+    @brief how the end of the request body is found */
+typedef NS_ENUM(NSUInteger, IHTTPBodyFraming) {
+    IHTTPBodyFramingNone,
+    IHTTPBodyFramingLength,
+    IHTTPBodyFramingChunked
+};
+
+// MARK: -
 
 @interface IHTTPRequest ()
-@property(nonatomic, readonly) CFHTTPMessageRef messageRef;
-@property(nonatomic, retain) id messageRefStorage;
+@property(nonatomic, retain) NSData* headData;
+@property(nonatomic, retain) NSMutableData* headBuffer;
+@property(nonatomic, retain) NSString* requestMethodStorage;
+@property(nonatomic, retain) NSDictionary* requestHeadersStorage;
 @property(nonatomic, retain) NSDate* requestTimeStorage;
+@property(nonatomic, retain) NSData* bodyStorage;
+@property(nonatomic, retain) NSError* bodyError;
+@property(nonatomic, retain) NSData* bufferedBody;
+@property(nonatomic, retain) NSData* pipelinedData;
+@property(nonatomic, copy) IHTTPBodyChunkBlock bodyBlock;
+@property(nonatomic, assign) IHTTPBodyFraming bodyFraming;
+@property(nonatomic, assign) NSUInteger contentLength;
+@property(nonatomic, assign) unsigned long long bodyRemaining;
+@property(nonatomic, assign) NSUInteger discardLength;
+@property(nonatomic, assign) BOOL keepAliveStorage;
+@property(nonatomic, assign) BOOL didParseHeaders;
+@property(nonatomic, assign) BOOL didReadBody;
+@property(nonatomic, assign) BOOL didFailBody;
+@property(nonatomic, assign) BOOL didCollectBody;
+@property(nonatomic, assign) BOOL isBodyPaused;
+@property(nonatomic, assign) BOOL didSendContinue;
+@property(nonatomic, assign) BOOL isReadingInput;
+@property(nonatomic, assign) BOOL isClosed;
 
 @end
 
 // MARK: -
 
-@implementation IHTTPRequest
-
-+ (IHTTPRequest*) requestWithMessageRef:(CFHTTPMessageRef) messageRef {
-    return [IHTTPRequest.alloc initWithMessageRef:messageRef];
+@implementation IHTTPRequest {
+    IHTTPParsedRequest _parsed;
+    IHTTPChunkDecoder _chunks;
 }
 
 // MARK: - Initializers
@@ -24,35 +70,177 @@
     return self;
 }
 
-- (id) initWithMessageRef:(CFHTTPMessageRef) mRef {
-    if ((self = self.init)) {
-        self.messageRefStorage = CFBridgingRelease(mRef);
+// MARK: - Properties
+
+- (NSString*) requestMethod {
+    if (!self.requestMethodStorage && self.headData) {
+        self.requestMethodStorage = [self stringForSlice:_parsed.method];
     }
-    return self;
+    return self.requestMethodStorage;
 }
 
-// MARK: - Properties
+- (NSDictionary*) requestHeaders {
+    if (!self.requestHeadersStorage && self.headData) {
+        NSMutableDictionary* headers = [NSMutableDictionary dictionaryWithCapacity:_parsed.headerCount];
+        for (unsigned index = 0; index < _parsed.headerCount; index++) {
+            NSString* name = [self stringForSlice:_parsed.headers[index].name];
+            NSString* value = [self stringForSlice:_parsed.headers[index].value];
+            headers[name] = (headers[name] ? [NSString stringWithFormat:@"%@, %@", headers[name], value] : value);
+        }
+        self.requestHeadersStorage = headers;
+    }
+    return self.requestHeadersStorage;
+}
 
-- (CFHTTPMessageRef) messageRef {
-    return (__bridge CFHTTPMessageRef)self.messageRefStorage;
+- (NSURL*) requestURL {
+    return (self.headData ? [NSURL URLWithString:[self stringForSlice:_parsed.target]] : nil);
 }
 
-- (NSString*) requestMethod {
-    return (self.messageRef ? CFBridgingRelease(CFHTTPMessageCopyRequestMethod(self.messageRef)) : nil);
+- (const uint8_t*) requestTargetBytes:(size_t*) length {
+    *length = (self.headData ? _parsed.target.length : 0);
+    return (self.headData ? ((const uint8_t*)self.headData.bytes + _parsed.target.offset) : NULL);
 }
 
-- (NSDictionary*) requestHeaders {
-    return (self.messageRef ? CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(self.messageRef)) : nil);
+- (NSString*) requestVersion {
+    if (self.stream) { // the head was rebuilt as HTTP/1.1
+        return (self.headData ? @"HTTP/2.0" : nil);
+    }
+    return (self.headData ? (_parsed.versionMinor == 0 ? @"HTTP/1.0" : @"HTTP/1.1") : nil);
 }
 
-- (NSURL*) requestURL {
-    return (self.messageRef ? CFBridgingRelease(CFHTTPMessageCopyRequestURL(self.messageRef)) : nil);
+- (NSData*) requestHead {
+    return self.headData;
 }
 
 - (NSDate*) requestTime {
     return self.requestTimeStorage;
 }
 
+- (BOOL) keepAlive {
+    return self.keepAliveStorage;
+}
+
+- (long long) expectedContentLength {
+    return (self.bodyFraming == IHTTPBodyFramingChunked ? -1 : (long long)self.contentLength);
+}
+
+- (NSUInteger) unreadBodyLength {
+    if (self.didReadBody || self.bodyFraming != IHTTPBodyFramingLength) {
+        return 0;
+    }
+    return (NSUInteger)(self.bodyRemaining - MIN(self.bufferedBody.length, self.bodyRemaining));
+}
+
+- (BOOL) canReadNextRequest {
+    if (self.isClosed || self.didFailBody) {
+        return NO;
+    }
+    else if (self.didReadBody) {
+        return YES;
+    }
+    else if (!self.didSendContinue && [self expectsContinue]) { // the client may still be holding the body back
+        return NO;
+    }
+    else if (self.bodyFraming == IHTTPBodyFramingChunked) { // the end of the body can only be found by decoding it
+        self.bodyBlock = nil;
+        self.isBodyPaused = NO;
+        [self deliverBufferedBody];
+        return self.didReadBody;
+    }
+    return YES; // nextRequest skips the rest of the Content-Length
+}
+
+- (NSString*) headerFieldValue:(NSString*) headerField {
+    if (!self.headData) {
+        return nil;
+    }
+
+    const char* name = headerField.UTF8String;
+    size_t nameLength = strlen(name);
+    NSString* value = nil;
+    for (int index = IHTTPFindHeader(&_parsed, self.headData.bytes, name, nameLength, 0); index >= 0;
+             index = IHTTPFindHeader(&_parsed, self.headData.bytes, name, nameLength, (unsigned)(index + 1))) {
+        NSString* fieldValue = [self stringForSlice:_parsed.headers[index].value];
+        value = (value ? [NSString stringWithFormat:@"%@, %@", value, fieldValue] : fieldValue); // repeated fields are combined
+    }
+    return value;
+}
+
+/*! @brief YES if the request has the header field, and one of its comma separated elements is the whole token without regard to case,
+    or if the token is NULL */
+- (BOOL) headerField:(NSString*) headerField containsToken:(const char*) token {
+    const uint8_t* head = self.headData.bytes;
+    const char* name = headerField.UTF8String;
+    size_t nameLength = strlen(name);
+    size_t tokenLength = (token ? strlen(token) : 0);
+    for (int index = IHTTPFindHeader(&_parsed, head, name, nameLength, 0); index >= 0;
+             index = IHTTPFindHeader(&_parsed, head, name, nameLength, (unsigned)(index + 1))) {
+        IHTTPSlice value = _parsed.headers[index].value;
+        if (!token) {
+            return YES;
+        }
+        if (IHTTPHasToken((head + value.offset), value.length, token, tokenLength)) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+/*! @brief sets the Content-Length of the request, or 0 if there isn't one, returns NO if a field isn't all digits or the fields disagree,
+    a recipient can't know where such a body ends so the request is rejected rather than guessed at, RFC 9112 section 6.3 */
+- (BOOL) contentLengthField:(NSUInteger*) contentLength {
+    const uint8_t* head = self.headData.bytes;
+    const char* name = IHTTPContentLengthHeader.UTF8String;
+    BOOL found = NO;
+    *contentLength = 0;
+    for (int index = IHTTPFindHeader(&_parsed, head, name, strlen(name), 0); index >= 0;
+             index = IHTTPFindHeader(&_parsed, head, name, strlen(name), (unsigned)(index + 1))) {
+        IHTTPSlice value = _parsed.headers[index].value;
+        NSUInteger fieldLength = 0;
+        if (value.length == 0) {
+            return NO;
+        }
+        for (uint32_t offset = 0; offset < value.length; offset++) {
+            uint8_t digit = head[value.offset + offset];
+            if (digit < '0' || digit > '9' || fieldLength > ((NSUIntegerMax - 9) / 10)) { // a list, sign, space or hex is invalid
+                return NO;
+            }
+            fieldLength = ((fieldLength * 10) + (digit - '0'));
+        }
+
+        if (found && fieldLength != *contentLength) {
+            return NO;
+        }
+        *contentLength = fieldLength;
+        found = YES;
+    }
+    return YES;
+}
+
+/*! @brief returns NO unless the Transfer-Encoding of the request ends with chunked, which appears only once,
+    sets isChunkedOnly to YES if there are no other codings, which the server doesn't decode */
+- (BOOL) transferEncodingIsChunked:(BOOL*) isChunkedOnly {
+    NSMutableArray<NSString*>* codings = NSMutableArray.new;
+    for (NSString* element in [[self headerFieldValue:IHTTPTransferEncodingHeader] componentsSeparatedByString:@","]) {
+        NSString* coding = [element stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+        if (coding.length > 0) {
+            [codings addObject:coding.lowercaseString];
+        }
+    }
+
+    NSUInteger chunkedCount = 0;
+    for (NSString* coding in codings) {
+        chunkedCount += ([coding isEqualToString:@"chunked"] ? 1 : 0);
+    }
+    *isChunkedOnly = (codings.count == 1);
+    return (chunkedCount == 1 && [codings.lastObject isEqualToString:@"chunked"]);
+}
+
+/*! @brief a string with the bytes of the request head, header values are ISO-8859-1 so this never fails */
+- (NSString*) stringForSlice:(IHTTPSlice) slice {
+    return [NSString.alloc initWithBytes:((const uint8_t*)self.headData.bytes + slice.offset) length:slice.length encoding:NSISOLatin1StringEncoding];
+}
+
 // MARK: -
 
 + (IHTTPRequest*) requestWithInput:(NSFileHandle*) input {
@@ -63,58 +251,548 @@
 
 // MARK: -
 
+- (IHTTPRequest*) nextRequest {
+    [self stopReadingInput];
+    self.bodyBlock = nil;
+
+    IHTTPRequest* next = [IHTTPRequest requestWithInput:self.input];
+    next.eventLoop = self.eventLoop;
+    next.connection = self.connection;
+    next.discardLength = self.unreadBodyLength;
+    next.pipelinedData = self.pipelinedData;
+    self.pipelinedData = nil;
+    return next;
+}
+
 - (void) readHeaders {
+    [self readHeadersWithTimeout:IHTTPTimeoutHeader];
+}
+
+- (void) readHeadersWithTimeout:(IHTTPTimeoutKind) timeout {
     if (!self.didReadHeaders) {
-        self.messageRefStorage = CFBridgingRelease(CFHTTPMessageCreateEmpty(kCFAllocatorDefault, YES));
-		[NSNotificationCenter.defaultCenter
-			addObserver:self
-			selector:@selector(receiveIncomingDataNotification:)
-			name:NSFileHandleDataAvailableNotification
-			object:self.input];
-		
-        [self.input waitForDataInBackgroundAndNotify];
+        memset(&_parsed, 0, sizeof(_parsed));
         self.didReadHeaders = YES;
+        [self.connection startTimeout:timeout];
+
+        if (self.pipelinedData.length > 0) { // parse on the next pass of the loop, so pipelined requests aren't handled recursively
+            IHTTPRequest* request = self;
+            [self.eventLoop performBlock:^{
+                [request readPipelinedData];
+            }];
+        }
+        else {
+            [self startReadingInput];
+        }
     }
 }
 
 - (NSData*) readBody {
-    if (self.didReadHeaders) {
-        return [self.input readDataToEndOfFile];
-    }
-    else {
+    if (!self.didParseHeaders) {
         [self readHeaders];
         return nil;
     }
+
+    if (self.didCollectBody) {
+        return self.bodyStorage;
+    }
+
+    __block NSData* collected = nil;
+    if (self.eventLoop.isLoopThread) { // waiting here would stop the loop which reads the body, the worker collects it before the handler runs
+        BOOL isTooLarge = (self.maxBodyLength > 0 && self.contentLength > self.maxBodyLength);
+        if (!isTooLarge && ![self isBodyBuffered]) { // called before the handler, from a delegate method
+            NSAssert(NO, @"%@ readBody would block the worker thread before the body was collected", self);
+            if (self.connection.worker.server.loggingLevel >= IHTTPServerLoggingErrors) {
+                NSLog(@"%@ readBody would block the worker thread before the body was collected, use readBodyWithCompletion:", self);
+            }
+            return nil;
+        }
+
+        self.didCollectBody = YES;
+        self.bodyBlock = [self collectBodyWithCompletion:^(NSData* body, NSError* error) {
+            collected = body;
+        }];
+        if (isTooLarge) {
+            [self failBody:IHTTPRequestBodyTooLargeError];
+        }
+        else {
+            [self deliverBufferedBody];
+        }
+    }
+    else { // the loop reads the body, and the timer wheel fails it after the body timeout
+        self.didCollectBody = YES;
+        dispatch_semaphore_t collectedBody = dispatch_semaphore_create(0);
+        [self readBodyWithCompletion:^(NSData* body, NSError* error) {
+            collected = body;
+            dispatch_semaphore_signal(collectedBody);
+        }];
+        dispatch_semaphore_wait(collectedBody, DISPATCH_TIME_FOREVER);
+    }
+
+    self.bodyStorage = collected;
+    return self.bodyStorage;
+}
+
+/*! @brief YES if the rest of the body arrived with the head, or can't be read at all, so collecting it won't wait for the socket */
+- (BOOL) isBodyBuffered {
+    if (self.didReadBody || self.didFailBody || self.isClosed) {
+        return YES;
+    }
+    else if (self.bodyFraming == IHTTPBodyFramingLength) {
+        return (self.bufferedBody.length >= self.bodyRemaining);
+    }
+
+    IHTTPChunkDecoder decoder = _chunks; // a copy, the chunks are decoded again as they're delivered
+    const uint8_t* bytes = self.bufferedBody.bytes;
+    size_t length = self.bufferedBody.length;
+    size_t offset = 0;
+    IHTTPParseResult result = IHTTPParseIncomplete;
+    while (offset < length && result == IHTTPParseIncomplete) {
+        const uint8_t* piece = NULL;
+        size_t pieceLength = 0;
+        size_t consumed = 0;
+        result = IHTTPDecodeChunk(&decoder, (bytes + offset), (length - offset), &consumed, &piece, &pieceLength);
+        offset += consumed;
+    }
+    return (result != IHTTPParseIncomplete);
+}
+
+- (void) collectBodyForHandler:(dispatch_block_t) block {
+    if (self.stream || self.didCollectBody || [self isBodyBuffered] || (self.maxBodyLength > 0 && self.contentLength > self.maxBodyLength)) {
+        block();
+        return;
+    }
+
+    IHTTPRequest* request = self; // the completion runs once the body is read, fails, times out or the connection closes
+    self.didCollectBody = YES;
+    [self readBodyWithCompletion:^(NSData* body, NSError* error) {
+        request.bodyStorage = body;
+        block();
+    }];
+}
+
+- (void) readBodyChunks:(IHTTPBodyChunkBlock) chunkBlock {
+    IHTTPRequest* request = self;
+    [self.eventLoop performBlock:^{ // the body is read on the loop thread, whichever thread the handler runs on
+        if (request.didCollectBody && request.didFailBody) { // before the handler ran, or by readBody
+            chunkBlock(nil, request.bodyError);
+            return;
+        }
+        else if (request.didCollectBody && request.didReadBody) {
+            if (request.bodyStorage.length > 0) {
+                chunkBlock(request.bodyStorage, nil);
+            }
+            chunkBlock(nil, nil);
+            return;
+        }
+
+        request.bodyBlock = chunkBlock;
+        [request sendContinue];
+    }];
+    [self resumeBody];
+}
+
+- (void) readBodyWithCompletion:(IHTTPBodyCompletionBlock) completion {
+    IHTTPBodyChunkBlock collector = [self collectBodyWithCompletion:completion];
+    if (self.maxBodyLength > 0 && self.contentLength > self.maxBodyLength) { // refuse before asking the client for the body
+        IHTTPRequest* request = self;
+        [self.eventLoop performBlock:^{
+            request.bodyBlock = collector;
+            [request failBody:IHTTPRequestBodyTooLargeError];
+        }];
+    }
+    else {
+        [self readBodyChunks:collector];
+    }
+}
+
+- (void) pauseBody {
+    self.isBodyPaused = YES;
+    [self stopReadingInput]; // and its timeout, the handler is holding the client back
+}
+
+- (void) resumeBody {
+    IHTTPRequest* request = self;
+    [self.eventLoop performBlock:^{ // deliver on the next pass of the loop, after the handler or the caller returns
+        request.isBodyPaused = NO;
+        [request deliverBufferedBody];
+        if (request.bodyBlock && !request.didReadBody && !request.didFailBody && !request.isBodyPaused && !request.isClosed) {
+            [request startReadingInput];
+            [request.connection startTimeout:IHTTPTimeoutBody];
+        }
+    }];
+}
+
+// MARK: - Body Framing
+
+- (BOOL) expectsContinue {
+    return (!self.stream && _parsed.versionMinor == 1 && [self headerField:IHTTPExpectHeader containsToken:"100-continue"]);
+}
+
+/*! @brief tell a client which sent Expect: 100-continue to send the body, unless it's already started */
+- (void) sendContinue {
+    static const char continueLines[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    if (!self.didSendContinue && !self.didReadBody && self.bufferedBody.length == 0 && [self expectsContinue]) {
+        [self.connection writeBytes:continueLines length:(sizeof(continueLines) - 1)];
+    }
+    self.didSendContinue = YES;
+}
+
+/*! @brief a chunk block which collects the body up to the maxBodyLength for the completion */
+- (IHTTPBodyChunkBlock) collectBodyWithCompletion:(IHTTPBodyCompletionBlock) completion {
+    NSUInteger maxBodyLength = self.maxBodyLength;
+    NSMutableData* body = [NSMutableData dataWithCapacity:MIN(self.contentLength, IHTTPRequestBodyCapacity)];
+    __weak IHTTPRequest* request = self;
+    return ^(NSData* chunk, NSError* error) {
+        if (chunk && maxBodyLength > 0 && (body.length + chunk.length) > maxBodyLength) {
+            [request failBody:IHTTPRequestBodyTooLargeError]; // calls this block again with the error
+        }
+        else if (chunk) {
+            [body appendData:chunk];
+        }
+        else if (completion) {
+            completion((error ? nil : body), error);
+        }
+    };
+}
+
+/*! @brief frame the body bytes which arrived with the head, and finish a request without a body */
+- (void) deliverBufferedBody {
+    NSData* buffered = self.bufferedBody;
+    self.bufferedBody = nil;
+    if (buffered.length > 0) {
+        [self appendBodyBytes:buffered.bytes length:buffered.length];
+    }
+
+    if (self.didReadBody) { // including a request without a body
+        [self finishBody];
+    }
+}
+
+/*! @brief frame the bytes, passing the body in them to the chunk block as one piece, or dropping it if there isn't one,
+    anything after the end of the body is passed to the next request */
+- (void) appendBodyBytes:(const uint8_t*) bytes length:(NSUInteger) length {
+    if (self.didReadBody || self.didFailBody) {
+        return;
+    }
+
+    NSData* chunk = nil;
+    NSUInteger offset = 0;
+    if (self.bodyFraming == IHTTPBodyFramingChunked) {
+        NSMutableData* decoded = (self.bodyBlock ? [NSMutableData dataWithCapacity:length] : nil);
+        while (offset < length && !self.didReadBody) {
+            const uint8_t* piece = NULL;
+            size_t pieceLength = 0;
+            size_t consumed = 0;
+            IHTTPParseResult result = IHTTPDecodeChunk(&_chunks, (bytes + offset), (length - offset), &consumed, &piece, &pieceLength);
+            if (result < IHTTPParseIncomplete) {
+                [self failBody:IHTTPRequestBodyInvalidError];
+                return;
+            }
+            [decoded appendBytes:piece length:pieceLength];
+            offset += consumed;
+            self.didReadBody = (result == IHTTPParseComplete);
+        }
+        chunk = decoded;
+    }
+    else if (self.bodyFraming == IHTTPBodyFramingLength) {
+        offset = (NSUInteger)MIN(self.bodyRemaining, (unsigned long long)length);
+        chunk = (self.bodyBlock ? [NSData dataWithBytes:bytes length:offset] : nil);
+        self.bodyRemaining -= offset;
+        self.didReadBody = (self.bodyRemaining == 0);
+    }
+
+    if (offset < length && self.didReadBody) { // before the block runs, it may complete the response and start the next request
+        self.pipelinedData = [NSData dataWithBytes:(bytes + offset) length:(length - offset)];
+    }
+
+    if (chunk.length > 0 && self.bodyBlock) {
+        self.bodyBlock(chunk, nil);
+    }
+
+    if (self.didReadBody) {
+        [self finishBody];
+    }
+}
+
+/*! @brief the body is complete, tell the chunk block */
+- (void) finishBody {
+    IHTTPBodyChunkBlock block = self.bodyBlock;
+    self.bodyBlock = nil;
+    [self stopReadingInput];
+
+    if (block) {
+        block(nil, nil);
+    }
+}
+
+- (void) failBody:(IHTTPRequestErrorNumber) errorNumber {
+    IHTTPBodyChunkBlock block = self.bodyBlock;
+    self.bodyBlock = nil;
+    self.didFailBody = YES;
+    self.keepAliveStorage = NO;
+    self.bufferedBody = nil;
+    [self stopReadingInput];
+
+    NSString* description = (errorNumber == IHTTPRequestBodyTooLargeError ? @"The request body is too large."
+                          : (errorNumber == IHTTPRequestBodyInvalidError ? @"The request body is malformed."
+                          : (errorNumber == IHTTPRequestBodyTimedOutError ? @"The client stopped sending the request body."
+                          : @"The connection closed before the end of the request body.")));
+    self.bodyError = [NSError errorWithDomain:IHTTPRequestErrorDomain code:errorNumber userInfo:@{
+        NSLocalizedDescriptionKey: description
+    }];
+    if (block) {
+        block(nil, self.bodyError);
+    }
 }
 
 - (void) completeRequest {
-    [[NSNotificationCenter defaultCenter] removeObserver:self name:NSFileHandleDataAvailableNotification object:self.input];
-    [self.input closeFile];
+    if (self.bodyBlock && !self.didReadBody && !self.didFailBody) { // wakes a handler waiting in readBody
+        [self failBody:IHTTPRequestBodyTruncatedError];
+    }
+    [self stopReadingInput];
+    self.isClosed = YES;
+    if (self.stream) { // the session closes the connection
+        return;
+    }
+    else if (self.connection) { // once the output still pending has been sent
+        [self.connection closeSocket];
+    }
+    else {
+        [self.input closeFile];
+    }
 }
 
 // MARK: -
 
-- (void)receiveIncomingDataNotification:(NSNotification *)notification {
-	NSFileHandle *incomingFileHandle = [notification object];
-	NSData *data = [incomingFileHandle availableData];
-	
-	if (data.length == 0) { // EoF
-		[self completeRequest];
-		return;
-	}
+- (void) closeConnection {
+    [self completeRequest];
+
+    if ([self.delegate respondsToSelector:@selector(requestDidClose:)]) {
+        [self.delegate requestDidClose:self];
+    }
+}
+
+- (NSData*) takeUpgradeData {
+    [self stopReadingInput];
+    NSData* data = self.pipelinedData;
+    self.pipelinedData = nil;
+    return data;
+}
+
+- (void) startReadingInput {
+    if (!self.isReadingInput) {
+        self.isReadingInput = [self.eventLoop addSource:self forFileDescriptor:self.input.fileDescriptor];
+    }
+}
+
+- (void) stopReadingInput {
+    if (self.isReadingInput) {
+        [self.eventLoop removeSource:self forFileDescriptor:self.input.fileDescriptor];
+        [self.connection cancelTimeout]; // nothing to wait for while the input isn't read
+        self.isReadingInput = NO;
+    }
+}
+
+/*! @brief parse the bytes as the next part of the request head, returns YES if they completed it or the request was rejected */
+- (BOOL) appendBytes:(const uint8_t*) bytes length:(NSUInteger) length {
+    if (self.discardLength > 0) { // skip over the unread body of the previous request on this connection
+        NSUInteger skip = MIN(self.discardLength, length);
+        self.discardLength -= skip;
+        bytes += skip;
+        length -= skip;
+    }
 
-    CFHTTPMessageAppendBytes(self.messageRef, data.bytes, data.length);
-    
-	if (CFHTTPMessageIsHeaderComplete(self.messageRef)) {
-        if ([self.delegate respondsToSelector:@selector(request:parsedHeaders:)]) {
-            [self.delegate request:self parsedHeaders:self.requestHeaders];
-            self.didReadHeaders = YES;
+    if (length == 0) {
+        return NO;
+    }
+
+    if (self.connection.timeoutKind == IHTTPTimeoutIdle) { // the next request has started, the rest of its head must follow
+        self.startTime = self.eventLoop.currentTime;
+        [self.connection startTimeout:IHTTPTimeoutHeader];
+    }
+
+    if (self.headBuffer) { // the head arrived in pieces, parse them together
+        [self.headBuffer appendBytes:bytes length:length];
+        bytes = self.headBuffer.bytes;
+        length = self.headBuffer.length;
+    }
+
+    IHTTPConnection* connection = self.connection;
+    if (connection.requestCount == 1 && connection.worker.http2Enabled) { // a client with prior knowledge starts with the HTTP/2 preface
+        IHTTPParseResult preface = IHTTP2ParsePreface(bytes, length);
+        if (preface == IHTTPParseComplete) {
+            __attribute__((objc_precise_lifetime)) IHTTPRequest* request = self; // the connection releases it
+            NSData* data = [NSData dataWithBytes:(bytes + IHTTP2PrefaceLength) length:(length - IHTTP2PrefaceLength)];
+            request.headBuffer = nil;
+            [connection.worker startHTTP2WithRequest:request data:data];
+            return YES;
+        }
+        else if (preface == IHTTPParseIncomplete) {
+            if (!self.headBuffer) {
+                self.headBuffer = [NSMutableData dataWithBytes:bytes length:length];
+            }
+            return NO;
         }
+    }
 
-        [NSNotificationCenter.defaultCenter removeObserver:self name:NSFileHandleDataAvailableNotification object:self.input];
+    IHTTPParseResult result = IHTTPParseRequest(&_parsed, bytes, length);
+    if (result == IHTTPParseIncomplete) {
+        if (!self.headBuffer) {
+            self.headBuffer = [NSMutableData dataWithBytes:bytes length:length];
+        }
+        return NO;
+    }
+    else if (result != IHTTPParseComplete) {
+        [self rejectRequest:(result == IHTTPParseTooLarge ? IHTTPStatus431RequestHeaderFieldsTooLarge : IHTTPStatus400BadRequest)];
+        return YES;
+    }
+
+    // keep the head, everything after it is body or the next pipelined request
+    if (self.headBuffer) { // take the buffer over rather than copying the head out of it again
+        self.headData = self.headBuffer;
     }
     else {
-        [incomingFileHandle waitForDataInBackgroundAndNotify];
+        self.headData = [NSData dataWithBytes:bytes length:_parsed.headLength];
+    }
+    NSData* buffered = ((length > _parsed.headLength) ? [NSData dataWithBytes:(bytes + _parsed.headLength) length:(length - _parsed.headLength)] : nil);
+    self.headBuffer = nil;
+    [self parseHeadersWithBuffered:buffered];
+
+    return YES;
+}
+
+- (void) rejectRequest:(NSUInteger) status {
+    IHTTP2Stream* stream = self.stream;
+    if (stream) { // the other streams on the connection carry on
+        [stream rejectWithStatus:status];
+        if ([self.delegate respondsToSelector:@selector(request:didRejectWithStatus:)]) {
+            [self.delegate request:self didRejectWithStatus:status];
+        }
+        return;
+    }
+
+    NSMutableData* rejection = [IHTTPResponse preparedHeaderDataWithStatus:status headers:@{IHTTPContentLengthHeader: @"0"}].mutableCopy;
+    [rejection appendBytes:"Connection: close\r\n\r\n" length:21];
+    [self.connection writeBytes:rejection.bytes length:rejection.length];
+    if ([self.delegate respondsToSelector:@selector(request:didRejectWithStatus:)]) {
+        [self.delegate request:self didRejectWithStatus:status];
+    }
+    self.connection.lingersOnClose = YES; // the client may still be sending the head or body
+    [self closeConnection];
+}
+
+- (void) readStreamHead:(NSData*) head body:(NSData*) body {
+    memset(&_parsed, 0, sizeof(_parsed));
+    self.didReadHeaders = YES;
+
+    IHTTPParseResult result = IHTTPParseRequest(&_parsed, head.bytes, head.length);
+    if (result != IHTTPParseComplete) { // the fields were checked when the head was rebuilt, but it may be too large to parse
+        [self rejectRequest:(result == IHTTPParseTooLarge ? IHTTPStatus431RequestHeaderFieldsTooLarge : IHTTPStatus400BadRequest)];
+        return;
+    }
+
+    self.headData = head;
+    [self parseHeadersWithBuffered:body];
+}
+
+- (void) parseHeadersWithBuffered:(NSData*) buffered {
+    [self stopReadingInput]; // the body is read by the handler
+    if (!self.stream) { // the session runs the timeouts of its streams
+        [self.connection cancelTimeout];
+    }
+
+    // framing and connection headers are checked in the head bytes, without making strings of them,
+    // any doubt about where the body ends is rejected, since an intermediary may have framed it differently, RFC 9112 section 6.3
+    BOOL chunked = [self headerField:IHTTPTransferEncodingHeader containsToken:NULL];
+    BOOL hasContentLength = [self headerField:IHTTPContentLengthHeader containsToken:NULL];
+    if (chunked) {
+        BOOL isChunkedOnly = NO;
+        if (hasContentLength || _parsed.versionMinor == 0 || ![self transferEncodingIsChunked:&isChunkedOnly]) {
+            [self rejectRequest:IHTTPStatus400BadRequest];
+            return;
+        }
+        else if (!isChunkedOnly) { // gzip or deflate inside the chunks, which isn't decoded
+            [self rejectRequest:IHTTPStatus501NotImplemented];
+            return;
+        }
+    }
+
+    NSUInteger contentLength = 0;
+    if (!chunked && ![self contentLengthField:&contentLength]) {
+        [self rejectRequest:IHTTPStatus400BadRequest];
+        return;
+    }
+
+    self.contentLength = contentLength;
+    if (chunked) { // decoded as the handler reads it, anything after the last chunk is the next pipelined request
+        memset(&_chunks, 0, sizeof(_chunks));
+        self.bodyFraming = IHTTPBodyFramingChunked;
+        self.bufferedBody = buffered;
+    }
+    else if (self.contentLength > 0) { // anything past the Content-Length is the next pipelined request
+        self.bodyFraming = IHTTPBodyFramingLength;
+        self.bodyRemaining = self.contentLength;
+        if (buffered.length > self.contentLength) {
+            self.bufferedBody = [buffered subdataWithRange:NSMakeRange(0, self.contentLength)];
+            self.pipelinedData = [buffered subdataWithRange:NSMakeRange(self.contentLength, (buffered.length - self.contentLength))];
+        }
+        else {
+            self.bufferedBody = buffered;
+        }
+    }
+    else {
+        self.didReadBody = YES;
+        self.pipelinedData = buffered;
+    }
+
+    if ([self headerField:IHTTPConnectionHeader containsToken:"close"]) {
+        self.keepAliveStorage = NO;
+    }
+    else if (_parsed.versionMinor == 0) {
+        self.keepAliveStorage = [self headerField:IHTTPConnectionHeader containsToken:"keep-alive"];
+    }
+    else {
+        self.keepAliveStorage = YES;
+    }
+
+    self.didParseHeaders = YES;
+
+    if ([self.delegate respondsToSelector:@selector(requestDidParseHeaders:)]) {
+        [self.delegate requestDidParseHeaders:self];
+    }
+    else if ([self.delegate respondsToSelector:@selector(request:parsedHeaders:)]) {
+        [self.delegate request:self parsedHeaders:self.requestHeaders];
+    }
+}
+
+- (void) readPipelinedData {
+    NSData* pipelined = self.pipelinedData;
+    self.pipelinedData = nil;
+
+    if (!self.isClosed && ![self appendBytes:pipelined.bytes length:pipelined.length]) {
+        [self startReadingInput];
+    }
+}
+
+// MARK: - IHTTPEventLoopSource
+
+- (void) eventLoopSourceIsReadable:(IHTTPEventLoop*) loop {
+    ssize_t received = recv(self.input.fileDescriptor, loop.readBuffer, loop.readBufferSize, MSG_DONTWAIT);
+
+    if (self.didParseHeaders) { // the handler is reading the body
+        if (received > 0) {
+            [self.connection startTimeout:IHTTPTimeoutBody]; // pushes the deadline back without moving the timer
+            [self appendBodyBytes:loop.readBuffer length:(NSUInteger)received];
+        }
+        else if (received == 0 || (errno != EAGAIN && errno != EINTR)) {
+            [self failBody:IHTTPRequestBodyTruncatedError]; // the response can still be sent before the connection closes
+        }
+    }
+    else if (received > 0) {
+        [self appendBytes:loop.readBuffer length:(NSUInteger)received];
+    }
+    else if (received == 0 || (errno != EAGAIN && errno != EINTR)) { // EoF or the connection was reset
+        [self closeConnection];
     }
 }
 
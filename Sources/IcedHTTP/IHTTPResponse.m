@@ -1,15 +1,130 @@
 #import "IHTTPResponse.h"
+
+#import "IHTTPConnection.h"
+#import "IHTTPConstants.h"
 #import "IHTTPServer.h"
+#import "IHTTPPrivate.h"
+#import "IHTTPWorker.h"
+#import "IHTTPCompression.h"
+
+#include "IHTTPDate.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+/*! @brief body writes are coalesced in the output buffer up to this size, larger writes go out with whatever is buffered */
+static NSUInteger const IHTTPResponseOutputBufferSize = (16 * 1024);
+
+/*! @brief the most compressed output produced by each deflate call, and the most of a file read to compress at once */
+static NSUInteger const IHTTPResponseCompressionSliceSize = (16 * 1024);
+
+/*! @brief a handler writing on another thread waits for the connection to send its output once it has queued this much */
+static unsigned long long const IHTTPResponseMaxQueuedOutput = (256 * 1024);
+
+/*! @brief write all of the vectors to a socket which blocks, for a response with no connection, resuming after partial writes,
+    returns NO with errno set if the write fails, sendmsg rather than writev so a closed connection can't raise SIGPIPE */
+static BOOL IHTTPWriteVectors(int socket, struct iovec* vectors, int count) {
+    while (count > 0) {
+        struct msghdr message = { .msg_iov = vectors, .msg_iovlen = count };
+        ssize_t written = sendmsg(socket, &message, IHTTPSendFlags);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NO;
+        }
+
+        while (count > 0 && (size_t)written >= vectors->iov_len) {
+            written -= (ssize_t)vectors->iov_len;
+            vectors++;
+            count--;
+        }
+
+        if (count > 0) {
+            vectors->iov_base = ((uint8_t*)vectors->iov_base + written);
+            vectors->iov_len -= (size_t)written;
+        }
+    }
+
+    return YES;
+}
+
+/*! @brief the reason phrase sent in the status line for the status code */
+static const char* IHTTPReasonPhrase(NSUInteger status) {
+    switch (status) {
+        case IHTTPStatus100Continue: return "Continue";
+        case IHTTPStatus101SwitchingProtocols: return "Switching Protocols";
+        case IHTTPStatus200OK: return "OK";
+        case IHTTPStatus201Created: return "Created";
+        case IHTTPStatus202Accepted: return "Accepted";
+        case IHTTPStatus203NonAuthoritativeInformation: return "Non-Authoritative Information";
+        case IHTTPStatus204NoContent: return "No Content";
+        case IHTTPStatus205ResetContent: return "Reset Content";
+        case IHTTPStatus206PartialContent: return "Partial Content";
+        case IHTTPStatus300MultipleChoices: return "Multiple Choices";
+        case IHTTPStatus301MovedPermanently: return "Moved Permanently";
+        case IHTTPStatus302Found: return "Found";
+        case IHTTPStatus303SeeOther: return "See Other";
+        case IHTTPStatus304NotModified: return "Not Modified";
+        case IHTTPStatus307TemporaryRedirect: return "Temporary Redirect";
+        case IHTTPStatus308PermanentRedirect: return "Permanent Redirect";
+        case IHTTPStatus400BadRequest: return "Bad Request";
+        case IHTTPStatus401Unauthorized: return "Unauthorized";
+        case IHTTPStatus403Forbidden: return "Forbidden";
+        case IHTTPStatus404NotFound: return "Not Found";
+        case IHTTPStatus405MethodNotAllowed: return "Method Not Allowed";
+        case IHTTPStatus406NotAcceptable: return "Not Acceptable";
+        case IHTTPStatus408RequestTimeout: return "Request Timeout";
+        case IHTTPStatus409Conflict: return "Conflict";
+        case IHTTPStatus410Gone: return "Gone";
+        case IHTTPStatus411LengthRequired: return "Length Required";
+        case IHTTPStatus412PreconditionFailed: return "Precondition Failed";
+        case IHTTPStatus413PayloadTooLarge: return "Payload Too Large";
+        case IHTTPStatus414RequestURITooLarge: return "URI Too Long";
+        case IHTTPStatus415UnsupportedMediaType: return "Unsupported Media Type";
+        case IHTTPStatus416RangeNotSatisfiable: return "Range Not Satisfiable";
+        case IHTTPStatus417ExpectationFailed: return "Expectation Failed";
+        case IHTTPStatus426UpgradeRequired: return "Upgrade Required";
+        case IHTTPStatus429TooManyRequests: return "Too Many Requests";
+        case IHTTPStatus431RequestHeaderFieldsTooLarge: return "Request Header Fields Too Large";
+        case IHTTPStatus500InternalServerError: return "Internal Server Error";
+        case IHTTPStatus501NotImplemented: return "Not Implemented";
+        case IHTTPStatus502BadGateway: return "Bad Gateway";
+        case IHTTPStatus503ServiceUnavailable: return "Service Unavailable";
+        case IHTTPStatus504GatewayTimeout: return "Gateway Timeout";
+        case IHTTPStatus505HTTPVersionNotSupported: return "HTTP Version Not Supported";
+        default: return (status < 200 ? "Informational" : status < 300 ? "Success" : status < 400 ? "Redirection" : status < 500 ? "Client Error" : "Server Error");
+    }
+}
+
+// MARK: -
 
 @interface IHTTPResponse ()
-@property(nonatomic,readonly) CFHTTPMessageRef messageRef;
-@property(nonatomic,retain) id messageRefStorage;
+@property(nonatomic,retain) NSMutableDictionary<NSString*, NSString*>* headerFields;
+@property(nonatomic,retain) NSMutableData* outputBuffer;
+@property(nonatomic,assign) NSUInteger responseStatusStorage;
+@property(atomic,assign) BOOL didCompleteResponseStorage;
+@property(atomic,assign) BOOL didFinishResponseStorage;
+@property(nonatomic,assign) BOOL isChunked;
+@property(atomic,assign) BOOL didFailOutput;
+@property(nonatomic,assign) BOOL isPerformingOutput;
+@property(nonatomic,assign) BOOL isDeallocating;
+@property(nonatomic,assign) unsigned long long bytesSentStorage;
+@property(nonatomic,assign) unsigned long long queuedOutputLength; // copied for the event loop by a handler on another thread since it last waited
+@property(nonatomic,assign) z_stream* deflater;
+@property(nonatomic,retain) NSMutableData* recordedBodyStorage;
 
 @end
 
 // MARK: -
 
-@implementation IHTTPResponse
+@implementation IHTTPResponse {
+    atomic_long _pendingOutput; // output blocks waiting for the event loop
+}
 
 // MARK: -
 
@@ -25,84 +140,706 @@
 	return response;
 }
 
-// MARK: - Properties
++ (IHTTPResponse*)recordingResponseForRequest:(IHTTPRequest*)request {
+    IHTTPResponse* response = [IHTTPResponse new];
+    response.request = request;
+    response.recordedBodyStorage = [NSMutableData new];
+    return response;
+}
 
-- (CFHTTPMessageRef) messageRef {
-    return (__bridge CFHTTPMessageRef)self.messageRefStorage;
++ (IHTTPResponse*)responseForStream:(IHTTP2Stream*)stream {
+    IHTTPResponse* response = [IHTTPResponse new];
+    response.stream = stream;
+    [stream startResponse];
+    return response;
 }
 
+// MARK: - Properties
+
 - (NSUInteger)responseStatus {
-    NSUInteger status = 0;
-    
-    if (self.messageRef) {
-        status = (NSUInteger)CFHTTPMessageGetResponseStatusCode(self.messageRef);
-    }
-    
-    return status;
+    return self.responseStatusStorage;
 }
 
 - (NSDictionary*)responseHeaders {
-    return CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(self.messageRef));
+    return (self.headerFields ? [NSDictionary dictionaryWithDictionary:self.headerFields] : nil);
+}
+
+- (BOOL)didCompleteResponse {
+    return self.didCompleteResponseStorage;
+}
+
+- (unsigned long long)bytesSent {
+    return self.bytesSentStorage;
+}
+
+- (BOOL)didFinishResponse {
+    return self.didFinishResponseStorage;
+}
+
+- (NSData*)recordedBody {
+    return self.recordedBodyStorage;
+}
+
+- (NSData*)recordedHeaderData {
+    NSMutableDictionary* headers = [NSMutableDictionary dictionaryWithDictionary:self.headerFields];
+    NSString* contentLength = [self headerFieldName:IHTTPContentLengthHeader];
+    if (contentLength) { // the handler's, which may not be the length of the body after compression
+        [headers removeObjectForKey:contentLength];
+    }
+
+    if ([self hasBody]) {
+        headers[IHTTPContentLengthHeader] = [NSString stringWithFormat:@"%lu", (unsigned long)self.recordedBody.length];
+    }
+
+    return [IHTTPResponse preparedHeaderDataWithStatus:self.responseStatus headers:headers];
+}
+
++ (NSData*)preparedHeaderDataWithStatus:(NSUInteger)status headers:(NSDictionary*)headers {
+    static NSSet<NSString*>* perResponseHeaders = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{ // lower case, sendPreparedHeaders:status:body: adds these for each response
+        perResponseHeaders = [NSSet setWithObjects:@"connection", @"keep-alive", @"transfer-encoding", @"date", nil];
+    });
+
+    NSMutableString* head = [NSMutableString stringWithFormat:@"HTTP/1.1 %lu %s\r\n", (unsigned long)status, IHTTPReasonPhrase(status)];
+    for (NSString* name in [headers.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        if (![perResponseHeaders containsObject:name.lowercaseString]) {
+            [head appendFormat:@"%@: %@\r\n", name, headers[name]];
+        }
+    }
+
+    return [head dataUsingEncoding:NSISOLatin1StringEncoding allowLossyConversion:YES];
+}
+
+/*! @brief the name of the header field as it was set, matched without regard to case */
+- (NSString*)headerFieldName:(NSString*)headerField {
+    if (self.headerFields[headerField]) {
+        return headerField;
+    }
+
+    for (NSString* name in self.headerFields) {
+        if ([name caseInsensitiveCompare:headerField] == NSOrderedSame) {
+            return name;
+        }
+    }
+    return nil;
+}
+
+- (NSString*)headerFieldValue:(NSString*)headerField {
+    NSString* name = [self headerFieldName:headerField];
+    return (name ? self.headerFields[name] : nil);
+}
+
+- (void)setHeaderField:(NSString*)headerField value:(NSString*)value {
+    NSString* name = [self headerFieldName:headerField];
+    if (name) {
+        [self.headerFields removeObjectForKey:name];
+    }
+    self.headerFields[headerField] = value;
+}
+
+// MARK: -
+
+/*! @brief NO if the status or the request method means the response has no body */
+- (BOOL)hasBody {
+    NSUInteger status = self.responseStatus;
+    return !((status >= 100 && status < 200) || status == IHTTPStatus204NoContent || status == IHTTPStatus304NotModified
+          || [self.request.requestMethod isEqualToString:IHTTPHeadMethod]);
+}
+
+/*! @brief remove the header field, matched without regard to case */
+- (void)removeHeaderField:(NSString*)headerField {
+    NSString* name = [self headerFieldName:headerField];
+    if (name) {
+        [self.headerFields removeObjectForKey:name];
+    }
+}
+
+/*! @brief decide how the client will find the end of the body and if the connection can stay open after the response,
+    setting the Transfer-Encoding and Connection headers to tell the client */
+- (void)setFramingHeaders {
+    NSString* connection = [self headerFieldValue:IHTTPConnectionHeader];
+    if (self.responseStatus == IHTTPStatus101SwitchingProtocols) { // Connection: Upgrade, the connection carries the new protocol next
+        return;
+    }
+
+    if ([self hasBody] && ![self headerFieldValue:IHTTPContentLengthHeader] && ![self headerFieldValue:IHTTPTransferEncodingHeader]) {
+        if (![self.request.requestVersion isEqualToString:@"HTTP/1.0"]) { // stream the body in chunks, the last one marks the end
+            [self setHeaderField:IHTTPTransferEncodingHeader value:@"chunked"];
+            self.isChunked = YES;
+        }
+        else {
+            self.keepAlive = NO; // an HTTP/1.0 client can only find the end of the body when the connection closes
+        }
+    }
+
+    if (connection && [connection rangeOfString:@"close" options:NSCaseInsensitiveSearch].location != NSNotFound) {
+        self.keepAlive = NO; // the handler asked for the connection to be closed
+    }
+
+    [self setHeaderField:IHTTPConnectionHeader value:(self.keepAlive ? @"keep-alive" : @"close")];
+}
+
+/*! @brief the output buffer, created when it's first needed after each write */
+- (NSMutableData*)bufferedOutput {
+    if (!self.outputBuffer) {
+        self.outputBuffer = [NSMutableData dataWithCapacity:IHTTPResponseOutputBufferSize];
+    }
+    return self.outputBuffer;
+}
+
+// MARK: - Output
+
+/*! @brief YES if output can be written right away, on the event loop thread with no output queued ahead of it,
+    or when the response has no event loop */
+- (BOOL)isOutputThread {
+    IHTTPEventLoop* loop = self.eventLoop;
+    return (!loop || self.isDeallocating || (loop.isLoopThread && (self.isPerformingOutput || atomic_load(&_pendingOutput) == 0)));
+}
+
+/*! @brief run the block now on the output thread, otherwise queue it on the event loop behind the output already waiting there,
+    so a handler on another thread writes to the socket in the order it sends */
+- (void)performOutput:(dispatch_block_t)block {
+    if ([self isOutputThread]) {
+        block();
+        return;
+    }
+
+    IHTTPResponse* response = self;
+    atomic_fetch_add(&_pendingOutput, 1);
+    [self.eventLoop performBlock:^{
+        response.isPerformingOutput = YES;
+        block();
+        response.isPerformingOutput = NO;
+        atomic_fetch_sub(&response->_pendingOutput, 1);
+    }];
+}
+
+/*! @brief run the block with the response's stream on the event loop in order with the rest of the output, and fail the response
+    if the stream has been reset, the rest of a response released on another thread goes to the stream without it */
+- (void)performStreamOutput:(BOOL (^)(IHTTP2Stream* stream))block {
+    IHTTP2Stream* stream = self.stream;
+    if ([self isOutputThread] && self.eventLoop.isLoopThread) {
+        if (!block(stream) && !self.didFailOutput) {
+            [self failOutput:@"stream: reset"];
+        }
+    }
+    else if (self.isDeallocating) { // no output is queued ahead of it
+        [self.eventLoop performBlock:^{
+            block(stream);
+        }];
+    }
+    else {
+        IHTTPResponse* response = self;
+        [self performOutput:^{
+            if (!block(stream) && !response.didFailOutput) {
+                [response failOutput:@"stream: reset"];
+            }
+        }];
+    }
+}
+
+/*! @brief send the status and headers in a HEADERS frame, which ends the stream if the response has no body */
+- (void)sendStreamHeaders {
+    NSMutableDictionary<NSString*, NSString*>* headers = [self.headerFields mutableCopy] ?: [NSMutableDictionary new];
+    if (![self headerFieldValue:IHTTPDateHeader]) {
+        headers[IHTTPDateHeader] = @(IHTTPCurrentDate());
+    }
+
+    NSUInteger status = self.responseStatus;
+    BOOL endStream = ![self hasBody];
+    [self performStreamOutput:^BOOL(IHTTP2Stream* stream) {
+        return [stream sendStatus:status headers:headers endStream:endStream];
+    }];
+}
+
+/*! @brief record the exception and finish the response, dropping the rest of its output */
+- (void)failOutput:(NSString*)reason {
+    // normally means the client closed the connection from the other end
+    self.outputException = [NSException exceptionWithName:NSFileHandleOperationException reason:reason userInfo:nil];
+    self.didFailOutput = YES;
+    self.keepAlive = NO;
+    [self finishResponse];
+}
+
+/*! @brief write the vectors to the output, copying them to the event loop when called on another thread,
+    on failure record the exception, drop the rest of the response and finish it */
+- (BOOL)writeVectors:(struct iovec*)vectors count:(int)count {
+    if (self.didFailOutput || self.didFinishResponse) {
+        return NO;
+    }
+
+    if (self.stream) { // the session frames the bytes as the flow control windows allow, on the loop thread
+        NSMutableData* data = [NSMutableData new];
+        for (int index = 0; index < count; index++) {
+            [data appendBytes:vectors[index].iov_base length:vectors[index].iov_len];
+        }
+
+        self.bytesSentStorage += data.length;
+        [self performStreamOutput:^BOOL(IHTTP2Stream* stream) {
+            return [stream sendData:data];
+        }];
+        return !self.didFailOutput;
+    }
+
+    if (![self isOutputThread]) { // the caller's bytes may be gone by the time the loop writes them
+        NSUInteger total = 0;
+        for (int index = 0; index < count; index++) {
+            total += vectors[index].iov_len;
+        }
+
+        NSMutableData* copied = [NSMutableData dataWithCapacity:total];
+        for (int index = 0; index < count; index++) {
+            [copied appendBytes:vectors[index].iov_base length:vectors[index].iov_len];
+        }
+
+        IHTTPResponse* response = self;
+        [self performOutput:^{
+            struct iovec vector = { copied.mutableBytes, copied.length };
+            [response writeVectors:&vector count:1];
+        }];
+
+        self.queuedOutputLength += total;
+        if (self.queuedOutputLength >= IHTTPResponseMaxQueuedOutput && !self.eventLoop.isLoopThread) {
+            [self waitForQueuedOutput];
+        }
+        return !self.didFailOutput;
+    }
+
+    IHTTPConnection* connection = self.connection;
+    if (!connection && !self.output) {
+        return NO;
+    }
+
+    unsigned long long total = 0; // before the vectors are advanced past what's written
+    for (int index = 0; index < count; index++) {
+        total += vectors[index].iov_len;
+    }
+
+    if (connection ? ![connection writeVectors:vectors count:count] : !IHTTPWriteVectors(self.output.fileDescriptor, vectors, count)) {
+        int writeError = (connection ? connection.outputError : errno);
+        [self failOutput:[NSString stringWithFormat:@"write: %s", (writeError != 0 ? strerror(writeError) : "closed")]];
+        return NO;
+    }
+
+    self.bytesSentStorage += total;
+    return YES;
+}
+
+/*! @brief hold a handler writing on another thread until the connection has sent what it queued, so a client which reads slowly
+    holds the handler back instead of its output piling up, the write timeout fails the output of a client which stops reading */
+- (void)waitForQueuedOutput {
+    dispatch_semaphore_t sent = dispatch_semaphore_create(0);
+    IHTTPResponse* response = self;
+    [self performOutput:^{
+        IHTTPConnection* connection = response.connection;
+        if (connection) {
+            [connection performWhenOutputSent:^(BOOL didSend) {
+                dispatch_semaphore_signal(sent);
+            }];
+        }
+        else {
+            dispatch_semaphore_signal(sent);
+        }
+    }];
+    dispatch_semaphore_wait(sent, DISPATCH_TIME_FOREVER);
+    self.queuedOutputLength = 0;
+}
+
+/*! @brief send length bytes of the file from the offset on the output thread, on failure record the exception and finish the response */
+- (BOOL)writeFile:(NSFileHandle*)file offset:(unsigned long long)offset length:(unsigned long long)length {
+    IHTTPConnection* connection = self.connection;
+    if ((!connection && !self.output && !self.stream) || self.didFailOutput || self.didFinishResponse) {
+        return NO;
+    }
+    else if (self.stream) { // read into DATA frames by the session as the flow control windows allow
+        if (![self hasBody]) {
+            return YES;
+        }
+
+        self.bytesSentStorage += length;
+        [self performStreamOutput:^BOOL(IHTTP2Stream* stream) {
+            return [stream sendFile:file offset:offset length:length];
+        }];
+        return !self.didFailOutput;
+    }
+
+    if (connection) { // the part of the file the socket doesn't take waits on the connection
+        if (![connection writeFile:file offset:offset length:length]) {
+            int sendError = connection.outputError;
+            [self failOutput:[NSString stringWithFormat:@"sendFile: %s", (sendError != 0 ? strerror(sendError) : "end of file")]];
+            return NO;
+        }
+    }
+    else {
+        long long sent = IHTTPSendFile(self.output.fileDescriptor, file.fileDescriptor, (off_t)offset, length);
+        if (sent < 0 || (unsigned long long)sent < length) {
+            // the client closed the connection, or the file was truncated and the body is short of its Content-Length
+            int sendError = (sent < 0 ? errno : 0);
+            [self failOutput:[NSString stringWithFormat:@"sendFile: %s", (sent < 0 ? strerror(sendError) : "end of file")]];
+            return NO;
+        }
+    }
+
+    self.bytesSentStorage += length;
+    return YES;
+}
+
+/*! @brief close an output with no connection unless it's kept alive and tell the delegate, once, after the last of the output is written,
+    the worker waits for the connection to send it before reading the next request or closing it */
+- (void)finishResponse {
+    if (!self.didFinishResponse) {
+        self.didFinishResponseStorage = YES;
+        self.didCompleteResponseStorage = YES;
+
+        if (self.output && !self.connection && !self.keepAlive) {
+            [self.output closeFile];
+        }
+
+        IHTTP2Stream* stream = self.stream;
+        BOOL didFail = self.didFailOutput;
+        if (stream && self.eventLoop.isLoopThread) { // ends the stream after the queued output, or resets it
+            [stream finishResponseWithError:didFail];
+        }
+        else if (stream) {
+            [self.eventLoop performBlock:^{
+                [stream finishResponseWithError:didFail];
+            }];
+        }
+
+        if (self.delegate && [self.delegate respondsToSelector:@selector(responseDidComplete:)]) {
+            [self.delegate responseDidComplete:self];
+        }
+
+        self.output = nil;
+    }
+}
+
+/*! @brief write the buffered output followed by the bytes, in one writev, without copying the bytes into the buffer */
+- (BOOL)writeBufferedOutputWithBytes:(const void*)bytes length:(NSUInteger)length trailer:(const char*)trailer {
+    NSMutableData* buffered = self.outputBuffer;
+    struct iovec vectors[3] = {
+        { (void*)buffered.bytes, buffered.length },
+        { (void*)bytes, length },
+        { (void*)trailer, (trailer ? strlen(trailer) : 0) }
+    };
+    self.outputBuffer = nil;
+    return [self writeVectors:vectors count:3];
+}
+
+/*! @brief add the body to the output, framed as a chunk if the response is chunked, and write the output once it's large */
+- (void)appendBody:(const void*)bytes length:(NSUInteger)length {
+    if (length == 0 || self.didFailOutput) {
+        return;
+    }
+    else if (self.recordedBodyStorage) {
+        [self.recordedBodyStorage appendBytes:bytes length:length];
+        return;
+    }
+    else if (![self hasBody]) { // a HEAD, 204 or 304 response ends with its headers, or its HEADERS frame ended the stream
+        return;
+    }
+
+    if (self.isChunked) {
+        char chunkSize[24];
+        [self.bufferedOutput appendBytes:chunkSize length:(NSUInteger)snprintf(chunkSize, sizeof(chunkSize), "%lx\r\n", (unsigned long)length)];
+    }
+
+    if ((self.outputBuffer.length + length) < IHTTPResponseOutputBufferSize) { // coalesce small writes
+        [self.bufferedOutput appendBytes:bytes length:length];
+        if (self.isChunked) {
+            [self.bufferedOutput appendBytes:"\r\n" length:2];
+        }
+    }
+    else { // large writes go straight from the caller's bytes, after whatever is buffered
+        [self writeBufferedOutputWithBytes:bytes length:length trailer:(self.isChunked ? "\r\n" : NULL)];
+    }
+}
+
+// MARK: - Compression
+
+/*! @brief run the bytes through the deflater and add what comes out to the body,
+    Z_SYNC_FLUSH or Z_FINISH push out everything it's holding back */
+- (void)appendCompressedBody:(const void*)bytes length:(NSUInteger)length flush:(int)flush {
+    z_stream* deflater = self.deflater;
+    uint8_t compressed[IHTTPResponseCompressionSliceSize];
+    NSUInteger consumed = 0;
+
+    do { // in slices zlib's unsigned int lengths can hold
+        uInt slice = (uInt)MIN((length - consumed), (NSUInteger)UINT_MAX);
+        BOOL isLastSlice = ((consumed + slice) == length);
+        deflater->next_in = (Bytef*)((const uint8_t*)bytes + consumed);
+        deflater->avail_in = slice;
+        do {
+            deflater->next_out = compressed;
+            deflater->avail_out = sizeof(compressed);
+            if (deflate(deflater, (isLastSlice ? flush : Z_NO_FLUSH)) == Z_STREAM_ERROR) {
+                return;
+            }
+            [self appendBody:compressed length:(sizeof(compressed) - deflater->avail_out)];
+        } while (deflater->avail_out == 0);
+        consumed += slice;
+    } while (consumed < length);
+}
+
+/*! @brief release the deflater, once the compressed stream has ended or the output failed */
+- (void)endCompression {
+    if (self.deflater) {
+        deflateEnd(self.deflater);
+        free(self.deflater);
+        self.deflater = NULL;
+    }
+}
+
+- (NSString*)compressBody {
+    if (!self.responseStatus || self.didSendHeaders) {
+        return nil;
+    }
+    else if (self.deflater) {
+        return [self headerFieldValue:IHTTPContentEncodingHeader];
+    }
+
+    NSString* vary = [self headerFieldValue:IHTTPVaryHeader];
+    if (!vary) {
+        [self setHeaderField:IHTTPVaryHeader value:IHTTPAcceptEncodingHeader];
+    }
+    else if ([vary rangeOfString:IHTTPAcceptEncodingHeader options:NSCaseInsensitiveSearch].location == NSNotFound && ![vary isEqualToString:@"*"]) {
+        [self setHeaderField:IHTTPVaryHeader value:[NSString stringWithFormat:@"%@, %@", vary, IHTTPAcceptEncodingHeader]];
+    }
+
+    NSString* encoding = IHTTPAcceptedEncodings([self.request headerFieldValue:IHTTPAcceptEncodingHeader], @[IHTTPGzipEncoding, IHTTPDeflateEncoding]).firstObject;
+    if (!encoding || [self headerFieldValue:IHTTPContentEncodingHeader]) { // the client takes it as it is, or the handler encoded it already
+        return nil;
+    }
+
+    if ([self hasBody]) {
+        z_stream* deflater = calloc(1, sizeof(z_stream));
+        int windowBits = ([encoding isEqualToString:IHTTPGzipEncoding] ? (MAX_WBITS + 16) : MAX_WBITS); // deflate is the zlib format
+        if (!deflater || deflateInit2(deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(deflater);
+            return nil;
+        }
+        self.deflater = deflater;
+    }
+
+    [self setHeaderField:IHTTPContentEncodingHeader value:encoding]; // a HEAD request gets the headers the GET would have
+    [self removeHeaderField:IHTTPContentLengthHeader];
+    return encoding;
 }
 
 // MARK: -
 
 - (void)sendStatus:(NSUInteger)httpStatus {
-    self.messageRefStorage = CFBridgingRelease(CFHTTPMessageCreateResponse(kCFAllocatorDefault, httpStatus, NULL, kCFHTTPVersion1_1));
+    self.responseStatusStorage = httpStatus;
+    self.headerFields = [NSMutableDictionary new];
 }
 
 - (void)sendHeaders:(NSDictionary *)headers {
     for (NSString* key in headers.allKeys) {
-        CFHTTPMessageSetHeaderFieldValue(self.messageRef, (__bridge CFStringRef)key, (__bridge CFStringRef)headers[key]);
+        [self setHeaderField:key value:headers[key]];
+    }
+
+    if (self.deflater) { // the length of the compressed body isn't known until it's all been sent
+        [self removeHeaderField:IHTTPContentLengthHeader];
     }
-    
-    if (self.messageRef) {
-        CFDataRef headerData = CFHTTPMessageCopySerializedMessage(self.messageRef);
-        @try {
-            self.didSendHeaders = YES; // set first to prevent loop via completeResponse
-            [self.output writeData:(__bridge NSData *)headerData];
+
+    if (self.responseStatus && !self.didSendHeaders) {
+        self.didSendHeaders = YES; // set first to prevent loop via completeResponse
+        if (self.recordedBodyStorage) { // serialized with the body's length by recordedHeaderData
+            return;
+        }
+        else if (self.stream) { // the frames carry the length of the body and the connection is the session's
+            [self sendStreamHeaders];
+            return;
         }
-        @catch (NSException *exception) {
-            // normally means the client closed the connection from the other end
-            [self completeResponse];
+        [self setFramingHeaders];
+
+        // the status line and headers wait in the output buffer for the first of the body
+        NSMutableString* head = [NSMutableString stringWithFormat:@"HTTP/1.1 %lu %s\r\n", (unsigned long)self.responseStatus, IHTTPReasonPhrase(self.responseStatus)];
+        if (![self headerFieldValue:IHTTPDateHeader]) {
+            [head appendFormat:@"%@: %s\r\n", IHTTPDateHeader, IHTTPCurrentDate()];
         }
-        @finally {
-            CFRelease(headerData);
+        for (NSString* name in self.headerFields) {
+            [head appendFormat:@"%@: %@\r\n", name, self.headerFields[name]];
         }
+        [head appendString:@"\r\n"];
+
+        [self.bufferedOutput appendData:[head dataUsingEncoding:NSISOLatin1StringEncoding allowLossyConversion:YES]];
     }
 }
 
 - (void)sendBody:(NSData *)bodyData {
-    if (!self.didSendHeaders) { // TODO check for the size of the data first
-        CFHTTPMessageSetBody(self.messageRef, (__bridge CFDataRef)bodyData);
-        [self sendHeaders:nil]; // no headers, complete message body
+    if (!self.didSendHeaders) { // the complete body, so it can be framed with its length
+        if (self.responseStatus && !self.deflater && ![self headerFieldValue:IHTTPContentLengthHeader]) {
+            [self setHeaderField:IHTTPContentLengthHeader value:[NSString stringWithFormat:@"%lu", (unsigned long)bodyData.length]];
+        }
+        [self sendHeaders:nil];
     }
-    else { // headers have been sent, so write the body to the output stream
-        @try {
-            [self.output writeData:bodyData];
+
+    if (self.deflater) {
+        [self appendCompressedBody:bodyData.bytes length:bodyData.length flush:Z_NO_FLUSH];
+    }
+    else {
+        [self appendBody:bodyData.bytes length:bodyData.length];
+    }
+}
+
+- (void)sendFile:(NSFileHandle*)file offset:(unsigned long long)offset length:(unsigned long long)length {
+    if (!self.didSendHeaders) {
+        if (self.responseStatus && !self.deflater && ![self headerFieldValue:IHTTPContentLengthHeader]) {
+            [self setHeaderField:IHTTPContentLengthHeader value:[NSString stringWithFormat:@"%llu", length]];
         }
-        @catch (NSException *exception) {
-            // normally means the client closed the connection from the other end
-            self.outputException = exception;
-            [self completeResponse];
+        [self sendHeaders:nil];
+    }
+
+    if (!self.recordedBodyStorage && ![self hasBody]) { // the Content-Length is the file's, as a GET would have it
+        return;
+    }
+    else if (self.deflater || self.recordedBodyStorage) { // compressed or recorded through user space, a slice at a time
+        uint8_t slice[IHTTPResponseCompressionSliceSize];
+        unsigned long long sent = 0;
+        while (sent < length && !self.didFailOutput) {
+            ssize_t count = pread(file.fileDescriptor, slice, (size_t)MIN((length - sent), sizeof(slice)), (off_t)(offset + sent));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            else if (count <= 0) { // the body can't be finished, so the connection is closed without the end of it
+                NSString* reason = [NSString stringWithFormat:@"sendFile: %s", (count < 0 ? strerror(errno) : "end of file")];
+                IHTTPResponse* response = self;
+                [self performOutput:^{
+                    [response failOutput:reason];
+                }];
+                break;
+            }
+            if (self.deflater) {
+                [self appendCompressedBody:slice length:(NSUInteger)count flush:Z_NO_FLUSH];
+            }
+            else {
+                [self appendBody:slice length:(NSUInteger)count];
+            }
+            sent += (unsigned long long)count;
         }
+        return;
     }
+
+    if (!self.didFailOutput && !self.didCompleteResponse && length > 0) {
+        char chunkSize[24];
+        if (self.isChunked) {
+            [self.bufferedOutput appendBytes:chunkSize length:(NSUInteger)snprintf(chunkSize, sizeof(chunkSize), "%llx\r\n", length)];
+        }
+
+        if ([self isOutputThread]) {
+            if (![self flush] || ![self writeFile:file offset:offset length:length]) {
+                return;
+            }
+        }
+        else { // the buffered output and the file go to the socket together on the event loop
+            NSMutableData* buffered = self.outputBuffer;
+            IHTTPResponse* response = self;
+            self.outputBuffer = nil;
+            [self performOutput:^{
+                struct iovec vector = { buffered.mutableBytes, buffered.length };
+                if ([response writeVectors:&vector count:1]) {
+                    [response writeFile:file offset:offset length:length];
+                }
+            }];
+        }
+
+        if (self.isChunked) {
+            [self.bufferedOutput appendBytes:"\r\n" length:2];
+        }
+    }
+}
+
+- (void)sendPreparedHeaders:(NSData*)headerData status:(NSUInteger)status body:(NSData*)body {
+    static const char keepAliveLines[] = "Connection: keep-alive\r\n\r\n";
+    static const char closeLines[] = "Connection: close\r\n\r\n";
+    if (self.recordedBodyStorage || self.stream) { // keep the headers as if they'd been sent one by one
+        NSString* head = [NSString.alloc initWithData:headerData encoding:NSISOLatin1StringEncoding];
+        NSArray<NSString*>* lines = [head componentsSeparatedByString:@"\r\n"];
+        [self sendStatus:status];
+        for (NSString* line in [lines subarrayWithRange:NSMakeRange(1, (lines.count - 1))]) {
+            NSRange colon = [line rangeOfString:@":"];
+            if (colon.location != NSNotFound) {
+                [self setHeaderField:[line substringToIndex:colon.location]
+                    value:[[line substringFromIndex:(colon.location + 1)] stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet]];
+            }
+        }
+        self.didSendHeaders = YES;
+        if (self.stream) {
+            [self sendStreamHeaders];
+        }
+        [self appendBody:body.bytes length:body.length];
+        return;
+    }
+
+    char dateLine[IHTTPDateLength + 9] = "Date: ";
+    memcpy((dateLine + 6), IHTTPCurrentDate(), IHTTPDateLength);
+    memcpy((dateLine + 6 + IHTTPDateLength), "\r\n", 2);
+
+    self.responseStatusStorage = status; // before hasBody, which a HEAD request or the status can make NO
+    NSMutableData* buffered = self.outputBuffer;
+    struct iovec vectors[5] = {
+        { (void*)buffered.bytes, buffered.length },
+        { (void*)headerData.bytes, headerData.length },
+        { dateLine, (IHTTPDateLength + 8) },
+        { (void*)(self.keepAlive ? keepAliveLines : closeLines), (self.keepAlive ? (sizeof(keepAliveLines) - 1) : (sizeof(closeLines) - 1)) },
+        { (void*)body.bytes, ([self hasBody] ? body.length : 0) }
+    };
+
+    self.didSendHeaders = YES;
+    self.outputBuffer = nil;
+    [self writeVectors:vectors count:5];
+}
+
+- (BOOL)flush {
+    if (!self.didSendHeaders) {
+        [self sendHeaders:nil];
+    }
+
+    if (self.deflater && !self.didFailOutput) {
+        [self appendCompressedBody:NULL length:0 flush:Z_SYNC_FLUSH];
+    }
+
+    if (self.outputBuffer.length > 0) {
+        return [self writeBufferedOutputWithBytes:NULL length:0 trailer:NULL];
+    }
+    return !self.didFailOutput;
 }
 
 - (void)completeResponse {
+    if (self.didCompleteResponse) { // including when the output failed
+        return;
+    }
+
     if (!self.didSendHeaders) {
+        if (!self.responseStatus) { // nothing to tell the client, so it can't expect another response on the connection
+            self.keepAlive = NO;
+        }
         [self sendHeaders:nil];
     }
 
-	if (self.output) {
-		[[NSNotificationCenter defaultCenter] removeObserver:self name:NSFileHandleDataAvailableNotification object:self.output];
-        // TODO [self.output synchronizeFile];
-        [self.output closeFile];
-		self.output = nil;
-	}
+    if (self.deflater) { // the end of the compressed stream, ahead of the last chunk
+        if (!self.didFailOutput) {
+            [self appendCompressedBody:NULL length:0 flush:Z_FINISH];
+        }
+        [self endCompression];
+    }
 
-    if (self.delegate && [self.delegate respondsToSelector:@selector(responseDidComplete:)]) {
-        [self.delegate responseDidComplete:self];
+    if (self.isChunked && !self.didFailOutput) { // the last chunk
+        [self.bufferedOutput appendBytes:"0\r\n\r\n" length:5];
+    }
+    [self flush];
+    self.didCompleteResponseStorage = YES;
+
+    if ([self isOutputThread]) {
+        [self finishResponse];
+    }
+    else { // after the output queued ahead of it
+        IHTTPResponse* response = self;
+        [self performOutput:^{
+            [response finishResponse];
+        }];
     }
 }
 
@@ -117,9 +854,13 @@
 // dealloc
 //
 // Stops the response if still running.
+// Queued output retains the response, so there is none left to wait for,
+// and the rest of the response is written on the thread which released it.
 //
 - (void)dealloc {
+    self.isDeallocating = YES;
     [self completeResponse];
+    [self endCompression]; // if the output failed before the response completed
 }
 
 @end
@@ -0,0 +1,411 @@
+#import "IHTTPResponseCache.h"
+
+#import "IHTTPConstants.h"
+#import "IHTTPEventLoop.h"
+#import "IHTTPPrivate.h"
+
+/*! @brief default size of the largest response kept in the cache */
+static NSUInteger const IHTTPResponseCacheDefaultMaxEntrySize = (1024 * 1024);
+
+// MARK: -
+
+/*! @brief a serialized response, ready to send with sendPreparedHeaders:status:body: */
+@interface IHTTPResponseCacheEntry : NSObject
+@property(nonatomic, retain) NSString* key;
+@property(nonatomic, retain) NSData* headerData;
+@property(nonatomic, retain) NSData* body;
+@property(nonatomic, assign) NSUInteger status;
+@property(nonatomic, assign) NSTimeInterval expires;
+@property(nonatomic, retain) IHTTPResponseCacheEntry* newer;
+@property(nonatomic, weak) IHTTPResponseCacheEntry* older;
+
+/*! @brief bytes the entry counts against the cache's capacity */
+@property(nonatomic, readonly) NSUInteger size;
+
+@end
+
+// MARK: -
+
+/*! @brief a handler running for a key, recording its response for the request which ran it and the requests waiting for it */
+@interface IHTTPResponseCacheFill : NSObject <IHTTPResponseDelegate>
+@property(nonatomic, retain) IHTTPResponseCache* cache;
+@property(nonatomic, retain) NSString* key;
+@property(nonatomic, retain) NSArray<NSString*>* varyHeaders;
+@property(nonatomic, retain) IHTTPHandler* prototype;
+@property(nonatomic, retain) IHTTPHandler* handler;
+@property(nonatomic, retain) IHTTPResponse* recording;
+@property(nonatomic, retain) IHTTPResponse* response;
+@property(nonatomic, retain) NSMutableArray<IHTTPResponse*>* waiting;
+
+@end
+
+// MARK: -
+
+@interface IHTTPResponseCache ()
+@property(nonatomic, assign) NSUInteger capacityStorage;
+@property(nonatomic, retain) NSLock* lock;
+@property(nonatomic, retain) NSMutableDictionary<NSString*, IHTTPResponseCacheEntry*>* entries;
+@property(nonatomic, retain) NSMutableDictionary<NSString*, IHTTPResponseCacheFill*>* fills;
+@property(nonatomic, retain) IHTTPResponseCacheEntry* oldest;
+@property(nonatomic, weak) IHTTPResponseCacheEntry* newest;
+@property(nonatomic, assign) NSUInteger sizeStorage;
+@property(nonatomic, assign) NSUInteger hitsStorage;
+@property(nonatomic, assign) NSUInteger missesStorage;
+@property(nonatomic, assign) NSUInteger coalescedStorage;
+@property(nonatomic, assign) NSUInteger evictionsStorage;
+
+- (void) completeFill:(IHTTPResponseCacheFill*) fill;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPResponseCacheEntry
+
+- (NSUInteger) size {
+    return (self.headerData.length + self.body.length);
+}
+
+@end
+
+// MARK: -
+
+@implementation IHTTPResponseCacheFill
+
+// MARK: - IHTTPResponseDelegate
+
+- (void) responseDidComplete:(IHTTPResponse*) response {
+    [self.cache completeFill:self];
+}
+
+@end
+
+// MARK: -
+
+@implementation IHTTPResponseCache
+
++ (IHTTPResponseCache*) cacheWithCapacity:(NSUInteger) capacity {
+    IHTTPResponseCache* cache = IHTTPResponseCache.new;
+    cache.capacityStorage = capacity;
+    return cache;
+}
+
+/*! @brief the seconds the response may be kept for from its Cache-Control header, s-maxage then max-age,
+    0 if it must not be kept, or -1 if it doesn't say and may be shared with the requests waiting for it */
++ (NSTimeInterval) timeToLiveForResponse:(IHTTPResponse*) response {
+    NSDictionary* headers = response.responseHeaders;
+    NSString* cacheControl = nil;
+    for (NSString* name in headers) { // set in whatever case the handler chose
+        if ([name caseInsensitiveCompare:IHTTPCacheControlHeader] == NSOrderedSame) {
+            cacheControl = headers[name];
+        }
+    }
+
+    NSTimeInterval maxAge = -1;
+    NSTimeInterval sharedMaxAge = -1;
+    for (NSString* listed in [cacheControl.lowercaseString componentsSeparatedByString:@","]) {
+        NSString* directive = [listed stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+        if ([directive isEqualToString:@"no-store"] || [directive isEqualToString:@"no-cache"]) {
+            return 0;
+        }
+        else if ([directive hasPrefix:@"s-maxage="]) {
+            sharedMaxAge = MAX([directive substringFromIndex:9].doubleValue, 0);
+        }
+        else if ([directive hasPrefix:@"max-age="]) {
+            maxAge = MAX([directive substringFromIndex:8].doubleValue, 0);
+        }
+    }
+
+    return (sharedMaxAge >= 0 ? sharedMaxAge : maxAge);
+}
+
+/*! @brief YES if the response can be sent to other clients, one which the handler sent completely,
+    with a status cacheable by default, not private to the client, and varying only on the headers in the key */
++ (BOOL) isSharedResponse:(IHTTPResponse*) response varyHeaders:(NSArray<NSString*>*) varyHeaders {
+    static NSIndexSet* cacheableStatus = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{ // https://www.rfc-editor.org/rfc/rfc9110#section-15.1
+        NSMutableIndexSet* statuses = NSMutableIndexSet.new;
+        for (NSNumber* status in @[@200, @203, @204, @300, @301, @308, @404, @405, @410, @414, @501]) {
+            [statuses addIndex:status.unsignedIntegerValue];
+        }
+        cacheableStatus = statuses;
+    });
+
+    if (response.outputException || ![cacheableStatus containsIndex:response.responseStatus]) {
+        return NO;
+    }
+
+    NSDictionary* headers = response.responseHeaders;
+    for (NSString* name in headers) {
+        NSString* value = headers[name];
+        if ([name caseInsensitiveCompare:IHTTPSetCookieHeader] == NSOrderedSame) {
+            return NO;
+        }
+        else if ([name caseInsensitiveCompare:IHTTPCacheControlHeader] == NSOrderedSame
+              && [value rangeOfString:@"private" options:NSCaseInsensitiveSearch].location != NSNotFound) {
+            return NO;
+        }
+        else if ([name caseInsensitiveCompare:IHTTPVaryHeader] == NSOrderedSame) {
+            for (NSString* listed in [value componentsSeparatedByString:@","]) {
+                NSString* varied = [listed stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+                NSUInteger index = [varyHeaders indexOfObjectPassingTest:^BOOL(NSString* header, NSUInteger index, BOOL* stop) {
+                    return ([header caseInsensitiveCompare:varied] == NSOrderedSame);
+                }];
+                if (index == NSNotFound) { // including *, the key doesn't tell the clients apart
+                    return NO;
+                }
+            }
+        }
+    }
+
+    return YES;
+}
+
+// MARK: - Initializers
+
+- (id) init {
+    if ((self = super.init)) {
+        self.maxEntrySize = IHTTPResponseCacheDefaultMaxEntrySize;
+        self.lock = NSLock.new;
+        self.entries = NSMutableDictionary.new;
+        self.fills = NSMutableDictionary.new;
+    }
+    return self;
+}
+
+// MARK: - Properties
+
+- (NSUInteger) capacity {
+    return self.capacityStorage;
+}
+
+- (NSUInteger) size {
+    [self.lock lock];
+    NSUInteger size = self.sizeStorage;
+    [self.lock unlock];
+    return size;
+}
+
+- (NSUInteger) count {
+    [self.lock lock];
+    NSUInteger count = self.entries.count;
+    [self.lock unlock];
+    return count;
+}
+
+- (NSUInteger) hits {
+    [self.lock lock];
+    NSUInteger hits = self.hitsStorage;
+    [self.lock unlock];
+    return hits;
+}
+
+- (NSUInteger) misses {
+    [self.lock lock];
+    NSUInteger misses = self.missesStorage;
+    [self.lock unlock];
+    return misses;
+}
+
+- (NSUInteger) coalesced {
+    [self.lock lock];
+    NSUInteger coalesced = self.coalescedStorage;
+    [self.lock unlock];
+    return coalesced;
+}
+
+- (NSUInteger) evictions {
+    [self.lock lock];
+    NSUInteger evictions = self.evictionsStorage;
+    [self.lock unlock];
+    return evictions;
+}
+
+// MARK: -
+
+- (void) removeAllEntries {
+    [self.lock lock];
+    while (self.oldest) {
+        [self removeEntry:self.oldest];
+    }
+    [self.lock unlock];
+}
+
+// MARK: - Entries, called with the lock held
+
+- (void) removeEntry:(IHTTPResponseCacheEntry*) entry {
+    [self.entries removeObjectForKey:entry.key];
+    self.sizeStorage -= entry.size;
+
+    if (entry.older) {
+        entry.older.newer = entry.newer;
+    }
+    else {
+        self.oldest = entry.newer;
+    }
+
+    if (entry.newer) {
+        entry.newer.older = entry.older;
+    }
+    else {
+        self.newest = entry.older;
+    }
+
+    entry.newer = nil;
+    entry.older = nil;
+}
+
+- (void) appendEntry:(IHTTPResponseCacheEntry*) entry {
+    entry.older = self.newest;
+    if (self.newest) {
+        self.newest.newer = entry;
+    }
+    else {
+        self.oldest = entry;
+    }
+    self.newest = entry;
+}
+
+- (void) touchEntry:(IHTTPResponseCacheEntry*) entry {
+    if (entry != self.newest) {
+        IHTTPResponseCacheEntry* retained = entry; // the list holds the only other reference
+        if (retained.older) {
+            retained.older.newer = retained.newer;
+        }
+        else {
+            self.oldest = retained.newer;
+        }
+        retained.newer.older = retained.older;
+        retained.newer = nil;
+        [self appendEntry:retained];
+    }
+}
+
+/*! @brief add the entry, replacing any entry for its key and evicting the least recently used entries to make room */
+- (void) insertEntry:(IHTTPResponseCacheEntry*) entry {
+    IHTTPResponseCacheEntry* existing = self.entries[entry.key];
+    if (existing) {
+        [self removeEntry:existing];
+    }
+
+    while (self.oldest && (self.sizeStorage + entry.size) > self.capacity) {
+        [self removeEntry:self.oldest];
+        self.evictionsStorage++;
+    }
+
+    self.entries[entry.key] = entry;
+    self.sizeStorage += entry.size;
+    [self appendEntry:entry];
+}
+
+// MARK: - Private
+
+/*! @brief send the entry and complete the response, without the body for a HEAD request */
++ (void) sendEntry:(IHTTPResponseCacheEntry*) entry withResponse:(IHTTPResponse*) response {
+    BOOL isHead = [response.request.requestMethod isEqualToString:IHTTPHeadMethod];
+    [response sendPreparedHeaders:entry.headerData status:entry.status body:(isHead ? nil : entry.body)];
+    [response completeResponse];
+}
+
+- (NSUInteger) sendResponseForKey:(NSString*) key varyHeaders:(NSArray<NSString*>*) varyHeaders
+    handler:(IHTTPHandler*) prototype request:(IHTTPRequest*) request response:(IHTTPResponse*) response {
+    BOOL isGet = [request.requestMethod isEqualToString:IHTTPGetMethod];
+    NSTimeInterval now = IHTTPMonotonicTime();
+
+    [self.lock lock];
+    IHTTPResponseCacheEntry* entry = self.entries[key];
+    if (entry && entry.expires <= now) {
+        [self removeEntry:entry];
+        entry = nil;
+    }
+
+    if (entry) {
+        self.hitsStorage++;
+        [self touchEntry:entry];
+        [self.lock unlock];
+        [IHTTPResponseCache sendEntry:entry withResponse:response];
+        return entry.status;
+    }
+
+    IHTTPResponseCacheFill* fill = self.fills[key];
+    if (fill && isGet) { // answered when the running handler completes
+        self.coalescedStorage++;
+        [fill.waiting addObject:response];
+        [self.lock unlock];
+        return IHTTPStatusCodeUnknown;
+    }
+
+    self.missesStorage++;
+    if (fill || !isGet) { // a HEAD response has no body to cache for the GET requests
+        [self.lock unlock];
+        return [[prototype handlerForRequest:request] handleRequest:request withResponse:response];
+    }
+
+    fill = IHTTPResponseCacheFill.new;
+    fill.cache = self;
+    fill.key = key;
+    fill.varyHeaders = varyHeaders;
+    fill.prototype = prototype;
+    fill.response = response;
+    fill.waiting = NSMutableArray.new;
+    self.fills[key] = fill;
+    [self.lock unlock];
+
+    fill.handler = [prototype handlerForRequest:request];
+    fill.recording = [IHTTPResponse recordingResponseForRequest:request];
+    fill.recording.delegate = fill;
+    return [fill.handler handleRequest:request withResponse:fill.recording];
+}
+
+/*! @brief called on the thread which completed the recording, cache it if it may be kept,
+    then answer the request which ran the handler and the requests waiting for it */
+- (void) completeFill:(IHTTPResponseCacheFill*) fill {
+    IHTTPResponse* recording = fill.recording;
+    IHTTPResponseCacheEntry* entry = IHTTPResponseCacheEntry.new;
+    entry.key = fill.key;
+    entry.headerData = recording.recordedHeaderData;
+    entry.body = recording.recordedBody;
+    entry.status = recording.responseStatus;
+
+    BOOL isShared = [IHTTPResponseCache isSharedResponse:recording varyHeaders:fill.varyHeaders];
+    NSTimeInterval timeToLive = [IHTTPResponseCache timeToLiveForResponse:recording];
+    timeToLive = (timeToLive < 0 ? self.defaultTimeToLive : timeToLive);
+    entry.expires = (IHTTPMonotonicTime() + timeToLive);
+
+    [self.lock lock];
+    if (isShared && timeToLive > 0 && entry.size <= MIN(self.maxEntrySize, self.capacity)) {
+        [self insertEntry:entry];
+    }
+    [self.fills removeObjectForKey:fill.key];
+    NSArray<IHTTPResponse*>* waiting = fill.waiting;
+    fill.waiting = nil;
+    [self.lock unlock];
+
+    if (recording.outputException || !recording.responseStatus) { // there's no complete response to send, so the client can't reuse the connection
+        fill.response.keepAlive = NO;
+        [fill.response completeResponse];
+    }
+    else {
+        [IHTTPResponseCache sendEntry:entry withResponse:fill.response];
+    }
+
+    for (IHTTPResponse* response in waiting) {
+        IHTTPRequest* request = response.request;
+        if (isShared) {
+            [IHTTPResponseCache sendEntry:entry withResponse:response];
+        }
+        else if (request) { // the response is for the client which asked for it, so each waiting request runs the handler itself
+            [[fill.prototype handlerForRequest:request] handleRequest:request withResponse:response];
+        }
+        else { // the connection closed while it waited
+            [response completeResponse];
+        }
+    }
+
+    fill.recording = nil;
+    fill.handler = nil;
+    fill.response = nil;
+}
+
+@end
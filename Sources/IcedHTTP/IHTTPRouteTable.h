@@ -0,0 +1,29 @@
+#import <Foundation/Foundation.h>
+
+@class IHTTPHandler;
+
+/*! @header IHTTPRouteTable.h
+    @abstract IHTTPRouteTable matches request paths against registered patterns, not part of the public API */
+
+/*! @class IHTTPRouteTable
+    @brief a radix tree of path patterns, looked up in time proportional to the length of the path
+    @discussion patterns are made of literal text, :name segments which match one non-empty path segment,
+    and a final *name which matches the rest of the path. Literal text is preferred over a :name segment,
+    which is preferred over a *name. Routes must be added before lookups start on other threads,
+    so a table in use is copied, the route added to the copy and the copy put in its place */
+@interface IHTTPRouteTable : NSObject <NSCopying>
+
+/*! @brief the number of routes in the table */
+@property(nonatomic, readonly) NSUInteger count;
+
+// MARK: -
+
+/*! @brief add the handler for requests with the method, or any method if nil, whose path matches the pattern
+    @discussion raises NSInvalidArgumentException if the pattern is malformed,
+    or names a parameter differently from another pattern at the same position */
+- (void) addRoute:(NSString*) pathPattern method:(NSString*) method handler:(IHTTPHandler*) handler;
+
+/*! @brief the handler for the method and the path bytes, which stop at a ? or # or the length, and the parameters captured from the path */
+- (IHTTPHandler*) handlerForMethod:(NSString*) method path:(const uint8_t*) path length:(size_t) length parameters:(NSDictionary<NSString*, NSString*>**) parameters;
+
+@end
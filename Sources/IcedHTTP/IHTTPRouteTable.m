@@ -0,0 +1,289 @@
+#import "IHTTPRouteTable.h"
+
+#include <string.h>
+
+/*! @brief the most parameters captured from one path */
+#define IHTTPRouteMaxCaptures 16
+
+/*! @brief the handlers key for routes which match any method */
+static NSString* const IHTTPRouteAnyMethod = @"*";
+
+/*! @brief a parameter's name and where its value is in the path */
+typedef struct {
+    __unsafe_unretained NSString* name;
+    size_t offset;
+    size_t length;
+} IHTTPRouteCapture;
+
+/*! @enum IHTTPRouteNodeKind */
+typedef NS_ENUM(NSUInteger, IHTTPRouteNodeKind) {
+    IHTTPRouteNodeLiteral,
+    IHTTPRouteNodeParameter,
+    IHTTPRouteNodeWildcard
+};
+
+// MARK: -
+
+@interface IHTTPRouteNode : NSObject
+@property(nonatomic, assign) IHTTPRouteNodeKind kind;
+@property(nonatomic, retain) NSData* prefix;
+@property(nonatomic, retain) NSString* name;
+@property(nonatomic, retain) NSMutableArray<IHTTPRouteNode*>* children;
+@property(nonatomic, retain) IHTTPRouteNode* parameterChild;
+@property(nonatomic, retain) IHTTPRouteNode* wildcardChild;
+@property(nonatomic, retain) NSMutableDictionary<NSString*, IHTTPHandler*>* handlers;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPRouteNode
+
++ (IHTTPRouteNode*) nodeWithKind:(IHTTPRouteNodeKind) kind {
+    IHTTPRouteNode* node = IHTTPRouteNode.new;
+    node.kind = kind;
+    node.prefix = NSData.data;
+    node.children = NSMutableArray.new;
+    return node;
+}
+
+/*! @brief a copy of the node and the nodes below it, which share the prefixes, names and handlers */
+- (IHTTPRouteNode*) deepCopy {
+    IHTTPRouteNode* node = [IHTTPRouteNode nodeWithKind:self.kind];
+    node.prefix = self.prefix;
+    node.name = self.name;
+    for (IHTTPRouteNode* child in self.children) {
+        [node.children addObject:[child deepCopy]];
+    }
+    node.parameterChild = [self.parameterChild deepCopy];
+    node.wildcardChild = [self.wildcardChild deepCopy];
+    node.handlers = [self.handlers mutableCopy];
+    return node;
+}
+
+/*! @brief the literal child whose prefix starts with the byte */
+- (IHTTPRouteNode*) childStartingWith:(uint8_t) byte {
+    for (IHTTPRouteNode* child in self.children) {
+        if (((const uint8_t*)child.prefix.bytes)[0] == byte) {
+            return child;
+        }
+    }
+    return nil;
+}
+
+@end
+
+// MARK: -
+
+@interface IHTTPRouteTable ()
+@property(nonatomic, retain) IHTTPRouteNode* root;
+@property(nonatomic, assign) NSUInteger countStorage;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPRouteTable
+
+- (id) init {
+    if ((self = super.init)) {
+        self.root = [IHTTPRouteNode nodeWithKind:IHTTPRouteNodeLiteral];
+    }
+    return self;
+}
+
+// MARK: - Properties
+
+- (NSUInteger) count {
+    return self.countStorage;
+}
+
+// MARK: - NSCopying
+
+- (id) copyWithZone:(NSZone*) zone {
+    IHTTPRouteTable* table = IHTTPRouteTable.new;
+    table.root = [self.root deepCopy];
+    table.countStorage = self.countStorage;
+    return table;
+}
+
+// MARK: - Adding Routes
+
+/*! @brief add the literal bytes below the node, splitting existing prefixes where they differ, returns the node they end at */
+- (IHTTPRouteNode*) addLiteral:(const uint8_t*) bytes length:(size_t) length toNode:(IHTTPRouteNode*) node {
+    while (length > 0) {
+        IHTTPRouteNode* child = [node childStartingWith:bytes[0]];
+        if (!child) {
+            child = [IHTTPRouteNode nodeWithKind:IHTTPRouteNodeLiteral];
+            child.prefix = [NSData dataWithBytes:bytes length:length];
+            [node.children addObject:child];
+            return child;
+        }
+
+        const uint8_t* prefix = child.prefix.bytes;
+        size_t common = 0;
+        while (common < length && common < child.prefix.length && prefix[common] == bytes[common]) {
+            common++;
+        }
+
+        if (common < child.prefix.length) { // split the child where the new literal leaves it
+            IHTTPRouteNode* split = [IHTTPRouteNode nodeWithKind:IHTTPRouteNodeLiteral];
+            split.prefix = [child.prefix subdataWithRange:NSMakeRange(0, common)];
+            child.prefix = [child.prefix subdataWithRange:NSMakeRange(common, (child.prefix.length - common))];
+            [split.children addObject:child];
+            [node.children replaceObjectAtIndex:[node.children indexOfObjectIdenticalTo:child] withObject:split];
+            child = split;
+        }
+
+        node = child;
+        bytes += common;
+        length -= common;
+    }
+
+    return node;
+}
+
+/*! @brief the parameter or wildcard child of the node with the name, raises if it already has one with another name */
+- (IHTTPRouteNode*) addCapture:(NSString*) name kind:(IHTTPRouteNodeKind) kind toNode:(IHTTPRouteNode*) node pattern:(NSString*) pathPattern {
+    IHTTPRouteNode* child = (kind == IHTTPRouteNodeParameter ? node.parameterChild : node.wildcardChild);
+    if (!child) {
+        child = [IHTTPRouteNode nodeWithKind:kind];
+        child.name = name;
+        if (kind == IHTTPRouteNodeParameter) {
+            node.parameterChild = child;
+        }
+        else {
+            node.wildcardChild = child;
+        }
+    }
+    else if (![child.name isEqualToString:name]) {
+        [[NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:
+            @"route %@ names parameter %@ where another route names it %@", pathPattern, name, child.name] userInfo:nil] raise];
+    }
+    return child;
+}
+
+- (void) addRoute:(NSString*) pathPattern method:(NSString*) method handler:(IHTTPHandler*) handler {
+    const uint8_t* pattern = (const uint8_t*)pathPattern.UTF8String;
+    size_t length = strlen((const char*)pattern);
+    if (length == 0 || pattern[0] != '/') {
+        [[NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:
+            @"route %@ must start with /", pathPattern] userInfo:nil] raise];
+    }
+
+    IHTTPRouteNode* node = self.root;
+    size_t literalStart = 0;
+    for (size_t index = 1; index <= length; index++) {
+        BOOL isCapture = (index < length && pattern[index - 1] == '/' && (pattern[index] == ':' || pattern[index] == '*'));
+        if (!isCapture && index < length) {
+            continue;
+        }
+
+        node = [self addLiteral:(pattern + literalStart) length:(index - literalStart) toNode:node];
+        if (!isCapture) {
+            break;
+        }
+
+        size_t nameEnd = (index + 1);
+        while (nameEnd < length && pattern[nameEnd] != '/') {
+            nameEnd++;
+        }
+
+        IHTTPRouteNodeKind kind = (pattern[index] == ':' ? IHTTPRouteNodeParameter : IHTTPRouteNodeWildcard);
+        if (nameEnd == (index + 1) || (kind == IHTTPRouteNodeWildcard && nameEnd < length)) {
+            [[NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:
+                @"route %@ has an unnamed parameter, or a wildcard before the end", pathPattern] userInfo:nil] raise];
+        }
+
+        NSString* name = [NSString.alloc initWithBytes:(pattern + index + 1) length:(nameEnd - index - 1) encoding:NSUTF8StringEncoding];
+        node = [self addCapture:name kind:kind toNode:node pattern:pathPattern];
+        literalStart = index = nameEnd;
+    }
+
+    if (!node.handlers) {
+        node.handlers = NSMutableDictionary.new;
+    }
+    if (!node.handlers[(method ?: IHTTPRouteAnyMethod)]) {
+        self.countStorage++;
+    }
+    node.handlers[(method ?: IHTTPRouteAnyMethod)] = handler;
+}
+
+// MARK: - Lookup
+
+/*! @brief match the rest of the path below the node, which has consumed the path up to the offset,
+    trying literal children before parameters before wildcards and backing out captures which don't lead to a handler */
+- (IHTTPHandler*) matchNode:(IHTTPRouteNode*) node method:(NSString*) method path:(const uint8_t*) path offset:(size_t) offset length:(size_t) length
+    captures:(IHTTPRouteCapture*) captures captureCount:(unsigned*) captureCount {
+    if (offset == length && node.handlers) {
+        IHTTPHandler* handler = (node.handlers[method] ?: node.handlers[IHTTPRouteAnyMethod]);
+        if (handler) {
+            return handler;
+        }
+    }
+
+    unsigned savedCount = *captureCount;
+    if (offset < length) {
+        IHTTPRouteNode* child = [node childStartingWith:path[offset]];
+        if (child && child.prefix.length <= (length - offset) && memcmp(child.prefix.bytes, (path + offset), child.prefix.length) == 0) {
+            IHTTPHandler* handler = [self matchNode:child method:method path:path offset:(offset + child.prefix.length) length:length
+                captures:captures captureCount:captureCount];
+            if (handler) {
+                return handler;
+            }
+        }
+
+        if (node.parameterChild) {
+            size_t segmentEnd = offset;
+            while (segmentEnd < length && path[segmentEnd] != '/') {
+                segmentEnd++;
+            }
+
+            if (segmentEnd > offset) {
+                if (*captureCount < IHTTPRouteMaxCaptures) {
+                    captures[(*captureCount)++] = (IHTTPRouteCapture){ node.parameterChild.name, offset, (segmentEnd - offset) };
+                }
+                IHTTPHandler* handler = [self matchNode:node.parameterChild method:method path:path offset:segmentEnd length:length
+                    captures:captures captureCount:captureCount];
+                if (handler) {
+                    return handler;
+                }
+                *captureCount = savedCount;
+            }
+        }
+    }
+
+    IHTTPRouteNode* wildcard = node.wildcardChild;
+    IHTTPHandler* handler = (wildcard ? (wildcard.handlers[method] ?: wildcard.handlers[IHTTPRouteAnyMethod]) : nil);
+    if (handler && *captureCount < IHTTPRouteMaxCaptures) {
+        captures[(*captureCount)++] = (IHTTPRouteCapture){ wildcard.name, offset, (length - offset) };
+    }
+    return handler;
+}
+
+- (IHTTPHandler*) handlerForMethod:(NSString*) method path:(const uint8_t*) path length:(size_t) length parameters:(NSDictionary<NSString*, NSString*>**) parameters {
+    size_t pathLength = 0;
+    while (pathLength < length && path[pathLength] != '?' && path[pathLength] != '#') {
+        pathLength++;
+    }
+
+    IHTTPRouteCapture captures[IHTTPRouteMaxCaptures];
+    unsigned captureCount = 0;
+    IHTTPHandler* handler = [self matchNode:self.root method:method path:path offset:0 length:pathLength captures:captures captureCount:&captureCount];
+
+    if (handler && parameters) {
+        NSMutableDictionary* captured = nil;
+        if (captureCount > 0) {
+            captured = [NSMutableDictionary dictionaryWithCapacity:captureCount];
+            for (unsigned index = 0; index < captureCount; index++) {
+                NSString* value = [NSString.alloc initWithBytes:(path + captures[index].offset) length:captures[index].length encoding:NSUTF8StringEncoding];
+                captured[captures[index].name] = (value.stringByRemovingPercentEncoding ?: value ?: @"");
+            }
+        }
+        *parameters = captured;
+    }
+
+    return handler;
+}
+
+@end
@@ -1,14 +1,35 @@
 #import "IHTTPServer.h"
 
+#import "IHTTPAccessLog.h"
 #import "IHTTPConstants.h"
 #import "IHTTPHandler.h"
 #import "IHTTPRequest.h"
 #import "IHTTPResponse.h"
-
-#import <sys/socket.h>
-#import <netinet/in.h>
-#import <Network/Network.h>
-
+#import "IHTTPPrivate.h"
+#import "IHTTPMetrics.h"
+#import "IHTTPRouteTable.h"
+#import "IHTTPWorker.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/*! @brief socket option which lets each worker listen on its own socket and has the kernel balance connections between them,
+    SO_REUSEPORT on Darwin lets the sockets share the port but sends every connection to the last one bound */
+#if __linux__
+#define IHTTPServerBalancedReusePort SO_REUSEPORT
+#elif defined(SO_REUSEPORT_LB)
+#define IHTTPServerBalancedReusePort SO_REUSEPORT_LB
+#endif
+
+#ifdef TCP_DEFER_ACCEPT
+/*! @brief seconds the kernel holds a deferred connection waiting for its first bytes */
+static int const IHTTPServerDeferAcceptTimeout = 5;
+#endif
 
 @class IHTTPServerTask;
 
@@ -16,19 +37,21 @@ NSString * const IHTTPServerStateChangedNotification = @"IHTTPServerStateChanged
 
 // MARK: -
 
-@interface IHTTPServer () <IHTTPRequestDelegate, IHTTPResponseDelegate>
+@interface IHTTPServer ()
 @property(nonatomic, assign) IHHTPServerState serverStateStorage;
-@property(nonatomic, assign) nw_endpoint_t networkListener;
-@property(nonatomic, retain) NSMutableArray* handlerPrototypesStorage;
-@property(nonatomic, retain) NSMutableSet* serverRequestsStorage;
+@property(atomic, retain) NSArray<IHTTPHandler*>* handlerPrototypesStorage;
+@property(atomic, retain) IHTTPRouteTable* routeTable;
 @property(nonatomic, retain) NSError* serverErrorStorage;
+@property(nonatomic, retain) NSMutableArray<IHTTPWorker*>* workers;
+@property(nonatomic, retain) NSMutableArray<NSNumber*>* listenSockets;
+@property(nonatomic, retain) NSOperationQueue* handlerQueueStorage;
+@property(atomic, retain) NSArray<NSString*>* handlerLabelsStorage;
+@property(nonatomic, assign) id<IHTTPServerDelegate> delegateStorage;
+@property(nonatomic, assign) BOOL delegateWantsReceive;
+@property(nonatomic, assign) BOOL delegateWantsComplete;
 
 - (void)setServerError:(NSError*) anError;
 
-// TODO remove
-@property(nonatomic, retain) NSFileHandle* listeningHandle;
-@property(nonatomic, assign) CFSocketRef serverSocket;
-
 @end
 
 // MARK: -
@@ -59,6 +82,19 @@ NSString * const IHTTPServerStateChangedNotification = @"IHTTPServerStateChanged
         self.serverPort = IHTTPDefaultPort;
 		self.serverStateStorage = IHTTPServerStateIdle;
         self.loggingLevel = IHTTPServerLoggingErrors;
+        self.keepAliveTimeout = 5;
+        self.keepAliveMaxRequests = 100;
+        self.headerTimeout = 10;
+        self.bodyTimeout = 30;
+        self.writeTimeout = 30;
+        self.webSocketPingInterval = 30;
+        self.http2MaxConcurrentStreams = 100;
+        self.overloadRetryAfter = 1;
+        self.maxRequestBodyLength = (16 * 1024 * 1024);
+        self.workerCount = 1;
+        self.listenBacklog = SOMAXCONN;
+        self.tcpNoDelay = YES;
+        self.handlerLabelsStorage = @[@"other"];
         [self resetPrototypes];
 	}
 	return self;
@@ -67,7 +103,162 @@ NSString * const IHTTPServerStateChangedNotification = @"IHTTPServerStateChanged
 // MARK: - Properties
 
 - (NSArray*) handlerPrototypes {
-    return [NSArray arrayWithArray:self.handlerPrototypesStorage];
+    return self.handlerPrototypesStorage;
+}
+
+- (NSSet*) serverRequests {
+    NSMutableSet* requests = NSMutableSet.new;
+    for (IHTTPWorker* worker in self.workers) {
+        [requests unionSet:worker.requests];
+    }
+    return requests;
+}
+
+- (NSOperationQueue*) handlerQueue {
+    return self.handlerQueueStorage;
+}
+
+- (NSTimeInterval) handlerQueueLatency {
+    NSUInteger count = 0;
+    NSTimeInterval total = 0;
+    for (IHTTPWorker* worker in self.workers) {
+        count += worker.queuedHandlerCount;
+        total += worker.handlerQueueTime;
+    }
+    return (count > 0 ? (total / count) : 0);
+}
+
+- (NSTimeInterval) maxHandlerQueueLatency {
+    NSTimeInterval longest = 0;
+    for (IHTTPWorker* worker in self.workers) {
+        longest = MAX(longest, worker.maxHandlerQueueTime);
+    }
+    return longest;
+}
+
+- (NSTimeInterval) handlerDispatchLatency {
+    NSUInteger count = 0;
+    NSTimeInterval total = 0;
+    for (IHTTPWorker* worker in self.workers) {
+        count += worker.queuedHandlerCount;
+        total += worker.handlerDispatchTime;
+    }
+    return (count > 0 ? (total / count) : 0);
+}
+
+- (NSTimeInterval) maxHandlerDispatchLatency {
+    NSTimeInterval longest = 0;
+    for (IHTTPWorker* worker in self.workers) {
+        longest = MAX(longest, worker.maxHandlerDispatchTime);
+    }
+    return longest;
+}
+
+/*! @brief the total of the workers' counts of the kind of timeout */
+- (NSUInteger) timeoutCountForKind:(IHTTPTimeoutKind) kind {
+    NSUInteger count = 0;
+    for (IHTTPWorker* worker in self.workers) {
+        count += [worker timeoutCountForKind:kind];
+    }
+    return count;
+}
+
+- (NSUInteger) headerTimeoutCount {
+    return [self timeoutCountForKind:IHTTPTimeoutHeader];
+}
+
+- (NSUInteger) bodyTimeoutCount {
+    return [self timeoutCountForKind:IHTTPTimeoutBody];
+}
+
+- (NSUInteger) idleTimeoutCount {
+    return [self timeoutCountForKind:IHTTPTimeoutIdle];
+}
+
+- (NSUInteger) writeTimeoutCount {
+    return [self timeoutCountForKind:IHTTPTimeoutWrite];
+}
+
+/*! @brief the total of the workers' counts of requests shed for the reason */
+- (NSUInteger) shedCountForReason:(IHTTPShedReason) reason {
+    NSUInteger count = 0;
+    for (IHTTPWorker* worker in self.workers) {
+        count += [worker shedCountForReason:reason];
+    }
+    return count;
+}
+
+- (NSUInteger) shedRequestCount {
+    return ([self shedCountForReason:IHTTPShedInFlight] + [self shedCountForReason:IHTTPShedQueueDelay]);
+}
+
+- (NSUInteger) rateLimitedRequestCount {
+    return [self shedCountForReason:IHTTPShedRateLimit];
+}
+
+- (NSUInteger) inFlightRequestCount {
+    NSUInteger count = 0;
+    for (IHTTPWorker* worker in self.workers) {
+        count += worker.inFlightCount;
+    }
+    return count;
+}
+
+- (NSArray<NSString*>*) handlerLabels {
+    return self.handlerLabelsStorage;
+}
+
+- (NSString*) prometheusMetrics {
+    NSArray<NSString*>* labels = self.handlerLabels;
+    NSArray<IHTTPWorker*>* workers = [self.workers copy];
+    IHTTPMetrics* total = [IHTTPMetrics metricsWithHandlerCount:labels.count];
+    NSUInteger connectionCount = 0;
+    NSUInteger inFlightCount = 0;
+    for (IHTTPWorker* worker in workers) {
+        [total addMetrics:worker.metrics];
+        connectionCount += worker.connectionCount;
+        inFlightCount += worker.inFlightCount;
+    }
+
+    NSMutableString* text = NSMutableString.new;
+    [total appendPrometheusText:text handlerLabels:labels];
+    [text appendString:@"# HELP ihttp_connections_open Connections currently open.\n# TYPE ihttp_connections_open gauge\n"];
+    [text appendFormat:@"ihttp_connections_open %lu\n", (unsigned long)connectionCount];
+    [text appendString:@"# HELP ihttp_timeouts_total Connections closed for exceeding a timeout, by timeout.\n# TYPE ihttp_timeouts_total counter\n"];
+    [text appendFormat:@"ihttp_timeouts_total{timeout=\"header\"} %lu\n", (unsigned long)self.headerTimeoutCount];
+    [text appendFormat:@"ihttp_timeouts_total{timeout=\"body\"} %lu\n", (unsigned long)self.bodyTimeoutCount];
+    [text appendFormat:@"ihttp_timeouts_total{timeout=\"idle\"} %lu\n", (unsigned long)self.idleTimeoutCount];
+    [text appendFormat:@"ihttp_timeouts_total{timeout=\"write\"} %lu\n", (unsigned long)self.writeTimeoutCount];
+    [text appendString:@"# HELP ihttp_requests_in_flight Requests being handled.\n# TYPE ihttp_requests_in_flight gauge\n"];
+    [text appendFormat:@"ihttp_requests_in_flight %lu\n", (unsigned long)inFlightCount];
+    [text appendString:@"# HELP ihttp_requests_shed_total Requests refused before their handlers ran, by reason.\n# TYPE ihttp_requests_shed_total counter\n"];
+    [text appendFormat:@"ihttp_requests_shed_total{reason=\"in_flight\"} %lu\n", (unsigned long)[self shedCountForReason:IHTTPShedInFlight]];
+    [text appendFormat:@"ihttp_requests_shed_total{reason=\"queue_delay\"} %lu\n", (unsigned long)[self shedCountForReason:IHTTPShedQueueDelay]];
+    [text appendFormat:@"ihttp_requests_shed_total{reason=\"rate_limit\"} %lu\n", (unsigned long)[self shedCountForReason:IHTTPShedRateLimit]];
+    return text;
+}
+
+- (id<IHTTPServerDelegate>) delegate {
+    return self.delegateStorage;
+}
+
+- (void) setDelegate:(id<IHTTPServerDelegate>) delegate {
+    self.delegateStorage = delegate;
+    // checked once here, rather than for every request on the workers
+    self.delegateWantsReceive = [delegate respondsToSelector:@selector(IHTTPServer:didReceive:)];
+    self.delegateWantsComplete = [delegate respondsToSelector:@selector(IHTTPServer:didComplete:)];
+}
+
+- (void) didReceiveRequest:(IHTTPRequest*) request {
+    if (self.delegateWantsReceive) {
+        [self.delegateStorage IHTTPServer:self didReceive:request];
+    }
+}
+
+- (void) didCompleteResponse:(IHTTPResponse*) response {
+    if (self.delegateWantsComplete) {
+        [self.delegateStorage IHTTPServer:self didComplete:response];
+    }
 }
 
 - (IHHTPServerState) serverState {
@@ -109,16 +300,68 @@ NSString * const IHTTPServerStateChangedNotification = @"IHTTPServerStateChanged
 
 // MARK: - Prototype Registry
 
+/*! @brief give the prototype the next metricsIndex and a label the first time it's registered, labels stay unique as Prometheus requires,
+    before the prototype is published to the workers so they never read the index while it's set */
+- (void)labelPrototype:(IHTTPHandler *)prototype defaultName:(NSString *)defaultName {
+    if (prototype.metricsIndex == 0) {
+        NSArray<NSString*>* labels = self.handlerLabelsStorage;
+        NSString* label = (prototype.name ?: defaultName);
+        if ([labels containsObject:label]) {
+            label = [NSString stringWithFormat:@"%@ %lu", label, (unsigned long)labels.count];
+        }
+        prototype.metricsIndex = labels.count;
+        self.handlerLabelsStorage = [labels arrayByAddingObject:label]; // replaced, so a scrape can read it while handlers are registered
+    }
+}
+
+// the prototypes and routes are replaced rather than changed, the workers look them up without locking while handlers are registered
+
 - (void)registerHandler:(IHTTPHandler *)prototype {
-	[self.handlerPrototypesStorage insertObject:prototype atIndex:0];
+    @synchronized(self) {
+        [self labelPrototype:prototype defaultName:NSStringFromClass(prototype.class)];
+        self.handlerPrototypesStorage = [@[prototype] arrayByAddingObjectsFromArray:self.handlerPrototypesStorage];
+    }
 
     if (self.loggingLevel >= IHTTPServerLoggingDebug) {
         NSLog(@"%@ registerPrototype: %@", NSStringFromClass([self class]), prototype);
     }
+
+    if ([self.delegate respondsToSelector:@selector(IHTTPServer:didRegister:)]) {
+        [self.delegate IHTTPServer:self didRegister:prototype];
+    }
+}
+
+- (void)registerHandler:(IHTTPHandler *)prototype method:(NSString *)method path:(NSString *)pathPattern {
+    @synchronized(self) {
+        IHTTPRouteTable* routeTable = [self.routeTable copy];
+        [routeTable addRoute:pathPattern method:method handler:prototype]; // raises before the table in use is replaced
+        [self labelPrototype:prototype defaultName:[NSString stringWithFormat:@"%@ %@", (method ?: @"*"), pathPattern]];
+        self.routeTable = routeTable;
+    }
+
+    if (self.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ registerPrototype: %@ method: %@ path: %@", NSStringFromClass([self class]), prototype, method, pathPattern);
+    }
+
+    if ([self.delegate respondsToSelector:@selector(IHTTPServer:didRegister:)]) {
+        [self.delegate IHTTPServer:self didRegister:prototype];
+    }
 }
 
 - (IHTTPHandler *)prototypeForRequest:(IHTTPRequest *)request {
-    for (IHTTPHandler* prototype in self.handlerPrototypes) {
+    IHTTPRouteTable* routeTable = self.routeTable;
+    if (routeTable.count > 0) {
+        size_t targetLength = 0;
+        const uint8_t* target = [request requestTargetBytes:&targetLength];
+        NSDictionary* parameters = nil;
+        IHTTPHandler* routed = [routeTable handlerForMethod:request.requestMethod path:target length:targetLength parameters:&parameters];
+        if (routed) {
+            request.pathParameters = parameters;
+            return routed;
+        }
+    }
+
+    for (IHTTPHandler* prototype in self.handlerPrototypesStorage) { // the array in place when the lookup started
         if ([prototype canHandleRequest:request]) {
             return prototype;
         }
@@ -127,80 +370,88 @@ NSString * const IHTTPServerStateChangedNotification = @"IHTTPServerStateChanged
 }
 
 - (void)resetPrototypes {
-    self.handlerPrototypesStorage = [NSMutableArray new];
+    @synchronized(self) {
+        self.handlerPrototypesStorage = @[];
+        self.routeTable = IHTTPRouteTable.new;
+    }
     
-    [self registerHandler:[IHTTPHandler handlerWithResponseBlock:^NSUInteger(IHTTPRequest *request, IHTTPResponse *response) {
+    IHTTPHandler* notImplemented = [IHTTPHandler handlerWithResponseBlock:^NSUInteger(IHTTPRequest *request, IHTTPResponse *response) {
         NSUInteger errorStatus = IHTTPStatus501NotImplemented;
         [response sendStatus:errorStatus];
         [response completeResponse];
         return errorStatus;
-    }]];
+    }];
+    notImplemented.name = @"not_implemented";
+    [self registerHandler:notImplemented];
     
     if (self.loggingLevel >= IHTTPServerLoggingDebug) {
         NSLog(@"%@ resetPrototypes", NSStringFromClass([self class]));
     }
+
+    if ([self.delegate respondsToSelector:@selector(IHTTPServerDidReset:)]) {
+        [self.delegate IHTTPServerDidReset:self];
+    }
 }
 
 // MARK: -
 
 - (void)startServer {
-    CFDataRef addressData = nil;
-    
     if ((self.serverState != IHTTPServerStateStarting) && (self.serverState != IHTTPServerStateRunning)) {
         self.serverErrorStorage = nil;
         self.serverStateStorage = IHTTPServerStateStarting;
-        self.serverRequestsStorage = [NSMutableSet new];
-        
+        self.workers = NSMutableArray.new;
+        self.listenSockets = NSMutableArray.new;
+
         if (self.loggingLevel >= IHTTPServerLoggingDebug) {
             NSLog(@"%@ startServer", NSStringFromClass([self class]));
         }
-        
-        self.serverSocket = CFSocketCreate(kCFAllocatorDefault, PF_INET, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL);
-        if (!self.serverSocket) {
-            [self errorWithName:@"Unable to create socket."];
-            return;
-        }
 
-        int reuse = true;
-        int fileDescriptor = CFSocketGetNative(self.serverSocket);
-        if (setsockopt(fileDescriptor, SOL_SOCKET, SO_REUSEADDR,
-            (void *)&reuse, sizeof(int)) != 0) {
-            [self errorWithName:@"Unable to set socket options."];
-            return;
+        if (!self.accessLog && self.loggingLevel >= IHTTPServerLoggingRequests) { // instead of describing every request with NSLog
+            self.accessLog = [IHTTPAccessLog accessLogWithPath:nil format:IHTTPAccessLogCommon];
         }
-        
-        struct sockaddr_in address;
-        memset(&address, 0, sizeof(address));
-        address.sin_len = sizeof(address);
-        address.sin_family = AF_INET;
-        address.sin_addr.s_addr = htonl(INADDR_ANY);
-        address.sin_port = htons(self.serverPort);
-        CFDataRef addressData = CFDataCreate(kCFAllocatorDefault, (const UInt8 *)&address, sizeof(address));
-        
-        if (CFSocketSetAddress(self.serverSocket, addressData) != kCFSocketSuccess) {
-            [self errorWithName:@"Unable to bind socket to address."];
-            goto exit;
+
+        if (self.handlerConcurrency > 0) { // handlers run here, socket I/O stays on the workers
+            self.handlerQueueStorage = NSOperationQueue.new;
+            self.handlerQueueStorage.name = [NSString stringWithFormat:@"%@ handlers", NSStringFromClass(self.class)];
+            self.handlerQueueStorage.maxConcurrentOperationCount = (NSInteger)self.handlerConcurrency;
+            self.handlerQueueStorage.qualityOfService = NSQualityOfServiceUserInitiated;
         }
 
-        self.listeningHandle = [NSFileHandle.alloc initWithFileDescriptor:fileDescriptor closeOnDealloc:YES];
+        NSUInteger workerCount = MAX(self.workerCount, 1);
+#ifdef IHTTPServerBalancedReusePort
+        BOOL socketPerWorker = (workerCount > 1);
+#else
+        BOOL socketPerWorker = NO;
+#endif
+        int listenSocket = -1;
+        for (NSUInteger index = 0; index < workerCount; index++) {
+            if (index == 0 || socketPerWorker) {
+                NSString* errorName = nil;
+                listenSocket = [self openListenSocketReusingPort:socketPerWorker errorName:&errorName];
+                if (listenSocket < 0) {
+                    [self errorWithName:errorName];
+                    return;
+                }
+                [self.listenSockets addObject:@(listenSocket)];
+            }
+
+            IHTTPWorker* worker = [IHTTPWorker workerWithServer:self listenSocket:listenSocket index:index];
+            if (![worker startWorker]) {
+                [self errorWithName:@"Unable to create event loop."];
+                return;
+            }
+            [self.workers addObject:worker];
+        }
 
-        [NSNotificationCenter.defaultCenter
-            addObserver:self
-            selector:@selector(receiveIncomingConnectionNotification:)
-            name:NSFileHandleConnectionAcceptedNotification
-            object:nil];
-        [self.listeningHandle acceptConnectionInBackgroundAndNotify];
-        
         self.serverState = IHTTPServerStateRunning;
+
+        if ([self.delegate respondsToSelector:@selector(IHTTPServerDidStart:)]) {
+            [self.delegate IHTTPServerDidStart:self];
+        }
     }
     else if (self.loggingLevel >= IHTTPServerLoggingWarnings) {
         NSLog(@"%@ warning can't startServer in state: %lu", NSStringFromClass([self class]), (unsigned long)self.serverState);
     }
-
-exit:
-    if (addressData) {
-        CFRelease(addressData);
-    }
 }
 
 - (void)stopServer {
@@ -210,97 +461,126 @@ exit:
         NSLog(@"%@ stopServer", NSStringFromClass([self class]));
     }
 
-    // stop listening
-	[self.listeningHandle closeFile];
-	self.listeningHandle = nil;
-
-	[NSNotificationCenter.defaultCenter
-		removeObserver:self
-		name:NSFileHandleConnectionAcceptedNotification
-		object:nil];
+    [self.handlerQueue waitUntilAllOperationsAreFinished]; // while the workers run to write their output
+    self.handlerQueueStorage = nil;
 
-    // complete all serverTasks
-    for (IHTTPRequest* request in self.serverRequests) {
-        [request.input closeFile];
+    for (IHTTPWorker* worker in self.workers) {
+        [worker stopWorker];
     }
-    [self.serverRequestsStorage removeAllObjects];
-    self.serverRequestsStorage = nil;
 
+    for (NSNumber* listenSocket in self.listenSockets) { // after the workers have removed them from their loops
+        close(listenSocket.intValue);
+    }
 
-	if (self.serverSocket) {
-		CFSocketInvalidate(self.serverSocket);
-		// CFRelease(self.serverSocket);
-		self.serverSocket = nil;
-	}
+    self.workers = nil;
+    self.listenSockets = nil;
 
 	self.serverState = IHTTPServerStateIdle;
-}
 
-// MARK: -
-
-- (void)errorWithName:(NSString *)errorName {
-	self.serverError = [NSError errorWithDomain:@"IHTTPServerError" code:0 userInfo:@{
-        NSLocalizedDescriptionKey: NSLocalizedStringFromTable(errorName, @"", @"IHTTPServerErrors")
-    }];
+    if ([self.delegate respondsToSelector:@selector(IHTTPServerDidStop:)]) {
+        [self.delegate IHTTPServerDidStop:self];
+    }
 }
 
-// MARK: -
+/*! @brief create a non-blocking socket listening on the bindAddress and serverPort, returns -1 and sets the errorName on failure */
+- (int)openListenSocketReusingPort:(BOOL) reusePort errorName:(NSString**) errorName {
+    struct sockaddr_storage address;
+    socklen_t addressLength = 0;
+    memset(&address, 0, sizeof(address));
+
+    struct sockaddr_in6* address6 = (struct sockaddr_in6*)&address;
+    struct sockaddr_in* address4 = (struct sockaddr_in*)&address;
+    BOOL dualStack = NO;
+    int listenSocket = -1;
+
+    if (!self.bindAddress) { // all addresses, both IPv6 and IPv4 when the system supports them
+        address6->sin6_family = AF_INET6;
+        address6->sin6_addr = in6addr_any;
+        addressLength = sizeof(struct sockaddr_in6);
+        dualStack = YES;
+        listenSocket = socket(PF_INET6, SOCK_STREAM, IPPROTO_TCP);
+
+        if (listenSocket < 0) { // no IPv6 on this host
+            memset(&address, 0, sizeof(address));
+            address4->sin_family = AF_INET;
+            address4->sin_addr.s_addr = htonl(INADDR_ANY);
+            addressLength = sizeof(struct sockaddr_in);
+            dualStack = NO;
+        }
+    }
+    else if (inet_pton(AF_INET6, self.bindAddress.UTF8String, &address6->sin6_addr) == 1) {
+        address6->sin6_family = AF_INET6;
+        addressLength = sizeof(struct sockaddr_in6);
+    }
+    else if (inet_pton(AF_INET, self.bindAddress.UTF8String, &address4->sin_addr) == 1) {
+        address4->sin_family = AF_INET;
+        addressLength = sizeof(struct sockaddr_in);
+    }
+    else {
+        *errorName = @"Invalid bind address.";
+        return -1;
+    }
 
-- (void)receiveIncomingConnectionNotification:(NSNotification *)notification {
-	NSDictionary* userInfo = [notification userInfo];
-	NSFileHandle* requestHandle = [userInfo objectForKey:NSFileHandleNotificationFileHandleItem];
+    if (address.ss_family == AF_INET6) {
+        address6->sin6_port = htons(self.serverPort);
+    }
+    else {
+        address4->sin_port = htons(self.serverPort);
+    }
+#if !__linux__
+    address.ss_len = addressLength;
+#endif
 
-    if (requestHandle) {
-        IHTTPRequest* request = [IHTTPRequest requestWithInput:requestHandle];
-        request.delegate = self;
-        [self.serverRequestsStorage addObject:request];
-        [request readHeaders]; // set the handler when the header read is complete
-        
-        if (self.loggingLevel >= IHTTPServerLoggingDebug) {
-            NSLog(@"%@ incoming request at %@", NSStringFromClass([self class]), request.requestTime);
-        }
+    if (listenSocket < 0) {
+        listenSocket = socket((address.ss_family == AF_INET6 ? PF_INET6 : PF_INET), SOCK_STREAM, IPPROTO_TCP);
     }
-    
-    // wait for the next connection
-	[self.listeningHandle acceptConnectionInBackgroundAndNotify];
-}
 
-// MARK: - IHTTPRequestDelegate
+    if (listenSocket < 0) {
+        *errorName = @"Unable to create socket.";
+        return -1;
+    }
 
-- (void) request:(IHTTPRequest*) request parsedHeaders:(NSDictionary*) headers {
-    // NSLog(@"request:%@ parsedHeaders:%@", request, headers);
-    IHTTPHandler* prototype = [self prototypeForRequest:request];
-    IHTTPHandler* handler = [prototype handlerForRequest:request];
-    IHTTPResponse* response = [IHTTPResponse responseWithOutput:request.input];
-    response.delegate = self;
+    int enable = true;
+    int v6Only = !dualStack;
+    if (setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, (void *)&enable, sizeof(int)) != 0
+     || (address.ss_family == AF_INET6 && setsockopt(listenSocket, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&v6Only, sizeof(int)) != 0)
+#ifdef IHTTPServerBalancedReusePort
+     || (reusePort && setsockopt(listenSocket, SOL_SOCKET, IHTTPServerBalancedReusePort, (void *)&enable, sizeof(int)) != 0)
+#endif
+     || fcntl(listenSocket, F_SETFL, (fcntl(listenSocket, F_GETFL) | O_NONBLOCK)) != 0) {
+        close(listenSocket);
+        *errorName = @"Unable to set socket options.";
+        return -1;
+    }
 
-    if (self.loggingLevel >= IHTTPServerLoggingRequests) {
-        NSLog(@"%@ request: %@", NSStringFromClass([self class]), request);
+#ifdef TCP_DEFER_ACCEPT
+    if (self.tcpDeferAccept) {
+        int deferSeconds = IHTTPServerDeferAcceptTimeout;
+        setsockopt(listenSocket, IPPROTO_TCP, TCP_DEFER_ACCEPT, (void *)&deferSeconds, sizeof(int));
     }
+#endif
 
-    [handler handleRequest:request withResponse:response];
-    
-    if (self.loggingLevel >= IHTTPServerLoggingResponses) {
-        NSLog(@"%@ response: %@ handler: %@ ", NSStringFromClass([self class]), response, handler);
+    if (bind(listenSocket, (struct sockaddr*)&address, addressLength) != 0) {
+        close(listenSocket);
+        *errorName = @"Unable to bind socket to address.";
+        return -1;
     }
-}
 
-// MARK: - IHTTPResponseDelegate
+    if (listen(listenSocket, (self.listenBacklog > 0 ? self.listenBacklog : SOMAXCONN)) != 0) {
+        close(listenSocket);
+        *errorName = @"Unable to listen on socket.";
+        return -1;
+    }
 
-- (void) responseDidComplete:(IHTTPResponse *)response {
-    for (IHTTPRequest* request in self.serverRequests) {
-        if (response.output == request.input) {
-            // NSLog(@"responseDidComplete:%@ sentHeaders:%@", response, response.responseHeaders);
-            [request completeRequest];
-            [self.serverRequestsStorage removeObject:request];
+    return listenSocket;
+}
 
-            if (self.loggingLevel >= IHTTPServerLoggingResponses) {
-                NSLog(@"%@ complete: %@", NSStringFromClass([self class]), response);
-            }
+// MARK: -
 
-            return;
-        }
-    }
+- (void)errorWithName:(NSString *)errorName {
+	self.serverError = [NSError errorWithDomain:@"IHTTPServerError" code:0 userInfo:@{
+        NSLocalizedDescriptionKey: NSLocalizedStringFromTable(errorName, @"", @"IHTTPServerErrors")
+    }];
 }
 
 @end
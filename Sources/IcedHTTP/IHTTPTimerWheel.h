@@ -0,0 +1,47 @@
+#import <Foundation/Foundation.h>
+
+/*! @header IHTTPTimerWheel.h
+    @abstract IHTTPTimerWheel expires the timeouts of a worker's connections, not part of the public API */
+
+/*! @protocol IHTTPTimer
+    @brief an object with one deadline at a time, which the wheel keeps in one of its slots */
+@protocol IHTTPTimer <NSObject>
+
+/*! @brief the time the timer expires, 0 when it isn't scheduled */
+@property(nonatomic, assign) NSTimeInterval timerDeadline;
+
+/*! @brief the slot of the wheel the timer is in, only used by the wheel */
+@property(nonatomic, assign) NSUInteger timerSlot;
+
+@end
+
+// MARK: -
+
+/*! @class IHTTPTimerWheel
+    @brief a hashed timing wheel, each slot holds the timers which expire on a tick of the wheel, modulo the number of slots
+    @discussion scheduling, cancelling and extending a timer take constant time however many are running,
+    an extended deadline only changes the timer, which moves to its new slot when the wheel reaches the old one.
+    Deadlines past the end of the wheel wait in their slot for as many turns as it takes. Only used on one thread */
+@interface IHTTPTimerWheel : NSObject
+
+/*! @brief the number of timers scheduled */
+@property(nonatomic, readonly) NSUInteger count;
+
+// MARK: -
+
+/*! @brief a wheel with the number of slots, each covering the resolution in seconds, starting at the time provided */
++ (IHTTPTimerWheel*) timerWheelWithSlotCount:(NSUInteger) slotCount resolution:(NSTimeInterval) resolution currentTime:(NSTimeInterval) now;
+
+// MARK: -
+
+/*! @brief schedule the timer to expire at the deadline, or move it if it's already scheduled */
+- (void) scheduleTimer:(id<IHTTPTimer>) timer deadline:(NSTimeInterval) deadline;
+
+/*! @brief remove the timer from the wheel without expiring it */
+- (void) cancelTimer:(id<IHTTPTimer>) timer;
+
+/*! @brief turn the wheel to the time, removing the timers whose deadlines have passed and passing each to the block,
+    which may schedule and cancel timers */
+- (void) advanceToTime:(NSTimeInterval) now expired:(void (^)(id<IHTTPTimer> timer)) expired;
+
+@end
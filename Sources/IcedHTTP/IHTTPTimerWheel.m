@@ -0,0 +1,105 @@
+#import "IHTTPTimerWheel.h"
+
+#include <math.h>
+
+@interface IHTTPTimerWheel ()
+@property(nonatomic, retain) NSArray<NSMutableSet<id<IHTTPTimer>>*>* slots;
+@property(nonatomic, assign) NSTimeInterval resolution;
+@property(nonatomic, assign) long long currentTick;
+@property(nonatomic, assign) NSUInteger countStorage;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPTimerWheel
+
++ (IHTTPTimerWheel*) timerWheelWithSlotCount:(NSUInteger) slotCount resolution:(NSTimeInterval) resolution currentTime:(NSTimeInterval) now {
+    IHTTPTimerWheel* wheel = IHTTPTimerWheel.new;
+    NSMutableArray* slots = [NSMutableArray arrayWithCapacity:MAX(slotCount, 1)];
+    for (NSUInteger index = 0; index < MAX(slotCount, 1); index++) {
+        [slots addObject:NSMutableSet.new];
+    }
+    wheel.slots = slots;
+    wheel.resolution = resolution;
+    wheel.currentTick = (long long)floor(now / resolution);
+    return wheel;
+}
+
+// MARK: - Properties
+
+- (NSUInteger) count {
+    return self.countStorage;
+}
+
+// MARK: -
+
+/*! @brief the slot for the tick on which the deadline has passed */
+- (NSUInteger) slotForDeadline:(NSTimeInterval) deadline {
+    long long tick = MAX((long long)ceil(deadline / self.resolution), (self.currentTick + 1)); // a deadline which has passed expires on the next tick
+    return (NSUInteger)(tick % (long long)self.slots.count);
+}
+
+- (void) scheduleTimer:(id<IHTTPTimer>) timer deadline:(NSTimeInterval) deadline {
+    NSTimeInterval previous = timer.timerDeadline;
+    timer.timerDeadline = deadline;
+
+    if (previous > 0 && deadline >= previous) { // a later deadline waits to be moved until the wheel reaches its slot
+        return;
+    }
+
+    if (previous > 0) {
+        [self.slots[timer.timerSlot] removeObject:timer];
+    }
+    else {
+        self.countStorage += 1;
+    }
+
+    timer.timerSlot = [self slotForDeadline:deadline];
+    [self.slots[timer.timerSlot] addObject:timer];
+}
+
+- (void) cancelTimer:(id<IHTTPTimer>) timer {
+    if (timer.timerDeadline > 0) {
+        [self.slots[timer.timerSlot] removeObject:timer];
+        timer.timerDeadline = 0;
+        self.countStorage -= 1;
+    }
+}
+
+- (void) advanceToTime:(NSTimeInterval) now expired:(void (^)(id<IHTTPTimer> timer)) expired {
+    long long targetTick = (long long)floor(now / self.resolution);
+    long long turns = MIN((targetTick - self.currentTick), (long long)self.slots.count); // after a long stall each slot is visited once
+
+    for (long long step = 0; step < turns; step++) {
+        long long tick = (targetTick - turns + step + 1);
+        NSMutableSet* slot = self.slots[(NSUInteger)(tick % (long long)self.slots.count)];
+        if (slot.count == 0) {
+            continue;
+        }
+
+        for (id<IHTTPTimer> timer in slot.allObjects) { // the block may change the slot
+            if (timer.timerDeadline <= 0 || ![slot containsObject:timer]) {
+                continue;
+            }
+            else if (timer.timerDeadline <= now) {
+                [slot removeObject:timer];
+                timer.timerDeadline = 0;
+                self.countStorage -= 1;
+                expired(timer);
+            }
+            else { // extended, or on a later turn of the wheel
+                NSUInteger due = [self slotForDeadline:timer.timerDeadline];
+                if (self.slots[due] != slot) {
+                    [slot removeObject:timer];
+                    timer.timerSlot = due;
+                    [self.slots[due] addObject:timer];
+                }
+            }
+        }
+    }
+
+    self.currentTick = MAX(self.currentTick, targetTick);
+}
+
+@end
@@ -0,0 +1,632 @@
+#import "IHTTPWebSocket.h"
+
+#import "IHTTPConnection.h"
+#import "IHTTPEventLoop.h"
+#import "IHTTPPrivate.h"
+#import "IHTTPWorker.h"
+
+#include "IHTTPWebSocketFrame.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/*! @brief default length of the longest message accepted from the client */
+static NSUInteger const IHTTPWebSocketDefaultMaxMessageLength = (1024 * 1024);
+
+/*! @brief the most output queued for a client which isn't reading it, on the WebSocket and its connection together,
+    past this the connection is closed */
+static NSUInteger const IHTTPWebSocketMaxPendingOutput = (1024 * 1024);
+
+// MARK: -
+
+@interface IHTTPWebSocketGroup ()
+@property(nonatomic, retain) NSLock* lock;
+@property(nonatomic, retain) NSMutableSet<IHTTPWebSocket*>* members;
+@property(nonatomic, retain) NSArray<IHTTPWebSocket*>* snapshot;
+
+@end
+
+// MARK: -
+
+@interface IHTTPWebSocket ()
+@property(nonatomic, retain) IHTTPRequest* requestStorage;
+@property(nonatomic, assign) int fileDescriptor;
+@property(nonatomic, retain) NSLock* lock;
+@property(nonatomic, retain) NSMutableData* pendingOutput;
+@property(nonatomic, assign) NSUInteger connectionOutputLength; // handed to the connection and not known to be sent
+@property(nonatomic, retain) NSHashTable<IHTTPWebSocketGroup*>* groups;
+@property(nonatomic, retain) NSMutableData* message;
+@property(nonatomic, assign) uint8_t messageOpcode;
+@property(nonatomic, assign) uint64_t payloadReceived;
+@property(nonatomic, assign) NSUInteger closeCode;
+@property(nonatomic, retain) NSString* closeReason;
+@property(atomic, assign) BOOL isClosedStorage;
+@property(nonatomic, assign) BOOL didFailOutput;
+@property(nonatomic, assign) BOOL didSendClose;
+@property(nonatomic, assign) BOOL hasFrameHeader;
+@property(nonatomic, assign) BOOL isOpen;
+@property(nonatomic, assign) BOOL isReadingInput;
+@property(nonatomic, assign) BOOL isAwaitingPong;
+@property(nonatomic, assign) BOOL didFinish;
+
+/*! @brief remember the group, so the WebSocket leaves it when it closes, returns NO if it's already closed */
+- (BOOL) joinGroup:(IHTTPWebSocketGroup*) group;
+
+/*! @brief forget the group */
+- (void) leaveGroup:(IHTTPWebSocketGroup*) group;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPWebSocket {
+    IHTTPWebSocketFrameHeader _frame;
+    uint8_t _headerBytes[IHTTPWebSocketMaxHeaderLength]; // a header split between reads
+    size_t _headerLength;
+    uint8_t _control[IHTTPWebSocketMaxControlLength]; // the payload of a control frame, which may arrive between the fragments of a message
+}
+
+// MARK: - Initializers
+
+- (id)init {
+    if ((self = super.init)) {
+        self.maxMessageLength = IHTTPWebSocketDefaultMaxMessageLength;
+        self.lock = NSLock.new;
+        self.pendingOutput = NSMutableData.new; // held until the 101 Switching Protocols response has been written
+        self.groups = NSHashTable.weakObjectsHashTable;
+    }
+    return self;
+}
+
++ (IHTTPWebSocket*) webSocketWithRequest:(IHTTPRequest*) request {
+    IHTTPWebSocket* webSocket = IHTTPWebSocket.new;
+    webSocket.requestStorage = request;
+    webSocket.fileDescriptor = request.input.fileDescriptor;
+    return webSocket;
+}
+
+// MARK: - Properties
+
+- (IHTTPRequest*) request {
+    return self.requestStorage;
+}
+
+- (BOOL) isClosed {
+    return self.isClosedStorage;
+}
+
+// MARK: - Frames
+
+/*! @brief a final frame with the opcode and payload, as the server sends it, unmasked */
++ (NSData*) frameWithOpcode:(IHTTPWebSocketOpcode) opcode bytes:(const void*) bytes length:(NSUInteger) length {
+    uint8_t header[IHTTPWebSocketMaxHeaderLength];
+    size_t headerLength = IHTTPWriteWebSocketFrameHeader(header, opcode, true, length);
+    NSMutableData* frame = [NSMutableData dataWithCapacity:(headerLength + length)];
+    [frame appendBytes:header length:headerLength];
+    if (length > 0) {
+        [frame appendBytes:bytes length:length];
+    }
+    return frame;
+}
+
++ (NSData*) frameWithText:(NSString*) text {
+    const char* utf8 = (text.UTF8String ?: "");
+    return [self frameWithOpcode:IHTTPWebSocketOpcodeText bytes:utf8 length:strlen(utf8)];
+}
+
++ (NSData*) frameWithData:(NSData*) data {
+    return [self frameWithOpcode:IHTTPWebSocketOpcodeBinary bytes:data.bytes length:data.length];
+}
+
+// MARK: - Output
+
+- (BOOL) sendText:(NSString*) text {
+    return (!self.isClosed && [self sendFrame:[IHTTPWebSocket frameWithText:text]]);
+}
+
+- (BOOL) sendData:(NSData*) data {
+    return (!self.isClosed && [self sendFrame:[IHTTPWebSocket frameWithData:data]]);
+}
+
+- (BOOL) sendFrame:(NSData*) frame {
+    return (!self.isClosed && [self writeFrame:frame]);
+}
+
+/*! @brief run the block on the loop thread of the connection's worker */
+- (void) performBlock:(dispatch_block_t) block {
+    [self.request.eventLoop performBlock:block];
+}
+
+/*! @brief write the frame now if the socket has room for it and no output is waiting, otherwise queue it for the loop thread,
+    so a broadcast isn't held up by a slow client, returns NO if the output has failed */
+- (BOOL) writeFrame:(NSData*) frame {
+    BOOL needsWrite = NO;
+    [self.lock lock];
+    NSMutableData* pending = self.pendingOutput;
+    if (self.didFailOutput) {
+        [self.lock unlock];
+        return NO;
+    }
+    else if (pending) { // before the WebSocket opens, or behind output the client hasn't taken yet
+        if ((self.connectionOutputLength + pending.length + frame.length) > IHTTPWebSocketMaxPendingOutput) { // closed, and leaves its groups
+            self.didFailOutput = YES;
+        }
+        else {
+            [pending appendData:frame];
+        }
+    }
+    else {
+        ssize_t written = 0;
+        do {
+            written = send(self.fileDescriptor, frame.bytes, frame.length, (MSG_DONTWAIT | IHTTPSendFlags));
+        } while (written < 0 && errno == EINTR);
+
+        if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            self.didFailOutput = YES;
+        }
+        else if ((NSUInteger)MAX(written, 0) < frame.length) { // the rest waits for the loop thread
+            NSUInteger sent = (NSUInteger)MAX(written, 0);
+            self.pendingOutput = [NSMutableData dataWithBytes:((const uint8_t*)frame.bytes + sent) length:(frame.length - sent)];
+            needsWrite = YES;
+        }
+    }
+    BOOL didFail = self.didFailOutput;
+    [self.lock unlock];
+
+    IHTTPWebSocket* webSocket = self;
+    if (needsWrite) {
+        [self performBlock:^{
+            [webSocket writePendingOutput];
+        }];
+    }
+    else if (didFail) {
+        [self performBlock:^{
+            [webSocket closeConnectionWithCode:IHTTPWebSocketCloseAbnormal];
+        }];
+    }
+    return !didFail;
+}
+
+/*! @brief hand the queued output to the connection on the loop thread, frames sent meanwhile queue behind it
+    until the connection has sent it, under the write timeout */
+- (void) writePendingOutput {
+    IHTTPConnection* connection = self.request.connection;
+    while (YES) {
+        [self.lock lock];
+        NSMutableData* pending = self.pendingOutput;
+        BOOL isDone = (self.didFailOutput || pending.length == 0);
+        self.pendingOutput = (isDone ? nil : NSMutableData.new);
+        [self.lock unlock];
+
+        if (isDone) {
+            return;
+        }
+        else if (![connection writeBytes:pending.bytes length:pending.length]) {
+            [self failPendingOutput];
+            return;
+        }
+        else if (connection.pendingOutputLength > 0) { // the rest once the client has read this
+            [self.lock lock];
+            self.connectionOutputLength = (NSUInteger)connection.pendingOutputLength;
+            [self.lock unlock];
+
+            IHTTPWebSocket* webSocket = self;
+            [connection performWhenOutputSent:^(BOOL didSend) {
+                [webSocket.lock lock];
+                webSocket.connectionOutputLength = 0;
+                [webSocket.lock unlock];
+                if (didSend) {
+                    [webSocket writePendingOutput];
+                }
+                else {
+                    [webSocket failPendingOutput];
+                }
+            }];
+            return;
+        }
+    }
+}
+
+/*! @brief the connection's output failed or timed out, close the WebSocket */
+- (void) failPendingOutput {
+    [self.lock lock];
+    self.didFailOutput = YES;
+    [self.lock unlock];
+    [self closeConnectionWithCode:IHTTPWebSocketCloseAbnormal];
+}
+
+/*! @brief send a close frame with the code and reason, once, the code is what the closeBlock is told unless the client closed first */
+- (void) sendCloseWithCode:(NSUInteger) code reason:(NSString*) reason {
+    [self.lock lock];
+    BOOL didSendClose = self.didSendClose;
+    self.didSendClose = YES;
+    if (!self.closeCode) {
+        self.closeCode = code;
+        self.closeReason = reason;
+    }
+    [self.lock unlock];
+
+    self.isClosedStorage = YES;
+    if (didSendClose || code == IHTTPWebSocketCloseAbnormal) {
+        return;
+    }
+
+    uint8_t payload[IHTTPWebSocketMaxControlLength] = { (uint8_t)(code >> 8), (uint8_t)code };
+    size_t length = 2;
+    if (code == IHTTPWebSocketCloseNoStatus) { // only ever received, answered with an empty close frame
+        length = 0;
+    }
+    else if (reason) {
+        const char* utf8 = (reason.UTF8String ?: "");
+        size_t reasonLength = MIN(strlen(utf8), (sizeof(payload) - 2));
+        while (reasonLength > 0 && reasonLength < strlen(utf8) && (utf8[reasonLength] & 0xC0) == 0x80) { // don't split a character
+            reasonLength--;
+        }
+        memcpy((payload + 2), utf8, reasonLength);
+        length += reasonLength;
+    }
+    [self writeFrame:[IHTTPWebSocket frameWithOpcode:IHTTPWebSocketOpcodeClose bytes:payload length:length]];
+}
+
+- (void) closeWithCode:(NSUInteger) code reason:(NSString*) reason {
+    if (self.isClosed) {
+        return;
+    }
+
+    [self sendCloseWithCode:code reason:reason];
+    IHTTPWebSocket* webSocket = self;
+    [self performBlock:^{ // wait a ping interval for the client's close frame
+        if (webSocket.isOpen && !webSocket.didFinish) {
+            [webSocket.request.connection startTimeout:IHTTPTimeoutPing];
+        }
+    }];
+}
+
+- (void) closeConnectionWithCode:(NSUInteger) code {
+    [self sendCloseWithCode:code reason:nil];
+    [self finish];
+}
+
+/*! @brief stop reading, close the connection if it opened, leave the groups and tell the closeBlock, once */
+- (void) finish {
+    if (self.didFinish) {
+        return;
+    }
+    self.didFinish = YES;
+    self.isClosedStorage = YES;
+
+    [self.lock lock];
+    NSData* closing = (self.didFailOutput ? nil : self.pendingOutput); // the close frame may be waiting behind output the client hasn't read
+    self.didFailOutput = YES; // nothing more is written once the socket's closed, another connection may reuse its descriptor
+    self.pendingOutput = nil;
+    NSArray<IHTTPWebSocketGroup*>* groups = self.groups.allObjects;
+    [self.groups removeAllObjects];
+    NSUInteger code = (self.closeCode ?: IHTTPWebSocketCloseAbnormal);
+    NSString* reason = self.closeReason;
+    [self.lock unlock];
+
+    for (IHTTPWebSocketGroup* group in groups) {
+        [group removeWebSocket:self];
+    }
+
+    if (self.isOpen) {
+        if (self.isReadingInput) {
+            [self.request.eventLoop removeSource:self forFileDescriptor:self.fileDescriptor];
+            self.isReadingInput = NO;
+        }
+        [self.request.connection cancelTimeout];
+        if (closing.length > 0) { // sent before the connection closes, under the write timeout
+            [self.request.connection writeBytes:closing.bytes length:closing.length];
+        }
+        [self.request closeConnection];
+    }
+
+    IHTTPWebSocketCloseBlock closeBlock = self.closeBlock;
+    self.closeBlock = nil; // the blocks often hold the WebSocket
+    self.messageBlock = nil;
+    if (closeBlock) {
+        closeBlock(self, code, reason);
+    }
+}
+
+// MARK: - Groups
+
+- (BOOL) joinGroup:(IHTTPWebSocketGroup*) group {
+    [self.lock lock];
+    BOOL canJoin = !self.didFailOutput;
+    if (canJoin) {
+        [self.groups addObject:group];
+    }
+    [self.lock unlock];
+    return canJoin;
+}
+
+- (void) leaveGroup:(IHTTPWebSocketGroup*) group {
+    [self.lock lock];
+    [self.groups removeObject:group];
+    [self.lock unlock];
+}
+
+// MARK: - Connection
+
+- (void) openWithData:(NSData*) data {
+    if (self.didFinish) { // the output failed before the response was written
+        [self.request closeConnection];
+        return;
+    }
+
+    self.isOpen = YES;
+    self.isReadingInput = [self.request.eventLoop addSource:self forFileDescriptor:self.fileDescriptor];
+    [self.request.connection startTimeout:IHTTPTimeoutPing];
+    [self writePendingOutput]; // what the handler's block sent, after the 101 Switching Protocols response
+
+    if (data.length > 0) { // frames the client sent straight after the request
+        NSMutableData* bytes = [data mutableCopy];
+        [self appendBytes:bytes.mutableBytes length:bytes.length];
+    }
+}
+
+- (void) pingTimerDidExpire {
+    __attribute__((objc_precise_lifetime)) IHTTPWebSocket* webSocket = self; // closing the connection releases its last reference
+    if (webSocket.didFinish) {
+        return;
+    }
+    else if (self.didSendClose || self.isAwaitingPong) { // the client hasn't answered the close frame, or the last ping
+        [self closeConnectionWithCode:IHTTPWebSocketCloseAbnormal];
+        return;
+    }
+
+    static const uint8_t pingFrame[2] = { (0x80 | IHTTPWebSocketOpcodePing), 0x00 };
+    self.isAwaitingPong = YES;
+    [self writeFrame:[NSData dataWithBytesNoCopy:(void*)pingFrame length:sizeof(pingFrame) freeWhenDone:NO]];
+    [self.request.connection startTimeout:IHTTPTimeoutPing];
+}
+
+// MARK: - Input
+
+/*! @brief parse and unmask the frames in the bytes, which are changed in place, delivering messages as their last frame completes */
+- (void) appendBytes:(uint8_t*) bytes length:(NSUInteger) length {
+    while (length > 0 && !self.didFinish) {
+        if (!self.hasFrameHeader) {
+            size_t previous = _headerLength;
+            size_t copied = MIN((size_t)length, (sizeof(_headerBytes) - previous));
+            memcpy((_headerBytes + previous), bytes, copied);
+            _headerLength += copied;
+
+            IHTTPParseResult result = IHTTPParseWebSocketFrameHeader(_headerBytes, _headerLength, &_frame);
+            if (result == IHTTPParseIncomplete) { // every byte was copied, the header is longer than they are
+                return;
+            }
+            else if (result != IHTTPParseComplete || !_frame.isMasked) { // clients must mask every frame
+                [self closeConnectionWithCode:IHTTPWebSocketCloseProtocolError];
+                return;
+            }
+
+            size_t consumed = (_frame.headerLength - previous);
+            bytes += consumed;
+            length -= consumed;
+            _headerLength = 0;
+            if (![self startFrame]) {
+                return;
+            }
+        }
+
+        // the payload, which may be empty, or continue in later reads
+        NSUInteger piece = (NSUInteger)MIN((uint64_t)length, (_frame.payloadLength - self.payloadReceived));
+        IHTTPUnmaskWebSocketPayload(bytes, piece, _frame.mask, self.payloadReceived);
+        if (_frame.opcode >= IHTTPWebSocketOpcodeClose) {
+            memcpy((_control + self.payloadReceived), bytes, piece);
+        }
+        else {
+            [self.message appendBytes:bytes length:piece];
+        }
+        self.payloadReceived += piece;
+        bytes += piece;
+        length -= piece;
+
+        if (self.payloadReceived == _frame.payloadLength) {
+            self.hasFrameHeader = NO;
+            [self finishFrame];
+        }
+    }
+}
+
+/*! @brief check the frame fits the message in progress and the length limit, returns NO if the connection was closed */
+- (BOOL) startFrame {
+    self.hasFrameHeader = YES;
+    self.payloadReceived = 0;
+
+    if (_frame.opcode == IHTTPWebSocketOpcodeText || _frame.opcode == IHTTPWebSocketOpcodeBinary) {
+        if (self.messageOpcode) { // the last message hasn't finished
+            [self closeConnectionWithCode:IHTTPWebSocketCloseProtocolError];
+            return NO;
+        }
+        self.messageOpcode = _frame.opcode;
+        self.message = [NSMutableData dataWithCapacity:(NSUInteger)MIN(_frame.payloadLength, (uint64_t)self.maxMessageLength)];
+    }
+    else if (_frame.opcode == IHTTPWebSocketOpcodeContinuation && !self.messageOpcode) { // nothing to continue
+        [self closeConnectionWithCode:IHTTPWebSocketCloseProtocolError];
+        return NO;
+    }
+
+    if (_frame.opcode < IHTTPWebSocketOpcodeClose && (self.message.length + _frame.payloadLength) > self.maxMessageLength) {
+        [self closeConnectionWithCode:IHTTPWebSocketCloseMessageTooBig];
+        return NO;
+    }
+    return YES;
+}
+
+/*! @brief act on a complete frame */
+- (void) finishFrame {
+    switch (_frame.opcode) {
+        case IHTTPWebSocketOpcodeClose:
+            [self receiveClose];
+            break;
+        case IHTTPWebSocketOpcodePing:
+            if (!self.didSendClose) {
+                [self writeFrame:[IHTTPWebSocket frameWithOpcode:IHTTPWebSocketOpcodePong bytes:_control length:(NSUInteger)_frame.payloadLength]];
+            }
+            break;
+        case IHTTPWebSocketOpcodePong: // any input shows the client is there
+            break;
+        default:
+            if (_frame.isFinal) {
+                [self deliverMessage];
+            }
+            break;
+    }
+}
+
+/*! @brief pass the reassembled message to the messageBlock, closing the WebSocket if a text message isn't UTF-8 */
+- (void) deliverMessage {
+    NSData* message = self.message;
+    BOOL isText = (self.messageOpcode == IHTTPWebSocketOpcodeText);
+    self.message = nil;
+    self.messageOpcode = 0;
+
+    if (isText && ![NSString.alloc initWithData:message encoding:NSUTF8StringEncoding]) {
+        [self closeConnectionWithCode:IHTTPWebSocketCloseInvalidData];
+    }
+    else if (self.messageBlock && !self.isClosed) {
+        self.messageBlock(self, message, isText);
+    }
+}
+
+/*! @brief answer the client's close frame with one of our own, unless we sent ours first, then close the connection */
+- (void) receiveClose {
+    NSUInteger length = (NSUInteger)_frame.payloadLength;
+    NSUInteger code = IHTTPWebSocketCloseNoStatus;
+    NSString* reason = nil;
+    if (length >= 2) {
+        code = (((NSUInteger)_control[0] << 8) | _control[1]);
+        reason = [NSString.alloc initWithBytes:(_control + 2) length:(length - 2) encoding:NSUTF8StringEncoding];
+        if (!reason) {
+            [self closeConnectionWithCode:IHTTPWebSocketCloseInvalidData];
+            return;
+        }
+    }
+
+    BOOL isValidCode = (length == 0 || (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) || (code >= 3000 && code <= 4999));
+    if (length == 1 || !isValidCode) {
+        [self closeConnectionWithCode:IHTTPWebSocketCloseProtocolError];
+        return;
+    }
+
+    [self.lock lock];
+    if (!self.closeCode) { // the client closed first, its code is the one the closeBlock is told
+        self.closeCode = code;
+        self.closeReason = (reason.length > 0 ? reason : nil);
+    }
+    [self.lock unlock];
+
+    [self closeConnectionWithCode:code]; // echoes the code, unless our close frame went first
+}
+
+// MARK: - IHTTPEventLoopSource
+
+- (void) eventLoopSourceIsReadable:(IHTTPEventLoop*) loop {
+    __attribute__((objc_precise_lifetime)) IHTTPWebSocket* webSocket = self; // until the frames after a close have been skipped
+    ssize_t received = recv(self.fileDescriptor, loop.readBuffer, loop.readBufferSize, MSG_DONTWAIT);
+    if (received > 0) {
+        if (!self.didSendClose) { // the client is there, push the next ping back, a close keeps its deadline
+            self.isAwaitingPong = NO;
+            [self.request.connection startTimeout:IHTTPTimeoutPing];
+        }
+        [self appendBytes:loop.readBuffer length:(NSUInteger)received];
+    }
+    else if (received == 0 || (errno != EAGAIN && errno != EINTR)) { // EoF or the connection was reset
+        [self closeConnectionWithCode:IHTTPWebSocketCloseAbnormal];
+    }
+}
+
+// MARK: - NSObject
+
+- (NSString*)description {
+    return [NSString stringWithFormat:@"<%@:%p fd: %i closed: %@ request: %@>",
+        NSStringFromClass(self.class), self, self.fileDescriptor, (self.isClosed ? @"YES" : @"NO"), self.request.requestURL];
+}
+
+@end
+
+// MARK: -
+
+@implementation IHTTPWebSocketGroup
+
+// MARK: - Initializers
+
+- (id)init {
+    if ((self = super.init)) {
+        self.lock = NSLock.new;
+        self.members = NSMutableSet.new;
+    }
+    return self;
+}
+
+// MARK: - Properties
+
+- (NSUInteger) count {
+    [self.lock lock];
+    NSUInteger count = self.members.count;
+    [self.lock unlock];
+    return count;
+}
+
+- (NSArray<IHTTPWebSocket*>*) webSockets {
+    [self.lock lock];
+    if (!self.snapshot) { // kept until the members change, so broadcasts don't copy the set each time
+        self.snapshot = self.members.allObjects;
+    }
+    NSArray<IHTTPWebSocket*>* webSockets = self.snapshot;
+    [self.lock unlock];
+    return webSockets;
+}
+
+// MARK: -
+
+- (void) addWebSocket:(IHTTPWebSocket*) webSocket {
+    [self.lock lock];
+    [self.members addObject:webSocket];
+    self.snapshot = nil;
+    [self.lock unlock];
+
+    if (![webSocket joinGroup:self]) { // it closed, and won't remove itself
+        [self removeWebSocket:webSocket];
+    }
+}
+
+- (void) removeWebSocket:(IHTTPWebSocket*) webSocket {
+    [self.lock lock];
+    [self.members removeObject:webSocket];
+    self.snapshot = nil;
+    [self.lock unlock];
+
+    [webSocket leaveGroup:self];
+}
+
+// MARK: -
+
+- (NSUInteger) broadcastText:(NSString*) text {
+    return [self broadcastFrame:[IHTTPWebSocket frameWithText:text]];
+}
+
+- (NSUInteger) broadcastData:(NSData*) data {
+    return [self broadcastFrame:[IHTTPWebSocket frameWithData:data]];
+}
+
+- (NSUInteger) broadcastFrame:(NSData*) frame {
+    NSUInteger sent = 0;
+    for (IHTTPWebSocket* webSocket in self.webSockets) { // the same bytes for each, only a slow client's unsent tail is copied
+        if ([webSocket sendFrame:frame]) {
+            sent++;
+        }
+    }
+    return sent;
+}
+
+// MARK: - NSObject
+
+- (NSString*)description {
+    return [NSString stringWithFormat:@"<%@:%p count: %lu>", NSStringFromClass(self.class), self, (unsigned long)self.count];
+}
+
+@end
@@ -0,0 +1,216 @@
+#include "IHTTPWebSocketFrame.h"
+
+#include <string.h>
+
+/*! @brief appended to the Sec-WebSocket-Key before it's hashed, RFC 6455 section 1.3 */
+static const char IHTTPWebSocketKeyGUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+/*! @brief the length of a SHA-1 digest in bytes */
+#define IHTTPSHA1DigestLength 20
+
+IHTTPParseResult IHTTPParseWebSocketFrameHeader(const uint8_t* bytes, size_t length, IHTTPWebSocketFrameHeader* header) {
+    if (length < 2) {
+        return IHTTPParseIncomplete;
+    }
+
+    header->isFinal = ((bytes[0] & 0x80) != 0);
+    header->opcode = (bytes[0] & 0x0F);
+    header->isMasked = ((bytes[1] & 0x80) != 0);
+    if ((bytes[0] & 0x70) != 0) { // no extension was negotiated which could use the reserved bits
+        return IHTTPParseInvalid;
+    }
+
+    switch (header->opcode) {
+        case IHTTPWebSocketOpcodeContinuation:
+        case IHTTPWebSocketOpcodeText:
+        case IHTTPWebSocketOpcodeBinary:
+            break;
+        case IHTTPWebSocketOpcodeClose:
+        case IHTTPWebSocketOpcodePing:
+        case IHTTPWebSocketOpcodePong:
+            if (!header->isFinal || (bytes[1] & 0x7F) > IHTTPWebSocketMaxControlLength) {
+                return IHTTPParseInvalid;
+            }
+            break;
+        default:
+            return IHTTPParseInvalid;
+    }
+
+    size_t offset = 2;
+    uint64_t payloadLength = (bytes[1] & 0x7F);
+    if (payloadLength == 126) {
+        if (length < 4) {
+            return IHTTPParseIncomplete;
+        }
+        payloadLength = (((uint64_t)bytes[2] << 8) | bytes[3]);
+        offset = 4;
+    }
+    else if (payloadLength == 127) {
+        if (length < 10) {
+            return IHTTPParseIncomplete;
+        }
+        payloadLength = 0;
+        for (size_t index = 2; index < 10; index++) {
+            payloadLength = ((payloadLength << 8) | bytes[index]);
+        }
+        if (payloadLength >> 63) { // the most significant bit must be 0
+            return IHTTPParseInvalid;
+        }
+        offset = 10;
+    }
+
+    if (header->isMasked) {
+        if (length < (offset + 4)) {
+            return IHTTPParseIncomplete;
+        }
+        memcpy(header->mask, (bytes + offset), 4);
+        offset += 4;
+    }
+
+    header->payloadLength = payloadLength;
+    header->headerLength = offset;
+    return IHTTPParseComplete;
+}
+
+size_t IHTTPWriteWebSocketFrameHeader(uint8_t* buffer, IHTTPWebSocketOpcode opcode, bool isFinal, uint64_t payloadLength) {
+    buffer[0] = (uint8_t)((isFinal ? 0x80 : 0x00) | (opcode & 0x0F));
+    if (payloadLength < 126) {
+        buffer[1] = (uint8_t)payloadLength;
+        return 2;
+    }
+    else if (payloadLength <= UINT16_MAX) {
+        buffer[1] = 126;
+        buffer[2] = (uint8_t)(payloadLength >> 8);
+        buffer[3] = (uint8_t)payloadLength;
+        return 4;
+    }
+
+    buffer[1] = 127;
+    for (size_t index = 0; index < 8; index++) {
+        buffer[2 + index] = (uint8_t)(payloadLength >> (56 - (8 * index)));
+    }
+    return 10;
+}
+
+void IHTTPUnmaskWebSocketPayload(uint8_t* bytes, size_t length, const uint8_t mask[4], uint64_t offset) {
+    uint8_t rotated[8]; // the mask lined up with the first byte, twice over to xor a word at a time
+    for (size_t index = 0; index < 8; index++) {
+        rotated[index] = mask[(offset + index) % 4];
+    }
+
+    uint64_t word;
+    uint64_t maskWord;
+    memcpy(&maskWord, rotated, sizeof(maskWord));
+    size_t position = 0;
+    for (; (position + sizeof(word)) <= length; position += sizeof(word)) {
+        memcpy(&word, (bytes + position), sizeof(word));
+        word ^= maskWord;
+        memcpy((bytes + position), &word, sizeof(word));
+    }
+    for (; position < length; position++) {
+        bytes[position] ^= rotated[position % 8];
+    }
+}
+
+// MARK: - Handshake
+
+static uint32_t IHTTPRotateLeft(uint32_t value, unsigned bits) {
+    return ((value << bits) | (value >> (32 - bits)));
+}
+
+/*! @brief process one 64 byte block of the SHA-1 message into the state, FIPS 180-4 section 6.1.2 */
+static void IHTTPSHA1Block(uint32_t state[5], const uint8_t block[64]) {
+    uint32_t words[80];
+    for (unsigned index = 0; index < 16; index++) {
+        words[index] = (((uint32_t)block[4 * index] << 24) | ((uint32_t)block[4 * index + 1] << 16)
+                      | ((uint32_t)block[4 * index + 2] << 8) | (uint32_t)block[4 * index + 3]);
+    }
+    for (unsigned index = 16; index < 80; index++) {
+        words[index] = IHTTPRotateLeft((words[index - 3] ^ words[index - 8] ^ words[index - 14] ^ words[index - 16]), 1);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (unsigned index = 0; index < 80; index++) {
+        uint32_t f, k;
+        if (index < 20) {
+            f = ((b & c) | (~b & d));
+            k = 0x5A827999;
+        }
+        else if (index < 40) {
+            f = (b ^ c ^ d);
+            k = 0x6ED9EBA1;
+        }
+        else if (index < 60) {
+            f = ((b & c) | (b & d) | (c & d));
+            k = 0x8F1BBCDC;
+        }
+        else {
+            f = (b ^ c ^ d);
+            k = 0xCA62C1D6;
+        }
+        uint32_t temp = (IHTTPRotateLeft(a, 5) + f + e + k + words[index]);
+        e = d;
+        d = c;
+        c = IHTTPRotateLeft(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+/*! @brief the SHA-1 digest of the bytes, which is only used for the handshake, not for security */
+static void IHTTPSHA1(const uint8_t* bytes, size_t length, uint8_t digest[IHTTPSHA1DigestLength]) {
+    uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    size_t offset = 0;
+    for (; (offset + 64) <= length; offset += 64) {
+        IHTTPSHA1Block(state, (bytes + offset));
+    }
+
+    uint8_t last[128] = {0}; // the rest of the bytes, the 1 bit, padding and the length in bits
+    size_t remaining = (length - offset);
+    memcpy(last, (bytes + offset), remaining);
+    last[remaining] = 0x80;
+    size_t lastLength = ((remaining + 9) <= 64 ? 64 : 128);
+    uint64_t bitLength = ((uint64_t)length * 8);
+    for (size_t index = 0; index < 8; index++) {
+        last[lastLength - 1 - index] = (uint8_t)(bitLength >> (8 * index));
+    }
+    for (size_t block = 0; block < lastLength; block += 64) {
+        IHTTPSHA1Block(state, (last + block));
+    }
+
+    for (unsigned index = 0; index < 5; index++) {
+        digest[4 * index] = (uint8_t)(state[index] >> 24);
+        digest[4 * index + 1] = (uint8_t)(state[index] >> 16);
+        digest[4 * index + 2] = (uint8_t)(state[index] >> 8);
+        digest[4 * index + 3] = (uint8_t)state[index];
+    }
+}
+
+void IHTTPWebSocketAcceptKey(const char* key, size_t keyLength, char accept[IHTTPWebSocketAcceptLength + 1]) {
+    static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t keyed[128];
+    size_t guidLength = (sizeof(IHTTPWebSocketKeyGUID) - 1);
+    keyLength = (keyLength < (sizeof(keyed) - guidLength) ? keyLength : (sizeof(keyed) - guidLength)); // a valid key is 24 bytes
+    memcpy(keyed, key, keyLength);
+    memcpy((keyed + keyLength), IHTTPWebSocketKeyGUID, guidLength);
+
+    uint8_t digest[IHTTPSHA1DigestLength + 1] = {0}; // padded to a whole number of 3 byte groups
+    IHTTPSHA1(keyed, (keyLength + guidLength), digest);
+
+    char* output = accept;
+    for (unsigned index = 0; index < IHTTPSHA1DigestLength; index += 3) {
+        uint32_t group = (((uint32_t)digest[index] << 16) | ((uint32_t)digest[index + 1] << 8) | (uint32_t)digest[index + 2]);
+        *output++ = base64[(group >> 18) & 0x3F];
+        *output++ = base64[(group >> 12) & 0x3F];
+        *output++ = base64[(group >> 6) & 0x3F];
+        *output++ = base64[group & 0x3F];
+    }
+    accept[IHTTPWebSocketAcceptLength - 1] = '='; // 20 bytes leave one byte of padding
+    accept[IHTTPWebSocketAcceptLength] = '\0';
+}
@@ -0,0 +1,57 @@
+#ifndef IHTTPWebSocketFrame_h
+#define IHTTPWebSocketFrame_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "IHTTPParser.h"
+
+/*! @header IHTTPWebSocketFrame.h
+    @abstract RFC 6455 WebSocket frame headers, masking and the opening handshake's accept key, not part of the public API */
+
+/*! @brief the longest frame header, with a 64 bit payload length and a masking key */
+#define IHTTPWebSocketMaxHeaderLength 14
+
+/*! @brief the longest payload of a control frame */
+#define IHTTPWebSocketMaxControlLength 125
+
+/*! @brief the length of a Sec-WebSocket-Accept value, the base64 of a SHA-1 digest */
+#define IHTTPWebSocketAcceptLength 28
+
+/*! @enum IHTTPWebSocketOpcode */
+typedef enum {
+    IHTTPWebSocketOpcodeContinuation = 0x0,
+    IHTTPWebSocketOpcodeText = 0x1,
+    IHTTPWebSocketOpcodeBinary = 0x2,
+    IHTTPWebSocketOpcodeClose = 0x8,
+    IHTTPWebSocketOpcodePing = 0x9,
+    IHTTPWebSocketOpcodePong = 0xA
+} IHTTPWebSocketOpcode;
+
+/*! @brief a parsed frame header */
+typedef struct {
+    bool isFinal;               /* the last frame of the message */
+    uint8_t opcode;
+    bool isMasked;
+    uint8_t mask[4];
+    uint64_t payloadLength;
+    size_t headerLength;        /* bytes of the header, before the payload */
+} IHTTPWebSocketFrameHeader;
+
+/*! @brief parse the frame header at the start of the bytes
+    @return IHTTPParseComplete with the header filled in, IHTTPParseIncomplete if more bytes are needed,
+    or IHTTPParseInvalid for reserved bits or opcodes, and control frames which are fragmented or too long */
+IHTTPParseResult IHTTPParseWebSocketFrameHeader(const uint8_t* bytes, size_t length, IHTTPWebSocketFrameHeader* header);
+
+/*! @brief write the header of an unmasked frame from the server into the buffer, which holds IHTTPWebSocketMaxHeaderLength bytes,
+    returns the length of the header */
+size_t IHTTPWriteWebSocketFrameHeader(uint8_t* buffer, IHTTPWebSocketOpcode opcode, bool isFinal, uint64_t payloadLength);
+
+/*! @brief unmask the bytes in place, which start offset bytes into the payload the mask applies to */
+void IHTTPUnmaskWebSocketPayload(uint8_t* bytes, size_t length, const uint8_t mask[4], uint64_t offset);
+
+/*! @brief the Sec-WebSocket-Accept value for the Sec-WebSocket-Key, NUL terminated in the buffer */
+void IHTTPWebSocketAcceptKey(const char* key, size_t keyLength, char accept[IHTTPWebSocketAcceptLength + 1]);
+
+#endif /* IHTTPWebSocketFrame_h */
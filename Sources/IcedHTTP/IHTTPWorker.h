@@ -0,0 +1,104 @@
+#import <Foundation/Foundation.h>
+
+#import "IHTTPConnection.h"
+#import "IHTTPEventLoop.h"
+#import "IHTTPRequest.h"
+#import "IHTTPResponse.h"
+
+@class IHTTPMetrics;
+@class IHTTPServer;
+
+/*! @header IHTTPWorker.h
+    @abstract IHTTPWorker runs one of an IHTTPServer's event loops */
+
+/*! @enum IHTTPShedReason
+    @brief why a request was answered before its handler ran */
+typedef NS_ENUM(NSUInteger, IHTTPShedReason) {
+    IHTTPShedInFlight,      /* the worker was handling its share of the server's maxInFlightRequests */
+    IHTTPShedQueueDelay,    /* requests had stood waiting over the server's maxQueueDelay */
+    IHTTPShedRateLimit      /* the client was over the server's rateLimiter */
+};
+
+/*! @class IHTTPWorker
+    @brief accepts connections from a listening socket and services them on its own event loop thread
+    @discussion each worker keeps its own table of connections indexed by file descriptor, which is only touched from the worker's thread,
+    handlers run on the server's handler queue hand their responses back to the worker's thread when they return */
+@interface IHTTPWorker : NSObject <IHTTPEventLoopSource, IHTTPRequestDelegate, IHTTPResponseDelegate>
+
+/*! @brief the server which owns the worker and its listening socket */
+@property(nonatomic, weak, readonly) IHTTPServer* server;
+
+/*! @brief the event loop servicing the worker's connections */
+@property(nonatomic, readonly) IHTTPEventLoop* eventLoop;
+
+/*! @brief the index of the worker in the server */
+@property(nonatomic, readonly) NSUInteger workerIndex;
+
+/*! @brief the number of connections the worker has open, stops accepting at its share of the server's maxConnections */
+@property(nonatomic, readonly) NSUInteger connectionCount;
+
+/*! @brief the worker's counters and latency histograms, counted for the handlers registered when it started */
+@property(nonatomic, readonly) IHTTPMetrics* metrics;
+
+/*! @brief the number of handlers the worker has run on the server's handler queue */
+@property(nonatomic, readonly) NSUInteger queuedHandlerCount;
+
+/*! @brief total and longest seconds queued handlers waited to start after their request headers were parsed */
+@property(nonatomic, readonly) NSTimeInterval handlerQueueTime;
+@property(nonatomic, readonly) NSTimeInterval maxHandlerQueueTime;
+
+/*! @brief total and longest seconds between queued handlers returning and the worker's loop thread taking their responses back */
+@property(nonatomic, readonly) NSTimeInterval handlerDispatchTime;
+@property(nonatomic, readonly) NSTimeInterval maxHandlerDispatchTime;
+
+/*! @brief YES if the worker serves cleartext HTTP/2 as well as HTTP/1.1, copied from the server when it starts */
+@property(nonatomic, readonly) BOOL http2Enabled;
+
+/*! @brief the most streams each HTTP/2 connection may have open at once, copied from the server when it starts */
+@property(nonatomic, readonly) NSUInteger http2MaxConcurrentStreams;
+
+/*! @brief the number of connections which have timed out waiting for the kind of timeout, may be called from any thread */
+- (NSUInteger) timeoutCountForKind:(IHTTPTimeoutKind) kind;
+
+/*! @brief the number of requests whose headers have been read and whose responses haven't completed */
+@property(nonatomic, readonly) NSUInteger inFlightCount;
+
+/*! @brief the number of requests answered before their handlers ran for the reason, may be called from any thread */
+- (NSUInteger) shedCountForReason:(IHTTPShedReason) reason;
+
+/*! @brief a snapshot of the current request of each of the worker's connections,
+    waits for the worker thread to take the snapshot when called from another thread */
+@property(nonatomic, readonly) NSSet* requests;
+
+// MARK: -
+
+/*! @brief a worker for the server which accepts connections from the listening socket, which may be shared with other workers */
++ (IHTTPWorker*) workerWithServer:(IHTTPServer*) server listenSocket:(int) listenSocket index:(NSUInteger) workerIndex;
+
+// MARK: -
+
+/*! @brief create the event loop and start its thread, returns NO if the loop could not be created */
+- (BOOL) startWorker;
+
+/*! @brief stop accepting, close all the worker's connections and wait for its thread to exit */
+- (void) stopWorker;
+
+// MARK: - Connections
+
+/*! @brief drop the connection from the table, making room for another, on the worker's thread */
+- (void) removeConnection:(IHTTPConnection*) connection;
+
+/*! @brief switch the connection of the request, which started with the HTTP/2 connection preface, to an HTTP/2 session,
+    the data is what the client sent after the preface, on the worker's thread */
+- (void) startHTTP2WithRequest:(IHTTPRequest*) request data:(NSData*) data;
+
+// MARK: - Timeouts
+
+/*! @brief schedule the connection's timer for its timeoutKind on the worker's timer wheel, or cancel it, on the worker's thread */
+- (void) startTimeoutForConnection:(IHTTPConnection*) connection;
+
+/*! @brief schedule the connection's outputTimer for the write timeout from now while it has output pending, otherwise cancel it,
+    on the worker's thread */
+- (void) startTimeoutForOutput:(IHTTPConnection*) connection;
+
+@end
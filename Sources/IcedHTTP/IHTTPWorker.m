@@ -0,0 +1,887 @@
+#import "IHTTPWorker.h"
+
+#import "IHTTPConnection.h"
+#import "IHTTPHandler.h"
+#import "IHTTPServer.h"
+#import "IHTTPPrivate.h"
+#import "IHTTPMetrics.h"
+#import "IHTTPRateLimiter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <signal.h>
+
+/*! @brief maximum number of connections accepted each time the listening socket is readable,
+    so the connections already established get a turn on a busy worker */
+static NSUInteger const IHTTPWorkerAcceptBatchSize = 64;
+
+/*! @brief file descriptors left for files, event loops and listening sockets when the connection limit comes from the process's limit */
+static NSUInteger const IHTTPWorkerReservedDescriptors = 64;
+
+/*! @brief slots in the timer wheel, each a second wide, longer timeouts wait for more turns of the wheel */
+static NSUInteger const IHTTPWorkerTimerSlots = 64;
+
+/*! @brief seconds a connection closed after a rejected or shed request reads and discards the client's input,
+    so a client still sending the request reads the response rather than a reset */
+static NSTimeInterval const IHTTPWorkerLingerTimeout = 2;
+
+/*! @brief most idle copies of each stateful prototype kept by a worker for later requests */
+static NSUInteger const IHTTPWorkerHandlerPoolSize = 32;
+
+/*! @brief seconds over which the shortest wait of the requests handled is compared with the server's maxQueueDelay, CoDel's interval */
+static NSTimeInterval const IHTTPWorkerSojournInterval = 0.1;
+
+// MARK: -
+
+@interface IHTTPWorker ()
+@property(nonatomic, weak) IHTTPServer* serverStorage;
+@property(nonatomic, retain) IHTTPEventLoop* eventLoopStorage;
+@property(nonatomic, retain) NSThread* eventLoopThread;
+@property(nonatomic, retain) dispatch_semaphore_t eventLoopStopped;
+@property(nonatomic, retain) IHTTPConnectionTable* connections;
+@property(nonatomic, retain) IHTTPTimerWheel* timerWheel;
+@property(nonatomic, retain) IHTTPMetrics* metricsStorage;
+@property(nonatomic, retain) IHTTPAccessLog* accessLog;
+@property(nonatomic, assign) NSTimeInterval headerTimeout;
+@property(nonatomic, assign) NSTimeInterval bodyTimeout;
+@property(nonatomic, assign) NSTimeInterval idleTimeout;
+@property(nonatomic, assign) NSTimeInterval writeTimeout;
+@property(nonatomic, assign) NSTimeInterval pingInterval;
+@property(nonatomic, assign) NSUInteger connectionLimit;
+@property(nonatomic, assign) BOOL http2EnabledStorage;
+@property(nonatomic, assign) NSUInteger http2MaxConcurrentStreamsStorage;
+@property(nonatomic, assign) NSUInteger inFlightLimit;
+@property(nonatomic, assign) NSTimeInterval maxQueueDelay;
+@property(nonatomic, assign) NSTimeInterval sojournIntervalStart;
+@property(nonatomic, assign) BOOL isQueueOverloaded;
+@property(nonatomic, retain) IHTTPRateLimiter* rateLimiter;
+@property(nonatomic, retain) NSData* overloadedLines;
+@property(nonatomic, retain) NSData* rateLimitedLines;
+@property(nonatomic, retain) NSDictionary<NSString*, NSString*>* overloadedHeaders;
+@property(nonatomic, retain) NSDictionary<NSString*, NSString*>* rateLimitedHeaders;
+@property(atomic, assign) NSUInteger inFlightCountStorage;
+@property(nonatomic, assign) BOOL isAccepting;
+@property(nonatomic, retain) NSMapTable<IHTTPHandler*, NSMutableArray<IHTTPHandler*>*>* handlerPools;
+@property(atomic, assign) NSUInteger queuedHandlerCountStorage;
+@property(atomic, assign) NSTimeInterval handlerQueueTimeStorage;
+@property(atomic, assign) NSTimeInterval maxHandlerQueueTimeStorage;
+@property(atomic, assign) NSTimeInterval handlerDispatchTimeStorage;
+@property(atomic, assign) NSTimeInterval maxHandlerDispatchTimeStorage;
+@property(nonatomic, assign) NSUInteger workerIndexStorage;
+@property(nonatomic, assign) int listenSocket;
+
+@end
+
+// MARK: -
+
+@implementation IHTTPWorker {
+    atomic_ulong _timeoutCounts[IHTTPTimeoutWrite + 1]; // counted on the loop thread, read from any
+    atomic_ulong _shedCounts[IHTTPShedRateLimit + 1];
+    atomic_ullong _shortestSojourn;     // microseconds, the shortest wait of the requests started in the current interval
+    atomic_ulong _waitingHandlerCount;  // handlers on the handler queue which haven't started
+}
+
++ (IHTTPWorker*) workerWithServer:(IHTTPServer*) server listenSocket:(int) listenSocket index:(NSUInteger) workerIndex {
+    IHTTPWorker* worker = IHTTPWorker.new;
+    worker.serverStorage = server;
+    worker.listenSocket = listenSocket;
+    worker.workerIndexStorage = workerIndex;
+    worker.connections = IHTTPConnectionTable.new;
+    worker.handlerPools = NSMapTable.weakToStrongObjectsMapTable; // pools go when their prototypes are reset
+    return worker;
+}
+
+// MARK: - Properties
+
+- (IHTTPServer*) server {
+    return self.serverStorage;
+}
+
+- (IHTTPEventLoop*) eventLoop {
+    return self.eventLoopStorage;
+}
+
+- (NSUInteger) workerIndex {
+    return self.workerIndexStorage;
+}
+
+- (IHTTPMetrics*) metrics {
+    return self.metricsStorage;
+}
+
+- (NSUInteger) queuedHandlerCount {
+    return self.queuedHandlerCountStorage;
+}
+
+- (NSTimeInterval) handlerQueueTime {
+    return self.handlerQueueTimeStorage;
+}
+
+- (NSTimeInterval) maxHandlerQueueTime {
+    return self.maxHandlerQueueTimeStorage;
+}
+
+- (NSTimeInterval) handlerDispatchTime {
+    return self.handlerDispatchTimeStorage;
+}
+
+- (NSTimeInterval) maxHandlerDispatchTime {
+    return self.maxHandlerDispatchTimeStorage;
+}
+
+- (BOOL) http2Enabled {
+    return self.http2EnabledStorage;
+}
+
+- (NSUInteger) http2MaxConcurrentStreams {
+    return self.http2MaxConcurrentStreamsStorage;
+}
+
+- (NSUInteger) timeoutCountForKind:(IHTTPTimeoutKind) kind {
+    return (kind <= IHTTPTimeoutWrite ? (NSUInteger)atomic_load(&_timeoutCounts[kind]) : 0);
+}
+
+- (NSUInteger) inFlightCount {
+    return self.inFlightCountStorage;
+}
+
+- (NSUInteger) shedCountForReason:(IHTTPShedReason) reason {
+    return (reason <= IHTTPShedRateLimit ? (NSUInteger)atomic_load(&_shedCounts[reason]) : 0);
+}
+
+- (NSUInteger) connectionCount {
+    return self.connections.count;
+}
+
+/*! @brief the current request of each open connection, on the loop thread */
+- (NSSet*) connectionRequests {
+    NSMutableSet* requests = NSMutableSet.new;
+    for (IHTTPConnection* connection in self.connections.allConnections) {
+        if (connection.request) {
+            [requests addObject:connection.request];
+        }
+        else if (connection.http2Session) {
+            [requests addObjectsFromArray:connection.http2Session.requests];
+        }
+    }
+    return requests;
+}
+
+- (NSSet*) requests {
+    if (!self.eventLoopThread || self.eventLoop.isLoopThread) {
+        return [self connectionRequests];
+    }
+
+    __block NSSet* snapshot = nil;
+    dispatch_semaphore_t taken = dispatch_semaphore_create(0);
+    [self.eventLoop performBlock:^{
+        snapshot = [self connectionRequests];
+        dispatch_semaphore_signal(taken);
+    }];
+    dispatch_semaphore_wait(taken, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC)); // don't deadlock with another worker asking for ours
+
+    return (snapshot ?: NSSet.set);
+}
+
+// MARK: -
+
+- (BOOL) startWorker {
+    self.eventLoopStorage = [IHTTPEventLoop eventLoop];
+    if (!self.eventLoop || ![self.eventLoop addSource:self forFileDescriptor:self.listenSocket]) {
+        return NO;
+    }
+    self.isAccepting = YES;
+    self.connectionLimit = [self connectionLimitForServer:self.server];
+    self.headerTimeout = self.server.headerTimeout;
+    self.bodyTimeout = self.server.bodyTimeout;
+    self.idleTimeout = self.server.keepAliveTimeout;
+    self.writeTimeout = self.server.writeTimeout;
+    self.pingInterval = self.server.webSocketPingInterval;
+    self.http2EnabledStorage = self.server.http2Enabled;
+    self.http2MaxConcurrentStreamsStorage = self.server.http2MaxConcurrentStreams;
+    [self startAdmissionControl];
+    self.metricsStorage = [IHTTPMetrics metricsWithHandlerCount:self.server.handlerLabels.count];
+    self.accessLog = self.server.accessLog;
+    self.timerWheel = [IHTTPTimerWheel timerWheelWithSlotCount:IHTTPWorkerTimerSlots resolution:1 currentTime:self.eventLoop.currentTime];
+
+    __weak IHTTPWorker* worker = self;
+    IHTTPEventLoop* loop = self.eventLoop;
+    dispatch_semaphore_t stopped = dispatch_semaphore_create(0);
+    loop.tickBlock = ^{
+        [worker expireTimeouts];
+        [worker resumeAccepting]; // after running out of file descriptors with no connections of its own to close
+    };
+    self.eventLoopStopped = stopped;
+    self.eventLoopThread = [NSThread.alloc initWithBlock:^{
+#if __linux__
+        // sendfile has no MSG_NOSIGNAL, so SIGPIPE is held pending on the loop thread alone and the write fails with EPIPE,
+        // the process's own handling of the signal is left alone
+        sigset_t pipeSignal;
+        sigemptyset(&pipeSignal);
+        sigaddset(&pipeSignal, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipeSignal, NULL);
+#endif
+        [loop run];
+        dispatch_semaphore_signal(stopped);
+    }];
+    self.eventLoopThread.name = [NSString stringWithFormat:@"%@ %lu", NSStringFromClass(self.server.class), (unsigned long)self.workerIndex];
+    [self.eventLoopThread start];
+
+    return YES;
+}
+
+- (void) stopWorker {
+    IHTTPEventLoop* loop = self.eventLoop;
+    if (self.eventLoopThread && !loop.isLoopThread) { // close the connections on the loop thread and wait for it to exit
+        [loop performBlock:^{
+            [self closeConnections];
+        }];
+        [loop stop];
+        dispatch_semaphore_wait(self.eventLoopStopped, DISPATCH_TIME_FOREVER);
+    }
+    else {
+        [self closeConnections];
+        [loop stop];
+    }
+
+    self.eventLoopThread = nil;
+    self.eventLoopStopped = nil;
+    self.eventLoopStorage = nil;
+}
+
+/*! @brief stop accepting and close all the open connections, the server closes the listening socket */
+- (void) closeConnections {
+    [self pauseAccepting];
+    self.listenSocket = -1;
+
+    for (IHTTPConnection* connection in self.connections.allConnections) {
+        if (connection.webSocket) { // tell the client the server is going away, and the WebSocket's closeBlock
+            [connection.webSocket closeConnectionWithCode:IHTTPWebSocketCloseGoingAway];
+        }
+        else if (connection.http2Session) { // GOAWAY, and reset the streams still open
+            [connection.http2Session closeWithError:IHTTP2ErrorNone];
+        }
+        else {
+            [connection.request completeRequest];
+        }
+        [connection abortSocket]; // whatever the client hasn't taken of the last output is dropped
+    }
+    self.connections = IHTTPConnectionTable.new;
+    self.timerWheel = [IHTTPTimerWheel timerWheelWithSlotCount:IHTTPWorkerTimerSlots resolution:1 currentTime:self.eventLoop.currentTime];
+}
+
+// MARK: - Admission Control
+
+/*! @brief take the worker's share of the server's maxInFlightRequests, its maxQueueDelay and rateLimiter,
+    and serialize the responses to shed requests once, so answering one costs a single write */
+- (void) startAdmissionControl {
+    IHTTPServer* server = self.server;
+    NSUInteger workerCount = MAX(server.workerCount, 1);
+    self.inFlightLimit = (server.maxInFlightRequests > 0 ? MAX(((server.maxInFlightRequests + workerCount - 1) / workerCount), 1) : 0);
+    self.maxQueueDelay = server.maxQueueDelay;
+    self.rateLimiter = server.rateLimiter;
+    self.sojournIntervalStart = self.eventLoop.currentTime;
+    self.isQueueOverloaded = NO;
+    atomic_store(&_shortestSojourn, UINT64_MAX);
+
+    NSUInteger overloadRetryAfter = MAX(server.overloadRetryAfter, 1);
+    self.overloadedLines = [self shedLinesWithStatusLine:"503 Service Unavailable" retryAfter:overloadRetryAfter];
+    self.overloadedHeaders = @{ IHTTPRetryAfterHeader: [NSString stringWithFormat:@"%lu", (unsigned long)overloadRetryAfter] };
+    if (self.rateLimiter) {
+        self.rateLimitedLines = [self shedLinesWithStatusLine:"429 Too Many Requests" retryAfter:self.rateLimiter.retryAfter];
+        self.rateLimitedHeaders = @{ IHTTPRetryAfterHeader: [NSString stringWithFormat:@"%lu", (unsigned long)self.rateLimiter.retryAfter] };
+    }
+}
+
+/*! @brief the status line and headers of a response to a shed request, which closes the connection since its body isn't read */
+- (NSData*) shedLinesWithStatusLine:(const char*) statusLine retryAfter:(NSUInteger) retryAfter {
+    char lines[128];
+    int length = snprintf(lines, sizeof(lines), "HTTP/1.1 %s\r\nRetry-After: %lu\r\nConnection: close\r\nContent-Length: 0\r\n\r\n",
+        statusLine, (unsigned long)retryAfter);
+    return [NSData dataWithBytes:lines length:(NSUInteger)MIN(length, (int)(sizeof(lines) - 1))];
+}
+
+/*! @brief keep the request's wait to be handled if it's the shortest in the interval, may be called from any thread */
+- (void) recordSojournTime:(NSTimeInterval) sojournTime {
+    unsigned long long micros = (unsigned long long)(MAX(sojournTime, 0) * 1e6);
+    unsigned long long shortest = atomic_load(&_shortestSojourn);
+    while (micros < shortest && !atomic_compare_exchange_weak(&_shortestSojourn, &shortest, micros)) {
+        // shortest now holds the value another thread stored
+    }
+}
+
+/*! @brief YES while requests stand waiting over the maxQueueDelay, decided at the end of each interval from the shortest wait in it,
+    a burst which drains within an interval never has every wait over the delay, on the loop thread */
+- (BOOL) isQueueDelayed {
+    NSTimeInterval now = self.eventLoop.currentTime;
+    if ((now - self.sojournIntervalStart) >= IHTTPWorkerSojournInterval) {
+        unsigned long long shortest = atomic_exchange(&_shortestSojourn, UINT64_MAX);
+        if (shortest != UINT64_MAX) {
+            self.isQueueOverloaded = (shortest > (unsigned long long)(self.maxQueueDelay * 1e6));
+        }
+        else { // no handler started in the interval, the queue stands if any are still waiting to
+            self.isQueueOverloaded = (self.isQueueOverloaded && atomic_load(&_waitingHandlerCount) > 0);
+        }
+        self.sojournIntervalStart = now;
+    }
+    return self.isQueueOverloaded;
+}
+
+/*! @brief YES if the request may run its handler, otherwise the reason it's shed, cheapest checks first */
+- (BOOL) admitRequest:(IHTTPRequest*) request reason:(IHTTPShedReason*) reason {
+    if (self.inFlightLimit > 0 && self.inFlightCount >= self.inFlightLimit) {
+        *reason = IHTTPShedInFlight;
+        return NO;
+    }
+    else if (self.maxQueueDelay > 0 && [self isQueueDelayed]) {
+        *reason = IHTTPShedQueueDelay;
+        return NO;
+    }
+    else if (self.rateLimiter && ![self.rateLimiter admitClient:request.connection.remoteAddress]) {
+        *reason = IHTTPShedRateLimit;
+        return NO;
+    }
+    return YES;
+}
+
+/*! @brief answer the request with the prepared 503 Service Unavailable or 429 Too Many Requests before its handler runs,
+    without reading its body, and close the connection once the client has read the response and closed its end, or the linger timeout,
+    or end the request's stream and carry on with the rest of its session */
+- (void) shedRequest:(IHTTPRequest*) request reason:(IHTTPShedReason) reason {
+    BOOL isRateLimited = (reason == IHTTPShedRateLimit);
+    NSUInteger status = (isRateLimited ? IHTTPStatus429TooManyRequests : IHTTPStatus503ServiceUnavailable);
+    atomic_fetch_add(&_shedCounts[reason], 1);
+
+    if (self.server.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ shed request: %@ status: %lu reason: %lu", NSStringFromClass([self class]), request, (unsigned long)status, (unsigned long)reason);
+    }
+
+    if (request.stream) {
+        [request.stream sendStatus:status headers:(isRateLimited ? self.rateLimitedHeaders : self.overloadedHeaders) endStream:YES];
+        [self request:request didRejectWithStatus:status];
+        return;
+    }
+
+    NSData* lines = (isRateLimited ? self.rateLimitedLines : self.overloadedLines);
+    IHTTPConnection* connection = request.connection;
+    [connection writeBytes:lines.bytes length:lines.length];
+    [self request:request didRejectWithStatus:status];
+    connection.lingersOnClose = YES;
+    [request closeConnection];
+}
+
+// MARK: - Timeouts
+
+/*! @brief count a connection which timed out waiting for the kind of timeout */
+- (void) countTimeout:(IHTTPTimeoutKind) kind {
+    if (kind <= IHTTPTimeoutWrite) {
+        atomic_fetch_add(&_timeoutCounts[kind], 1);
+    }
+}
+
+/*! @brief the seconds the worker allows for the kind of timeout, 0 if it's disabled */
+- (NSTimeInterval) durationForTimeout:(IHTTPTimeoutKind) kind {
+    switch (kind) {
+        case IHTTPTimeoutHeader: return self.headerTimeout;
+        case IHTTPTimeoutBody: return self.bodyTimeout;
+        case IHTTPTimeoutIdle: return self.idleTimeout;
+        case IHTTPTimeoutWrite: return self.writeTimeout;
+        case IHTTPTimeoutPing: return self.pingInterval;
+        case IHTTPTimeoutLinger: return IHTTPWorkerLingerTimeout;
+        default: return 0;
+    }
+}
+
+- (void) startTimeoutForConnection:(IHTTPConnection*) connection {
+    NSTimeInterval duration = [self durationForTimeout:connection.timeoutKind];
+    if (duration > 0) {
+        [self.timerWheel scheduleTimer:connection deadline:(self.eventLoop.currentTime + duration)];
+    }
+    else {
+        [self.timerWheel cancelTimer:connection];
+    }
+}
+
+- (void) startTimeoutForOutput:(IHTTPConnection*) connection {
+    NSTimeInterval duration = [self durationForTimeout:IHTTPTimeoutWrite];
+    if (duration > 0 && connection.pendingOutputLength > 0 && !connection.didFailOutput && !connection.isClosed) {
+        [self.timerWheel scheduleTimer:connection.outputTimer deadline:(self.eventLoop.currentTime + duration)];
+    }
+    else {
+        [self.timerWheel cancelTimer:connection.outputTimer];
+    }
+}
+
+/*! @brief turn the timer wheel to the loop's time, expiring the connections which have waited too long */
+- (void) expireTimeouts {
+    [self.timerWheel advanceToTime:self.eventLoop.currentTime expired:^(id<IHTTPTimer> timer) {
+        if ([timer isKindOfClass:IHTTPOutputTimer.class]) {
+            [self outputDidTimeOut:((IHTTPOutputTimer*)timer).connection];
+        }
+        else {
+            [self connectionDidTimeOut:(IHTTPConnection*)timer];
+        }
+    }];
+}
+
+/*! @brief drop the output of a connection whose client stopped reading it for the write timeout,
+    the connection's reader sees it shut down and closes it */
+- (void) outputDidTimeOut:(IHTTPConnection*) connection {
+    [self countTimeout:IHTTPTimeoutWrite];
+
+    if (self.server.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ connection timed out: %@ waiting for: %lu", NSStringFromClass([self class]), connection, (unsigned long)IHTTPTimeoutWrite);
+    }
+
+    [connection outputTimerDidExpire];
+}
+
+/*! @brief answer a request whose head is too slow with 408 Request Timeout, fail a stalled body, close an idle connection,
+    ping a quiet WebSocket and close a connection which lingered long enough */
+- (void) connectionDidTimeOut:(IHTTPConnection*) connection {
+    IHTTPTimeoutKind kind = connection.timeoutKind;
+    IHTTPRequest* request = connection.request;
+    [connection cancelTimeout];
+    [self countTimeout:kind];
+
+    if (self.server.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ connection timed out: %@ waiting for: %lu", NSStringFromClass([self class]), connection, (unsigned long)kind);
+    }
+
+    if (kind == IHTTPTimeoutLinger) { // the response has been sent, stop waiting for the client to close
+        [connection lingerTimerDidExpire];
+    }
+    else if (connection.http2Session) { // the session answers the streams whose bodies stalled or closes the idle connection
+        [connection.http2Session connectionDidTimeOut:kind];
+    }
+    else if (kind == IHTTPTimeoutHeader) {
+        [request rejectRequest:IHTTPStatus408RequestTimeout];
+    }
+    else if (kind == IHTTPTimeoutBody) { // the handler answers, the connection closes after the response
+        [request failBody:IHTTPRequestBodyTimedOutError];
+    }
+    else if (kind == IHTTPTimeoutPing) { // or close it, if it didn't answer the last ping
+        [connection.webSocket pingTimerDidExpire];
+    }
+    else {
+        [request closeConnection];
+    }
+}
+
+// MARK: - Connections
+
+/*! @brief the worker's share of the server's maxConnections, or of the process's file descriptor limit when it's 0 */
+- (NSUInteger) connectionLimitForServer:(IHTTPServer*) server {
+    NSUInteger maxConnections = server.maxConnections;
+    if (maxConnections == 0) {
+        struct rlimit descriptors;
+        if (getrlimit(RLIMIT_NOFILE, &descriptors) != 0 || descriptors.rlim_cur == RLIM_INFINITY) {
+            return NSUIntegerMax;
+        }
+        NSUInteger available = (NSUInteger)descriptors.rlim_cur;
+        maxConnections = (available > (2 * IHTTPWorkerReservedDescriptors) ? (available - IHTTPWorkerReservedDescriptors) : (available / 2));
+    }
+
+    NSUInteger workerCount = MAX(server.workerCount, 1);
+    return MAX(((maxConnections + workerCount - 1) / workerCount), 1);
+}
+
+/*! @brief stop watching the listening socket, connections wait in its backlog or go to other workers */
+- (void) pauseAccepting {
+    if (self.isAccepting && self.listenSocket >= 0) {
+        [self.eventLoop removeSource:self forFileDescriptor:self.listenSocket];
+    }
+    self.isAccepting = NO;
+}
+
+/*! @brief watch the listening socket again once the worker is under its connection limit */
+- (void) resumeAccepting {
+    if (!self.isAccepting && self.listenSocket >= 0 && self.connections.count < self.connectionLimit) {
+        self.isAccepting = [self.eventLoop addSource:self forFileDescriptor:self.listenSocket];
+
+        if (self.server.loggingLevel >= IHTTPServerLoggingDebug) {
+            NSLog(@"%@ resumed accepting with %lu connections", NSStringFromClass([self class]), (unsigned long)self.connections.count);
+        }
+    }
+}
+
+- (void) removeConnection:(IHTTPConnection*) connection {
+    if (connection.isClosing && !connection.isClosed) { // dropped once its last output has been sent
+        return;
+    }
+
+    [self.timerWheel cancelTimer:connection];
+    [self.timerWheel cancelTimer:connection.outputTimer];
+    [self.connections removeConnection:connection];
+    [self resumeAccepting];
+}
+
+- (void) startHTTP2WithRequest:(IHTTPRequest*) request data:(NSData*) data {
+    IHTTPConnection* connection = request.connection;
+    IHTTP2Session* session = [IHTTP2Session sessionWithConnection:connection];
+    [request takeUpgradeData]; // stops the request reading the connection
+    connection.request = nil;
+    connection.http2Session = session;
+    [session openWithData:data];
+
+    if (self.server.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ started HTTP/2 on connection: %@", NSStringFromClass([self class]), connection);
+    }
+}
+
+/*! @brief YES if the request asks to switch its connection to cleartext HTTP/2, RFC 7540 section 3.2,
+    a request with a body is answered as HTTP/1.1 */
+- (BOOL) requestUpgradesToHTTP2:(IHTTPRequest*) request {
+    return (self.http2Enabled && !request.stream && [request.requestVersion isEqualToString:@"HTTP/1.1"]
+         && request.expectedContentLength == 0 && [request headerFieldValue:IHTTPHTTP2SettingsHeader]
+         && [request headerField:IHTTPUpgradeHeader containsToken:"h2c"]
+         && [request headerField:IHTTPConnectionHeader containsToken:"upgrade"] // both are connection options
+         && [request headerField:IHTTPConnectionHeader containsToken:"http2-settings"]);
+}
+
+- (void) acceptConnection:(int) clientSocket address:(struct sockaddr_storage*) address {
+    IHTTPServer* server = self.server;
+
+    // accepted sockets on Linux don't inherit O_NONBLOCK from the listening socket, output the socket doesn't take waits on the connection
+    fcntl(clientSocket, F_SETFL, (fcntl(clientSocket, F_GETFL) | O_NONBLOCK));
+#ifdef SO_NOSIGPIPE
+    int noSigPipe = true;
+    setsockopt(clientSocket, SOL_SOCKET, SO_NOSIGPIPE, (void *)&noSigPipe, sizeof(int));
+#endif
+    if (server.tcpNoDelay) {
+        int noDelay = true;
+        setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, (void *)&noDelay, sizeof(int));
+    }
+
+    NSFileHandle* socket = [NSFileHandle.alloc initWithFileDescriptor:clientSocket closeOnDealloc:YES];
+    IHTTPConnection* connection = [IHTTPConnection connectionWithSocket:socket];
+    if (self.accessLog || self.rateLimiter) { // the log's host, and the key of the client's token bucket
+        char host[INET6_ADDRSTRLEN] = "-";
+        const void* hostAddress = (address->ss_family == AF_INET6 ? (const void*)&((struct sockaddr_in6*)address)->sin6_addr
+                                                                  : (const void*)&((struct sockaddr_in*)address)->sin_addr);
+        inet_ntop(address->ss_family, hostAddress, host, sizeof(host));
+        connection.remoteAddress = @(host);
+    }
+    IHTTPRequest* request = [IHTTPRequest requestWithInput:socket];
+    request.delegate = self;
+    request.eventLoop = self.eventLoop;
+    request.connection = connection;
+    request.startTime = self.eventLoop.currentTime; // when the loop woke to accept it
+    connection.worker = self;
+    connection.request = request;
+    connection.requestCount = 1;
+    [self.connections addConnection:connection];
+    [self.metrics countConnection];
+    [request readHeaders]; // set the handler when the header read is complete
+
+    if (server.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ incoming request at %@", NSStringFromClass([self class]), request.requestTime);
+    }
+}
+
+// MARK: - Handler Pools
+
+/*! @brief the prototype itself if it's stateless, otherwise an idle copy from the pool or a new one */
+- (IHTTPHandler*) handlerWithPrototype:(IHTTPHandler*) prototype forRequest:(IHTTPRequest*) request {
+    if (prototype.isStateless) {
+        return prototype;
+    }
+
+    NSMutableArray<IHTTPHandler*>* pool = [self.handlerPools objectForKey:prototype];
+    IHTTPHandler* handler = pool.lastObject;
+    if (handler) {
+        [pool removeLastObject];
+    }
+    else {
+        handler = [prototype handlerForRequest:request];
+        if (handler != prototype) {
+            handler.prototype = prototype;
+        }
+    }
+    return handler;
+}
+
+/*! @brief keep the handler of a completed response for the next request for its prototype */
+- (void) reuseHandler:(IHTTPHandler*) handler {
+    IHTTPHandler* prototype = handler.prototype;
+
+    if (prototype) {
+        NSMutableArray<IHTTPHandler*>* pool = [self.handlerPools objectForKey:prototype];
+        if (!pool) {
+            pool = [NSMutableArray arrayWithCapacity:IHTTPWorkerHandlerPoolSize];
+            [self.handlerPools setObject:pool forKey:prototype];
+        }
+
+        if (pool.count < IHTTPWorkerHandlerPoolSize) {
+            [handler prepareForReuse];
+            [pool addObject:handler];
+        }
+    }
+}
+
+// MARK: - IHTTPEventLoopSource
+
+- (void) eventLoopSourceIsReadable:(IHTTPEventLoop*) loop {
+    for (NSUInteger accepted = 0; accepted < IHTTPWorkerAcceptBatchSize; accepted++) {
+        if (self.connections.count >= self.connectionLimit) { // leave the rest in the backlog until connections close
+            if (self.server.loggingLevel >= IHTTPServerLoggingDebug) {
+                NSLog(@"%@ paused accepting at %lu connections", NSStringFromClass([self class]), (unsigned long)self.connections.count);
+            }
+            [self pauseAccepting];
+            break;
+        }
+
+        struct sockaddr_storage address;
+        socklen_t addressLength = sizeof(address);
+        int clientSocket = accept(self.listenSocket, (struct sockaddr*)&address, &addressLength);
+        if (clientSocket >= 0) {
+            [self acceptConnection:clientSocket address:&address];
+        }
+        else if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) { // try again when a connection closes, or on the next tick
+            if (self.server.loggingLevel >= IHTTPServerLoggingWarnings) {
+                NSLog(@"%@ warning paused accepting at %lu connections: %s", NSStringFromClass([self class]), (unsigned long)self.connections.count, strerror(errno));
+            }
+            [self pauseAccepting];
+            break;
+        }
+        else if (errno != EINTR && errno != ECONNABORTED) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && self.server.loggingLevel >= IHTTPServerLoggingWarnings) {
+                NSLog(@"%@ warning accept failed: %s", NSStringFromClass([self class]), strerror(errno));
+            }
+            break; // another worker sharing the socket may have taken the connection
+        }
+    }
+}
+
+// MARK: - IHTTPRequestDelegate
+
+- (void) requestDidParseHeaders:(IHTTPRequest*) request {
+    IHTTPServer* server = self.server;
+    IHTTPConnection* connection = request.connection;
+    if ([self requestUpgradesToHTTP2:request]) { // answered on stream 1 of the session, after the 101 Switching Protocols response
+        IHTTP2Session* session = [IHTTP2Session sessionWithConnection:connection];
+        if ([session upgradeRequest:request]) {
+            __attribute__((objc_precise_lifetime)) IHTTPRequest* upgraded = request; // the connection releases it
+            NSData* data = [upgraded takeUpgradeData];
+            connection.request = nil;
+            connection.http2Session = session;
+            [session openWithData:data];
+            return;
+        }
+    }
+
+    IHTTPShedReason shedReason = IHTTPShedInFlight;
+    if (![self admitRequest:request reason:&shedReason]) { // before the handler is chosen or the body is read
+        [self shedRequest:request reason:shedReason];
+        return;
+    }
+
+    NSTimeInterval parsed = IHTTPMonotonicTime();
+    IHTTPHandler* prototype = [server prototypeForRequest:request];
+    IHTTPHandler* handler = [self handlerWithPrototype:prototype forRequest:request];
+    IHTTPResponse* response = (request.stream ? [IHTTPResponse responseForStream:request.stream] : [IHTTPResponse responseWithOutput:request.input]);
+    response.startTime = request.startTime;
+    response.parsedTime = parsed;
+    response.metricsIndex = prototype.metricsIndex;
+    response.delegate = self;
+    response.eventLoop = self.eventLoop;
+    response.connection = request.connection;
+    response.request = request;
+    response.handler = handler;
+    request.maxBodyLength = server.maxRequestBodyLength;
+    response.keepAlive = (request.keepAlive
+                       && server.keepAliveTimeout > 0
+                       && (server.keepAliveMaxRequests == 0 || request.connection.requestCount < server.keepAliveMaxRequests));
+
+    if (server.loggingLevel >= IHTTPServerLoggingDebug) { // the access log records every request at IHTTPServerLoggingRequests
+        NSLog(@"%@ request: %@", NSStringFromClass(server.class), request);
+    }
+
+    [self.metrics countRequest];
+    [server didReceiveRequest:request];
+    self.inFlightCountStorage += 1;
+
+    NSOperationQueue* handlerQueue = server.handlerQueue;
+    if (!handlerQueue) { // on the loop thread, for handlers which don't block, once the body they may read with readBody has arrived
+        if (self.maxQueueDelay > 0) { // how long the loop was busy before it reached the request
+            [self recordSojournTime:(parsed - self.eventLoop.currentTime)];
+        }
+
+        __weak IHTTPWorker* worker = self;
+        [request collectBodyForHandler:^{
+            response.handlerStartTime = IHTTPMonotonicTime();
+            [handler handleRequest:request withResponse:response];
+            [worker handlerDidReturn:handler response:response];
+        }];
+        return;
+    }
+
+    __weak IHTTPWorker* worker = self;
+    IHTTPEventLoop* loop = self.eventLoop;
+    BOOL recordsSojourn = (self.maxQueueDelay > 0);
+    atomic_fetch_add(&_waitingHandlerCount, 1);
+    [handlerQueue addOperationWithBlock:^{
+        NSTimeInterval started = IHTTPMonotonicTime();
+        response.handlerStartTime = started; // read when the response completes, after the handler has started sending it
+        [worker handlerDidStartAfter:(started - parsed) recordsSojourn:recordsSojourn];
+        [handler handleRequest:request withResponse:response];
+        NSTimeInterval returned = IHTTPMonotonicTime();
+
+        [loop performBlock:^{
+            NSTimeInterval noticed = IHTTPMonotonicTime();
+            [worker recordQueueTime:(started - parsed) dispatchTime:(noticed - returned)];
+            [worker handlerDidReturn:handler response:response];
+        }];
+    }];
+}
+
+/*! @brief a queued handler has started, on its thread, its wait counts towards the maxQueueDelay as soon as it ends */
+- (void) handlerDidStartAfter:(NSTimeInterval) queueTime recordsSojourn:(BOOL) recordsSojourn {
+    atomic_fetch_sub(&_waitingHandlerCount, 1);
+    if (recordsSojourn) {
+        [self recordSojournTime:queueTime];
+    }
+}
+
+/*! @brief add a queued handler's wait to start and the delay before its return reached the loop thread to the worker's totals */
+- (void) recordQueueTime:(NSTimeInterval) queueTime dispatchTime:(NSTimeInterval) dispatchTime {
+    self.queuedHandlerCountStorage += 1;
+    self.handlerQueueTimeStorage += queueTime;
+    self.handlerDispatchTimeStorage += dispatchTime;
+    self.maxHandlerQueueTimeStorage = MAX(self.maxHandlerQueueTime, queueTime);
+    self.maxHandlerDispatchTimeStorage = MAX(self.maxHandlerDispatchTime, dispatchTime);
+
+    if (self.server.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ handler queued %.3f ms dispatched %.3f ms", NSStringFromClass([self class]), (queueTime * 1000), (dispatchTime * 1000));
+    }
+}
+
+/*! @brief called on the loop thread once the handler has returned, the handler is reused once its response has also finished */
+- (void) handlerDidReturn:(IHTTPHandler*) handler response:(IHTTPResponse*) response {
+    IHTTPServer* server = self.server;
+    response.didHandlerReturn = YES;
+
+    if (response.didFinishResponse) {
+        response.handler = nil;
+        [self reuseHandler:handler];
+    }
+
+    if (server.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ response status: %lu handler: %@ ", NSStringFromClass(server.class), (unsigned long)response.responseStatus, handler); // headers may still be changing on another thread
+    }
+}
+
+- (void) request:(IHTTPRequest*) request didRejectWithStatus:(NSUInteger) status {
+    [self.metrics countResponseStatus:status];
+    [self.accessLog logRequest:request remoteAddress:request.connection.remoteAddress status:status bytesSent:0 duration:0];
+}
+
+- (void) requestDidClose:(IHTTPRequest*) request {
+    IHTTPConnection* connection = request.connection;
+    [self removeConnection:connection];
+
+    if (self.server.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ closed connection after %lu requests", NSStringFromClass([self class]), (unsigned long)(connection.requestCount - 1));
+    }
+}
+
+// MARK: - IHTTPResponseDelegate
+
+- (void) responseDidComplete:(IHTTPResponse *)response {
+    IHTTPConnection* connection = response.connection;
+    IHTTPRequest* completed = response.request;
+    IHTTPHandler* handler = (response.didHandlerReturn ? response.handler : nil); // otherwise reused when the handler returns
+    IHTTPWebSocket* webSocket = response.webSocket;
+    BOOL keepAlive = response.keepAlive;
+
+    NSTimeInterval completedTime = IHTTPMonotonicTime();
+    [self.metrics recordResponseStatus:response.responseStatus handlerIndex:response.metricsIndex started:response.startTime
+        parsed:response.parsedTime handlerStarted:response.handlerStartTime completed:completedTime];
+    [self.accessLog logRequest:completed remoteAddress:connection.remoteAddress status:response.responseStatus bytesSent:response.bytesSent
+        duration:(completedTime - (response.startTime > 0 ? response.startTime : response.parsedTime))];
+
+    if (handler) {
+        response.handler = nil;
+    }
+
+    if (!self.eventLoop.isLoopThread) { // a response released unfinished on a handler thread, the worker's table belongs to its loop
+        __weak IHTTPWorker* worker = self;
+        [self.eventLoop performBlock:^{
+            [worker connection:connection didCompleteRequest:completed keepAlive:keepAlive handler:handler webSocket:webSocket];
+        }];
+        return;
+    }
+
+    if (connection.request == completed && self.server.loggingLevel >= IHTTPServerLoggingDebug) {
+        NSLog(@"%@ complete: %@", NSStringFromClass(self.server.class), response);
+    }
+
+    [self.server didCompleteResponse:response]; // not for a response released unfinished, which is gone before the loop thread could be told
+
+    [self connection:connection didCompleteRequest:completed keepAlive:keepAlive handler:handler webSocket:webSocket];
+}
+
+/*! @brief reuse the handler of the completed request, then hand the connection to the WebSocket it was upgraded to,
+    read the next request on it or close it */
+- (void) connection:(IHTTPConnection*) connection didCompleteRequest:(IHTTPRequest*) completed keepAlive:(BOOL) keepAlive
+    handler:(IHTTPHandler*) handler webSocket:(IHTTPWebSocket*) webSocket {
+    IHTTPServer* server = self.server;
+    BOOL isCurrent = (completed && connection.request == completed && [self.connections connectionForFileDescriptor:connection.fileDescriptor] == connection);
+    if (self.inFlightCountStorage > 0) {
+        self.inFlightCountStorage -= 1;
+    }
+
+    if (handler) {
+        [self reuseHandler:handler];
+    }
+
+    if (webSocket && !(isCurrent && keepAlive && completed.canReadNextRequest && server.serverState == IHTTPServerStateRunning)) {
+        [webSocket closeConnectionWithCode:IHTTPWebSocketCloseAbnormal]; // the upgrade failed, tell its closeBlock
+        webSocket = nil;
+    }
+
+    // the request is still the connection's current one, and the connection hasn't closed,
+    // carry on once the client has taken the response, or close it if the output failed
+    if (isCurrent) {
+        __weak IHTTPWorker* worker = self;
+        [connection performWhenOutputSent:^(BOOL didSend) {
+            [worker connection:connection didSendRequest:completed keepAlive:keepAlive webSocket:webSocket didSend:didSend];
+        }];
+    }
+}
+
+/*! @brief hand the connection to the WebSocket it was upgraded to or read the next request on it, once the response has been sent,
+    otherwise close it */
+- (void) connection:(IHTTPConnection*) connection didSendRequest:(IHTTPRequest*) completed keepAlive:(BOOL) keepAlive
+    webSocket:(IHTTPWebSocket*) webSocket didSend:(BOOL) didSend {
+    BOOL isRunning = (self.server.serverState == IHTTPServerStateRunning);
+    if (connection.request != completed || connection.isClosing || connection.isClosed) {
+        return;
+    }
+    else if (webSocket && didSend && isRunning) { // the connection carries WebSocket frames from now on
+        connection.webSocket = webSocket;
+        [webSocket openWithData:[completed takeUpgradeData]];
+    }
+    else if (!webSocket && didSend && keepAlive && completed.canReadNextRequest && isRunning) { // wait for the next request on the connection
+        IHTTPRequest* next = [completed nextRequest];
+        next.delegate = self;
+        connection.request = next;
+        connection.requestCount += 1;
+        [next readHeadersWithTimeout:IHTTPTimeoutIdle];
+    }
+    else {
+        [webSocket closeConnectionWithCode:IHTTPWebSocketCloseAbnormal];
+        [completed completeRequest];
+        [self removeConnection:connection];
+    }
+}
+
+@end
@@ -0,0 +1,59 @@
+#import <Foundation/Foundation.h>
+
+/*! @header IHTTPAccessLog.h
+    @abstract IHTTPAccessLog writes a line for each response, off the worker threads */
+
+/*! @enum IHTTPAccessLogFormat
+    @brief the format of the access log's lines */
+typedef NS_ENUM(NSUInteger, IHTTPAccessLogFormat) {
+    IHTTPAccessLogCommon,       /* Common Log Format: host - - [time] "request line" status bytes */
+    IHTTPAccessLogCombined,     /* Common Log Format followed by the quoted Referer and User-Agent */
+    IHTTPAccessLogJSON          /* one JSON object per line, with the duration and the Referer and User-Agent */
+};
+
+// MARK: -
+
+/*! @class IHTTPAccessLog
+    @brief an access log fed through a lock-free ring buffer and written to its file in batches by a thread of its own
+    @discussion the workers format each line straight into a slot of the ring without locking or allocating, and never wait for the file.
+    When the ring is full the line is dropped and counted. The bytes logged are all the bytes sent for the response, headers included.
+    The log writes until closeLog is called */
+@interface IHTTPAccessLog : NSObject
+
+/*! @brief the path of the log file, nil for the standard error */
+@property(nonatomic, readonly) NSString* filePath;
+
+/*! @brief the format of the lines */
+@property(nonatomic, readonly) IHTTPAccessLogFormat format;
+
+/*! @brief the number of lines the ring holds while they wait to be written */
+@property(nonatomic, readonly) NSUInteger capacity;
+
+/*! @brief lines written to the file */
+@property(nonatomic, readonly) NSUInteger writtenEntryCount;
+
+/*! @brief lines dropped because the ring was full, or the file could not be written */
+@property(nonatomic, readonly) NSUInteger droppedEntryCount;
+
+// MARK: -
+
+/*! @brief a log appending lines in the format to the file at the path, or to the standard error if the path is nil,
+    with a ring of 4096 lines, nil if the file can't be opened */
++ (IHTTPAccessLog*) accessLogWithPath:(NSString*) filePath format:(IHTTPAccessLogFormat) format;
+
+/*! @brief a log with a ring of at least capacity lines, rounded up to a power of two */
++ (IHTTPAccessLog*) accessLogWithPath:(NSString*) filePath format:(IHTTPAccessLogFormat) format capacity:(NSUInteger) capacity;
+
+/*! @brief reopen the log files of every access log when the process receives SIGHUP, e.g. from logrotate
+    @discussion installs a SIGHUP handler, which only sets a flag the logs' threads check before each batch */
++ (void) reopenLogsOnHangup;
+
+// MARK: -
+
+/*! @brief close and reopen the log file on the log's thread, after the lines already written */
+- (void) reopenLog;
+
+/*! @brief write the lines waiting in the ring, close the file and stop the log's thread */
+- (void) closeLog;
+
+@end
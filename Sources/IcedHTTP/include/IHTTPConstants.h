@@ -204,6 +204,22 @@ typedef NS_ENUM(NSUInteger, IHTTPDefaultPorts) {
     IHTTPSecurePort = 8443
 };
 
+// MARK: - HTTP Request Methods
+
+static NSString* const IHTTPGetMethod                           = @"GET";
+static NSString* const IHTTPHeadMethod                          = @"HEAD";
+static NSString* const IHTTPPostMethod                          = @"POST";
+static NSString* const IHTTPPutMethod                           = @"PUT";
+static NSString* const IHTTPDeleteMethod                        = @"DELETE";
+static NSString* const IHTTPPatchMethod                         = @"PATCH";
+static NSString* const IHTTPOptionsMethod                       = @"OPTIONS";
+
+// MARK: - HTTP Content Codings
+
+static NSString* const IHTTPBrotliEncoding                      = @"br";
+static NSString* const IHTTPGzipEncoding                        = @"gzip";
+static NSString* const IHTTPDeflateEncoding                     = @"deflate";
+
 // MARK: - HTTP Header Fields
 
 // static NSString* const IHTTPHeaderTemplate                   = @"Header";
@@ -215,6 +231,8 @@ static NSString* const IHTTPConnectionHeader                    = @"Connection";
 static NSString* const IHTTPContentLengthHeader                 = @"Content-Length";
 static NSString* const IHTTPContentMD5Header                    = @"Content-MD5";
 static NSString* const IHTTPUpgradeHeader                       = @"Upgrade";
+static NSString* const IHTTPSecWebSocketProtocolHeader          = @"Sec-WebSocket-Protocol";
+static NSString* const IHTTPSecWebSocketVersionHeader           = @"Sec-WebSocket-Version";
 static NSString* const IHTTPViaHeader                           = @"Via";
 static NSString* const IHTTPWarningHeader                       = @"Warning";
 
@@ -233,6 +251,7 @@ static NSString* const IHTTPExpectHeader                        = @"Expect";
 static NSString* const IHTTPForwardedHeader                     = @"Forwarded";
 static NSString* const IHTTPFromHeader                          = @"From";
 static NSString* const IHTTPHostHeader                          = @"Host";
+static NSString* const IHTTPHTTP2SettingsHeader                 = @"HTTP2-Settings";
 static NSString* const IHTTPIfMatchHeader                       = @"If-Match";
 static NSString* const IHTTPIfModifiedSinceHeader               = @"If-Modified-Since";
 static NSString* const IHTTPIfNoneMatchHeader                   = @"If-None-Match";
@@ -244,6 +263,7 @@ static NSString* const IHTTPProxyAuthorizationHeader            = @"Proxy-Author
 static NSString* const IHTTPRangeHeader                         = @"Range";
 static NSString* const IHTTPRefererHeader                       = @"Referer";
 static NSString* const IHTTPReferrerHeader                      = IHTTPRefererHeader;
+static NSString* const IHTTPSecWebSocketKeyHeader               = @"Sec-WebSocket-Key";
 static NSString* const IHTTPTEHeader                            = @"TE";
 static NSString* const IHTTPUserAgentHeader                     = @"User-Agent";
 
@@ -276,6 +296,7 @@ static NSString* const IHTTPP3PHeader                           = @"P3P";
 static NSString* const IHTTPProxyAuthenticateHeader             = @"Pragma";
 static NSString* const IHTTPPublicKeyPinsHeader                 = @"Public-Key-Pins";
 static NSString* const IHTTPRetryAfterHeader                    = @"Retry-After";
+static NSString* const IHTTPSecWebSocketAcceptHeader            = @"Sec-WebSocket-Accept";
 static NSString* const IHTTPServerHeader                        = @"Server";
 static NSString* const IHTTPSetCookieHeader                     = @"Set-Cookie";
 static NSString* const IHTTPStrictTransportSecurityHeader       = @"Strict-Transport-Security";
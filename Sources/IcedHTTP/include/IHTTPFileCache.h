@@ -0,0 +1,49 @@
+#import <Foundation/Foundation.h>
+
+/*! @header IHTTPFileCache.h
+    @abstract IHTTPFileCache keeps small files in memory for IHTTPFileHandler */
+
+/*! @class IHTTPFileCache
+    @brief a bounded least recently used cache of file contents, with their response headers serialized ahead of time
+    @discussion cached files are served without touching the file system, entries are dropped when the file changes,
+    as reported by inotify on Linux or kqueue vnode events on BSD and macOS. Files compressed for clients which accept gzip
+    are kept alongside them, keyed by their modification time, and age out once the file changes. One cache can be shared by several
+    handlers and is safe to use from every worker thread */
+@interface IHTTPFileCache : NSObject
+
+/*! @brief the most bytes of file contents the cache holds before it evicts the least recently used entries */
+@property(nonatomic, readonly) NSUInteger capacity;
+
+/*! @brief files larger than this are always sent from disk, default 256 KB */
+@property(nonatomic, assign) NSUInteger maxEntrySize;
+
+/*! @brief bytes of file contents currently in the cache */
+@property(nonatomic, readonly) NSUInteger size;
+
+/*! @brief number of files currently in the cache */
+@property(nonatomic, readonly) NSUInteger count;
+
+/*! @brief requests served from the cache */
+@property(nonatomic, readonly) NSUInteger hits;
+
+/*! @brief requests for files which weren't in the cache */
+@property(nonatomic, readonly) NSUInteger misses;
+
+/*! @brief entries dropped to make room for others */
+@property(nonatomic, readonly) NSUInteger evictions;
+
+/*! @brief entries dropped because their file changed */
+@property(nonatomic, readonly) NSUInteger invalidations;
+
+// MARK: -
+
+/*! @brief a cache holding up to capacity bytes of file contents,
+    nil if the file system can't report changes, so the entries could not be kept current */
++ (IHTTPFileCache*) cacheWithCapacity:(NSUInteger) capacity;
+
+// MARK: -
+
+/*! @brief drop every entry in the cache */
+- (void) removeAllEntries;
+
+@end
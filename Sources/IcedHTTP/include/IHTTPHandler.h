@@ -1,11 +1,15 @@
 #import <Foundation/Foundation.h>
 
+@class IHTTPFileCache;
 @class IHTTPRequest;
 @class IHTTPResponse;
+@class IHTTPResponseCache;
+@class IHTTPServer;
+@class IHTTPWebSocket;
 
 /*! @header IHTTPHandler.h 
     @abstract Handlers are created as prototypes, registered with the server,
-    copied to handle a request, then completed */
+    copied to handle a request, then completed, stateless handlers are used without being copied */
 
 /*! @typedef IHTTPRequestBlock
     @param request the IHTTPRequest*  to evaluate
@@ -18,19 +22,75 @@ typedef BOOL (^ IHTTPRequestBlock)(IHTTPRequest* request);
     @returns NSUInteger HTTP response code */
 typedef NSUInteger (^ IHTTPResponseBlock)(IHTTPRequest* request, IHTTPResponse* response);
 
+/*! @typedef IHTTPAsyncResponseBlock
+    @param request the IHTTPRequest* request input stream
+    @param response the IHTTPResponse* response output stream, which the block or the work it starts
+    completes later, from any thread, with completeResponse */
+typedef void (^ IHTTPAsyncResponseBlock)(IHTTPRequest* request, IHTTPResponse* response);
+
+/*! @typedef IHTTPWebSocketBlock
+    @param request the IHTTPRequest* which asked to upgrade the connection
+    @param webSocket the IHTTPWebSocket* the connection is upgraded to, which the block gives its messageBlock and closeBlock,
+    and may send messages on, or add to a group */
+typedef void (^ IHTTPWebSocketBlock)(IHTTPRequest* request, IHTTPWebSocket* webSocket);
+
 /*! @class IHTTPHandler
     @abstract Handlers are used to service individual requests */
 @interface IHTTPHandler : NSObject <NSCopying>
 
+/*! @brief YES if the handler keeps no state of its own while it handles a request, default NO
+    @discussion a stateless prototype handles every request itself, without being copied,
+    and may be called from all of the server's worker threads at once.
+    The file and block handlers are stateless, so the blocks must be safe to call from any thread */
+@property(nonatomic, readonly) BOOL isStateless;
+
+/*! @brief the name the server's metrics count the handler's requests under, set before registering the handler,
+    defaults to the route it's registered for, or its class name */
+@property(nonatomic, copy) NSString* name;
+
 /*! @abstract a handler which will return the file at the path provided */
 + (IHTTPHandler*) handlerWithFilePath:(NSString*) filePath;
 
+/*! @abstract a handler which will return the file at the path provided, keeping small files in the cache
+    @discussion a file in the cache is served in a single write without checking the file system,
+    the cache drops the file when it changes. A nil cache sends the file from disk for every request */
++ (IHTTPHandler*) handlerWithFilePath:(NSString*) filePath cache:(IHTTPFileCache*) fileCache;
+
+/*! @abstract a handler which answers any request with the same status, headers and body, serialized once when it's created
+    @discussion for health checks, redirects and fixed documents, sent in a single write with a Date header formatted once a second,
+    the Content-Length is set from the body */
++ (IHTTPHandler*) handlerWithStatus:(NSUInteger) status headers:(NSDictionary<NSString*, NSString*>*) headers body:(NSData*) body;
+
 /*! @abstract a handler which will execute the blocks provided to evaluate and service the request */
 + (IHTTPHandler*) handlerWithRequestBlock:(IHTTPRequestBlock) requestBlock responseBlock:(IHTTPResponseBlock) responseBlock;
 
 /*! @abstract a handler which will execute the responseBlock for any request */
 + (IHTTPHandler*) handlerWithResponseBlock:(IHTTPResponseBlock) responseBlock;
 
+/*! @abstract a handler which will execute the blocks provided to evaluate the request and start the response
+    @discussion the response may be sent and completed from any thread after the block returns,
+    its output is written on the worker thread in the order it's sent */
++ (IHTTPHandler*) handlerWithRequestBlock:(IHTTPRequestBlock) requestBlock asyncResponseBlock:(IHTTPAsyncResponseBlock) responseBlock;
+
+/*! @abstract a handler which will execute the asynchronous responseBlock for any request */
++ (IHTTPHandler*) handlerWithAsyncResponseBlock:(IHTTPAsyncResponseBlock) responseBlock;
+
+/*! @abstract a handler which answers the requests the handler provided can handle from the cache, running the handler on a miss
+    @discussion GET and HEAD responses are kept for their Cache-Control max-age, keyed by the Host, the request target and the values
+    of the varyHeaders, and sent in a single write without running the handler. Concurrent GET requests for a key which isn't cached
+    wait for the first of them to run the handler and are all sent its response, unless it's private to the client it was made for.
+    Other methods go straight to the handler, a stateful handler is copied for each request it handles */
++ (IHTTPHandler*) handlerWithHandler:(IHTTPHandler*) handler responseCache:(IHTTPResponseCache*) responseCache varyHeaders:(NSArray<NSString*>*) varyHeaders;
+
+/*! @abstract a handler which upgrades the connection to a WebSocket and calls the block with it, before the handshake's response is sent
+    @discussion a request which isn't a version 13 WebSocket handshake is answered with 426 Upgrade Required,
+    closing the WebSocket in the block refuses the upgrade with 403 Forbidden. The block is called from all of the server's threads */
++ (IHTTPHandler*) handlerWithWebSocketBlock:(IHTTPWebSocketBlock) webSocketBlock;
+
+/*! @abstract a handler which answers any request with the server's metrics in the Prometheus text format
+    @discussion register it for a route, e.g. GET /metrics, to scrape the server */
++ (IHTTPHandler*) handlerWithMetricsOfServer:(IHTTPServer*) server;
+
 // MARK: -
 
 /*!
@@ -44,10 +104,19 @@ typedef NSUInteger (^ IHTTPResponseBlock)(IHTTPRequest* request, IHTTPResponse*
 /*!
     @method handlerForRequest:
     @param request the request to find a handler for
-    @returns a copy of the current handler
+    @returns the handler itself if it's stateless, otherwise a copy of it
+    @discussion the server keeps the copies when their responses complete and hands them to later requests
+    for the same prototype on the same worker, after calling prepareForReuse
 */
 - (IHTTPHandler*) handlerForRequest:(IHTTPRequest*) request;
 
+/*!
+    @method prepareForReuse
+    @discussion called on a copy of a stateful handler after its response completes and before it handles another request,
+    subclasses which keep per-request state must reset it here and call super
+*/
+- (void) prepareForReuse;
+
 /*!
     @method handleRequest:withResponse
     @param request the request to handle
@@ -0,0 +1,36 @@
+#import <Foundation/Foundation.h>
+
+/*! @header IHTTPRateLimiter.h
+    @abstract IHTTPRateLimiter limits the rate of requests from each client address */
+
+/*! @class IHTTPRateLimiter
+    @brief a token bucket for each client address, shared by the server's workers
+    @discussion each client starts with a full bucket of burst tokens, which refills at the rate, a request takes a token
+    and is refused with 429 Too Many Requests when there are none. The buckets are spread across independently locked tables
+    by address, so workers admitting different clients rarely wait for each other. Buckets which have refilled are forgotten
+    when a table fills up, a client which comes back starts with a full bucket as it would have had anyway */
+@interface IHTTPRateLimiter : NSObject
+
+/*! @brief the tokens each client earns a second */
+@property(nonatomic, readonly) double rate;
+
+/*! @brief the most tokens a client can hold, the requests it can send at once after being quiet */
+@property(nonatomic, readonly) NSUInteger burst;
+
+/*! @brief the seconds a client which has been refused waits for its next token, sent in the Retry-After header of a 429 */
+@property(nonatomic, readonly) NSUInteger retryAfter;
+
+/*! @brief the number of requests refused */
+@property(nonatomic, readonly) NSUInteger limitedCount;
+
+// MARK: -
+
+/*! @brief a limiter allowing each client rate requests a second, with bursts of up to burst requests, nil if the rate isn't positive */
++ (IHTTPRateLimiter*) rateLimiterWithRate:(double) rate burst:(NSUInteger) burst;
+
+// MARK: -
+
+/*! @brief take a token from the client's bucket, returns NO and counts the request if it's empty, may be called from any thread */
+- (BOOL) admitClient:(NSString*) clientAddress;
+
+@end
@@ -2,6 +2,30 @@
 
 @protocol IHTTPRequestDelegate;
 
+/*! @const IHTTPRequestErrorDomain
+    @brief the domain of the errors passed to the body blocks */
+extern NSString* const IHTTPRequestErrorDomain;
+
+/*! @enum IHTTPRequestErrorNumber
+    @brief Error numbers for reading the body of an IHTTPRequest */
+typedef NS_ENUM(NSInteger, IHTTPRequestErrorNumber) {
+    IHTTPRequestNoError = 0,
+    IHTTPRequestBodyInvalidError,       /* the chunked transfer coding of the body is malformed */
+    IHTTPRequestBodyTooLargeError,      /* the body is longer than the maxBodyLength */
+    IHTTPRequestBodyTruncatedError,     /* the connection closed before the end of the body */
+    IHTTPRequestBodyTimedOutError       /* the client sent none of the body for the server's bodyTimeout */
+};
+
+/*! @typedef IHTTPBodyChunkBlock
+    @param chunk the next piece of the body as it arrives, or nil once the body is complete or can't be read
+    @param error nil, or the reason the body can't be read when chunk is nil */
+typedef void (^ IHTTPBodyChunkBlock)(NSData* chunk, NSError* error);
+
+/*! @typedef IHTTPBodyCompletionBlock
+    @param body the complete body, or nil if it can't be read
+    @param error nil, or the reason the body can't be read */
+typedef void (^ IHTTPBodyCompletionBlock)(NSData* body, NSError* error);
+
 /*! @header IHTTPRequest.h
     @brief IHTTPRequest class */
 
@@ -20,15 +44,34 @@
 /*! @brief HTTP Request Method */
 @property(nonatomic, readonly) NSString* requestMethod;
 
-/*! @brief HTTP Request Headers in dictionary form */
+/*! @brief HTTP Request Headers in dictionary form, built the first time it's used,
+    headerFieldValue: is cheaper for looking up a few headers */
 @property(nonatomic, readonly) NSDictionary* requestHeaders;
 
 /*! @brief HTTP Request URL */
 @property(nonatomic, readonly) NSURL* requestURL;
 
+/*! @brief the parameters captured from the path by the pattern of the route which matched the request,
+    e.g. @{@"id": @"42"} for /users/42 and the pattern /users/:id, or nil */
+@property(nonatomic, readonly) NSDictionary<NSString*, NSString*>* pathParameters;
+
+/*! @brief HTTP Request Version, e.g. HTTP/1.1 */
+@property(nonatomic, readonly) NSString* requestVersion;
+
 /*! @brief HTTP Request Time */
 @property(nonatomic, readonly) NSDate* requestTime;
 
+/*! @brief the Content-Length of the body, 0 if there is no body, or -1 if the body is chunked and its length isn't known */
+@property(nonatomic, readonly) long long expectedContentLength;
+
+/*! @brief the longest body readBody and readBodyWithCompletion: will collect, 0 for no limit,
+    set to the server's maxRequestBodyLength before the handler is called */
+@property(nonatomic, assign) NSUInteger maxBodyLength;
+
+/*! @brief YES if the client will accept another request on this connection after the response,
+    the default for HTTP/1.1 unless the client sends Connection: close */
+@property(nonatomic, readonly) BOOL keepAlive;
+
 // MARK: -
 
 /*! @brief create a request object with the file handle provided */
@@ -36,13 +79,44 @@
 
 // MARK: -
 
+/*! @brief the value of the header field, matched without regard to case, or nil if the client didn't send it
+    @discussion looks the field up in the parsed request head without building the requestHeaders dictionary,
+    the values of repeated fields are joined with commas */
+- (NSString*) headerFieldValue:(NSString*) headerField;
+
+// MARK: -
+
 /*! @brief read the headers of the request */
 - (void) readHeaders;
 
-/*! @brief NSData with the body of the IHTTPRequest */
+/*! @brief NSData with the body of the IHTTPRequest, framed by its Content-Length or chunked transfer coding
+    @discussion blocks the calling thread until the whole body arrives, returns nil if the body is malformed,
+    truncated, too slow to arrive, or longer than the maxBodyLength. Handlers run on the worker thread unless the server has a
+    handlerConcurrency, and waiting there would stop the worker reading the body, so the worker collects the body up to the maxBodyLength
+    before calling such a handler and readBody returns it at once. Set a handlerConcurrency and use readBodyChunks: to stream bodies
+    which shouldn't be held in memory */
 - (NSData*) readBody;
 
-/*! @brief close the input stream */
+/*! @brief deliver the body to the block a piece at a time as it arrives, without blocking the worker thread, may be called from any thread
+    @discussion the block is called on the worker thread, after the handler returns, with each piece of the body,
+    then once with nil. Chunked bodies are decoded. A client which sent Expect: 100-continue is told to send the body.
+    A body the worker collected before calling a handler on its thread is passed as one piece.
+    The handler completes the response from the block, or at any time, the rest of an unread body is discarded */
+- (void) readBodyChunks:(IHTTPBodyChunkBlock) chunkBlock;
+
+/*! @brief collect the body up to the maxBodyLength and pass it to the completion on the worker thread, may be called from any thread
+    @discussion a Content-Length over the maxBodyLength fails without asking a client waiting for 100-continue for the body,
+    respond with IHTTPStatus413PayloadTooLarge when the error is IHTTPRequestBodyTooLargeError */
+- (void) readBodyWithCompletion:(IHTTPBodyCompletionBlock) completion;
+
+/*! @brief stop reading the body until resumeBody, the client's sends back up once the socket buffers fill
+    @discussion call from the chunk block, which runs on the worker thread */
+- (void) pauseBody;
+
+/*! @brief continue delivering the body to the chunk block after pauseBody, may be called from any thread */
+- (void) resumeBody;
+
+/*! @brief close the input stream, the connection closes once the output still pending on it has been sent */
 - (void) completeRequest;
 
 @end
@@ -51,6 +125,19 @@
 
 @protocol IHTTPRequestDelegate <NSObject>
 
+@optional
+
+/*! @brief called when the request head has been parsed, preferred over request:parsedHeaders:
+    because the requestHeaders dictionary isn't built unless the delegate asks for it */
+- (void) requestDidParseHeaders:(IHTTPRequest*) request;
+
+/*! @brief called when the request head has been parsed, with the requestHeaders dictionary */
 - (void) request:(IHTTPRequest*) request parsedHeaders:(NSDictionary*) headers;
 
+/*! @brief called when a request which can't be read is answered with the status, before the connection is closed */
+- (void) request:(IHTTPRequest*) request didRejectWithStatus:(NSUInteger) status;
+
+/*! @brief called when the client closes the connection, or it is closed for being idle, before the headers are parsed */
+- (void) requestDidClose:(IHTTPRequest*) request;
+
 @end
@@ -11,18 +11,28 @@
 /*! @class IHTTPResponse 
     @brief IcedHTTP Response Object
     @discussion contains the output stream, provides for sending headers and body content,
-    as well as monitoring the completion of the response via a delegate method
+    as well as monitoring the completion of the response via a delegate method.
+    A response may be sent from any thread, one thread at a time, the output sent off the worker thread
+    which owns the connection is copied and written there in the order it was sent
 */
 @interface IHTTPResponse : NSObject
 
 @property(nonatomic, weak) id<IHTTPResponseDelegate> delegate;
 
-/*! @abstract the NSFileHandle the response will write it's output to */
+/*! @abstract the NSFileHandle the response will write its output to */
 @property(nonatomic, retain) NSFileHandle* output;
 
 /*! @abstract YES if sendHeaders: has been called, successfully or not */
 @property(nonatomic, assign) BOOL didSendHeaders;
 
+/*! @abstract YES if completeResponse has been called */
+@property(nonatomic, readonly) BOOL didCompleteResponse;
+
+/*! @abstract YES if the connection will be left open for the next request when the response completes
+    @discussion set by the server from the request and its keep-alive limits, cleared if the response
+    can't be framed because it has a body but no Content-Length header and the client doesn't support chunked transfer coding */
+@property(nonatomic, assign) BOOL keepAlive;
+
 /*! @abstract the NSException which was encountered trying to write to the output */
 @property(nonatomic, retain) NSException* outputException;
 
@@ -43,13 +53,33 @@
 /*! @abstract send the status code */
 - (void) sendStatus:(NSUInteger) httpStatus;
 
-/*! @abstract send the headers provided */
+/*! @abstract compress the body with gzip or deflate, whichever the request accepts, for a handler's dynamic output
+    @discussion call after sendStatus: and before the headers are sent. Adds Vary: Accept-Encoding and the Content-Encoding,
+    then the body is compressed as it's sent, without a Content-Length, and flush sends everything compressed so far
+    @returns the content coding of the body, or nil if the request accepts neither and the body is sent as it is */
+- (NSString*) compressBody;
+
+/*! @abstract send the headers provided
+    @discussion the status line and headers wait in the output buffer to be written with the start of the body,
+    without a Content-Length header the body is sent with chunked transfer coding */
 - (void) sendHeaders:(NSDictionary*) headers;
 
-/*! @abstract send the body data provided */
+/*! @abstract send the body data provided
+    @discussion before sendHeaders: the data is the complete body and sets the Content-Length header,
+    after it the data is the next part of the body. Small writes are coalesced in the output buffer */
 - (void) sendBody:(NSData*) bodyData;
 
-/*! @abstract closes the outgoing file handle and completes the response */
+/*! @abstract send length bytes of the file from the offset as body data
+    @discussion the bytes go from the file to the socket with sendfile where the system has it, or from a memory map of the file,
+    sets the Content-Length header to the length if the headers have not been sent */
+- (void) sendFile:(NSFileHandle*) file offset:(unsigned long long) offset length:(unsigned long long) length;
+
+/*! @abstract write the buffered output to the client now, e.g. after each server-sent event
+    @returns NO if the output has failed and the response is complete */
+- (BOOL) flush;
+
+/*! @abstract completes the response, closing the outgoing file handle unless the connection is kept alive
+    @discussion the delegate is told on the worker thread once the output has been written */
 - (void) completeResponse;
 
 @end
@@ -59,7 +89,7 @@
 /*! @protocol IHTTPResponseDelegate */
 @protocol IHTTPResponseDelegate <NSObject>
 
-/*! @brief called on the delegate when the response is completed */
+/*! @brief called on the delegate when the response is completed and its output written */
 - (void) responseDidComplete:(IHTTPResponse *)response;
 
 @end
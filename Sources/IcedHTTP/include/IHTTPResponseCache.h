@@ -0,0 +1,52 @@
+#import <Foundation/Foundation.h>
+
+/*! @header IHTTPResponseCache.h
+    @abstract IHTTPResponseCache keeps the complete responses of dynamic handlers in memory */
+
+/*! @class IHTTPResponseCache
+    @brief a bounded least recently used cache of serialized responses, for handlers made with handlerWithHandler:responseCache:varyHeaders:
+    @discussion each entry holds the status line, headers and body of a response to a GET request, keyed by the Host, the request target
+    and the request headers the handler varies on, kept for the s-maxage or max-age of its Cache-Control header.
+    While a handler is running for a key, other requests for the key wait and are answered with its response, so an
+    expensive response is computed once however many clients ask for it at once. One cache can be shared by several
+    handlers and is safe to use from every worker thread */
+@interface IHTTPResponseCache : NSObject
+
+/*! @brief the most bytes of responses the cache holds before it evicts the least recently used entries */
+@property(nonatomic, readonly) NSUInteger capacity;
+
+/*! @brief larger responses are sent to the waiting requests but not cached, default 1 MB */
+@property(nonatomic, assign) NSUInteger maxEntrySize;
+
+/*! @brief seconds to keep a response which has no max-age or s-maxage in its Cache-Control header, default 0, which doesn't keep it */
+@property(nonatomic, assign) NSTimeInterval defaultTimeToLive;
+
+/*! @brief bytes of responses currently in the cache */
+@property(nonatomic, readonly) NSUInteger size;
+
+/*! @brief number of responses currently in the cache */
+@property(nonatomic, readonly) NSUInteger count;
+
+/*! @brief requests answered from the cache without running a handler */
+@property(nonatomic, readonly) NSUInteger hits;
+
+/*! @brief requests which ran their handler */
+@property(nonatomic, readonly) NSUInteger misses;
+
+/*! @brief requests which waited for another request's handler and were answered with its response */
+@property(nonatomic, readonly) NSUInteger coalesced;
+
+/*! @brief entries dropped to make room for others */
+@property(nonatomic, readonly) NSUInteger evictions;
+
+// MARK: -
+
+/*! @brief a cache holding up to capacity bytes of responses */
++ (IHTTPResponseCache*) cacheWithCapacity:(NSUInteger) capacity;
+
+// MARK: -
+
+/*! @brief drop every entry in the cache, requests waiting for a handler are still answered */
+- (void) removeAllEntries;
+
+@end
@@ -1,6 +1,8 @@
 #import <Foundation/Foundation.h>
 
+@class IHTTPAccessLog;
 @class IHTTPHandler;
+@class IHTTPRateLimiter;
 @class IHTTPRequest;
 @class IHTTPResponse;
 @protocol IHTTPServerDelegate;
@@ -49,12 +51,136 @@ extern NSString* const IHTTPServerStateChangedNotification;
 /*! @brief the TCP port the server is running on */
 @property(nonatomic, assign) NSUInteger serverPort;
 
+/*! @brief the address the server listens on, an IPv4 or IPv6 literal,
+    nil listens on all IPv4 and IPv6 addresses, or all IPv4 addresses when IPv6 is unavailable, default nil */
+@property(nonatomic, copy) NSString* bindAddress;
+
+/*! @brief the number of worker threads accepting and servicing connections, each with its own event loop, default 1
+    @discussion where the system balances SO_REUSEPORT connections (Linux, FreeBSD) each worker has its own listening socket,
+    elsewhere the workers share a single socket */
+@property(nonatomic, assign) NSUInteger workerCount;
+
+/*! @brief the most connections open at once, shared evenly between the workers,
+    0 limits the connections to the process's file descriptor limit, less a reserve for files, default 0
+    @discussion a worker at its limit stops accepting and leaves new connections waiting in the listen backlog until one of its connections closes,
+    a worker which runs out of file descriptors stops accepting until a connection closes or a second passes. Set before startServer */
+@property(nonatomic, assign) NSUInteger maxConnections;
+
+/*! @brief the maximum length of the queue of connections waiting to be accepted, default SOMAXCONN */
+@property(nonatomic, assign) int listenBacklog;
+
+/*! @brief disable Nagle's algorithm on accepted connections, so small responses are sent immediately, default YES */
+@property(nonatomic, assign) BOOL tcpNoDelay;
+
+/*! @brief only wake a worker once the first bytes of a request have arrived, default NO
+    @discussion uses TCP_DEFER_ACCEPT on Linux, ignored elsewhere */
+@property(nonatomic, assign) BOOL tcpDeferAccept;
+
 /*! @brief the current state of the server */
 @property(nonatomic, assign) IHHTPServerState serverState;
 
-/*! @brief the current logging level of the server */
+/*! @brief seconds to wait for the first bytes of the next request on a kept-alive connection before closing it,
+    0 disables keep-alive and closes every connection after its response, default 5 seconds */
+@property(nonatomic, assign) NSTimeInterval keepAliveTimeout;
+
+/*! @brief maximum number of requests served on a connection before it's closed, 0 for no limit, default 100 */
+@property(nonatomic, assign) NSUInteger keepAliveMaxRequests;
+
+/*! @brief seconds a client has to send the whole request head, from when the connection opens or the first bytes of a kept-alive request arrive,
+    answered with 408 Request Timeout, 0 for no limit, default 10 seconds */
+@property(nonatomic, assign) NSTimeInterval headerTimeout;
+
+/*! @brief seconds a handler reading the request body waits for more of it before the read fails with IHTTPRequestBodyTimedOutError,
+    0 for no limit, default 30 seconds */
+@property(nonatomic, assign) NSTimeInterval bodyTimeout;
+
+/*! @brief seconds output waits on a connection for a client which has stopped reading it before the output fails and the connection is closed,
+    pushed back whenever the client takes some, 0 for no limit, default 30 seconds */
+@property(nonatomic, assign) NSTimeInterval writeTimeout;
+
+/*! @brief seconds a WebSocket may be quiet before the server pings it, it's closed if the client doesn't answer within another interval,
+    or doesn't answer a close frame within one, 0 for no pings, default 30 seconds */
+@property(nonatomic, assign) NSTimeInterval webSocketPingInterval;
+
+/*! @brief serve cleartext HTTP/2 to clients which start with its connection preface or upgrade with Upgrade: h2c, default NO
+    @discussion each stream is handled as a request of its own, so many requests share one connection without waiting on each other.
+    Handlers don't change, a request's body has arrived in full before its handler runs, under the maxRequestBodyLength,
+    and the keepAliveTimeout closes a connection with no open streams. Set before startServer */
+@property(nonatomic, assign) BOOL http2Enabled;
+
+/*! @brief the most streams a client may have open at once on each HTTP/2 connection, default 100 */
+@property(nonatomic, assign) NSUInteger http2MaxConcurrentStreams;
+
+/*! @brief the number of connections closed for exceeding each timeout, the idle count is for kept-alive connections past the keepAliveTimeout
+    @discussion the timeouts run on a timer wheel in each worker, which expires them about once a second
+    without a timer for each connection */
+@property(nonatomic, readonly) NSUInteger headerTimeoutCount;
+@property(nonatomic, readonly) NSUInteger bodyTimeoutCount;
+@property(nonatomic, readonly) NSUInteger idleTimeoutCount;
+@property(nonatomic, readonly) NSUInteger writeTimeoutCount;
+
+/*! @brief the server's counters and latency histograms in the Prometheus text exposition format, version 0.0.4
+    @discussion connections accepted, requests, responses by status code, latency from the connection being accepted, or the first bytes
+    of a kept-alive request arriving, to the headers being parsed, the handler starting and the response completing,
+    and the requests and handler latency of each registered prototype by its name. Each worker counts into its own atomic counters without locks,
+    they are summed when the metrics are read. Prototypes registered while the server is running are counted as "other" until it restarts,
+    since the workers' counters are sized when they start. Serve them with IHTTPHandler's handlerWithMetricsOfServer: */
+@property(nonatomic, readonly) NSString* prometheusMetrics;
+
+/*! @brief the longest request body collected by readBody and readBodyWithCompletion:, 0 for no limit, default 16 MB
+    @discussion set on each request before its handler is called, handlers on the handler queue may change it on the request,
+    handlers on the worker thread are called once the body has been collected up to this length */
+@property(nonatomic, assign) NSUInteger maxRequestBodyLength;
+
+/*! @brief the most handlers run at once on the server's handler queue, 0 runs each handler on the worker thread which read its request, default 0
+    @discussion handlers which block, on a database call or a template render, should run on the queue so the worker threads
+    keep serving their other connections. Socket reads and writes stay on the worker threads, the output a handler sends on the queue
+    is written by its worker in the order it was sent. Set before startServer */
+@property(nonatomic, assign) NSUInteger handlerConcurrency;
+
+/*! @brief the average and longest seconds requests waited for a thread on the handler queue after their headers were parsed */
+@property(nonatomic, readonly) NSTimeInterval handlerQueueLatency;
+@property(nonatomic, readonly) NSTimeInterval maxHandlerQueueLatency;
+
+/*! @brief the average and longest seconds between a handler on the queue returning and its worker thread taking the response back */
+@property(nonatomic, readonly) NSTimeInterval handlerDispatchLatency;
+@property(nonatomic, readonly) NSTimeInterval maxHandlerDispatchLatency;
+
+/*! @brief the most requests the server handles at once, each worker takes its share, 0 for no limit, default 0
+    @discussion requests past the limit are shed, answered with a prepared 503 Service Unavailable and a Retry-After of overloadRetryAfter
+    seconds before their handlers run or their bodies are read, and their connections are closed. Set before startServer */
+@property(nonatomic, assign) NSUInteger maxInFlightRequests;
+
+/*! @brief seconds requests may stand waiting to be handled before new requests are shed with 503 Service Unavailable, 0 for no limit, default 0
+    @discussion as CoDel does, a worker sheds while the shortest wait in each 100 ms interval is over the limit, a queue which stands
+    rather than a burst which drains. The wait is for a thread on the handler queue, or for the worker's event loop to reach the request
+    when handlers run on it. Set before startServer */
+@property(nonatomic, assign) NSTimeInterval maxQueueDelay;
+
+/*! @brief the seconds in the Retry-After header of a shed request's 503 Service Unavailable, default 1. Set before startServer */
+@property(nonatomic, assign) NSUInteger overloadRetryAfter;
+
+/*! @brief limits the rate of requests from each client address, over it they're answered with a prepared 429 Too Many Requests
+    before their handlers run or their bodies are read, default nil. Set before startServer */
+@property(nonatomic, retain) IHTTPRateLimiter* rateLimiter;
+
+/*! @brief the number of requests shed because maxInFlightRequests were being handled, or the queue stood over the maxQueueDelay */
+@property(nonatomic, readonly) NSUInteger shedRequestCount;
+
+/*! @brief the number of requests refused by the rateLimiter */
+@property(nonatomic, readonly) NSUInteger rateLimitedRequestCount;
+
+/*! @brief the number of requests being handled, whose headers have been read and whose responses haven't completed */
+@property(nonatomic, readonly) NSUInteger inFlightRequestCount;
+
+/*! @brief the current logging level of the server
+    @discussion at IHTTPServerLoggingRequests and above the server writes an access log to the standard error, unless it has an accessLog,
+    the requests and responses themselves are only described at IHTTPServerLoggingDebug */
 @property(nonatomic, assign) IHTTPServerLoggingLevel loggingLevel;
 
+/*! @brief the access log the server writes a line to for every response, default nil. Set before startServer */
+@property(nonatomic, retain) IHTTPAccessLog* accessLog;
+
 /*! @brief the last error encountered while processing incoming requests */
 @property(nonatomic, retain) NSError* serverError;
 
@@ -67,7 +193,9 @@ extern NSString* const IHTTPServerStateChangedNotification;
 /*! @brief the rootURL of the server */
 @property(nonatomic, readonly) NSURL* rootURL;
 
-/*! @brief the delegate of the server */
+/*! @brief the delegate of the server
+    @discussion didReceive: and didComplete: are called on the thread of the worker which owns the connection,
+    the others on the thread which started, stopped or changed the server */
 @property(nonatomic, assign) id<IHTTPServerDelegate> delegate;
 
 // MARK: -
@@ -82,15 +210,29 @@ extern NSString* const IHTTPServerStateChangedNotification;
 
 /*! @brief register a new handler prototype
     @discussion this method will place the handler on the top of the stack,
-    giving it the first opportunity to respond to @selector(canHandleRequest:) */
+    giving it the first opportunity to respond to @selector(canHandleRequest:). It may be called from any thread while the server is running,
+    the prototypes are replaced with a new array so requests already being matched finish with the old one */
 - (void) registerHandler:(IHTTPHandler*) prototype;
 
+/*! @brief register a handler prototype for requests with the method whose path matches the pattern
+    @param method the request method, e.g. IHTTPGetMethod, or nil for any method
+    @param pathPattern literal path segments, :name segments which match any one segment,
+    and an optional final *name segment which matches the rest of the path, e.g. /users/:id/files/&#42;path
+    @discussion routes are compiled into a radix tree which finds the handler in time proportional to the length of the path,
+    and are tried before the prototypes registered with registerHandler:. The parameters are available to the handler
+    as the request's pathParameters. Routes may be registered from any thread while the server is running, the route is added to a copy
+    of the tree which then replaces it, raises NSInvalidArgumentException for a malformed pattern and leaves the routes unchanged */
+- (void) registerHandler:(IHTTPHandler*) prototype method:(NSString*) method path:(NSString*) pathPattern;
+
 /*! @brief clear all registered handler prototypes
-    @discussion clears the list of prototypes and registers a default hander which
+    @discussion clears the routes and the list of prototypes and registers a default hander which
     responds to all request with an IHTTPStatus501NotImplemented error */
 - (void) resetPrototypes;
 
-/*! @brief start listening for connections on the designated port */
+/*! @brief start listening for connections on the designated port
+    @discussion connections are serviced by workerCount event loops (epoll on Linux, kqueue on BSD and macOS) each running on its own thread,
+    handlers are called on the thread of the worker which accepted the connection, or on the handler queue when there is a handlerConcurrency,
+    and the delegate methods of the server are called on the worker's thread */
 - (void) startServer;
 
 /*! @brief stops accepting new connections, waits for any running handlers to complete, and closes the socket */
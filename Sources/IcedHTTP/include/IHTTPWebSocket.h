@@ -0,0 +1,125 @@
+#import <Foundation/Foundation.h>
+
+@class IHTTPRequest;
+@class IHTTPWebSocket;
+
+/*! @header IHTTPWebSocket.h
+    @abstract IHTTPWebSocket carries RFC 6455 WebSocket messages on a connection upgraded by a handler made with handlerWithWebSocketBlock: */
+
+/*! @enum IHTTPWebSocketCloseCode
+    @brief status codes sent and received in close frames, RFC 6455 section 7.4.1 */
+typedef NS_ENUM(NSUInteger, IHTTPWebSocketCloseCode) {
+    IHTTPWebSocketCloseNormal           = 1000,
+    IHTTPWebSocketCloseGoingAway        = 1001,
+    IHTTPWebSocketCloseProtocolError    = 1002,
+    IHTTPWebSocketCloseUnsupportedData  = 1003,
+    IHTTPWebSocketCloseNoStatus         = 1005, /* received without a code, never sent */
+    IHTTPWebSocketCloseAbnormal         = 1006, /* the connection closed without a close frame, never sent */
+    IHTTPWebSocketCloseInvalidData      = 1007,
+    IHTTPWebSocketClosePolicyViolation  = 1008,
+    IHTTPWebSocketCloseMessageTooBig    = 1009,
+    IHTTPWebSocketCloseInternalError    = 1011
+};
+
+/*! @typedef IHTTPWebSocketMessageBlock
+    @param webSocket the IHTTPWebSocket* the message arrived on
+    @param message the payload of the message, with its fragments joined and unmasked
+    @param isText YES for a text message, which has been checked to be UTF-8 */
+typedef void (^ IHTTPWebSocketMessageBlock)(IHTTPWebSocket* webSocket, NSData* message, BOOL isText);
+
+/*! @typedef IHTTPWebSocketCloseBlock
+    @param webSocket the IHTTPWebSocket* which closed
+    @param code the IHTTPWebSocketCloseCode the client sent, or the server sent if it closed first
+    @param reason the reason sent with the code, or nil */
+typedef void (^ IHTTPWebSocketCloseBlock)(IHTTPWebSocket* webSocket, NSUInteger code, NSString* reason);
+
+// MARK: -
+
+/*! @class IHTTPWebSocket
+    @brief one end of a WebSocket connection
+    @discussion frames are read and parsed on the event loop of the worker which accepted the connection, and the blocks are
+    called there, so they must not block. Messages may be sent from any thread: each frame is written straight to the socket
+    when it has room, otherwise it's queued and sent by the worker as the client reads it, under the server's writeTimeout,
+    and a client which falls more than a megabyte behind is closed, leaving its groups.
+    The server pings a connection which has been quiet for the server's webSocketPingInterval and closes it if there's no answer
+    within another interval */
+@interface IHTTPWebSocket : NSObject
+
+/*! @brief the request which opened the WebSocket, with its path and headers */
+@property(nonatomic, readonly) IHTTPRequest* request;
+
+/*! @brief the subprotocol to accept from the client's Sec-WebSocket-Protocol header, set in the handler's block, default nil */
+@property(nonatomic, copy) NSString* protocol;
+
+/*! @brief called with each message the client sends */
+@property(nonatomic, copy) IHTTPWebSocketMessageBlock messageBlock;
+
+/*! @brief called once when the WebSocket closes, after the close handshake or when the connection is lost */
+@property(nonatomic, copy) IHTTPWebSocketCloseBlock closeBlock;
+
+/*! @brief the longest message accepted from the client, longer ones close the WebSocket with IHTTPWebSocketCloseMessageTooBig, default 1 MB */
+@property(nonatomic, assign) NSUInteger maxMessageLength;
+
+/*! @brief YES once the WebSocket has started closing, no more messages are sent or delivered */
+@property(nonatomic, readonly) BOOL isClosed;
+
+// MARK: - Frames
+
+/*! @brief a text message encoded as a frame once, to send on any number of WebSockets with sendFrame: */
++ (NSData*) frameWithText:(NSString*) text;
+
+/*! @brief a binary message encoded as a frame once, to send on any number of WebSockets with sendFrame: */
++ (NSData*) frameWithData:(NSData*) data;
+
+// MARK: -
+
+/*! @brief send a text message, returns NO if the WebSocket is closed */
+- (BOOL) sendText:(NSString*) text;
+
+/*! @brief send a binary message, returns NO if the WebSocket is closed */
+- (BOOL) sendData:(NSData*) data;
+
+/*! @brief send a frame made by frameWithText: or frameWithData:, without copying it, returns NO if the WebSocket is closed */
+- (BOOL) sendFrame:(NSData*) frame;
+
+/*! @brief start the close handshake with the code and reason, the connection closes when the client answers or after the ping interval,
+    closing it in the handler's block refuses the upgrade with 403 Forbidden instead */
+- (void) closeWithCode:(NSUInteger) code reason:(NSString*) reason;
+
+@end
+
+// MARK: -
+
+/*! @class IHTTPWebSocketGroup
+    @brief a set of WebSockets to broadcast messages to, such as the subscribers to a channel
+    @discussion each message is encoded as a frame once and the same bytes are written to every WebSocket in the group,
+    WebSockets leave the group when they close. Safe to use from any thread */
+@interface IHTTPWebSocketGroup : NSObject
+
+/*! @brief the number of WebSockets in the group */
+@property(nonatomic, readonly) NSUInteger count;
+
+/*! @brief the WebSockets in the group */
+@property(nonatomic, readonly) NSArray<IHTTPWebSocket*>* webSockets;
+
+// MARK: -
+
+/*! @brief add the WebSocket to the group, unless it's closed */
+- (void) addWebSocket:(IHTTPWebSocket*) webSocket;
+
+/*! @brief remove the WebSocket from the group */
+- (void) removeWebSocket:(IHTTPWebSocket*) webSocket;
+
+// MARK: -
+
+/*! @brief send the text message to every WebSocket in the group, returns the number it was sent to */
+- (NSUInteger) broadcastText:(NSString*) text;
+
+/*! @brief send the binary message to every WebSocket in the group, returns the number it was sent to */
+- (NSUInteger) broadcastData:(NSData*) data;
+
+/*! @brief send a frame made by IHTTPWebSocket's frameWithText: or frameWithData: to every WebSocket in the group,
+    returns the number it was sent to */
+- (NSUInteger) broadcastFrame:(NSData*) frame;
+
+@end
@@ -1,5 +1,10 @@
+#import <IcedHTTP/IHTTPAccessLog.h>
 #import <IcedHTTP/IHTTPConstants.h>
+#import <IcedHTTP/IHTTPFileCache.h>
 #import <IcedHTTP/IHTTPHandler.h>
+#import <IcedHTTP/IHTTPRateLimiter.h>
 #import <IcedHTTP/IHTTPRequest.h>
 #import <IcedHTTP/IHTTPResponse.h>
+#import <IcedHTTP/IHTTPResponseCache.h>
 #import <IcedHTTP/IHTTPServer.h>
+#import <IcedHTTP/IHTTPWebSocket.h>
@@ -0,0 +1,638 @@
+#import <Foundation/Foundation.h>
+#import <IcedHTTP/IcedHTTP.h>
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#if __APPLE__
+#include <malloc/malloc.h>
+#include <mach/mach.h>
+#endif
+
+/*! @header ihttpbench.m
+    @abstract runs an IHTTPServer in the process and measures it over loopback with a closed or open loop load generator,
+    writing a JSON line of results for each scenario so runs can be compared between releases
+
+    usage: ihttpbench [-d seconds] [-W warmup seconds] [-c connections] [-r open loop requests/sec] [-w workers]
+                      [-i idle connections] [-p port] [-s scenario name filter] [-o output path] */
+
+/*! @brief the most bytes of a response head the client reads */
+#define IHTTPBenchHeadSize (16 * 1024)
+
+/*! @brief a send to a connection the server has closed fails instead of raising SIGPIPE, Darwin uses SO_NOSIGPIPE */
+#ifdef MSG_NOSIGNAL
+#define IHTTPBenchSendFlags MSG_NOSIGNAL
+#else
+#define IHTTPBenchSendFlags 0
+#endif
+
+/*! @brief the size of the buffer the client reads bodies into and sends upload bodies from */
+#define IHTTPBenchBufferSize (64 * 1024)
+
+// MARK: - Allocation Counting
+
+/*! @brief allocations made by every thread in the process, the load generator doesn't allocate while it measures,
+    so the count over a scenario is the server's, give or take the growth of the clients' latency arrays */
+static atomic_ullong IHTTPBenchAllocations;
+
+#if defined(__GLIBC__)
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* pointer, size_t size);
+
+// interposed on glibc's allocator, which every other allocation in the process goes through
+void* malloc(size_t size) {
+    atomic_fetch_add_explicit(&IHTTPBenchAllocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&IHTTPBenchAllocations, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    atomic_fetch_add_explicit(&IHTTPBenchAllocations, 1, memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+
+static BOOL IHTTPBenchCountAllocations(void) {
+    return YES;
+}
+#elif __APPLE__
+static void* (*IHTTPBenchZoneMalloc)(malloc_zone_t* zone, size_t size);
+static void* (*IHTTPBenchZoneCalloc)(malloc_zone_t* zone, size_t count, size_t size);
+static void* (*IHTTPBenchZoneRealloc)(malloc_zone_t* zone, void* pointer, size_t size);
+
+static void* IHTTPBenchCountingMalloc(malloc_zone_t* zone, size_t size) {
+    atomic_fetch_add_explicit(&IHTTPBenchAllocations, 1, memory_order_relaxed);
+    return IHTTPBenchZoneMalloc(zone, size);
+}
+
+static void* IHTTPBenchCountingCalloc(malloc_zone_t* zone, size_t count, size_t size) {
+    atomic_fetch_add_explicit(&IHTTPBenchAllocations, 1, memory_order_relaxed);
+    return IHTTPBenchZoneCalloc(zone, count, size);
+}
+
+static void* IHTTPBenchCountingRealloc(malloc_zone_t* zone, void* pointer, size_t size) {
+    atomic_fetch_add_explicit(&IHTTPBenchAllocations, 1, memory_order_relaxed);
+    return IHTTPBenchZoneRealloc(zone, pointer, size);
+}
+
+/*! @brief wrap the default malloc zone's functions, which malloc and the Objective-C runtime allocate from */
+static BOOL IHTTPBenchCountAllocations(void) {
+    malloc_zone_t* zone = malloc_default_zone();
+    if (vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, (VM_PROT_READ | VM_PROT_WRITE)) != KERN_SUCCESS) {
+        return NO;
+    }
+    IHTTPBenchZoneMalloc = zone->malloc;
+    IHTTPBenchZoneCalloc = zone->calloc;
+    IHTTPBenchZoneRealloc = zone->realloc;
+    zone->malloc = IHTTPBenchCountingMalloc;
+    zone->calloc = IHTTPBenchCountingCalloc;
+    zone->realloc = IHTTPBenchCountingRealloc;
+    vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, VM_PROT_READ);
+    return YES;
+}
+#else
+static BOOL IHTTPBenchCountAllocations(void) {
+    return NO;
+}
+#endif
+
+// MARK: - Scenarios
+
+/*! @brief a request the load generator repeats for the length of the run */
+typedef struct {
+    const char* name;
+    const char* method;
+    const char* path;
+    size_t bodyLength;              /* bytes of request body sent with each request */
+    BOOL keepAlive;                 /* NO sends Connection: close and opens a new connection for each request */
+    BOOL openLoop;                  /* send at the fixed -r rate, timing each request from when it should have been sent */
+    NSUInteger maxConnections;      /* fewer connections than -c, or 0 */
+    BOOL idleConnections;           /* hold -i idle kept-alive connections open during the run */
+} IHTTPBenchScenario;
+
+static const IHTTPBenchScenario IHTTPBenchScenarios[] = {
+    { "hello_keepalive", "GET", "/hello", 0, YES, NO, 0, NO },
+    { "head_keepalive", "HEAD", "/hello", 0, YES, NO, 0, NO }, // a body sent after the headers garbles the next response
+    { "hello_close", "GET", "/hello", 0, NO, NO, 0, NO },
+    { "hello_open_loop", "GET", "/hello", 0, YES, YES, 0, NO },
+    { "static_keepalive", "GET", "/static", 0, YES, NO, 0, NO },
+    { "file_1k", "GET", "/files/1k", 0, YES, NO, 0, NO },
+    { "file_64k", "GET", "/files/64k", 0, YES, NO, 0, NO },
+    { "file_1m", "GET", "/files/1m", 0, YES, NO, 0, NO },
+    { "upload_8m", "POST", "/upload", (8 * 1024 * 1024), YES, NO, 8, NO },
+    { "hello_idle_connections", "GET", "/hello", 0, YES, NO, 0, YES },
+};
+
+// MARK: - Load Generator
+
+/*! @brief the state of one client thread, which drives one connection at a time */
+typedef struct {
+    const IHTTPBenchScenario* scenario;
+    struct sockaddr_in address;
+    const char* head;
+    size_t headLength;
+    uint64_t measureStart;          /* requests sent before this are warming up and aren't counted */
+    uint64_t end;
+    uint64_t interval;              /* nanoseconds between requests in an open loop, 0 in a closed loop */
+    uint64_t* latencies;            /* nanoseconds, for the requests counted */
+    size_t latencyCount;
+    size_t latencyCapacity;
+    unsigned long long requests;
+    unsigned long long errors;
+    unsigned long long bytesReceived;
+    unsigned long long bytesSent;
+    char* buffer;
+} IHTTPBenchClient;
+
+static uint64_t IHTTPBenchNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ull) + (uint64_t)now.tv_nsec;
+}
+
+static void IHTTPBenchSleepUntil(uint64_t time) {
+    uint64_t now = IHTTPBenchNow();
+    if (time > now) {
+        struct timespec delay = { (time_t)((time - now) / 1000000000ull), (long)((time - now) % 1000000000ull) };
+        nanosleep(&delay, NULL);
+    }
+}
+
+static int IHTTPBenchConnect(const struct sockaddr_in* address) {
+    int client = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (client < 0) {
+        return -1;
+    }
+    int noDelay = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (void *)&noDelay, sizeof(int));
+#ifdef SO_NOSIGPIPE
+    setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, (void *)&noDelay, sizeof(int));
+#endif
+    if (connect(client, (const struct sockaddr*)address, sizeof(*address)) != 0) {
+        close(client);
+        return -1;
+    }
+    return client;
+}
+
+static BOOL IHTTPBenchSendAll(int client, const void* bytes, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t count = send(client, ((const uint8_t*)bytes + sent), (length - sent), IHTTPBenchSendFlags);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return NO;
+        }
+        sent += (size_t)count;
+    }
+    return YES;
+}
+
+/*! @brief the value of the header field in the NUL terminated head, matched without regard to case, or NULL */
+static const char* IHTTPBenchHeaderValue(const char* head, const char* field) {
+    size_t fieldLength = strlen(field);
+    for (const char* line = strstr(head, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, field, fieldLength) == 0 && line[fieldLength] == ':') {
+            const char* value = (line + fieldLength + 1);
+            while (*value == ' ') {
+                value++;
+            }
+            return value;
+        }
+    }
+    return NULL;
+}
+
+/*! @brief send the request and read the whole response, returns the bytes received or -1 on failure,
+    sets closed if the server will close the connection */
+static long long IHTTPBenchExchange(IHTTPBenchClient* client, int connection, BOOL* closed) {
+    if (!IHTTPBenchSendAll(connection, client->head, client->headLength)) {
+        return -1;
+    }
+    for (size_t sent = 0; sent < client->scenario->bodyLength; ) { // the buffer's contents stand in for the upload
+        size_t slice = MIN((client->scenario->bodyLength - sent), IHTTPBenchBufferSize);
+        if (!IHTTPBenchSendAll(connection, client->buffer, slice)) {
+            return -1;
+        }
+        sent += slice;
+    }
+
+    char head[IHTTPBenchHeadSize + 1];
+    size_t headLength = 0;
+    char* headEnd = NULL;
+    while (!headEnd) {
+        if (headLength == IHTTPBenchHeadSize) {
+            return -1;
+        }
+        ssize_t count = recv(connection, (head + headLength), (IHTTPBenchHeadSize - headLength), 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        headLength += (size_t)count;
+        head[headLength] = '\0';
+        headEnd = strstr(head, "\r\n\r\n");
+    }
+
+    int status = 0;
+    if (sscanf(head, "HTTP/1.%*d %d", &status) != 1 || status < 200 || status >= 300) {
+        return -1;
+    }
+    *headEnd = '\0'; // end the header search at the end of the head
+    const char* contentLength = IHTTPBenchHeaderValue(head, "Content-Length");
+    const char* connectionValue = IHTTPBenchHeaderValue(head, "Connection");
+    *closed = (connectionValue && strncasecmp(connectionValue, "close", 5) == 0);
+    if (!contentLength) { // the benchmark's handlers all send a Content-Length
+        return -1;
+    }
+
+    size_t headBytes = (size_t)((headEnd + 4) - head);
+    unsigned long long contentBytes = (strcmp(client->scenario->method, "HEAD") == 0 ? 0 : strtoull(contentLength, NULL, 10));
+    unsigned long long remaining = contentBytes;
+    size_t early = (headLength - headBytes); // body which arrived with the head
+    if (early > remaining) {
+        return -1;
+    }
+    remaining -= early;
+    while (remaining > 0) {
+        ssize_t count = recv(connection, client->buffer, (size_t)MIN(remaining, IHTTPBenchBufferSize), 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        remaining -= (unsigned long long)count;
+    }
+
+    return (long long)(headLength + (contentBytes - early));
+}
+
+static void IHTTPBenchRecordLatency(IHTTPBenchClient* client, uint64_t latency) {
+    if (client->latencyCount == client->latencyCapacity) {
+        client->latencyCapacity = MAX((client->latencyCapacity * 2), 4096);
+        client->latencies = realloc(client->latencies, (client->latencyCapacity * sizeof(uint64_t)));
+    }
+    client->latencies[client->latencyCount++] = latency;
+}
+
+static void* IHTTPBenchRunClient(void* argument) {
+    IHTTPBenchClient* client = argument;
+    int connection = -1;
+    uint64_t next = IHTTPBenchNow();
+
+    while (YES) {
+        uint64_t sent = IHTTPBenchNow();
+        if (client->interval > 0) { // timed from when the request was due, so a stalled server can't hide its backlog
+            if (next >= client->end) {
+                break;
+            }
+            IHTTPBenchSleepUntil(next);
+            sent = next;
+            next += client->interval;
+        }
+        if (sent >= client->end) {
+            break;
+        }
+
+        if (connection < 0) {
+            connection = IHTTPBenchConnect(&client->address);
+            if (connection < 0) {
+                client->errors += (sent >= client->measureStart);
+                usleep(1000); // out of ports or descriptors, let some close
+                continue;
+            }
+        }
+
+        BOOL closed = NO;
+        long long received = IHTTPBenchExchange(client, connection, &closed);
+        uint64_t done = IHTTPBenchNow();
+        if (sent >= client->measureStart) {
+            if (received < 0) {
+                client->errors += 1;
+            }
+            else {
+                client->requests += 1;
+                client->bytesReceived += (unsigned long long)received;
+                client->bytesSent += (client->headLength + client->scenario->bodyLength);
+                IHTTPBenchRecordLatency(client, (done - sent));
+            }
+        }
+
+        if (received < 0 || closed || !client->scenario->keepAlive) {
+            close(connection);
+            connection = -1;
+        }
+    }
+
+    if (connection >= 0) {
+        close(connection);
+    }
+    return NULL;
+}
+
+/*! @brief open connections which each make one request and then sit idle in their workers' tables, returns the number opened */
+static NSUInteger IHTTPBenchOpenIdleConnections(const struct sockaddr_in* address, NSUInteger count, int* connections) {
+    static const char request[] = "GET /hello HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    char* buffer = malloc(IHTTPBenchBufferSize);
+    IHTTPBenchScenario scenario = { "idle", "GET", "/hello", 0, YES, NO, 0, NO };
+    IHTTPBenchClient client = { .scenario = &scenario, .head = request, .headLength = (sizeof(request) - 1), .buffer = buffer };
+    NSUInteger opened = 0;
+    for (; opened < count; opened++) {
+        BOOL closed = NO;
+        connections[opened] = IHTTPBenchConnect(address);
+        if (connections[opened] < 0 || IHTTPBenchExchange(&client, connections[opened], &closed) < 0 || closed) {
+            if (connections[opened] >= 0) {
+                close(connections[opened]);
+            }
+            break;
+        }
+    }
+    free(buffer);
+    return opened;
+}
+
+static int IHTTPBenchCompareLatencies(const void* first, const void* second) {
+    uint64_t a = *(const uint64_t*)first;
+    uint64_t b = *(const uint64_t*)second;
+    return (a < b ? -1 : (a > b ? 1 : 0));
+}
+
+/*! @brief the latency in microseconds below which the fraction of the sorted latencies fall */
+static double IHTTPBenchPercentile(const uint64_t* sorted, size_t count, double fraction) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t index = (size_t)ceil(fraction * (double)count);
+    return (sorted[(index > 0 ? (index - 1) : 0)] / 1000.0);
+}
+
+// MARK: -
+
+/*! @brief run the scenario and write its results as a line of JSON */
+static void IHTTPBenchRunScenario(const IHTTPBenchScenario* scenario, NSUInteger port, double duration, double warmup,
+    NSUInteger connectionCount, double rate, NSUInteger idleCount, BOOL countsAllocations, FILE* output) {
+    NSUInteger threadCount = (scenario->maxConnections > 0 ? MIN(connectionCount, scenario->maxConnections) : connectionCount);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int* idleConnections = NULL;
+    NSUInteger idleOpened = 0;
+    if (scenario->idleConnections && idleCount > 0) {
+        idleConnections = calloc(idleCount, sizeof(int));
+        idleOpened = IHTTPBenchOpenIdleConnections(&address, idleCount, idleConnections);
+    }
+
+    char head[512];
+    size_t headLength = 0;
+    if (scenario->bodyLength > 0) {
+        headLength = (size_t)snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: %zu\r\n%s\r\n",
+            scenario->method, scenario->path, scenario->bodyLength, (scenario->keepAlive ? "" : "Connection: close\r\n"));
+    }
+    else {
+        headLength = (size_t)snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: 127.0.0.1\r\n%s\r\n",
+            scenario->method, scenario->path, (scenario->keepAlive ? "" : "Connection: close\r\n"));
+    }
+
+    uint64_t start = IHTTPBenchNow();
+    uint64_t measureStart = (start + (uint64_t)(warmup * 1e9));
+    uint64_t end = (measureStart + (uint64_t)(duration * 1e9));
+    IHTTPBenchClient* clients = calloc(threadCount, sizeof(IHTTPBenchClient));
+    pthread_t* threads = calloc(threadCount, sizeof(pthread_t));
+    for (NSUInteger index = 0; index < threadCount; index++) {
+        IHTTPBenchClient* client = &clients[index];
+        client->scenario = scenario;
+        client->address = address;
+        client->head = head;
+        client->headLength = headLength;
+        client->measureStart = measureStart;
+        client->end = end;
+        client->interval = (scenario->openLoop && rate > 0 ? (uint64_t)((threadCount * 1e9) / rate) : 0);
+        client->buffer = calloc(1, IHTTPBenchBufferSize);
+        client->latencyCapacity = 65536; // grown by doubling, so it's rarely reallocated while measuring
+        client->latencies = malloc(client->latencyCapacity * sizeof(uint64_t));
+        pthread_create(&threads[index], NULL, IHTTPBenchRunClient, client);
+    }
+
+    IHTTPBenchSleepUntil(measureStart);
+    unsigned long long allocationsBefore = atomic_load(&IHTTPBenchAllocations);
+    IHTTPBenchSleepUntil(end);
+    unsigned long long allocationsAfter = atomic_load(&IHTTPBenchAllocations);
+
+    unsigned long long requests = 0, errors = 0, bytesReceived = 0, bytesSent = 0;
+    size_t latencyCount = 0;
+    for (NSUInteger index = 0; index < threadCount; index++) {
+        pthread_join(threads[index], NULL);
+        requests += clients[index].requests;
+        errors += clients[index].errors;
+        bytesReceived += clients[index].bytesReceived;
+        bytesSent += clients[index].bytesSent;
+        latencyCount += clients[index].latencyCount;
+    }
+
+    uint64_t* latencies = malloc(MAX(latencyCount, 1) * sizeof(uint64_t));
+    size_t merged = 0;
+    for (NSUInteger index = 0; index < threadCount; index++) {
+        memcpy((latencies + merged), clients[index].latencies, (clients[index].latencyCount * sizeof(uint64_t)));
+        merged += clients[index].latencyCount;
+        free(clients[index].latencies);
+        free(clients[index].buffer);
+    }
+    qsort(latencies, latencyCount, sizeof(uint64_t), IHTTPBenchCompareLatencies);
+
+    for (NSUInteger index = 0; index < idleOpened; index++) {
+        close(idleConnections[index]);
+    }
+
+    double allocationsPerRequest = ((countsAllocations && requests > 0) ? ((double)(allocationsAfter - allocationsBefore) / requests) : -1);
+    fprintf(output, "{\"scenario\":\"%s\",\"loop\":\"%s\",\"keep_alive\":%s,\"connections\":%lu,\"idle_connections\":%lu,"
+        "\"duration\":%.3f,\"requests\":%llu,\"errors\":%llu,\"requests_per_second\":%.1f,"
+        "\"received_bytes_per_second\":%.0f,\"sent_bytes_per_second\":%.0f,"
+        "\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},\"allocations_per_request\":%.2f}\n",
+        scenario->name, ((scenario->openLoop && rate > 0) ? "open" : "closed"), (scenario->keepAlive ? "true" : "false"),
+        (unsigned long)threadCount, (unsigned long)idleOpened, duration, requests, errors, (requests / duration),
+        (bytesReceived / duration), (bytesSent / duration),
+        IHTTPBenchPercentile(latencies, latencyCount, 0.5), IHTTPBenchPercentile(latencies, latencyCount, 0.99),
+        IHTTPBenchPercentile(latencies, latencyCount, 0.999), (latencyCount > 0 ? (latencies[latencyCount - 1] / 1000.0) : 0),
+        allocationsPerRequest);
+    fflush(output);
+
+    fprintf(stderr, "%-24s %12.0f req/s  p50 %9.1f us  p99 %9.1f us  p999 %9.1f us  %6.1f allocs/req  %llu errors\n",
+        scenario->name, (requests / duration), IHTTPBenchPercentile(latencies, latencyCount, 0.5),
+        IHTTPBenchPercentile(latencies, latencyCount, 0.99), IHTTPBenchPercentile(latencies, latencyCount, 0.999),
+        allocationsPerRequest, errors);
+
+    free(latencies);
+    free(idleConnections);
+    free(clients);
+    free(threads);
+}
+
+/*! @brief the value following the option in the arguments, or the default */
+static double IHTTPBenchOption(NSString* option, double defaultValue) {
+    NSArray<NSString*>* arguments = NSProcessInfo.processInfo.arguments;
+    NSUInteger optionIndex = [arguments indexOfObject:option];
+    if (optionIndex != NSNotFound) {
+        if (arguments.count > (optionIndex + 1)) {
+            return arguments[(optionIndex + 1)].doubleValue;
+        }
+        else NSLog(@"WARNING no value provided for %@ in arguments: %@\nusing default: %g", option, arguments, defaultValue);
+    }
+    return defaultValue;
+}
+
+/*! @brief the string following the option in the arguments, or nil */
+static NSString* IHTTPBenchStringOption(NSString* option) {
+    NSArray<NSString*>* arguments = NSProcessInfo.processInfo.arguments;
+    NSUInteger optionIndex = [arguments indexOfObject:option];
+    return ((optionIndex != NSNotFound && arguments.count > (optionIndex + 1)) ? arguments[(optionIndex + 1)] : nil);
+}
+
+/*! @brief write a file of the size filled with text into the directory, returns its path */
+static NSString* IHTTPBenchWriteFile(NSString* directory, NSString* name, NSUInteger size) {
+    NSMutableData* contents = [NSMutableData dataWithLength:size];
+    uint8_t* bytes = contents.mutableBytes;
+    for (NSUInteger index = 0; index < size; index++) {
+        bytes[index] = (uint8_t)('a' + (index % 26));
+    }
+    NSString* path = [directory stringByAppendingPathComponent:name];
+    [contents writeToFile:path atomically:NO];
+    return path;
+}
+
+/*!
+    @fuction main
+    @abstract start an IHTTPServer on the loopback interface and run the benchmark scenarios against it
+*/
+int main(int argc, char** argv) {
+    int status = 0;
+    @autoreleasepool {
+        BOOL countsAllocations = IHTTPBenchCountAllocations();
+        double duration = MAX(IHTTPBenchOption(@"-d", 5), 0.1);
+        double warmup = MAX(IHTTPBenchOption(@"-W", 1), 0);
+        NSUInteger connectionCount = (NSUInteger)MAX(IHTTPBenchOption(@"-c", 64), 1);
+        double rate = IHTTPBenchOption(@"-r", 10000);
+        NSUInteger idleCount = (NSUInteger)MAX(IHTTPBenchOption(@"-i", 1000), 0);
+        NSUInteger port = (NSUInteger)IHTTPBenchOption(@"-p", 18080);
+        NSString* scenarioFilter = IHTTPBenchStringOption(@"-s");
+        NSString* outputPath = IHTTPBenchStringOption(@"-o");
+
+        struct rlimit descriptors; // room for the idle connections at both ends
+        if (getrlimit(RLIMIT_NOFILE, &descriptors) == 0 && descriptors.rlim_cur < descriptors.rlim_max) {
+#ifdef OPEN_MAX
+            descriptors.rlim_cur = MIN(descriptors.rlim_max, (rlim_t)OPEN_MAX); // Darwin refuses more
+#else
+            descriptors.rlim_cur = descriptors.rlim_max;
+#endif
+            setrlimit(RLIMIT_NOFILE, &descriptors);
+        }
+
+        NSString* directory = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"ihttpbench-%d", getpid()]];
+        [NSFileManager.defaultManager createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+        IHTTPFileCache* fileCache = [IHTTPFileCache cacheWithCapacity:(16 * 1024 * 1024)]; // 1m is over the largest entry, and sent from disk
+
+        IHTTPServer* server = [IHTTPServer serverOnPort:port];
+        server.bindAddress = @"127.0.0.1";
+        server.workerCount = (NSUInteger)IHTTPBenchOption(@"-w", NSProcessInfo.processInfo.activeProcessorCount);
+        server.keepAliveTimeout = (warmup + duration + 30); // the idle connections stay open for the whole run
+        server.keepAliveMaxRequests = 0;
+        server.maxRequestBodyLength = 0;
+        server.loggingLevel = IHTTPServerLoggingErrors;
+
+        NSData* helloBody = [@"Hello IcedHttp" dataUsingEncoding:NSUTF8StringEncoding];
+        IHTTPHandler* hello = [IHTTPHandler handlerWithResponseBlock:^(IHTTPRequest* request, IHTTPResponse* response) {
+            [response sendStatus:IHTTPStatus200OK];
+            [response sendHeaders:@{
+                IHTTPContentTypeHeader: @"text/plain",
+                IHTTPContentLengthHeader: [NSString stringWithFormat:@"%lu", (unsigned long)helloBody.length]
+            }];
+            [response sendBody:helloBody];
+            [response completeResponse];
+            return (NSUInteger)IHTTPStatus200OK;
+        }];
+        [server registerHandler:hello method:IHTTPGetMethod path:@"/hello"];
+        [server registerHandler:hello method:IHTTPHeadMethod path:@"/hello"];
+        [server registerHandler:[IHTTPHandler handlerWithStatus:IHTTPStatus200OK headers:@{ IHTTPContentTypeHeader: @"text/plain" } body:helloBody]
+            method:IHTTPGetMethod path:@"/static"];
+
+        for (NSArray* file in @[@[@"1k", @(1024)], @[@"64k", @(64 * 1024)], @[@"1m", @(1024 * 1024)]]) {
+            NSString* path = IHTTPBenchWriteFile(directory, file[0], [file[1] unsignedIntegerValue]);
+            [server registerHandler:[IHTTPHandler handlerWithFilePath:path cache:fileCache] method:IHTTPGetMethod
+                path:[@"/files/" stringByAppendingString:file[0]]];
+        }
+
+        [server registerHandler:[IHTTPHandler handlerWithAsyncResponseBlock:^(IHTTPRequest* request, IHTTPResponse* response) {
+            __block unsigned long long received = 0;
+            [request readBodyChunks:^(NSData* chunk, NSError* error) {
+                if (chunk) {
+                    received += chunk.length;
+                    return;
+                }
+                NSData* body = [[NSString stringWithFormat:@"received %llu", received] dataUsingEncoding:NSUTF8StringEncoding];
+                NSUInteger uploadStatus = (error ? IHTTPStatus400BadRequest : IHTTPStatus200OK);
+                [response sendStatus:uploadStatus];
+                [response sendHeaders:@{
+                    IHTTPContentTypeHeader: @"text/plain",
+                    IHTTPContentLengthHeader: [NSString stringWithFormat:@"%lu", (unsigned long)body.length]
+                }];
+                [response sendBody:body];
+                [response completeResponse];
+            }];
+        }] method:IHTTPPostMethod path:@"/upload"];
+
+        [server startServer];
+        if (server.serverError) {
+            NSLog(@"ihttpbench unable to start server: %@", server.serverError);
+            return 1;
+        }
+
+        FILE* output = stdout;
+        if (outputPath) {
+            output = fopen(outputPath.fileSystemRepresentation, "a");
+            if (!output) {
+                NSLog(@"ihttpbench unable to open output (-o) at path: %@", outputPath);
+                return 1;
+            }
+        }
+
+        for (size_t index = 0; index < (sizeof(IHTTPBenchScenarios) / sizeof(IHTTPBenchScenarios[0])); index++) {
+            const IHTTPBenchScenario* scenario = &IHTTPBenchScenarios[index];
+            if (!scenarioFilter || strstr(scenario->name, scenarioFilter.UTF8String)) {
+                @autoreleasepool {
+                    IHTTPBenchRunScenario(scenario, port, duration, warmup, connectionCount, rate, idleCount, countsAllocations, output);
+                }
+            }
+        }
+
+        if (output != stdout) {
+            fclose(output);
+        }
+        [server stopServer];
+        [NSFileManager.defaultManager removeItemAtPath:directory error:nil];
+    }
+    return status;
+}
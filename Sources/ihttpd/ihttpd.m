@@ -23,6 +23,31 @@ int main(int argc, char** argv) {
         }
         
         IHTTPServer* server = [IHTTPServer serverOnPort:serverPort];
+        server.workerCount = NSProcessInfo.processInfo.activeProcessorCount;
+
+        NSUInteger workersIndex = [NSProcessInfo.processInfo.arguments indexOfObject:@"-w"];
+        if (workersIndex != NSNotFound) {
+            if (NSProcessInfo.processInfo.arguments.count > (workersIndex + 1)) {
+                NSString* workersString = NSProcessInfo.processInfo.arguments[(workersIndex + 1)];
+                if (workersString.integerValue > 0) {
+                    server.workerCount = workersString.integerValue;
+                }
+                else NSLog(@"WARNING invalid workers (-w) argument: %@\nusing default: %lu", workersString, (unsigned long)server.workerCount);
+            }
+            else NSLog(@"WARNING no workers argument provided for -w in arguments: %@\nusing default: %lu", NSProcessInfo.processInfo.arguments, (unsigned long)server.workerCount);
+        }
+
+        NSUInteger concurrencyIndex = [NSProcessInfo.processInfo.arguments indexOfObject:@"-c"];
+        if (concurrencyIndex != NSNotFound) {
+            if (NSProcessInfo.processInfo.arguments.count > (concurrencyIndex + 1)) {
+                NSString* concurrencyString = NSProcessInfo.processInfo.arguments[(concurrencyIndex + 1)];
+                if (concurrencyString.integerValue >= 0) {
+                    server.handlerConcurrency = concurrencyString.integerValue;
+                }
+                else NSLog(@"WARNING invalid handler concurrency (-c) argument: %@\nusing default: %lu", concurrencyString, (unsigned long)server.handlerConcurrency);
+            }
+            else NSLog(@"WARNING no handler concurrency argument provided for -c in arguments: %@\nusing default: %lu", NSProcessInfo.processInfo.arguments, (unsigned long)server.handlerConcurrency);
+        }
 
         NSUInteger fileIndex = [NSProcessInfo.processInfo.arguments indexOfObject:@"-f"];
         if (fileIndex != NSNotFound) {
@@ -30,33 +55,50 @@ int main(int argc, char** argv) {
                 NSString* pathString = NSProcessInfo.processInfo.arguments[(fileIndex + 1)];
                 BOOL isDir = NO;
                 if ([NSFileManager.defaultManager fileExistsAtPath:pathString isDirectory:&isDir] && isDir) {
-                    [server registerHandler:[IHTTPHandler handlerWithFilePath:pathString]];
+                    [server registerHandler:[IHTTPHandler handlerWithFilePath:pathString cache:[IHTTPFileCache cacheWithCapacity:(64 * 1024 * 1024)]]];
                 }
                 else NSLog(@"WARNING no file at path (%@) or isDir (%i)", pathString, isDir);
             }
             else NSLog(@"WARNING no file argument provided for -f in arguments: %@\nusing default: %lu", NSProcessInfo.processInfo.arguments, (unsigned long)serverPort);
         }
 
-        if (server.handlerPrototypes.count == 1) { // register a default hello handler
-            NSLog(@"registered default handler");
-            [server registerHandler:[IHTTPHandler
-                handlerWithRequestBlock:^(IHTTPRequest* request){
-                    return YES; // handle all requests
-                }
-                responseBlock: ^(IHTTPRequest* request, IHTTPResponse* response) {
-                    NSUInteger statusCode = IHTTPStatus200OK;
-                    NSString* messageString = [NSString stringWithFormat:@"Hello IcedHttp @ %@", [NSDate date]];
-                    NSData* bodyData = [messageString dataUsingEncoding:NSUTF8StringEncoding];
-                    [response sendStatus:statusCode];
-                    [response sendHeaders:@{
-                        IHTTPContentTypeHeader: @"text/plain",
-                        IHTTPContentLengthHeader: [NSString stringWithFormat:@"%lu", (unsigned long)bodyData.length]
-                    }];
-                    [response sendBody:bodyData];
-                    [response completeResponse];
-                    return statusCode;
+        NSUInteger logIndex = [NSProcessInfo.processInfo.arguments indexOfObject:@"-l"];
+        if (logIndex != NSNotFound) {
+            if (NSProcessInfo.processInfo.arguments.count > (logIndex + 1)) {
+                NSString* logPath = NSProcessInfo.processInfo.arguments[(logIndex + 1)];
+                server.accessLog = [IHTTPAccessLog accessLogWithPath:logPath format:IHTTPAccessLogCombined];
+                if (server.accessLog) {
+                    [IHTTPAccessLog reopenLogsOnHangup]; // for logrotate
                 }
-            ]];
+                else NSLog(@"WARNING unable to open access log (-l) at path: %@", logPath);
+            }
+            else NSLog(@"WARNING no access log path provided for -l in arguments: %@", NSProcessInfo.processInfo.arguments);
+        }
+
+        if ([NSProcessInfo.processInfo.arguments containsObject:@"-2"]) { // cleartext HTTP/2, e.g. curl --http2-prior-knowledge
+            server.http2Enabled = YES;
+        }
+
+        if ([NSProcessInfo.processInfo.arguments containsObject:@"-m"]) { // Prometheus metrics for scraping
+            [server registerHandler:[IHTTPHandler handlerWithMetricsOfServer:server] method:IHTTPGetMethod path:@"/metrics"];
+        }
+
+        if ([NSProcessInfo.processInfo.arguments containsObject:@"-s"]) { // a WebSocket which sends each message to every client connected
+            IHTTPWebSocketGroup* subscribers = IHTTPWebSocketGroup.new;
+            [server registerHandler:[IHTTPHandler handlerWithWebSocketBlock:^(IHTTPRequest* request, IHTTPWebSocket* webSocket) {
+                webSocket.messageBlock = ^(IHTTPWebSocket* sender, NSData* message, BOOL isText) {
+                    [subscribers broadcastFrame:(isText ? [IHTTPWebSocket frameWithText:[NSString.alloc initWithData:message encoding:NSUTF8StringEncoding]]
+                                                        : [IHTTPWebSocket frameWithData:message])];
+                };
+                [subscribers addWebSocket:webSocket];
+            }] method:IHTTPGetMethod path:@"/live"];
+        }
+
+        if (server.handlerPrototypes.count == 1) { // register a default hello handler, serialized once and answering all requests
+            NSLog(@"registered default handler");
+            [server registerHandler:[IHTTPHandler handlerWithStatus:IHTTPStatus200OK
+                headers:@{ IHTTPContentTypeHeader: @"text/plain" }
+                body:[@"Hello IcedHttp" dataUsingEncoding:NSUTF8StringEncoding]]];
         }
         
         [server startServer];
@@ -0,0 +1,253 @@
+#include "IHTTPParser.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*! @header IHTTPParserTests.c
+    @abstract checks the request head parser and chunked body decoder against the inputs in the corpus directory,
+    then against mutations of them, run with 'make test' under the sanitizers, exits with 1 if any check fails
+
+    usage: IHTTPParserTests corpus-directory */
+
+/*! @brief the mutations tried of each corpus input */
+#define IHTTPTestMutations 512
+
+/*! @brief the most bytes of a corpus input */
+#define IHTTPTestMaxInput (64 * 1024)
+
+static int IHTTPTestFailures = 0;
+
+static void IHTTPCheck(int passed, const char* name, const char* input) {
+    if (!passed) {
+        IHTTPTestFailures++;
+        fprintf(stderr, "FAIL %s: %s\n", name, input);
+    }
+}
+
+// MARK: - Request Heads
+
+/*! @brief parse the head all at once, then a byte at a time as if each arrived in its own read, the results must agree */
+static IHTTPParseResult IHTTPTestParseHead(const uint8_t* input, size_t length, const char* name) {
+    IHTTPParsedRequest whole = {0};
+    IHTTPParseResult result = IHTTPParseRequest(&whole, input, length);
+    IHTTPCheck((result != IHTTPParseComplete || (whole.headLength <= length && whole.headerCount <= IHTTPParserMaxHeaders)),
+        "head length", name);
+
+    IHTTPParsedRequest pieces = {0};
+    IHTTPParseResult pieceResult = IHTTPParseIncomplete;
+    for (size_t end = 1; end <= length && pieceResult == IHTTPParseIncomplete; end++) {
+        pieceResult = IHTTPParseRequest(&pieces, input, end);
+    }
+    IHTTPCheck((pieceResult == result && (result != IHTTPParseComplete || pieces.headLength == whole.headLength)),
+        "head parsed in pieces differs", name);
+    return result;
+}
+
+static void IHTTPTestHeadFields(void) {
+    const char* input = "POST /upload HTTP/1.1\r\nHost: example.com\r\nContent-Length:  5 \r\nConnection: keep-alive, Upgrade\r\n\r\nhello";
+    IHTTPParsedRequest parsed = {0};
+    IHTTPParseResult result = IHTTPParseRequest(&parsed, (const uint8_t*)input, strlen(input));
+    int field = IHTTPFindHeader(&parsed, (const uint8_t*)input, "content-length", 14, 0);
+    int connection = IHTTPFindHeader(&parsed, (const uint8_t*)input, "CONNECTION", 10, 0);
+    IHTTPCheck((result == IHTTPParseComplete && parsed.headLength == (strlen(input) - 5) && parsed.headerCount == 3
+             && parsed.method.length == 4 && memcmp((input + parsed.method.offset), "POST", 4) == 0
+             && parsed.target.length == 7 && memcmp((input + parsed.target.offset), "/upload", 7) == 0 && parsed.versionMinor == 1
+             && field == 1 && parsed.headers[field].value.length == 1 && input[parsed.headers[field].value.offset] == '5'
+             && connection == 2), "head fields", "POST /upload");
+
+    const uint8_t* value = (const uint8_t*)(input + parsed.headers[connection].value.offset);
+    size_t valueLength = parsed.headers[connection].value.length;
+    IHTTPCheck((IHTTPHasToken(value, valueLength, "upgrade", 7) && IHTTPHasToken(value, valueLength, "keep-alive", 10)
+             && !IHTTPHasToken(value, valueLength, "keep", 4) && !IHTTPHasToken(value, valueLength, "close", 5)), "tokens", "Connection");
+
+    static uint8_t large[IHTTPParserMaxHeaderSize + 64];
+    size_t length = (size_t)snprintf((char*)large, sizeof(large), "GET / HTTP/1.1\r\nX-Large: ");
+    memset((large + length), 'a', (sizeof(large) - length));
+    IHTTPParsedRequest tooLarge = {0};
+    IHTTPCheck((IHTTPParseRequest(&tooLarge, large, sizeof(large)) == IHTTPParseTooLarge), "head over the size limit", "X-Large");
+}
+
+// MARK: - Chunked Bodies
+
+/*! @brief decode the body with split more bytes arriving for each call, the decoded data is copied to body if it fits,
+    consumed is set to the bytes of the input used */
+static IHTTPParseResult IHTTPTestDecodeBody(const uint8_t* input, size_t length, size_t split, uint8_t* body, size_t capacity,
+    size_t* bodyLength, size_t* used) {
+    IHTTPChunkDecoder decoder = {0};
+    size_t offset = 0;
+    size_t available = 0;
+    *bodyLength = 0;
+    for (;;) {
+        available = ((available + split) < (length - offset) ? (available + split) : (length - offset));
+        size_t consumed = 0;
+        const uint8_t* data = NULL;
+        size_t dataLength = 0;
+        IHTTPParseResult result = IHTTPDecodeChunk(&decoder, (input + offset), available, &consumed, &data, &dataLength);
+        if (consumed > available || (dataLength > 0 && (data < (input + offset) || (data + dataLength) > (input + offset + consumed)))) {
+            IHTTPCheck(0, "decoder used bytes it wasn't given", "");
+            return IHTTPParseInvalid;
+        }
+        if (dataLength > 0 && (*bodyLength + dataLength) <= capacity) {
+            memcpy((body + *bodyLength), data, dataLength);
+        }
+        *bodyLength += dataLength;
+        offset += consumed;
+        available -= consumed;
+        *used = offset;
+        if (result != IHTTPParseIncomplete) {
+            return result;
+        }
+        else if (consumed == 0 && (offset + available) >= length) { // the input ended before the body did
+            return IHTTPParseIncomplete;
+        }
+    }
+}
+
+/*! @brief decode the body all at once and a byte at a time, the results must agree */
+static IHTTPParseResult IHTTPTestDecode(const uint8_t* input, size_t length, size_t* used, const char* name) {
+    static uint8_t body[IHTTPTestMaxInput];
+    static uint8_t pieceBody[IHTTPTestMaxInput];
+    size_t bodyLength = 0;
+    size_t pieceLength = 0;
+    size_t pieceUsed = 0;
+    IHTTPParseResult result = IHTTPTestDecodeBody(input, length, length, body, sizeof(body), &bodyLength, used);
+    IHTTPParseResult pieceResult = IHTTPTestDecodeBody(input, length, 1, pieceBody, sizeof(pieceBody), &pieceLength, &pieceUsed);
+    IHTTPCheck((pieceResult == result && (result != IHTTPParseComplete
+             || (pieceUsed == *used && pieceLength == bodyLength && memcmp(pieceBody, body, bodyLength) == 0))),
+        "body decoded in pieces differs", name);
+    return result;
+}
+
+static void IHTTPTestChunkData(void) {
+    static const char input[] = "5\r\nhello\r\n6;a=b\r\n world\r\n0\r\nX-Digest: abc\r\n\r\nGET";
+    uint8_t body[32];
+    size_t bodyLength = 0;
+    size_t used = 0;
+    IHTTPParseResult result = IHTTPTestDecodeBody((const uint8_t*)input, (sizeof(input) - 1), 1, body, sizeof(body), &bodyLength, &used);
+    IHTTPCheck((result == IHTTPParseComplete && bodyLength == 11 && memcmp(body, "hello world", 11) == 0 && used == (sizeof(input) - 4)),
+        "chunk data", "hello world");
+}
+
+// MARK: - Corpus
+
+/*! @brief what the inputs in each directory of the corpus must parse as */
+static const struct {
+    const char* directory;
+    int isChunked;
+    IHTTPParseResult expected;
+} IHTTPTestDirectories[] = {
+    { "head-valid", 0, IHTTPParseComplete },
+    { "head-invalid", 0, IHTTPParseInvalid },
+    { "head-too-large", 0, IHTTPParseTooLarge },
+    { "chunked-valid", 1, IHTTPParseComplete },
+    { "chunked-invalid", 1, IHTTPParseInvalid },
+    { "chunked-too-large", 1, IHTTPParseTooLarge },
+};
+
+/*! @brief the next of a fixed sequence of pseudo random numbers, so a failing mutation is found again on the next run */
+static uint32_t IHTTPTestRandom(uint32_t* state) {
+    *state ^= (*state << 13);
+    *state ^= (*state >> 17);
+    *state ^= (*state << 5);
+    return *state;
+}
+
+/*! @brief parse copies of the input with bytes changed, inserted, removed or cut off, only the sanitizers and the parser's
+    consistency are checked, since a mutation may or may not still be valid */
+static void IHTTPTestMutate(const uint8_t* input, size_t length, int isChunked, const char* name) {
+    static const uint8_t interesting[] = { '\r', '\n', ' ', '\t', ':', ';', '"', '\\', '=', '0', 'f', 'x', 0x00, 0x7F, 0xFF };
+    static uint8_t mutation[IHTTPTestMaxInput + 1];
+    uint32_t state = 2463534242u;
+    for (int index = 0; index < IHTTPTestMutations; index++) {
+        memcpy(mutation, input, length);
+        size_t mutationLength = length;
+        size_t position = (length > 0 ? (IHTTPTestRandom(&state) % length) : 0);
+        uint8_t byte = (IHTTPTestRandom(&state) & 1 ? interesting[IHTTPTestRandom(&state) % sizeof(interesting)] : (uint8_t)IHTTPTestRandom(&state));
+        switch (IHTTPTestRandom(&state) % 4) {
+            case 0:
+                if (length > 0) {
+                    mutation[position] = byte;
+                }
+                break;
+            case 1:
+                memmove((mutation + position + 1), (mutation + position), (length - position));
+                mutation[position] = byte;
+                mutationLength++;
+                break;
+            case 2:
+                if (length > 0) {
+                    memmove((mutation + position), (mutation + position + 1), (length - position - 1));
+                    mutationLength--;
+                }
+                break;
+            default:
+                mutationLength = position;
+                break;
+        }
+
+        size_t used = 0;
+        if (isChunked) {
+            IHTTPTestDecode(mutation, mutationLength, &used, name);
+        }
+        else {
+            IHTTPTestParseHead(mutation, mutationLength, name);
+        }
+    }
+}
+
+static void IHTTPTestCorpus(const char* corpus) {
+    static uint8_t input[IHTTPTestMaxInput];
+    char path[4096];
+    for (size_t index = 0; index < (sizeof(IHTTPTestDirectories) / sizeof(IHTTPTestDirectories[0])); index++) {
+        snprintf(path, sizeof(path), "%s/%s", corpus, IHTTPTestDirectories[index].directory);
+        DIR* directory = opendir(path);
+        IHTTPCheck((directory != NULL), "missing corpus directory", path);
+        if (!directory) {
+            continue;
+        }
+
+        int count = 0;
+        for (struct dirent* entry = readdir(directory); entry; entry = readdir(directory)) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+
+            snprintf(path, sizeof(path), "%s/%s/%s", corpus, IHTTPTestDirectories[index].directory, entry->d_name);
+            FILE* file = fopen(path, "rb");
+            size_t length = (file ? fread(input, 1, sizeof(input), file) : 0);
+            IHTTPCheck((file != NULL && length < sizeof(input)), "unreadable corpus input", path);
+            if (file) {
+                fclose(file);
+            }
+
+            size_t used = 0;
+            IHTTPParseResult result = (IHTTPTestDirectories[index].isChunked ? IHTTPTestDecode(input, length, &used, path)
+                                                                             : IHTTPTestParseHead(input, length, path));
+            IHTTPCheck((result == IHTTPTestDirectories[index].expected), "unexpected result", path);
+            IHTTPCheck((!IHTTPTestDirectories[index].isChunked || result != IHTTPParseComplete || used == length), "bytes after the body", path);
+            IHTTPTestMutate(input, length, IHTTPTestDirectories[index].isChunked, path);
+            count++;
+        }
+        closedir(directory);
+        IHTTPCheck((count > 0), "empty corpus directory", IHTTPTestDirectories[index].directory);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s corpus-directory\n", argv[0]);
+        return 2;
+    }
+
+    IHTTPTestHeadFields();
+    IHTTPTestChunkData();
+    IHTTPTestCorpus(argv[1]);
+    if (IHTTPTestFailures > 0) {
+        fprintf(stderr, "%d checks failed\n", IHTTPTestFailures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}